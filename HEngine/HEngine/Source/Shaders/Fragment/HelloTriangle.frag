@@ -3,13 +3,151 @@
 
 layout(location=0) in vec3 fragColor;
 layout(location=1) in vec2 fragTexCoord;
+layout(location=2) flat in uint fragMaterial;
+layout(location=3) in vec3 fragWorldPosition;
+layout(location=4) in vec3 fragNormal;
+layout(location=5) in float fragViewDepth;
 
 layout(location=0) out vec4 outColor;
 
-layout(binding=1) uniform sampler2D texSampler;
+// Must match ShadowCascades in shadow_cascades.h
+const uint cascadeCount = 4;
+const float cascadeResolution = 1024.0;
+
+layout(binding=0) uniform UniformBufferObject
+{
+  mat4 model;
+  mat4 view;
+  mat4 proj;
+  mat4 previousViewProj;
+  vec4 clusterParams; // xy: render extent in pixels, z: near plane, w: far plane
+  mat4 shadowViewProj[cascadeCount];
+  vec4 cascadeSplits; // View depth each cascade covers up to
+  vec4 sunDirection; // xyz: the way the light travels
+  vec4 sunColor;
+} ubo;
+
+layout(binding=1) uniform sampler texSampler;
+
+// Every texture, indexed by material. The size is set when the pipeline is built. All instances
+// in a draw share a material, so the index is dynamically uniform.
+layout(constant_id=0) const uint maxTextures = 1;
+layout(set=1, binding=0) uniform texture2D textures[maxTextures];
+
+// Must match ClusteredLighting in clustered_lighting.h
+const uint clusterCountX = 16;
+const uint clusterCountY = 9;
+const uint clusterCountZ = 24;
+const uint clusterCount = clusterCountX * clusterCountY * clusterCountZ;
+const uint maxLightsPerCluster = 128;
+
+const uint lightTypeSpot = 1;
+
+// Matches GpuLight in render_types.h
+struct Light
+{
+  vec3 position;
+  float radius;
+  vec3 color;
+  uint type;
+  vec3 direction;
+  float cosOuterAngle;
+  float cosInnerAngle;
+  uint padding0;
+  uint padding1;
+  uint padding2;
+};
+
+layout(std430, binding=2) readonly buffer Lights
+{
+  Light lights[];
+};
+
+// Written by LightBinning.comp this frame
+layout(std430, binding=3) readonly buffer Clusters
+{
+  uint lightCounts[clusterCount];
+  uint lightIndices[];
+};
+
+// Every cascade's shadow map, 2x2 in one atlas, compared against with filtering
+layout(binding=4) uniform sampler2DShadow shadowAtlas;
+
+// Light that reaches everything, so unlit surfaces aren't black
+const vec3 ambient = vec3(0.1);
+
+uint getCluster()
+{
+  uvec2 tile = uvec2(gl_FragCoord.xy / ubo.clusterParams.xy * vec2(clusterCountX, clusterCountY));
+  tile = min(tile, uvec2(clusterCountX - 1, clusterCountY - 1));
+
+  // Inverse of the binning shader's exponential slice depths
+  float slice = log(max(fragViewDepth, ubo.clusterParams.z) / ubo.clusterParams.z) /
+    log(ubo.clusterParams.w / ubo.clusterParams.z) * float(clusterCountZ);
+  uint z = min(uint(slice), clusterCountZ - 1);
+
+  return tile.x + tile.y * clusterCountX + z * clusterCountX * clusterCountY;
+}
+
+// How much of the sun reaches this fragment, 0 to 1. Beyond the last cascade, nothing is shadowed.
+float getSunShadow()
+{
+  uint cascade = 0;
+  while (cascade < cascadeCount && fragViewDepth > ubo.cascadeSplits[cascade])
+  {
+    cascade++;
+  }
+
+  if (cascade == cascadeCount)
+  {
+    return 1.0;
+  }
+
+  vec4 shadowPosition = ubo.shadowViewProj[cascade] * vec4(fragWorldPosition, 1.0);
+
+  // Stay half a texel inside the cascade, so filtering doesn't pull in its neighbours
+  float halfTexel = 0.5 / cascadeResolution;
+  vec2 uv = clamp(shadowPosition.xy * 0.5 + 0.5, halfTexel, 1.0 - halfTexel);
+  uv = (uv + vec2(cascade % 2, cascade / 2)) * 0.5;
+
+  return texture(shadowAtlas, vec3(uv, shadowPosition.z));
+}
 
 void main()
 {
-    // outColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);
-    outColor = texture(texSampler, fragTexCoord);
+    vec4 albedo = texture(sampler2D(textures[fragMaterial], texSampler), fragTexCoord);
+    vec3 normal = normalize(fragNormal);
+
+    // Only the lights binned into this fragment's cluster can reach it
+    uint cluster = getCluster();
+    uint count = lightCounts[cluster];
+    vec3 lighting = ambient;
+
+    float sunAmount = max(dot(normal, -ubo.sunDirection.xyz), 0.0);
+    if (sunAmount > 0.0)
+    {
+        lighting += ubo.sunColor.rgb * sunAmount * getSunShadow();
+    }
+
+    for (uint i = 0; i < count; ++i)
+    {
+        Light light = lights[lightIndices[cluster * maxLightsPerCluster + i]];
+
+        vec3 toLight = light.position - fragWorldPosition;
+        float distance = length(toLight);
+        vec3 direction = toLight / max(distance, 1e-4);
+
+        // Inverse square, windowed to reach zero at the radius
+        float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (distance * distance + 1.0);
+
+        if (light.type == lightTypeSpot)
+        {
+            attenuation *= smoothstep(light.cosOuterAngle, light.cosInnerAngle, dot(-direction, light.direction));
+        }
+
+        lighting += light.color * attenuation * max(dot(normal, direction), 0.0);
+    }
+
+    outColor = vec4(albedo.rgb * lighting, albedo.a);
 }
@@ -0,0 +1,12 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Copies the static shadow cache into the frame's shadow atlas, texel for texel, so dynamic
+// casters can be drawn over it
+
+layout(binding=0) uniform sampler2D shadowCache;
+
+void main()
+{
+  gl_FragDepth = texelFetch(shadowCache, ivec2(gl_FragCoord.xy), 0).r;
+}
@@ -0,0 +1,26 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location=0) in vec2 fragTexCoord;
+layout(location=1) in vec4 fragColor;
+
+layout(location=0) out vec4 outColor;
+
+layout(binding=0) uniform sampler spriteSampler;
+
+// Every sprite in a draw samples the same one of the bindless textures. Constant 0 sizes the
+// array to match its descriptor set layout.
+layout(constant_id=0) const uint maxTextures = 1;
+layout(set=1, binding=0) uniform texture2D textures[maxTextures];
+
+// Matches SpritePushConstants in render_types.h
+layout(push_constant) uniform PushConstants
+{
+  vec2 screenScale;
+  uint textureSlot;
+} constants;
+
+void main()
+{
+  outColor = texture(sampler2D(textures[constants.textureSlot], spriteSampler), fragTexCoord) * fragColor;
+}
@@ -0,0 +1,22 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Stretches the part of the scene color image the scene was rendered into over the whole
+// backbuffer, with bilinear filtering
+
+layout(location=0) in vec2 inUv;
+
+layout(location=0) out vec4 outColor;
+
+layout(binding=0) uniform sampler2D sceneColor;
+
+layout(push_constant) uniform PushConstants
+{
+  vec2 uvScale;
+  vec2 uvMax;
+} pc;
+
+void main()
+{
+  outColor = texture(sceneColor, min(inUv * pc.uvScale, pc.uvMax));
+}
@@ -0,0 +1,24 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Depth-only prepass. Positions come from their own tightly packed stream. gl_Position must come
+// out exactly as in HelloTriangle.vert, so the main pass's EQUAL depth test passes.
+
+layout(binding=0) uniform UniformBufferObject
+{
+  mat4 model;
+  mat4 view;
+  mat4 proj;
+} ubo;
+
+layout(location=0) in vec3 inPosition;
+
+// Per-instance input, as in HelloTriangle.vert
+layout(location=8) in mat4 instanceModel;
+
+invariant gl_Position;
+
+void main()
+{
+  gl_Position = ubo.proj * ubo.view * ubo.model * instanceModel * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// One triangle covering the whole screen, drawn with 3 vertices and no vertex buffers.
+// Vertices are at (-1, -1), (3, -1) and (-1, 3), so the screen is the triangle's uv 0..1 corner.
+
+layout(location=0) out vec2 outUv;
+
+void main()
+{
+  vec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+  outUv = uv;
+  gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
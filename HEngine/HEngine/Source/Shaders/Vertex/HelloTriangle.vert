@@ -12,15 +12,36 @@ layout(binding=0) uniform UniformBufferObject
 layout(location=0) in vec3 inPosition;
 layout(location=1) in vec3 inColor;
 layout(location=2) in vec2 inTexCoord;
+layout(location=3) in vec3 inNormal;
+
+// Per-instance input. Locations 0-7 are reserved for per-vertex attributes.
+layout(location=8) in mat4 instanceModel;
+layout(location=12) in uint instanceMaterial;
 
 // Output
 layout(location=0) out vec3 fragColor;
 layout(location=1) out vec2 fragTexCoord;
+layout(location=2) flat out uint fragMaterial;
+layout(location=3) out vec3 fragWorldPosition;
+layout(location=4) out vec3 fragNormal;
+layout(location=5) out float fragViewDepth; // Distance along the view direction, for picking a depth slice
+
+// Must match DepthPrepass.vert exactly for the EQUAL depth test after the prepass
+invariant gl_Position;
 
 void main()
 {
-  gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+  gl_Position = ubo.proj * ubo.view * ubo.model * instanceModel * vec4(inPosition, 1.0);
+
+  // Lighting is done in world space. Scales are uniform, so normals transform like directions.
+  mat4 world = ubo.model * instanceModel;
+  vec4 worldPosition = world * vec4(inPosition, 1.0);
+  fragWorldPosition = worldPosition.xyz;
+  fragNormal = mat3(world) * inNormal;
+  fragViewDepth = -(ubo.view * worldPosition).z;
+
   fragColor = inColor;
   fragTexCoord = inTexCoord;
+  fragMaterial = instanceMaterial;
 }
 
@@ -0,0 +1,78 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Draws each particle that survived this frame's simulation as a quad facing the camera, with no
+// vertex buffers. The instance picks the particle from the alive list simulation wrote, and the
+// vertex index the corner.
+
+// Must match GpuParticles::capacity
+const uint capacity = 1048576;
+
+// World-space half width of a new particle. They shrink to half that by the time they die.
+const float particleSize = 0.008;
+
+// Matches GpuParticle in render_types.h
+struct Particle
+{
+  vec3 position;
+  float age;
+  vec3 velocity;
+  float lifetime;
+};
+
+layout(std430, binding=0) readonly buffer Particles
+{
+  Particle particles[];
+};
+
+// The free slots, then the two alive lists, each capacity long
+layout(std430, binding=1) readonly buffer Indices
+{
+  uint indices[];
+};
+
+layout(binding=3) uniform UniformBufferObject
+{
+  mat4 model;
+  mat4 view;
+  mat4 proj;
+} ubo;
+
+// Matches ParticlePushConstants in render_types.h
+layout(push_constant) uniform PushConstants
+{
+  vec3 emitterPosition;
+  float deltaTime;
+  float time;
+  float lifetime;
+  uint emitCount;
+  uint currentList;
+} constants;
+
+layout(location=0) out vec3 fragColor;
+layout(location=1) out vec2 fragOffset; // From the center of the quad, in [-1, 1]
+
+const vec2 corners[6] = vec2[](
+  vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+  vec2(1.0, 1.0), vec2(-1.0, 1.0), vec2(-1.0, -1.0));
+
+void main()
+{
+  // Survivors were written to the list that isn't being simulated
+  uint particle = indices[capacity * (2 - constants.currentList) + gl_InstanceIndex];
+  Particle p = particles[particle];
+  float t = p.age / p.lifetime;
+
+  // The camera's right and up, from the rows of the view matrix
+  vec3 right = vec3(ubo.view[0][0], ubo.view[1][0], ubo.view[2][0]);
+  vec3 up = vec3(ubo.view[0][1], ubo.view[1][1], ubo.view[2][1]);
+
+  vec2 corner = corners[gl_VertexIndex];
+  float size = particleSize * (1.0 - 0.5 * t);
+  vec3 position = p.position + (right * corner.x + up * corner.y) * size;
+  gl_Position = ubo.proj * ubo.view * vec4(position, 1.0);
+
+  // Cools from yellow to red, and fades out
+  fragColor = mix(vec3(1.0, 0.8, 0.4), vec3(0.6, 0.1, 0.05), t) * (1.0 - t) * 0.5;
+  fragOffset = corner;
+}
@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Draws shadow casters into one cascade of the shadow atlas. Positions come from the same tightly
+// packed stream as the depth prepass. The UBO's model matrix is always identity, so instances are
+// already in world space.
+
+layout(push_constant) uniform PushConstants
+{
+  mat4 viewProj; // The cascade's
+} pc;
+
+layout(location=0) in vec3 inPosition;
+
+// Per-instance input, as in HelloTriangle.vert
+layout(location=8) in mat4 instanceModel;
+
+void main()
+{
+  gl_Position = pc.viewProj * instanceModel * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,43 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Draws 2D sprites in screen space, one instance each. The quad's corners come from the vertex
+// index, so the only vertex data is the instance.
+
+// Per-instance input, matching GpuSprite in render_types.h
+layout(location=0) in vec2 inPosition; // Center, in pixels from the top-left
+layout(location=1) in vec2 inSize;
+layout(location=2) in vec4 inUvRect; // Min uv in xy, max in zw
+layout(location=3) in float inRotation;
+layout(location=4) in vec4 inColor;
+
+// Matches SpritePushConstants in render_types.h
+layout(push_constant) uniform PushConstants
+{
+  vec2 screenScale;
+  uint textureSlot;
+} constants;
+
+layout(location=0) out vec2 fragTexCoord;
+layout(location=1) out vec4 fragColor;
+
+const vec2 corners[6] = vec2[](
+  vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+  vec2(1.0, 1.0), vec2(0.0, 1.0), vec2(0.0, 0.0));
+
+void main()
+{
+  vec2 corner = corners[gl_VertexIndex];
+  vec2 offset = (corner - 0.5) * inSize;
+
+  // With y pointing down the screen, this turns clockwise
+  float s = sin(inRotation);
+  float c = cos(inRotation);
+  vec2 pixel = inPosition + vec2(offset.x * c - offset.y * s, offset.x * s + offset.y * c);
+
+  // Vulkan's clip space has y pointing down too
+  gl_Position = vec4(pixel * constants.screenScale - 1.0, 0.0, 1.0);
+
+  fragTexCoord = mix(inUvRect.xy, inUvRect.zw, corner);
+  fragColor = inColor;
+}
@@ -1,2 +0,0 @@
-C:\VulkanSDK\1.0.61.1\Bin\glslangValidator.exe -V ./Vertex/HelloTriangle.vert
-C:\VulkanSDK\1.0.61.1\Bin\glslangValidator.exe -V ./Fragment/HelloTriangle.frag
@@ -3,10 +3,72 @@
 #include <sstream>
 #include <unordered_map>
 #include <algorithm>
-#include <fstream>
 
 #include "image.h"
 #include "obj_util.h"
+#include "parallel_util.h"
+#include "draw_sort.h"
+
+// GLSL sources for the main pipeline, compiled at runtime
+static const std::string mainVertShaderPath = "Source/Shaders/Vertex/HelloTriangle.vert";
+static const std::string mainFragShaderPath = "Source/Shaders/Fragment/HelloTriangle.frag";
+static const std::string depthPrepassVertShaderPath = "Source/Shaders/Vertex/DepthPrepass.vert";
+
+// Shadow casters, and the copy of the static shadow cache into the shadow map
+static const std::string shadowVertShaderPath = "Source/Shaders/Vertex/Shadow.vert";
+static const std::string shadowCopyFragShaderPath = "Source/Shaders/Fragment/ShadowCopy.frag";
+
+// Stretches the dynamic resolution scene image over the backbuffer
+static const std::string fullscreenVertShaderPath = "Source/Shaders/Vertex/Fullscreen.vert";
+static const std::string upscaleFragShaderPath = "Source/Shaders/Fragment/Upscale.frag";
+
+// Compute shaders for GPU culling
+static const std::string cullInstancesShaderPath = "Source/Shaders/Compute/CullInstances.comp";
+static const std::string compactDrawsShaderPath = "Source/Shaders/Compute/CompactDraws.comp";
+static const std::string depthPyramidShaderPath = "Source/Shaders/Compute/DepthPyramid.comp";
+
+// Compute shader binning lights into clusters
+static const std::string lightBinningShaderPath = "Source/Shaders/Compute/LightBinning.comp";
+static const std::string skinningShaderPath = "Source/Shaders/Compute/Skinning.comp";
+
+// Particle emission, simulation and compaction, and drawing what survives
+static const std::string particleBeginShaderPath = "Source/Shaders/Compute/ParticleBegin.comp";
+static const std::string particleEmitShaderPath = "Source/Shaders/Compute/ParticleEmit.comp";
+static const std::string particleSimulateShaderPath = "Source/Shaders/Compute/ParticleSimulate.comp";
+static const std::string particleVertShaderPath = "Source/Shaders/Vertex/Particle.vert";
+static const std::string particleFragShaderPath = "Source/Shaders/Fragment/Particle.frag";
+
+// Screen-space sprites
+static const std::string spriteVertShaderPath = "Source/Shaders/Vertex/Sprite.vert";
+static const std::string spriteFragShaderPath = "Source/Shaders/Fragment/Sprite.frag";
+
+// Threads per workgroup in the culling shaders
+static const uint32_t cullWorkgroupSize = 64;
+
+// Threads per workgroup along each axis in the depth pyramid shader
+static const uint32_t depthPyramidWorkgroupSize = 8;
+
+// Enough levels for a 64K wide swapchain
+static const uint32_t maxDepthPyramidLevels = 16;
+
+// Upper limit on bindless textures, if the device allows that many
+static const uint32_t maxBindlessTextures = 4096;
+
+// Sprites each frame's sprite buffer holds. Any more are dropped.
+static const size_t maxSpritesPerFrame = 1 << 18;
+
+// Sprites in the demo swarm
+static const uint32_t swarmSpriteCount = 100000;
+
+// Bindless texture the sprite atlas goes in, after the statue's
+static const uint32_t spriteAtlasTextureSlot = 1;
+
+// Vertices each skinning workgroup handles. Must match Skinning.comp
+static const uint32_t skinningWorkgroupSize = 64;
+
+// Camera clip planes, also the range draw sort depth buckets cover
+static const float cameraNear = 0.1f;
+static const float cameraFar = 10.0f;
 
 void VulkanApplication::run()
 {
@@ -15,6 +77,10 @@ void VulkanApplication::run()
 	initWindow();
 
 	std::cout << "Loading assets..." << std::endl;
+	JobSystem::getDefault().run([this]()
+	{
+		statueImage.reset(new STB_RGBA_Image("Content/Textures/statue.jpg"));
+	}, &textureLoads);
 	loadModel();	
 
 	// Vulkan setup
@@ -26,22 +92,49 @@ void VulkanApplication::run()
 	initQueuesAndDevice();
 	initSwapchain();
 	initImageViews();
-	createRenderPass();
+	initCommandPools();
+	descriptorAllocator.init(device, maxFramesInFlight);
+
+	// The render graph imports the static shadow cache
+	initShadows();
+
+	// The render graph's depth pyramid pass needs the culling pipelines' descriptor layouts
+	if (gpuCullingEnabled)
+	{
+		initCullPipelines();
+	}
+
+	initRenderGraph();
 	initDescriptorSetLayout();
+	initBindlessTextures();
+	initDynamicResolution();
+	initLightBinPipeline();
+	initParticles();
+	initSprites();
 	initGraphicsPipeline();
-	initCommandPools();
-	initDepthResources();
-	initFramebuffers();
 
 	initVertexBuffers();
 	initIndexBuffers();
 
+	scene.updateBatches();
+	initInstanceBuffer();
+	initLightBuffers();
+	initSkinning();
+
 	createTextureImage();
 	initUniformBuffer();
-	initDescriptorPool();
-	initDescriptorSet();
+
+	// Every material uses the statue texture for now
+	setMaterialTexture(0, textureImageView);
+
+	if (gpuCullingEnabled)
+	{
+		initCullBuffers();
+	}
+
 	initCommandBuffers();
 	initSynchro();
+	initShaderHotReload();
 	std::cout << std::endl << "Vulkan initialized OK " << std::endl;	
 
 	fillVertexBuffer();
@@ -50,8 +143,52 @@ void VulkanApplication::run()
 	std::cout << "Graphics queue index: " << queueIndices.graphics << std::endl;
 	std::cout << "Present queue index: " << queueIndices.present << std::endl;
 	std::cout << "Transfer queue index: " << queueIndices.transfer << std::endl;
-
+	std::cout << "Compute queue index: " << queueIndices.compute << std::endl;
+	std::cout << "Job system: " << JobSystem::getDefault().getThreadCount() << " threads" << std::endl;
+	std::cout << "GPU culling: " << (gpuCullingEnabled ? "on" : "off") 
+		<< (cmdDrawIndexedIndirectCount ? " (indirect count)" : "") << std::endl;
+	std::cout << "Depth prepass: " << (depthPrepassEnabled ? "on" : "off") << std::endl;
+	std::cout << "Clustered lighting: " << lights.size() << " lights, " << ClusteredLighting::clusterCountX << "x"
+		<< ClusteredLighting::clusterCountY << "x" << ClusteredLighting::clusterCountZ << " clusters" << std::endl;
+	std::cout << "Particles: up to " << GpuParticles::capacity << ", simulated on the GPU" << std::endl;
+	std::cout << "Skinning: " << skinnedInstances.size() << " animated instances, " << animation.getJointCount() << " joints" << std::endl;
+	std::cout << "Shadows: " << ShadowCascades::cascadeCount << " cascades at " << ShadowCascades::cascadeResolution
+		<< ", " << scene.getStaticInstanceCount() << " static casters cached" << std::endl;
+	std::cout << "Dynamic resolution: " << (dynamicResolutionEnabled ? "on" : "off (no timestamp support)") << std::endl;
+	std::cout << "Bindless textures: " << bindlessTextureCapacity
+		<< (descriptorIndexingSupported ? " (descriptor indexing)" : "") << std::endl;
+	std::cout << "Software occlusion: " << (!gpuCullingEnabled && softwareOcclusionEnabled ? "on" : "off") << std::endl;
+
+	simulation.start(renderCommands, quadMesh);
 	mainLoop();
+	simulation.stop();
+
+	std::cout << "Simulation: " << simulation.getTickCount() << " ticks at " << Simulation::ticksPerSecond << " Hz over "
+		<< frameCount << " frames, " << simulation.getSkippedTickCount() << " skipped" << std::endl;
+	std::cout << "Render commands: " << appliedRenderCommandCount << " applied, queue full "
+		<< renderCommands.getFullCount() << " times" << std::endl;
+
+	// Without the cache, static casters would be drawn into every cascade every frame
+	std::cout << "Static shadow cascade redraws: " << shadowCascades.getStaticDrawCount() << " in " << frameCount
+		<< " frames (" << frameCount * ShadowCascades::cascadeCount << " uncached)" << std::endl;
+
+	// Without batching, every sprite would be a draw
+	std::cout << "Sprites: " << spriteBatch.getSpriteCount() << " in the last frame, drawn with "
+		<< spriteBatch.getRuns().size() << " draws" << std::endl;
+
+	if (dynamicResolutionEnabled)
+	{
+		std::cout << "Final render scale: " << dynamicResolution.getScale()
+			<< ", smoothed GPU frame time: " << dynamicResolution.getSmoothedMilliseconds() << " ms" << std::endl;
+	}
+
+	// Both counts skip binds of state that's already bound; the difference is only the draw order
+	if (drawStats.draws > 0)
+	{
+		std::cout << "Draws: " << drawStats.draws << ", state binds: " << drawStats.binds
+			<< ", unsorted: " << drawStats.unsortedBinds
+			<< ", saved by sorting: " << (drawStats.unsortedBinds > drawStats.binds ? drawStats.unsortedBinds - drawStats.binds : 0) << std::endl;
+	}
 
 	cleanup();
 }
@@ -76,6 +213,7 @@ void VulkanApplication::initWindow()
 	// Register size-change callback
 	glfwSetWindowUserPointer(window, this);
 	glfwSetWindowSizeCallback(window, VulkanApplication::onWindowResized);
+	glfwSetMouseButtonCallback(window, VulkanApplication::onMouseButton);
 }
 
 void VulkanApplication::initVulkanInstance()
@@ -96,6 +234,14 @@ void VulkanApplication::initVulkanInstance()
 
 	// Get required extensions
 	std::vector<const char*> requiredExtensions = getRequiredExtensions();
+
+	// Optional: lets device features newer than Vulkan 1.0, e.g. descriptor indexing, be queried
+	if (isInstanceExtensionAvailable(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME))
+	{
+		requiredExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+		physicalDeviceProperties2Enabled = true;
+	}
+
 	uint32_t requiredExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
 		
 	// Instance creation context - specify extensions, validation layers
@@ -240,7 +386,8 @@ void VulkanApplication::initQueuesAndDevice()
 	std::set<int> uniqueQueueFamilies = { 
 queueIndices.graphics,
 queueIndices.present,
-queueIndices.transfer 
+queueIndices.transfer,
+queueIndices.compute
 	};
 
 	float queuePriority = 1.0f;
@@ -254,20 +401,80 @@ queueIndices.transfer
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
 	// Create the logical device
 	// Device features we want to use: 
 	VkPhysicalDeviceFeatures deviceFeatures = { };
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
+
+	// GPU-driven drawing: indirect draws need a non-zero firstInstance to find their instances,
+	// and ideally many draws per indirect call.
+	deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+
+	// Bindless textures index a sampled image array by material. All instances in a draw share a
+	// material, so dynamic indexing is enough; nonuniform indexing isn't needed.
+	deviceFeatures.shaderSampledImageArrayDynamicIndexing = supportedFeatures.shaderSampledImageArrayDynamicIndexing;
+
+	// Culling is recorded into the graphics command buffers, so it needs compute on the graphics family
+	if (!supportedFeatures.drawIndirectFirstInstance || queueIndices.compute != queueIndices.graphics)
+	{
+		gpuCullingEnabled = false;
+	}
+
+	// Optional extensions
+	std::vector<const char*> enabledExtensions = deviceExtensions;
+	bool drawIndirectCountAvailable = multiDrawIndirectSupported &&
+		isDeviceExtensionAvailable(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	if (drawIndirectCountAvailable)
+	{
+		enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+
+	// Descriptor indexing lets the bindless texture array be partially bound and updated after binding.
+	// Its features can only be queried through VK_KHR_get_physical_device_properties2.
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = { };
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	if (physicalDeviceProperties2Enabled &&
+		isDeviceExtensionAvailable(physicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) &&
+		isDeviceExtensionAvailable(physicalDevice, VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+	{
+		PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)
+			vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+
+		VkPhysicalDeviceFeatures2KHR features2 = { };
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+		features2.pNext = &indexingFeatures;
+		getFeatures2(physicalDevice, &features2);
+
+		descriptorIndexingSupported = indexingFeatures.descriptorBindingPartiallyBound == VK_TRUE &&
+			indexingFeatures.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE;
+	}
+
+	// Only enable what the bindless array uses
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabledIndexingFeatures = { };
+	enabledIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	if (descriptorIndexingSupported)
+	{
+		enabledIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		enabledIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		enabledExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+	}
 		
 	VkDeviceCreateInfo deviceCreateInfo = { };
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+	deviceCreateInfo.pNext = descriptorIndexingSupported ? &enabledIndexingFeatures : nullptr;
 
 	// Enable device-specific extensions
-	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+	deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 	// Enable validation layers
 	if (enableValidationLayers)
@@ -292,9 +499,17 @@ queueIndices.transfer
 	vkGetDeviceQueue(device, queueIndices.graphics, 0, &graphicsQueue);	 
 	vkGetDeviceQueue(device, queueIndices.present, 0, &presentQueue);
 	vkGetDeviceQueue(device, queueIndices.transfer, 0, &transferQueue);
+	vkGetDeviceQueue(device, queueIndices.compute, 0, &computeQueue);
+
+	// Extension commands aren't exported by the loader, look them up
+	if (drawIndirectCountAvailable)
+	{
+		cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)
+			vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+	}
 }
 
-void VulkanApplication::initSwapchain()
+void VulkanApplication::initSwapchain(VkSwapchainKHR oldSwapchain)
 {
 	// Set up swap chain
 	SwapChainSupportInfo swapChainInfo;
@@ -326,7 +541,8 @@ void VulkanApplication::initSwapchain()
 	swapchainCreateInfo.imageArrayLayers = 1; // only higher for stereoscopic 3d
 	// Color attachment = render to this swapchain directly
 	swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-	swapchainCreateInfo.oldSwapchain = nullptr;
+	// Lets the new swapchain take over from the old one, which can still present images it handed out
+	swapchainCreateInfo.oldSwapchain = oldSwapchain;
 	
 	uint32_t queueFamilyIndices[] = { (uint32_t)queueIndices.graphics, (uint32_t)queueIndices.present };
 	if (queueIndices.graphics != queueIndices.present)
@@ -357,10 +573,12 @@ void VulkanApplication::initSwapchain()
 	swapchainCreateInfo.clipped = VK_TRUE;
 
 	// Make swap chain
-	if (vkCreateSwapchainKHR(device, &swapchainCreateInfo, nullptr, &swapchain) != VK_SUCCESS)
+	VkSwapchainKHR newSwapchain;
+	if (vkCreateSwapchainKHR(device, &swapchainCreateInfo, nullptr, &newSwapchain) != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create swapchain");
 	}
+	swapchain.reset(device, newSwapchain);
 
 	// Set up swapchain images. Number of images may have changed, so query it.
 	vkGetSwapchainImagesKHR(device, swapchain, &imageCount, nullptr);
@@ -404,87 +622,352 @@ void VulkanApplication::initImageViews()
 	}
 }
 
-void VulkanApplication::createRenderPass()
+void VulkanApplication::initRenderGraph()
 {
-	// Set up color buffer -- just one, since we aren't multisampling
-	VkAttachmentDescription colorAttachment = { };
-	colorAttachment.format = swapchainFormat;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // clear to black before rendering
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // Rendered contents stay in memory
+	// Swapchain images come from outside the graph, one per image index
+	ImportedImageDesc swapchainDesc = { };
+	swapchainDesc.images = swapchainImages;
+	swapchainDesc.views = swapchainViews;
+	swapchainDesc.format = swapchainFormat;
+	swapchainDesc.extent = swapchainExtent;
+	swapchainDesc.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	swapchainDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // Previous contents aren't needed
+	swapchainDesc.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	swapchainDesc.initialStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // Where the acquire semaphore is waited on
+
+	RenderResourceId backbuffer = renderGraph.importImage("Backbuffer", swapchainDesc);
+
+	// Depth is only needed while drawing, so it's transient
+	TransientImageDesc depthDesc = { };
+	depthDesc.format = depthImageFormat;
+	depthDesc.extent = swapchainExtent;
+	depthDesc.usage = 0;
+
+	RenderResourceId depth = renderGraph.createImage("Depth", depthDesc);
+
+	// The scene is drawn into the top-left renderExtent of this, then upscaled into the backbuffer.
+	// It's full size, so changing the render scale never recreates it.
+	TransientImageDesc sceneColorDesc = { };
+	sceneColorDesc.format = swapchainFormat;
+	sceneColorDesc.extent = swapchainExtent;
+	sceneColorDesc.usage = 0;
+
+	sceneColor = renderGraph.createImage("SceneColor", sceneColorDesc);
+
+	VkClearColorValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f }; // clear to black before rendering
+
+	// Skinned meshes are drawn by every later pass, from buffers the graph doesn't track, so skinning
+	// records its own barriers
+	RenderPassId skinningPass = renderGraph.addComputePass("Skinning", [this](VkCommandBuffer commandBuffer, uint32_t)
+	{
+		recordSkinning(commandBuffer, frames[currentFrame]);
+	});
+	renderGraph.setSideEffects(skinningPass);
 
-	// Not currently using stencil buffer
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	
-	// Indicate that final layout will be used in swapchain
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; 
-
-	VkAttachmentReference colorAttachmentRefInfo = { };
-	colorAttachmentRefInfo.attachment = 0;
-	colorAttachmentRefInfo.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	// Set up depth buffer:
-
-	VkAttachmentDescription depthAttachment = {};
-	depthAttachment.format = depthImageFormat;
-	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentReference depthAttachmentRef = {};
-	depthAttachmentRef.attachment = 1;
-	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	// Light lists are needed by every pass that shades. The cluster buffer isn't tracked by the
+	// graph, so binning records its own barrier.
+	RenderPassId lightBinPass = renderGraph.addComputePass("LightBinning", [this](VkCommandBuffer commandBuffer, uint32_t)
+	{
+		recordLightBinning(commandBuffer, frames[currentFrame]);
+	});
+	renderGraph.setSideEffects(lightBinPass);
 
-	VkSubpassDescription subpass = { };
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &colorAttachmentRefInfo;
-	subpass.pDepthStencilAttachment = &depthAttachmentRef;
-
-	VkSubpassDependency dependency = { };
-	// Implicit subpass -- before or after render pass
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	// Index of target subpass
-	dependency.dstSubpass = 0; 
-	// operation to wait on, stage where it occurs:
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	// operations that wait on this:
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-	// std::array<VkAttachmentDescription, 1> attachments = { colorAttachment };
-	std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
+	// Particles only ever live in buffers the graph doesn't track, so simulation records its own barriers
+	RenderPassId particleSimulationPass = renderGraph.addComputePass("ParticleSimulation", [this](VkCommandBuffer commandBuffer, uint32_t)
+	{
+		recordParticleSimulation(commandBuffer, frames[currentFrame]);
+	});
+	renderGraph.setSideEffects(particleSimulationPass);
+
+	// Static casters are drawn into the cache outside the graph, before it runs, and only when the
+	// cache is stale. It's kept between frames in the layout it's read in.
+	ImportedImageDesc shadowCacheDesc = { };
+	shadowCacheDesc.images = { shadowCacheImage };
+	shadowCacheDesc.views = { shadowCacheImageView };
+	shadowCacheDesc.format = depthImageFormat;
+	shadowCacheDesc.extent = { ShadowCascades::atlasResolution, ShadowCascades::atlasResolution };
+	shadowCacheDesc.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+	shadowCacheDesc.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	shadowCacheDesc.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	shadowCacheDesc.initialStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+	RenderResourceId shadowCache = renderGraph.importImage("ShadowCache", shadowCacheDesc);
+
+	TransientImageDesc shadowMapDesc = { };
+	shadowMapDesc.format = depthImageFormat;
+	shadowMapDesc.extent = { ShadowCascades::atlasResolution, ShadowCascades::atlasResolution };
+	shadowMapDesc.usage = 0;
+
+	shadowMap = renderGraph.createImage("ShadowMap", shadowMapDesc);
+
+	// The copy covers the whole atlas, so its old contents don't need loading
+	shadowPass = renderGraph.addGraphicsPass("Shadows", [this](VkCommandBuffer commandBuffer, uint32_t)
+	{
+		recordShadows(commandBuffer, frames[currentFrame]);
+	});
+	renderGraph.addTextureInput(shadowPass, shadowCache, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	renderGraph.setDepthOutput(shadowPass, shadowMap, VK_ATTACHMENT_LOAD_OP_DONT_CARE, 1.0f);
+
+	if (!gpuCullingEnabled)
+	{
+		if (depthPrepassEnabled)
+		{
+			depthPrepassPass = renderGraph.addGraphicsPass("DepthPrepass", [this](VkCommandBuffer commandBuffer, uint32_t)
+			{
+				const FrameResources& frame = frames[currentFrame];
+				vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(frame.secondaryCount), frame.prepassThreadCommandBuffers.data());
+			});
+			renderGraph.setDepthOutput(depthPrepassPass, depth, VK_ATTACHMENT_LOAD_OP_CLEAR, 1.0f);
+			renderGraph.setSecondaryCommandBuffers(depthPrepassPass);
+		}
 
+		// Draws are recorded into per-thread secondaries by recordCommandBuffer
+		mainPass = renderGraph.addGraphicsPass("Main", [this](VkCommandBuffer commandBuffer, uint32_t)
+		{
+			const FrameResources& frame = frames[currentFrame];
 
-	VkRenderPassCreateInfo renderPassInfo = { };
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-	renderPassInfo.pAttachments = attachments.data();
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
+			// Secondaries run in order, so draw order is the same as recording them on one thread
+			vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(frame.secondaryCount), frame.threadCommandBuffers.data());
+		});
+
+		renderGraph.addColorOutput(mainPass, sceneColor, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor);
+		renderGraph.addTextureInput(mainPass, shadowMap, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		setMainPassDepth(mainPass, depth, VK_ATTACHMENT_LOAD_OP_CLEAR);
+		renderGraph.setSecondaryCommandBuffers(mainPass);
+	}
+	else
+	{
+		initDepthPyramid();
+
+		ImportedImageDesc pyramidDesc = { };
+		pyramidDesc.images = { depthPyramid.get() };
+		pyramidDesc.views = { depthPyramidView.get() };
+		pyramidDesc.format = VK_FORMAT_R32_SFLOAT;
+		pyramidDesc.extent = depthPyramidExtent;
+		pyramidDesc.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, static_cast<uint32_t>(depthPyramidLevelViews.size()), 0, 1 };
+		// Kept from one frame to the next, in the layout culling reads it in
+		pyramidDesc.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		pyramidDesc.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		pyramidDesc.initialStages = 0;
+
+		RenderResourceId pyramid = renderGraph.importImage("DepthPyramid", pyramidDesc);
+
+		// Culling writes the indirect draws the main passes read. Buffers aren't tracked by the
+		// graph, so the culling code records its own buffer barriers.
+		RenderPassId earlyCullPass = renderGraph.addComputePass("EarlyCull", [this](VkCommandBuffer commandBuffer, uint32_t)
+		{
+			recordGpuCulling(commandBuffer, frames[currentFrame], CullPhaseEarly);
+		});
+		renderGraph.addTextureInput(earlyCullPass, pyramid, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		renderGraph.setSideEffects(earlyCullPass);
+
+		// Draw what was visible last frame
+		if (depthPrepassEnabled)
+		{
+			depthPrepassPass = renderGraph.addGraphicsPass("EarlyDepthPrepass", [this](VkCommandBuffer commandBuffer, uint32_t)
+			{
+				const FrameResources& frame = frames[currentFrame];
+				vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(frame.secondaryCount), frame.prepassThreadCommandBuffers.data());
+			});
+			renderGraph.setDepthOutput(depthPrepassPass, depth, VK_ATTACHMENT_LOAD_OP_CLEAR, 1.0f);
+			renderGraph.setSecondaryCommandBuffers(depthPrepassPass);
+		}
+
+		mainPass = renderGraph.addGraphicsPass("EarlyMain", [this](VkCommandBuffer commandBuffer, uint32_t)
+		{
+			const FrameResources& frame = frames[currentFrame];
+			vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(frame.secondaryCount), frame.threadCommandBuffers.data());
+		});
+		renderGraph.addColorOutput(mainPass, sceneColor, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor);
+		renderGraph.addTextureInput(mainPass, shadowMap, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		setMainPassDepth(mainPass, depth, VK_ATTACHMENT_LOAD_OP_CLEAR);
+		renderGraph.setSecondaryCommandBuffers(mainPass);
+
+		RenderPassId pyramidPass = renderGraph.addComputePass("DepthPyramid", [this](VkCommandBuffer commandBuffer, uint32_t)
+		{
+			recordDepthPyramid(commandBuffer);
+		});
+		renderGraph.addTextureInput(pyramidPass, depth, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		renderGraph.addStorageOutput(pyramidPass, pyramid, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+		RenderPassId lateCullPass = renderGraph.addComputePass("LateCull", [this](VkCommandBuffer commandBuffer, uint32_t)
+		{
+			recordGpuCulling(commandBuffer, frames[currentFrame], CullPhaseLate);
+		});
+		renderGraph.addTextureInput(lateCullPass, pyramid, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		renderGraph.setSideEffects(lateCullPass);
+
+		// Draw what the early draws revealed, on top of them
+		if (depthPrepassEnabled)
+		{
+			lateDepthPrepassPass = renderGraph.addGraphicsPass("LateDepthPrepass", [this](VkCommandBuffer commandBuffer, uint32_t)
+			{
+				const FrameResources& frame = frames[currentFrame];
+				vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(frame.secondaryCount), frame.latePrepassThreadCommandBuffers.data());
+			});
+			renderGraph.setDepthOutput(lateDepthPrepassPass, depth, VK_ATTACHMENT_LOAD_OP_LOAD, 1.0f);
+			renderGraph.setSecondaryCommandBuffers(lateDepthPrepassPass);
+		}
 
-	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
+		lateMainPass = renderGraph.addGraphicsPass("LateMain", [this](VkCommandBuffer commandBuffer, uint32_t)
+		{
+			const FrameResources& frame = frames[currentFrame];
+			vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(frame.secondaryCount), frame.lateThreadCommandBuffers.data());
+		});
+		renderGraph.addColorOutput(lateMainPass, sceneColor, VK_ATTACHMENT_LOAD_OP_LOAD, clearColor);
+		renderGraph.addTextureInput(lateMainPass, shadowMap, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		setMainPassDepth(lateMainPass, depth, VK_ATTACHMENT_LOAD_OP_LOAD);
+		renderGraph.setSecondaryCommandBuffers(lateMainPass);
+	}
+
+	// Particles are blended over the finished scene, and hidden by it
+	particlePass = renderGraph.addGraphicsPass("Particles", [this](VkCommandBuffer commandBuffer, uint32_t)
+	{
+		recordParticles(commandBuffer, frames[currentFrame]);
+	});
+	renderGraph.addColorOutput(particlePass, sceneColor, VK_ATTACHMENT_LOAD_OP_LOAD, clearColor);
+	renderGraph.setDepthInput(particlePass, depth);
+
+	// Covers the whole backbuffer, so its old contents don't need loading
+	upscalePass = renderGraph.addGraphicsPass("Upscale", [this](VkCommandBuffer commandBuffer, uint32_t)
+	{
+		recordUpscale(commandBuffer);
+	});
+	renderGraph.addTextureInput(upscalePass, sceneColor, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	renderGraph.addColorOutput(upscalePass, backbuffer, VK_ATTACHMENT_LOAD_OP_DONT_CARE, clearColor);
+
+	// Sprites go on top at full resolution, so they stay sharp whatever the render scale
+	spritePass = renderGraph.addGraphicsPass("Sprites", [this](VkCommandBuffer commandBuffer, uint32_t)
+	{
+		recordSprites(commandBuffer, frames[currentFrame]);
+	});
+	renderGraph.addColorOutput(spritePass, backbuffer, VK_ATTACHMENT_LOAD_OP_LOAD, clearColor);
+
+	renderGraph.compile(device, physicalDevice);
+
+	// Both main passes use the same attachments, so pipelines built for one work in the other.
+	// The same goes for the prepasses.
+	renderPass = renderGraph.getRenderPass(mainPass);
+	if (depthPrepassEnabled)
+	{
+		depthPrepassRenderPass = renderGraph.getRenderPass(depthPrepassPass);
+	}
+	shadowRenderPass = renderGraph.getRenderPass(shadowPass);
+
+	if (gpuCullingEnabled)
+	{
+		writeDepthPyramidDescriptors(renderGraph.getImageView(depth, 0));
+	}
+
+	std::cout << "Render graph transient memory: " << renderGraph.getTransientMemorySize() / 1024 << " KB ("
+		<< renderGraph.getUnaliasedMemorySize() / 1024 << " KB without aliasing)" << std::endl;
+}
+
+void VulkanApplication::setMainPassDepth(RenderPassId pass, RenderResourceId depth, VkAttachmentLoadOp loadOp)
+{
+	// After a prepass, depth is complete and only needs testing against
+	if (depthPrepassEnabled)
+	{
+		renderGraph.setDepthInput(pass, depth);
+	}
+	else
 	{
-		throw std::runtime_error("Coult not create render pass");
+		renderGraph.setDepthOutput(pass, depth, loadOp, 1.0f);
 	}
 }
 
 void VulkanApplication::initGraphicsPipeline()
 {
-	auto vertShaderCode = readFileBytes("Source/Shaders/vert.spv");
-	auto fragShaderCode = readFileBytes("Source/Shaders/frag.spv");
+	// Set up pipeline layout. Can also set up 'push constants', dynamic constants sent to shaders.
+	// These aren't used yet.	
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = { };
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	// Set 0 is per frame, set 1 the bindless textures
+	VkDescriptorSetLayout setLayouts[] = { descriptorSetLayout, bindlessDescriptorSetLayout };
+	pipelineLayoutInfo.setLayoutCount = 2;
+	pipelineLayoutInfo.pSetLayouts = setLayouts;
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = 0;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+
+	std::string errors;
+	if (!buildGraphicsPipeline(GraphicsPipelineMain, graphicsPipeline, errors))
+	{
+		throw std::runtime_error("Failed to create graphics pipeline!\n" + errors);
+	}
+
+	if (depthPrepassEnabled && !buildGraphicsPipeline(GraphicsPipelineDepthPrepass, depthPrepassPipeline, errors))
+	{
+		throw std::runtime_error("Failed to create depth prepass pipeline!\n" + errors);
+	}
+
+	if (!buildGraphicsPipeline(GraphicsPipelineShadow, shadowPipeline, errors))
+	{
+		throw std::runtime_error("Failed to create shadow pipeline!\n" + errors);
+	}
+
+	if (!buildShadowCopyPipeline(shadowCopyPipeline, errors))
+	{
+		throw std::runtime_error("Failed to create shadow copy pipeline!\n" + errors);
+	}
+
+	// Upscaling samples the scene through a per-frame set, with the extents as push constants
+	VkPushConstantRange upscalePushConstants = { };
+	upscalePushConstants.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	upscalePushConstants.offset = 0;
+	upscalePushConstants.size = sizeof(UpscalePushConstants);
+
+	VkPipelineLayoutCreateInfo upscaleLayoutInfo = { };
+	upscaleLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	upscaleLayoutInfo.setLayoutCount = 1;
+	upscaleLayoutInfo.pSetLayouts = &upscaleDescriptorSetLayout;
+	upscaleLayoutInfo.pushConstantRangeCount = 1;
+	upscaleLayoutInfo.pPushConstantRanges = &upscalePushConstants;
+
+	if (vkCreatePipelineLayout(device, &upscaleLayoutInfo, nullptr, &upscalePipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create upscale pipeline layout");
+	}
+
+	if (!buildUpscalePipeline(upscalePipeline, errors))
+	{
+		throw std::runtime_error("Failed to create upscale pipeline!\n" + errors);
+	}
+
+	if (!buildParticlePipeline(particlePipeline, errors))
+	{
+		throw std::runtime_error("Failed to create particle pipeline!\n" + errors);
+	}
+
+	if (!buildSpritePipeline(spritePipeline, errors))
+	{
+		throw std::runtime_error("Failed to create sprite pipeline!\n" + errors);
+	}
+}
+
+bool VulkanApplication::buildGraphicsPipeline(GraphicsPipelineType type, VkPipeline& outPipeline, std::string& outErrors)
+{
+	VkShaderModule vertShaderModule;
+	VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+
+	// Depth only needs positions, and no fragment shader at all
+	bool depthOnly = type != GraphicsPipelineMain;
+	bool shadow = type == GraphicsPipelineShadow;
+	const std::string& vertShaderPath = shadow ? shadowVertShaderPath : (depthOnly ? depthPrepassVertShaderPath : mainVertShaderPath);
+	if (!loadShaderModule(vertShaderPath, vertShaderModule, outErrors))
+	{
+		return false;
+	}
 
-	vertShaderModule = createShaderModule(vertShaderCode, device);
-	fragShaderModule = createShaderModule(fragShaderCode, device);
+	if (!depthOnly && !loadShaderModule(mainFragShaderPath, fragShaderModule, outErrors))
+	{
+		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+		return false;
+	}
 
 	// Modules are just bytecode wrappers -- ShaderStageInfo is pipeline context
 	VkPipelineShaderStageCreateInfo vertShaderStageInfo = { };
@@ -501,16 +984,53 @@ void VulkanApplication::initGraphicsPipeline()
 	fragShaderStageInfo.module = fragShaderModule;
 	fragShaderStageInfo.pName = "main";
 
+	// Constant 0 sizes the bindless texture array to match its descriptor set layout
+	VkSpecializationMapEntry textureCapacityEntry = { };
+	textureCapacityEntry.constantID = 0;
+	textureCapacityEntry.offset = 0;
+	textureCapacityEntry.size = sizeof(uint32_t);
+
+	VkSpecializationInfo fragSpecializationInfo = { };
+	fragSpecializationInfo.mapEntryCount = 1;
+	fragSpecializationInfo.pMapEntries = &textureCapacityEntry;
+	fragSpecializationInfo.dataSize = sizeof(uint32_t);
+	fragSpecializationInfo.pData = &bindlessTextureCapacity;
+	fragShaderStageInfo.pSpecializationInfo = &fragSpecializationInfo;
+
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
-	// Describes format of vertex data, attributes passed to vert shader:
-	auto vertexBindingDescription = VulkanUtil::getBindingDescription<Vertex3D>();
-	auto vertexAttributeDescriptions = VulkanUtil::getAttributeDescriptions<Vertex3D>();
+	// Describes format of vertex data, attributes passed to vert shader.
+	// Binding 0 is per-vertex, binding 1 is per-instance. Depth only reads the position stream,
+	// and only the instance transform.
+	std::array<VkVertexInputBindingDescription, 2> vertexBindingDescriptions = {
+depthOnly ? VulkanUtil::getPositionBindingDescription() : VulkanUtil::getBindingDescription<Vertex3D>(),
+VulkanUtil::getInstanceBindingDescription<InstanceData>()
+	};
+
+	std::vector<VkVertexInputAttributeDescription> vertexAttributeDescriptions;
+	if (depthOnly)
+	{
+		vertexAttributeDescriptions.push_back(VulkanUtil::getPositionAttributeDescription());
+	}
+	else
+	{
+		for (const auto& attribute : VulkanUtil::getAttributeDescriptions<Vertex3D>())
+		{
+			vertexAttributeDescriptions.push_back(attribute);
+		}
+	}
+	for (const auto& attribute : VulkanUtil::getInstanceAttributeDescriptions<InstanceData>())
+	{
+		if (!depthOnly || attribute.location < 12)
+		{
+			vertexAttributeDescriptions.push_back(attribute);
+		}
+	}
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = { };
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &vertexBindingDescription;
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexBindingDescriptions.size());
+	vertexInputInfo.pVertexBindingDescriptions = vertexBindingDescriptions.data();
 	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexAttributeDescriptions.size());
 	vertexInputInfo.pVertexAttributeDescriptions = vertexAttributeDescriptions.data();
 
@@ -520,27 +1040,13 @@ void VulkanApplication::initGraphicsPipeline()
 	inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssemblyInfo.primitiveRestartEnable = false;
 
-	// viewport -- region of framebuffer where output is rendered
-	VkViewport viewport = { };
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)swapchainExtent.width;
-	viewport.height = (float)swapchainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 0.0f;
-
-	// Scissor - cut out part of the viewport
-	VkRect2D scissor = { };
-	scissor.offset = { 0,0 };
-	scissor.extent = swapchainExtent;
-
-	// Combine viewport, scissor
+	// Viewport and scissor are dynamic, and set to the dynamic resolution render extent when drawing
 	VkPipelineViewportStateCreateInfo viewportStateInfo = { };
 	viewportStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportStateInfo.viewportCount = 1;
-	viewportStateInfo.pViewports = &viewport;
+	viewportStateInfo.pViewports = nullptr;
 	viewportStateInfo.scissorCount = 1;
-	viewportStateInfo.pScissors = &scissor;
+	viewportStateInfo.pScissors = nullptr;
 
 	// Set up rasterizer
 	VkPipelineRasterizationStateCreateInfo rasterizerInfo = { };
@@ -556,17 +1062,17 @@ void VulkanApplication::initGraphicsPipeline()
 	// rasterizerInfo.polygonMode = VK_POLYGON_MODE_POINTS;
 	rasterizerInfo.lineWidth = 1.0f;
 
-	// Cull back-facing triangles
-	rasterizerInfo.cullMode = VK_CULL_MODE_BACK_BIT;
+	// Cull back-facing triangles. Shadow casters cast from either side.
+	rasterizerInfo.cullMode = shadow ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT;
 	rasterizerInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	//rasterizerInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
 
 	// Depth bias -- usually used to resolve z-layering issues on coplanar geometry, e.g., shadows
 	// I.e., you'd give everything in the shadow buffer a small bias
-	rasterizerInfo.depthBiasEnable = VK_FALSE;
-	rasterizerInfo.depthBiasConstantFactor = 0.0f;
+	rasterizerInfo.depthBiasEnable = shadow ? VK_TRUE : VK_FALSE;
+	rasterizerInfo.depthBiasConstantFactor = shadow ? 1.25f : 0.0f;
 	rasterizerInfo.depthBiasClamp = 0.0f;
-	rasterizerInfo.depthBiasSlopeFactor = 0.0f;
+	rasterizerInfo.depthBiasSlopeFactor = shadow ? 1.75f : 0.0f;
 
 	// Set up multisampling -- turned off for now
 	VkPipelineMultisampleStateCreateInfo multisampleInfo = { };
@@ -584,6 +1090,14 @@ void VulkanApplication::initGraphicsPipeline()
 	depthStencil.depthTestEnable = VK_TRUE;
 	depthStencil.depthWriteEnable = VK_TRUE;
 	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+	// After a prepass, depth already holds the nearest surface, so only fragments of that surface
+	// are shaded. Both vertex shaders compute gl_Position the same way, so depths match exactly.
+	if (depthPrepassEnabled && !depthOnly)
+	{
+		depthStencil.depthWriteEnable = VK_FALSE;
+		depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+	}
 	depthStencil.depthBoundsTestEnable = VK_FALSE;
 	depthStencil.minDepthBounds = 0.0f; // Optional
 	depthStencil.maxDepthBounds = 1.0f; // Optional
@@ -612,7 +1126,7 @@ void VulkanApplication::initGraphicsPipeline()
 	colorBlendingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 	colorBlendingInfo.logicOpEnable = VK_FALSE;
 	colorBlendingInfo.logicOp = VK_LOGIC_OP_COPY;
-	colorBlendingInfo.attachmentCount = 1;
+	colorBlendingInfo.attachmentCount = depthOnly ? 0 : 1;
 	colorBlendingInfo.pAttachments = &colorBlendAttachmentInfo;
 	colorBlendingInfo.blendConstants[0] = 0.0f;
   	colorBlendingInfo.blendConstants[1] = 0.0f;
@@ -620,10 +1134,11 @@ void VulkanApplication::initGraphicsPipeline()
 	colorBlendingInfo.blendConstants[3] = 0.0f;
 
 	// A few pipeline things CAN be changed dynamically - e.g., viewport size, line width...
+	// The render extent changes from frame to frame, so viewport and scissor do.
 	VkDynamicState dynamicStates[] =
 	{
 		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
+		VK_DYNAMIC_STATE_SCISSOR
 	};
 	
 	VkPipelineDynamicStateCreateInfo dynamicStateInfo = { };
@@ -631,24 +1146,10 @@ void VulkanApplication::initGraphicsPipeline()
 	dynamicStateInfo.dynamicStateCount = 2;
 	dynamicStateInfo.pDynamicStates = dynamicStates;
 
-	// Set up pipeline layout. Can also set up 'push constants', dynamic constants sent to shaders.
-	// These aren't used yet.	
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo = { };
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;
-	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = 0;
-
-	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create pipeline layout");
-	}
-
 	// Create the actual pipeline:	
 	VkGraphicsPipelineCreateInfo pipelineInfo = { };
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.stageCount = 2;
+	pipelineInfo.stageCount = depthOnly ? 1 : 2;
 	pipelineInfo.pStages = shaderStages;
 	pipelineInfo.pVertexInputState = &vertexInputInfo;
 	pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
@@ -657,9 +1158,9 @@ void VulkanApplication::initGraphicsPipeline()
 	pipelineInfo.pMultisampleState = &multisampleInfo;
 	pipelineInfo.pDepthStencilState = &depthStencil;
 	pipelineInfo.pColorBlendState = &colorBlendingInfo;
-	pipelineInfo.pDynamicState = nullptr;
-	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.pDynamicState = &dynamicStateInfo;
+	pipelineInfo.layout = shadow ? shadowPipelineLayout : pipelineLayout;
+	pipelineInfo.renderPass = shadow ? shadowRenderPass : (depthOnly ? depthPrepassRenderPass : renderPass);
 	pipelineInfo.subpass = 0; // index of subpass for this pipeline
 
 	// Base pipeline handle allows 'inheritance' from a parent pipeline -- switching
@@ -668,343 +1169,3402 @@ void VulkanApplication::initGraphicsPipeline()
 	pipelineInfo.basePipelineIndex = -1;
 	// pipelineInfo.flags |= VK_PIPELINE_CREATE_DERIVATIVE_BIT; // turn on to use inheritance
 
-	if (vkCreateGraphicsPipelines(device,
+	VkResult result = vkCreateGraphicsPipelines(device,
 		VK_NULL_HANDLE,
 		1,
 		&pipelineInfo,
 		nullptr,
-		&graphicsPipeline) != VK_SUCCESS)
+		&outPipeline);
+
+	// Modules are only needed while the pipeline is created
+	vkDestroyShaderModule(device, vertShaderModule, nullptr);
+	if (fragShaderModule != VK_NULL_HANDLE)
+	{
+		vkDestroyShaderModule(device, fragShaderModule, nullptr);
+	}
+
+	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create graphics pipeline!");
+		outErrors = "vkCreateGraphicsPipelines failed";
+		return false;
 	}
+
+	return true;
 }
 
-void VulkanApplication::initFramebuffers()
+void VulkanApplication::initDynamicResolution()
 {
-	swapchainFramebuffers.resize(swapchainViews.size());
+	renderExtent = swapchainExtent;
+	previousRenderExtent = swapchainExtent;
 
-	for (size_t i = 0; i < swapchainViews.size(); ++i)
+	// Frame times come from timestamps at either end of the frame's command buffer, which needs the
+	// graphics family to support them
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	uint32_t validBits = queueFamilies[queueIndices.graphics].timestampValidBits;
+	timestampPeriod = deviceProperties.limits.timestampPeriod;
+	timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+	dynamicResolutionEnabled = validBits > 0 && timestampPeriod > 0.0f;
+
+	for (FrameResources& frame : frames)
 	{
-		std::array<VkImageView, 2> attachments = { swapchainViews[i], depthImageView };
+		frame.timestampQueryPool = VK_NULL_HANDLE;
+		frame.timestampsWritten = false;
+
+		if (!dynamicResolutionEnabled)
+		{
+			continue;
+		}
 
-		VkFramebufferCreateInfo framebufferInfo = { };
-		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferInfo.renderPass = renderPass;
-		framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-		framebufferInfo.pAttachments = attachments.data();
-		framebufferInfo.width = swapchainExtent.width;
-		framebufferInfo.height = swapchainExtent.height;
-		framebufferInfo.layers = 1;
+		VkQueryPoolCreateInfo queryPoolInfo = { };
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2;
 
-		if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapchainFramebuffers[i]) != VK_SUCCESS)
+		if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &frame.timestampQueryPool) != VK_SUCCESS)
 		{
-			throw std::runtime_error("Failed to create framebuffer");
+			throw std::runtime_error("Failed to create timestamp query pool");
 		}
-	}	
-}
+	}
 
-void VulkanApplication::initCommandPools()
-{
-	// Create graphics command pool
-	VkCommandPoolCreateInfo graphicsPoolInfo = { };
-	graphicsPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	graphicsPoolInfo.queueFamilyIndex = queueIndices.graphics;
-	graphicsPoolInfo.flags = 0;
-	
-	// Possible flags:
-	// Flag that this pool is rerecorded with new commands often
-	// poolInfo.flags |= VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
-	// Allow command buffers to be rerecorded individually
-	// poolInfo.flags |= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-	
-	if (vkCreateCommandPool(device, &graphicsPoolInfo, nullptr, &graphicsCommandPool) != VK_SUCCESS)
+	// Bilinear, and clamped so the edges of the rendered area don't pull in the other side
+	VkSamplerCreateInfo samplerInfo = { };
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = 0.0f;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &upscaleSampler) != VK_SUCCESS)
 	{
-		throw std::runtime_error("Could not create graphics command pool");
+		throw std::runtime_error("Failed to create upscale sampler");
 	}
 
-	VkCommandPoolCreateInfo transferPoolInfo = { };
+	VkDescriptorSetLayoutBinding sceneColorBinding = { };
+	sceneColorBinding.binding = 0;
+	sceneColorBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	sceneColorBinding.descriptorCount = 1;
+	sceneColorBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	upscaleDescriptorSetLayout = descriptorAllocator.getLayout({ sceneColorBinding });
+}
+
+bool VulkanApplication::buildUpscalePipeline(VkPipeline& outPipeline, std::string& outErrors)
+{
+	VkShaderModule vertShaderModule;
+	VkShaderModule fragShaderModule;
+
+	if (!loadShaderModule(fullscreenVertShaderPath, vertShaderModule, outErrors))
+	{
+		return false;
+	}
+
+	if (!loadShaderModule(upscaleFragShaderPath, fragShaderModule, outErrors))
+	{
+		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+		return false;
+	}
+
+	VkPipelineShaderStageCreateInfo shaderStages[2] = { };
+	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStages[0].module = vertShaderModule;
+	shaderStages[0].pName = "main";
+	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStages[1].module = fragShaderModule;
+	shaderStages[1].pName = "main";
+
+	// The fullscreen triangle is made from the vertex index alone
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo = { };
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = { };
+	inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssemblyInfo.primitiveRestartEnable = false;
+
+	// Always the whole backbuffer, and rebuilt with the swapchain
+	VkViewport viewport = { };
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)swapchainExtent.width;
+	viewport.height = (float)swapchainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = { };
+	scissor.offset = { 0,0 };
+	scissor.extent = swapchainExtent;
+
+	VkPipelineViewportStateCreateInfo viewportStateInfo = { };
+	viewportStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportStateInfo.viewportCount = 1;
+	viewportStateInfo.pViewports = &viewport;
+	viewportStateInfo.scissorCount = 1;
+	viewportStateInfo.pScissors = &scissor;
+
+	VkPipelineRasterizationStateCreateInfo rasterizerInfo = { };
+	rasterizerInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizerInfo.lineWidth = 1.0f;
+	rasterizerInfo.cullMode = VK_CULL_MODE_NONE;
+	rasterizerInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampleInfo = { };
+	multisampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampleInfo.minSampleShading = 1.0f;
+
+	// No depth attachment, and every pixel is overwritten, so no blending either
+	VkPipelineColorBlendAttachmentState colorBlendAttachmentInfo = { };
+	colorBlendAttachmentInfo.colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
+		VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT |
+		VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachmentInfo.blendEnable = VK_FALSE;
+
+	VkPipelineColorBlendStateCreateInfo colorBlendingInfo = { };
+	colorBlendingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlendingInfo.logicOpEnable = VK_FALSE;
+	colorBlendingInfo.attachmentCount = 1;
+	colorBlendingInfo.pAttachments = &colorBlendAttachmentInfo;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = { };
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = shaderStages;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
+	pipelineInfo.pViewportState = &viewportStateInfo;
+	pipelineInfo.pRasterizationState = &rasterizerInfo;
+	pipelineInfo.pMultisampleState = &multisampleInfo;
+	pipelineInfo.pDepthStencilState = nullptr;
+	pipelineInfo.pColorBlendState = &colorBlendingInfo;
+	pipelineInfo.pDynamicState = nullptr;
+	pipelineInfo.layout = upscalePipelineLayout;
+	pipelineInfo.renderPass = renderGraph.getRenderPass(upscalePass);
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &outPipeline);
+
+	vkDestroyShaderModule(device, vertShaderModule, nullptr);
+	vkDestroyShaderModule(device, fragShaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		outErrors = "vkCreateGraphicsPipelines failed";
+		return false;
+	}
+
+	return true;
+}
+
+void VulkanApplication::recordUpscale(VkCommandBuffer commandBuffer)
+{
+	// The render graph has already put sceneColor in SHADER_READ_ONLY_OPTIMAL
+	DescriptorWrite write = { };
+	write.binding = 0;
+	write.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.image.sampler = upscaleSampler;
+	write.image.imageView = renderGraph.getImageView(sceneColor, 0);
+	write.image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkDescriptorSet descriptorSet = descriptorAllocator.getSet(upscaleDescriptorSetLayout, { write });
+
+	float width = static_cast<float>(swapchainExtent.width);
+	float height = static_cast<float>(swapchainExtent.height);
+
+	UpscalePushConstants constants;
+	constants.uvScale = glm::vec2(renderExtent.width / width, renderExtent.height / height);
+	constants.uvMax = glm::vec2((renderExtent.width - 0.5f) / width, (renderExtent.height - 0.5f) / height);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, upscalePipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, upscalePipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, upscalePipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+	vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
+
+void VulkanApplication::initShadows()
+{
+	// Sampled by the copy into the shadow map, and drawn to by the cache's own render pass
+	if (!createVkImage(shadowCacheImage,
+		shadowCacheImageMemory,
+		device,
+		physicalDevice,
+		ShadowCascades::atlasResolution,
+		ShadowCascades::atlasResolution,
+		depthImageFormat,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+	{
+		throw std::runtime_error("Failed to create shadow cache image");
+	}
+
+	if (!createVkImageView(shadowCacheImage, depthImageFormat, VK_IMAGE_ASPECT_DEPTH_BIT, shadowCacheImageView))
+	{
+		throw std::runtime_error("Failed to create shadow cache image view");
+	}
+
+	// Kept in the layout it's read in between frames. Every cascade starts out stale, so the first
+	// frame draws all of it.
+	if (!transitionImageLayout(shadowCacheImage,
+		depthImageFormat,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		0,
+		VK_ACCESS_SHADER_READ_BIT,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT))
+	{
+		throw std::runtime_error("Failed to transition shadow cache image");
+	}
+
+	// Stale cascades are cleared and redrawn, the rest kept, so the cache is loaded
+	VkAttachmentDescription cacheAttachment = { };
+	cacheAttachment.format = depthImageFormat;
+	cacheAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	cacheAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	cacheAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	cacheAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	cacheAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	cacheAttachment.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	cacheAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference cacheReference = { 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription subpass = { };
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 0;
+	subpass.pDepthStencilAttachment = &cacheReference;
+
+	// Wait for earlier frames' copies out of the cache, and make what's drawn visible to the next copy
+	VkSubpassDependency dependencies[2] = { };
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = { };
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = 1;
+	renderPassInfo.pAttachments = &cacheAttachment;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = 2;
+	renderPassInfo.pDependencies = dependencies;
+
+	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &shadowCacheRenderPass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow cache render pass");
+	}
+
+	VkFramebufferCreateInfo framebufferInfo = { };
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = shadowCacheRenderPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &shadowCacheImageView;
+	framebufferInfo.width = ShadowCascades::atlasResolution;
+	framebufferInfo.height = ShadowCascades::atlasResolution;
+	framebufferInfo.layers = 1;
+
+	if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &shadowCacheFramebuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow cache framebuffer");
+	}
+
+	// The copy reads exact texels
+	VkSamplerCreateInfo samplerInfo = { };
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = 0.0f;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &shadowCacheSampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow cache sampler");
+	}
+
+	// Shading compares against the map, and filters the results of the four nearest texels
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.compareEnable = VK_TRUE;
+	samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &shadowSampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow sampler");
+	}
+
+	VkDescriptorSetLayoutBinding cacheBinding = { };
+	cacheBinding.binding = 0;
+	cacheBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	cacheBinding.descriptorCount = 1;
+	cacheBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	shadowCopyDescriptorSetLayout = descriptorAllocator.getLayout({ cacheBinding });
+
+	VkPipelineLayoutCreateInfo copyLayoutInfo = { };
+	copyLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	copyLayoutInfo.setLayoutCount = 1;
+	copyLayoutInfo.pSetLayouts = &shadowCopyDescriptorSetLayout;
+
+	if (vkCreatePipelineLayout(device, &copyLayoutInfo, nullptr, &shadowCopyPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow copy pipeline layout");
+	}
+
+	// Casters only need the cascade's matrix, pushed before each cascade is drawn
+	VkPushConstantRange casterPushConstants = { };
+	casterPushConstants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	casterPushConstants.offset = 0;
+	casterPushConstants.size = sizeof(glm::mat4);
+
+	VkPipelineLayoutCreateInfo casterLayoutInfo = { };
+	casterLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	casterLayoutInfo.setLayoutCount = 0;
+	casterLayoutInfo.pushConstantRangeCount = 1;
+	casterLayoutInfo.pPushConstantRanges = &casterPushConstants;
+
+	if (vkCreatePipelineLayout(device, &casterLayoutInfo, nullptr, &shadowPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow pipeline layout");
+	}
+}
+
+bool VulkanApplication::buildShadowCopyPipeline(VkPipeline& outPipeline, std::string& outErrors)
+{
+	VkShaderModule vertShaderModule;
+	VkShaderModule fragShaderModule;
+
+	if (!loadShaderModule(fullscreenVertShaderPath, vertShaderModule, outErrors))
+	{
+		return false;
+	}
+
+	if (!loadShaderModule(shadowCopyFragShaderPath, fragShaderModule, outErrors))
+	{
+		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+		return false;
+	}
+
+	VkPipelineShaderStageCreateInfo shaderStages[2] = { };
+	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStages[0].module = vertShaderModule;
+	shaderStages[0].pName = "main";
+	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStages[1].module = fragShaderModule;
+	shaderStages[1].pName = "main";
+
+	// The fullscreen triangle is made from the vertex index alone
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo = { };
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = { };
+	inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssemblyInfo.primitiveRestartEnable = false;
+
+	// Always the whole atlas
+	VkViewport viewport = { };
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(ShadowCascades::atlasResolution);
+	viewport.height = static_cast<float>(ShadowCascades::atlasResolution);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = { };
+	scissor.offset = { 0, 0 };
+	scissor.extent = { ShadowCascades::atlasResolution, ShadowCascades::atlasResolution };
+
+	VkPipelineViewportStateCreateInfo viewportStateInfo = { };
+	viewportStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportStateInfo.viewportCount = 1;
+	viewportStateInfo.pViewports = &viewport;
+	viewportStateInfo.scissorCount = 1;
+	viewportStateInfo.pScissors = &scissor;
+
+	VkPipelineRasterizationStateCreateInfo rasterizerInfo = { };
+	rasterizerInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizerInfo.lineWidth = 1.0f;
+	rasterizerInfo.cullMode = VK_CULL_MODE_NONE;
+	rasterizerInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampleInfo = { };
+	multisampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampleInfo.minSampleShading = 1.0f;
+
+	// Every texel is overwritten with the cache's depth, whatever was there
+	VkPipelineDepthStencilStateCreateInfo depthStencil = { };
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+	depthStencil.depthBoundsTestEnable = VK_FALSE;
+	depthStencil.stencilTestEnable = VK_FALSE;
+
+	// Depth only
+	VkPipelineColorBlendStateCreateInfo colorBlendingInfo = { };
+	colorBlendingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlendingInfo.logicOpEnable = VK_FALSE;
+	colorBlendingInfo.attachmentCount = 0;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = { };
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = shaderStages;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
+	pipelineInfo.pViewportState = &viewportStateInfo;
+	pipelineInfo.pRasterizationState = &rasterizerInfo;
+	pipelineInfo.pMultisampleState = &multisampleInfo;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlendingInfo;
+	pipelineInfo.pDynamicState = nullptr;
+	pipelineInfo.layout = shadowCopyPipelineLayout;
+	pipelineInfo.renderPass = shadowRenderPass;
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &outPipeline);
+
+	vkDestroyShaderModule(device, vertShaderModule, nullptr);
+	vkDestroyShaderModule(device, fragShaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		outErrors = "vkCreateGraphicsPipelines failed";
+		return false;
+	}
+
+	return true;
+}
+
+void VulkanApplication::updateShadows(FrameResources& frame)
+{
+	// Moving, adding or removing static objects makes the whole cache stale
+	if (scene.getStaticVersion() != shadowStaticVersion)
+	{
+		shadowCascades.invalidateStatic();
+		shadowStaticVersion = scene.getStaticVersion();
+	}
+
+	// Dynamic casters are drawn every frame. Static ones come first in the scene's instances, and are
+	// only read when the cache is redrawn.
+	const std::vector<InstanceData>& instances = scene.getInstances();
+	uint32_t staticCount = scene.getStaticInstanceCount();
+	InstanceData* mapped = static_cast<InstanceData*>(frame.shadowInstanceBufferMapped);
+
+	memcpy(mapped + staticCount, instances.data() + staticCount, (instances.size() - staticCount) * sizeof(InstanceData));
+
+	bool cacheStale = false;
+	for (uint32_t i = 0; i < ShadowCascades::cascadeCount; ++i)
+	{
+		cacheStale = cacheStale || !shadowCascades.getCascade(i).staticValid;
+	}
+
+	if (cacheStale)
+	{
+		memcpy(mapped, instances.data(), staticCount * sizeof(InstanceData));
+	}
+}
+
+void VulkanApplication::recordStaticShadows(VkCommandBuffer commandBuffer, const FrameResources& frame)
+{
+	bool cacheStale = false;
+	for (uint32_t i = 0; i < ShadowCascades::cascadeCount; ++i)
+	{
+		cacheStale = cacheStale || !shadowCascades.getCascade(i).staticValid;
+	}
+
+	if (!cacheStale)
+	{
+		return;
+	}
+
+	VkRenderPassBeginInfo renderPassInfo = { };
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = shadowCacheRenderPass;
+	renderPassInfo.framebuffer = shadowCacheFramebuffer;
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = { ShadowCascades::atlasResolution, ShadowCascades::atlasResolution };
+	renderPassInfo.clearValueCount = 0;
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+	VkBuffer vertexBuffers[] = { positionBuffer, frame.shadowInstanceBuffer };
+	VkDeviceSize offsets[] = { 0, 0 };
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline);
+	vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+	for (uint32_t i = 0; i < ShadowCascades::cascadeCount; ++i)
+	{
+		if (shadowCascades.getCascade(i).staticValid)
+		{
+			continue;
+		}
+
+		// Only this cascade's part of the atlas; the others keep what's cached
+		glm::uvec2 atlasOffset = ShadowCascades::getAtlasOffset(i);
+
+		VkClearAttachment clear = { };
+		clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		clear.colorAttachment = 0;
+		clear.clearValue.depthStencil = { 1.0f, 0 };
+
+		VkClearRect clearRect = { };
+		clearRect.rect.offset = { static_cast<int32_t>(atlasOffset.x), static_cast<int32_t>(atlasOffset.y) };
+		clearRect.rect.extent = { ShadowCascades::cascadeResolution, ShadowCascades::cascadeResolution };
+		clearRect.baseArrayLayer = 0;
+		clearRect.layerCount = 1;
+
+		vkCmdClearAttachments(commandBuffer, 1, &clear, 1, &clearRect);
+
+		recordShadowCasters(commandBuffer, i, true);
+		shadowCascades.markStaticDrawn(i);
+	}
+
+	vkCmdEndRenderPass(commandBuffer);
+}
+
+void VulkanApplication::recordShadows(VkCommandBuffer commandBuffer, const FrameResources& frame)
+{
+	// The cache stays in SHADER_READ_ONLY_OPTIMAL outside its own render pass
+	DescriptorWrite write = { };
+	write.binding = 0;
+	write.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.image.sampler = shadowCacheSampler;
+	write.image.imageView = shadowCacheImageView;
+	write.image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkDescriptorSet descriptorSet = descriptorAllocator.getSet(shadowCopyDescriptorSetLayout, { write });
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowCopyPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowCopyPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+	VkBuffer vertexBuffers[] = { positionBuffer, frame.shadowInstanceBuffer };
+	VkDeviceSize offsets[] = { 0, 0 };
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline);
+	vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+	for (uint32_t i = 0; i < ShadowCascades::cascadeCount; ++i)
+	{
+		recordShadowCasters(commandBuffer, i, false);
+	}
+}
+
+void VulkanApplication::recordShadowCasters(VkCommandBuffer commandBuffer, uint32_t cascade, bool isStatic)
+{
+	glm::uvec2 atlasOffset = ShadowCascades::getAtlasOffset(cascade);
+
+	VkViewport viewport = { };
+	viewport.x = static_cast<float>(atlasOffset.x);
+	viewport.y = static_cast<float>(atlasOffset.y);
+	viewport.width = static_cast<float>(ShadowCascades::cascadeResolution);
+	viewport.height = static_cast<float>(ShadowCascades::cascadeResolution);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = { };
+	scissor.offset = { static_cast<int32_t>(atlasOffset.x), static_cast<int32_t>(atlasOffset.y) };
+	scissor.extent = { ShadowCascades::cascadeResolution, ShadowCascades::cascadeResolution };
+
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	const glm::mat4& viewProj = shadowCascades.getCascade(cascade).viewProj;
+	vkCmdPushConstants(commandBuffer, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &viewProj);
+
+	// Every caster in the cascade's box is drawn; the scene is small enough not to cull per cascade
+	for (const DrawBatch& batch : scene.getBatches())
+	{
+		if (batch.isStatic != isStatic)
+		{
+			continue;
+		}
+
+		const MeshInfo& mesh = scene.getMesh(batch.mesh);
+		vkCmdDrawIndexed(commandBuffer, mesh.indexCount, batch.instanceCount, mesh.firstIndex, mesh.vertexOffset, batch.firstInstance);
+	}
+}
+
+void VulkanApplication::initShaderHotReload()
+{
+	HotReloadPipeline mainPipeline;
+	mainPipeline.shaderPaths = { mainVertShaderPath, mainFragShaderPath };
+	mainPipeline.pipeline = &graphicsPipeline;
+	mainPipeline.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildGraphicsPipeline(GraphicsPipelineMain, outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(mainPipeline);
+
+	if (depthPrepassEnabled)
+	{
+		HotReloadPipeline prepassPipeline;
+		prepassPipeline.shaderPaths = { depthPrepassVertShaderPath };
+		prepassPipeline.pipeline = &depthPrepassPipeline;
+		prepassPipeline.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+		{
+			return buildGraphicsPipeline(GraphicsPipelineDepthPrepass, outPipeline, outErrors);
+		};
+		hotReloadPipelines.push_back(prepassPipeline);
+	}
+
+	HotReloadPipeline shadowCasters;
+	shadowCasters.shaderPaths = { shadowVertShaderPath };
+	shadowCasters.pipeline = &shadowPipeline;
+	shadowCasters.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildGraphicsPipeline(GraphicsPipelineShadow, outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(shadowCasters);
+
+	HotReloadPipeline shadowCopy;
+	shadowCopy.shaderPaths = { fullscreenVertShaderPath, shadowCopyFragShaderPath };
+	shadowCopy.pipeline = &shadowCopyPipeline;
+	shadowCopy.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildShadowCopyPipeline(outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(shadowCopy);
+
+	HotReloadPipeline upscale;
+	upscale.shaderPaths = { fullscreenVertShaderPath, upscaleFragShaderPath };
+	upscale.pipeline = &upscalePipeline;
+	upscale.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildUpscalePipeline(outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(upscale);
+
+	HotReloadPipeline lightBinning;
+	lightBinning.shaderPaths = { lightBinningShaderPath };
+	lightBinning.pipeline = &lightBinPipeline;
+	lightBinning.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildComputePipeline(lightBinningShaderPath, lightBinPipelineLayout, outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(lightBinning);
+
+	HotReloadPipeline skinning;
+	skinning.shaderPaths = { skinningShaderPath };
+	skinning.pipeline = &skinningPipeline;
+	skinning.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildComputePipeline(skinningShaderPath, skinningPipelineLayout, outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(skinning);
+
+	HotReloadPipeline particleBegin;
+	particleBegin.shaderPaths = { particleBeginShaderPath };
+	particleBegin.pipeline = &particleBeginPipeline;
+	particleBegin.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildComputePipeline(particleBeginShaderPath, particlePipelineLayout, outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(particleBegin);
+
+	HotReloadPipeline particleEmit;
+	particleEmit.shaderPaths = { particleEmitShaderPath };
+	particleEmit.pipeline = &particleEmitPipeline;
+	particleEmit.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildComputePipeline(particleEmitShaderPath, particlePipelineLayout, outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(particleEmit);
+
+	HotReloadPipeline particleSimulate;
+	particleSimulate.shaderPaths = { particleSimulateShaderPath };
+	particleSimulate.pipeline = &particleSimulatePipeline;
+	particleSimulate.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildComputePipeline(particleSimulateShaderPath, particlePipelineLayout, outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(particleSimulate);
+
+	HotReloadPipeline particleDraw;
+	particleDraw.shaderPaths = { particleVertShaderPath, particleFragShaderPath };
+	particleDraw.pipeline = &particlePipeline;
+	particleDraw.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildParticlePipeline(outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(particleDraw);
+
+	HotReloadPipeline sprites;
+	sprites.shaderPaths = { spriteVertShaderPath, spriteFragShaderPath };
+	sprites.pipeline = &spritePipeline;
+	sprites.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+	{
+		return buildSpritePipeline(outPipeline, outErrors);
+	};
+	hotReloadPipelines.push_back(sprites);
+
+	if (gpuCullingEnabled)
+	{
+		HotReloadPipeline cullInstances;
+		cullInstances.shaderPaths = { cullInstancesShaderPath };
+		cullInstances.pipeline = &cullPipeline;
+		cullInstances.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+		{
+			return buildComputePipeline(cullInstancesShaderPath, cullPipelineLayout, outPipeline, outErrors);
+		};
+		hotReloadPipelines.push_back(cullInstances);
+
+		HotReloadPipeline compactDraws;
+		compactDraws.shaderPaths = { compactDrawsShaderPath };
+		compactDraws.pipeline = &compactDrawsPipeline;
+		compactDraws.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+		{
+			return buildComputePipeline(compactDrawsShaderPath, cullPipelineLayout, outPipeline, outErrors);
+		};
+		hotReloadPipelines.push_back(compactDraws);
+
+		HotReloadPipeline depthPyramidBuild;
+		depthPyramidBuild.shaderPaths = { depthPyramidShaderPath };
+		depthPyramidBuild.pipeline = &depthPyramidPipeline;
+		depthPyramidBuild.build = [this](VkPipeline& outPipeline, std::string& outErrors)
+		{
+			return buildComputePipeline(depthPyramidShaderPath, depthPyramidPipelineLayout, outPipeline, outErrors);
+		};
+		hotReloadPipelines.push_back(depthPyramidBuild);
+	}
+
+	for (const HotReloadPipeline& hotReloadPipeline : hotReloadPipelines)
+	{
+		for (const std::string& path : hotReloadPipeline.shaderPaths)
+		{
+			shaderWatcher.watch(path);
+		}
+	}
+}
+
+void VulkanApplication::reloadChangedShaders()
+{
+	std::vector<std::string> changedPaths = shaderWatcher.poll();
+	if (changedPaths.empty())
+	{
+		return;
+	}
+
+	bool rebuiltAny = false;
+	for (HotReloadPipeline& hotReloadPipeline : hotReloadPipelines)
+	{
+		// Only rebuild pipelines that actually use one of the changed files
+		bool affected = false;
+		for (const std::string& path : hotReloadPipeline.shaderPaths)
+		{
+			if (std::find(changedPaths.begin(), changedPaths.end(), path) != changedPaths.end())
+			{
+				affected = true;
+				break;
+			}
+		}
+
+		if (!affected)
+		{
+			continue;
+		}
+
+		// On failure, keep drawing with the old pipeline until the shader is fixed
+		VkPipeline newPipeline;
+		std::string errors;
+		if (!hotReloadPipeline.build(newPipeline, errors))
+		{
+			std::cerr << "Shader reload failed: " << std::endl << errors << std::endl;
+			continue;
+		}
+
+		VkPipeline oldPipeline = *hotReloadPipeline.pipeline;
+		retireObject([this, oldPipeline]() { vkDestroyPipeline(device, oldPipeline, nullptr); });
+		*hotReloadPipeline.pipeline = newPipeline;
+		rebuiltAny = true;
+	}
+
+	if (rebuiltAny)
+	{
+		// Command buffers are recorded every frame, so the next frame picks up the new pipelines
+		std::cout << "Shaders reloaded" << std::endl;
+	}
+}
+
+void VulkanApplication::retireObject(std::function<void()> destroy)
+{
+	deletionQueue.retire(frameCount, destroy);
+}
+
+void VulkanApplication::destroyRetiredObjects()
+{
+	// Called once the current frame's fence has signaled, so every frame up to
+	// frameCount - maxFramesInFlight has completed. Anything retired while recording frame K
+	// was last used by frame K - 1.
+	if (frameCount + 1 >= maxFramesInFlight)
+	{
+		deletionQueue.destroyCompleted(frameCount + 1 - maxFramesInFlight);
+	}
+}
+
+void VulkanApplication::initCommandPools()
+{
+	// Create graphics command pool
+	VkCommandPoolCreateInfo graphicsPoolInfo = { };
+	graphicsPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	graphicsPoolInfo.queueFamilyIndex = queueIndices.graphics;
+	graphicsPoolInfo.flags = 0;
+	
+	// Possible flags:
+	// Flag that this pool is rerecorded with new commands often
+	// poolInfo.flags |= VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	// Allow command buffers to be rerecorded individually
+	// poolInfo.flags |= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	
+	if (vkCreateCommandPool(device, &graphicsPoolInfo, nullptr, &graphicsCommandPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Could not create graphics command pool");
+	}
+
+	VkCommandPoolCreateInfo transferPoolInfo = { };
 	transferPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	transferPoolInfo.queueFamilyIndex = queueIndices.transfer;
 	// Flag as transient, since the command buffer is recorded each time we transfer
 	transferPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-	if (vkCreateCommandPool(device, &transferPoolInfo, nullptr, &transferCommandPool) != VK_SUCCESS)
+	if (vkCreateCommandPool(device, &transferPoolInfo, nullptr, &transferCommandPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Could not create transfer command pool");
+	}
+
+	// Per-frame pools. Command buffers are recorded every frame, and a whole pool is reset
+	// at once when its frame comes around again. Command pools aren't thread safe, so each
+	// recording thread gets its own.
+	VkCommandPoolCreateInfo framePoolInfo = { };
+	framePoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	framePoolInfo.queueFamilyIndex = queueIndices.graphics;
+	framePoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	for (FrameResources& frame : frames)
+	{
+		frame.threadCommandPools.resize(ParallelUtil::getThreadCount());
+
+		bool created = vkCreateCommandPool(device, &framePoolInfo, nullptr, &frame.commandPool) == VK_SUCCESS;
+		for (VkCommandPool& threadPool : frame.threadCommandPools)
+		{
+			created = created && vkCreateCommandPool(device, &framePoolInfo, nullptr, &threadPool) == VK_SUCCESS;
+		}
+
+		if (!created)
+		{
+			throw std::runtime_error("Could not create per-frame command pools");
+		}
+	}
+}
+
+void VulkanApplication::initVertexBuffers()
+{
+	// Allow both graphics and transfer queues to access this buffer.
+	// If we used the graphics queue for both ops, you'd use exclusive mode.
+	std::vector<uint32_t> vertexQueues = {
+static_cast<uint32_t>(queueIndices.graphics),
+static_cast<uint32_t>(queueIndices.transfer)
+	};
+	vertexBufferSize = sizeof(Vertex3D) * scene.getVertices().size();
+
+	if (!createVkBuffer(vertexBuffer,
+		vertexBufferMemory,
+		device,
+		physicalDevice,
+		vertexBufferSize,
+		vertexQueues,
+		VK_SHARING_MODE_CONCURRENT,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, // Skinning writes it
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+	{
+		throw std::runtime_error("failed to create vertex buffer");
+	}
+
+	// Positions again, tightly packed, so depth-only passes and shadows fetch a third of the data
+	positionBufferSize = sizeof(glm::vec3) * scene.getVertices().size();
+
+	if (!createVkBuffer(positionBuffer,
+		positionBufferMemory,
+		device,
+		physicalDevice,
+		positionBufferSize,
+		vertexQueues,
+		VK_SHARING_MODE_CONCURRENT,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+	{
+		throw std::runtime_error("failed to create position buffer");
+	}
+
+	std::vector<uint32_t> vertexStagingQueues = {
+static_cast<uint32_t>(queueIndices.transfer)
+	};
+	vertexStagingBufferSize = sizeof(Vertex3D) * scene.getVertices().size();
+
+	if (!createVkBuffer(vertexStagingBuffer,
+		vertexStagingMemory,
+		device,
+		physicalDevice,
+		vertexStagingBufferSize,
+		vertexStagingQueues,
+		VK_SHARING_MODE_EXCLUSIVE,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+	{
+		throw std::runtime_error("failed to create vertex staging buffer");
+	}
+}
+
+void VulkanApplication::initIndexBuffers()
+{		
+	// Allow both graphics and transfer queues to access this buffer.
+	// If we used the graphics queue for both ops, you'd use exclusive mode.
+	std::vector<uint32_t> indexQueues = {
+static_cast<uint32_t>(queueIndices.graphics),
+static_cast<uint32_t>(queueIndices.transfer)
+	};
+	indexBufferSize = sizeof(uint32_t) * scene.getIndices().size();
+
+	if (!createVkBuffer(indexBuffer,
+		indexBufferMemory,
+		device,
+		physicalDevice,
+		indexBufferSize,
+		indexQueues,
+		VK_SHARING_MODE_CONCURRENT,
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+	{
+		throw std::runtime_error("failed to create index buffer");
+	}
+
+	std::vector<uint32_t> indexStagingQueues = {
+static_cast<uint32_t>(queueIndices.transfer)
+	};
+	indexStagingBufferSize = sizeof(uint32_t) * scene.getIndices().size();
+
+	if (!createVkBuffer(indexStagingBuffer,
+		indexStagingMemory,
+		device,
+		physicalDevice,
+		indexStagingBufferSize,
+		indexStagingQueues,
+		VK_SHARING_MODE_EXCLUSIVE,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+	{
+		throw std::runtime_error("failed to create index staging buffer");
+	}
+}
+
+void VulkanApplication::loadModel()
+{
+	/*
+		std::string path = "Content/Models/chalet.obj";
+		std::vector<Vertex3D> modelVertices;
+		std::vector<uint32_t> modelIndices;
+		Aabb modelBounds;
+		if (!ObjUtil::loadObj(path, modelVertices, modelIndices, modelBounds))
+		{
+			throw std::runtime_error("Failed to load model at path: " + path);
+		}
+		MeshId modelMesh = scene.addMesh(modelVertices, modelIndices, modelBounds);
+
+		// Occluders are best kept low-poly; a simplified version of the model would do as well
+		OccluderMeshId modelOccluder = softwareOcclusion.addOccluderMesh(modelVertices, modelIndices);
+	*/
+
+	std::vector<Vertex3D> vertices = {
+{{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+{{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+{{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}, {0.0f, 0.0f, 1.0f}},
+{{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}, {0.0f, 0.0f, 1.0f}},
+
+{{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+{{0.5f, -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+{{0.5f, 0.5f, -0.5f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}, {0.0f, 0.0f, 1.0f}},
+{{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}, {0.0f, 0.0f, 1.0f}}
+	};
+
+	std::vector<uint32_t> indices = {
+0, 1, 2, 2, 3, 0,
+4, 5, 6, 6, 7, 4
+	};
+
+	quadMesh = scene.addMesh(vertices, indices);
+	OccluderMeshId quadOccluder = softwareOcclusion.addOccluderMesh(vertices, indices);
+
+	sceneRoot = transforms.addNode(TransformHierarchy::invalidTransform);
+
+	// Lay out a grid of instances sharing the mesh
+	const int gridSize = 16;
+	const float spacing = 0.25f;
+	for (int y = 0; y < gridSize; ++y)
+	{
+		for (int x = 0; x < gridSize; ++x)
+		{
+			glm::vec3 position((x - gridSize / 2) * spacing, (y - gridSize / 2) * spacing, 0.0f);
+			ObjectId object = scene.addObject(quadMesh, 0, glm::mat4(1.0f));
+			addObjectTransform(object, sceneRoot, position, glm::vec3(0.2f));
+			occluders.push_back(std::make_pair(object, quadOccluder));
+		}
+	}
+
+	// Ground under the grid to catch its shadows. It never moves, so its own shadows are cached.
+	glm::mat4 groundTransform = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+	groundTransform = glm::scale(groundTransform, glm::vec3(8.0f, 8.0f, 1.0f));
+	ObjectId ground = scene.addObject(quadMesh, 0, groundTransform);
+	scene.setStatic(ground, true);
+
+	loadSkinnedMeshes();
+
+	// A grid of small colored point lights just above the quads, and a few spot lights shining
+	// down on them, to keep the clusters busy
+	const int lightGridSize = 32;
+	for (int y = 0; y < lightGridSize; ++y)
+	{
+		for (int x = 0; x < lightGridSize; ++x)
+		{
+			glm::vec3 position((x - lightGridSize / 2) * spacing * 0.5f, (y - lightGridSize / 2) * spacing * 0.5f, 0.1f);
+			glm::vec3 color(0.5f + 0.5f * std::sin(x * 0.7f), 0.5f + 0.5f * std::sin(y * 0.9f + 2.0f), 0.5f + 0.5f * std::sin((x + y) * 0.5f + 4.0f));
+			lights.push_back(ClusteredLighting::makePointLight(position, 0.3f, color * 0.5f));
+		}
+	}
+
+	for (int i = 0; i < 4; ++i)
+	{
+		float angle = i * glm::radians(90.0f);
+		glm::vec3 position(std::cos(angle), std::sin(angle), 1.5f);
+		lights.push_back(ClusteredLighting::makeSpotLight(position, -position, 3.0f, glm::vec3(2.0f),
+			glm::radians(15.0f), glm::radians(25.0f)));
+	}
+
+	// Objects start out with their world matrices in place
+	updateTransforms();
+}
+
+#pragma optimize("gtsy", off)
+void VulkanApplication::fillIndexBuffer()
+{
+	void* data;
+	std::cout << "DOING!!" << std::endl;
+	// Transfer to staging memory first:
+	vkMapMemory(device, indexStagingMemory, 0, 
+		static_cast<VkDeviceSize>(indexStagingBufferSize), 0, &data);
+
+	memcpy(data, scene.getIndices().data(), indexStagingBufferSize);
+
+	// Note: For some type of memory, you would need to call vkFlushMappedMemoryRanges after writing,
+	// to ensure the write makes it to the device. This isn't necessery because we specified the 
+	// COHERENT bit. 
+	//
+	// Similarly, if reading memory, you would need to call vkInvalidateMappedMemoryRanges before
+	// reading, if the memory is not coherent.
+
+	vkUnmapMemory(device, indexStagingMemory);
+
+	// Copy into device memory
+	assert(copyBuffer(indexStagingBuffer, indexBuffer, indexStagingBufferSize));
+}
+#pragma optimize("gtsy", on)
+
+#pragma optimize("gtsy", off)
+void VulkanApplication::fillVertexBuffer()
+{
+	void* data;
+	std::cout << "BOING!!" << std::endl;
+	// Transfer to staging memory first:
+	vkMapMemory(device, vertexStagingMemory, 0, static_cast<VkDeviceSize>(vertexStagingBufferSize), 0, &data);
+
+	memcpy(data, scene.getVertices().data(), vertexStagingBufferSize);
+
+	// Note: For some type of memory, you would need to call vkFlushMappedMemoryRanges after writing,
+	// to ensure the write makes it to the device. This isn't necessery because we specified the 
+	// COHERENT bit. 
+	//
+	// Similarly, if reading memory, you would need to call vkInvalidateMappedMemoryRanges before
+	// reading, if the memory is not coherent.	
+
+	vkUnmapMemory(device, vertexStagingMemory);
+
+	// Copy into device memory
+	assert(copyBuffer(vertexStagingBuffer, vertexBuffer, vertexStagingBufferSize));
+
+	// The position stream goes through the same staging buffer, which is big enough to hold it
+	vkMapMemory(device, vertexStagingMemory, 0, static_cast<VkDeviceSize>(positionBufferSize), 0, &data);
+
+	glm::vec3* positions = static_cast<glm::vec3*>(data);
+	const std::vector<Vertex3D>& vertices = scene.getVertices();
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		positions[i] = vertices[i].pos;
+	}
+
+	vkUnmapMemory(device, vertexStagingMemory);
+
+	if (!copyBuffer(vertexStagingBuffer, positionBuffer, positionBufferSize))
+	{
+		throw std::runtime_error("failed to fill position buffer");
+	}
+}
+#pragma optimize("gtsy", on)
+
+void VulkanApplication::initCommandBuffers()
+{
+	for (FrameResources& frame : frames)
+	{
+		VkCommandBufferAllocateInfo allocInfo = { };
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = frame.commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device, &allocInfo, &frame.commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Could not allocate command buffers");
+		}
+
+		// Secondaries hold the draws, and are executed inside the primary's render passes.
+		// Each pass that draws the scene gets one per thread.
+		auto allocateSecondaries = [&](std::vector<VkCommandBuffer>& outCommandBuffers)
+		{
+			outCommandBuffers.resize(frame.threadCommandPools.size());
+			for (size_t i = 0; i < frame.threadCommandPools.size(); ++i)
+			{
+				allocInfo.commandPool = frame.threadCommandPools[i];
+				allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+				if (vkAllocateCommandBuffers(device, &allocInfo, &outCommandBuffers[i]) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Could not allocate secondary command buffers");
+				}
+			}
+		};
+
+		allocateSecondaries(frame.threadCommandBuffers);
+		if (gpuCullingEnabled)
+		{
+			allocateSecondaries(frame.lateThreadCommandBuffers);
+		}
+
+		if (depthPrepassEnabled)
+		{
+			allocateSecondaries(frame.prepassThreadCommandBuffers);
+			if (gpuCullingEnabled)
+			{
+				allocateSecondaries(frame.latePrepassThreadCommandBuffers);
+			}
+		}
+	}
+}
+
+void VulkanApplication::recordCommandBuffer(FrameResources& frame, uint32_t imageIndex)
+{
+	// Everything recorded from these pools last time round has finished executing
+	vkResetCommandPool(device, frame.commandPool, 0);
+	for (VkCommandPool threadPool : frame.threadCommandPools)
+	{
+		vkResetCommandPool(device, threadPool, 0);
+	}
+
+	// Split the draws between threads. With a GPU-supplied draw count, or multi-draw indirect,
+	// the whole scene is a single call and isn't worth splitting.
+	size_t drawCount;
+	if (gpuCullingEnabled)
+	{
+		drawCount = scene.getBatches().size();
+		if (cmdDrawIndexedIndirectCount || multiDrawIndirectSupported)
+		{
+			drawCount = std::min<size_t>(drawCount, 1);
+		}
+	}
+	else
+	{
+		drawCount = visibleBatches.size();
+	}
+
+	threadDrawStats.assign(frame.threadCommandBuffers.size(), DrawStats());
+
+	frame.secondaryCount = ParallelUtil::parallelForRanges(drawCount, frame.threadCommandBuffers.size(), minDrawsPerThread,
+		[this, &frame, imageIndex](size_t range, size_t begin, size_t end)
+	{
+		DrawStats& stats = threadDrawStats[range];
+		if (depthPrepassEnabled)
+		{
+			recordDraws(frame.prepassThreadCommandBuffers[range], frame, depthPrepassPass, imageIndex, CullPhaseEarly, true, begin, end, stats);
+		}
+		recordDraws(frame.threadCommandBuffers[range], frame, mainPass, imageIndex, CullPhaseEarly, false, begin, end, stats);
+
+		if (gpuCullingEnabled)
+		{
+			if (depthPrepassEnabled)
+			{
+				recordDraws(frame.latePrepassThreadCommandBuffers[range], frame, lateDepthPrepassPass, imageIndex, CullPhaseLate, true, begin, end, stats);
+			}
+			recordDraws(frame.lateThreadCommandBuffers[range], frame, lateMainPass, imageIndex, CullPhaseLate, false, begin, end, stats);
+		}
+	});
+
+	for (const DrawStats& stats : threadDrawStats)
+	{
+		drawStats.draws += stats.draws;
+		drawStats.binds += stats.binds;
+		drawStats.unsortedBinds += stats.unsortedBinds;
+	}
+
+	VkCommandBufferBeginInfo beginInfo = { };
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	// Recorded again next time this frame comes round
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+
+	vkBeginCommandBuffer(frame.commandBuffer, &beginInfo);
+
+	// Bracket the whole frame, so the time between covers everything it does on the GPU
+	if (dynamicResolutionEnabled)
+	{
+		vkCmdResetQueryPool(frame.commandBuffer, frame.timestampQueryPool, 0, 2);
+		vkCmdWriteTimestamp(frame.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestampQueryPool, 0);
+	}
+
+	if (depthPyramidNeedsClear)
+	{
+		recordDepthPyramidClear(frame.commandBuffer);
+		depthPyramidNeedsClear = false;
+	}
+
+	// Only does anything when a cascade was refit or static casters changed
+	recordStaticShadows(frame.commandBuffer, frame);
+
+	// Culling, shadows, drawing, the depth pyramid and upscaling, with the barriers and layout transitions between them
+	renderGraph.execute(frame.commandBuffer, imageIndex);
+
+	if (dynamicResolutionEnabled)
+	{
+		vkCmdWriteTimestamp(frame.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestampQueryPool, 1);
+		frame.timestampsWritten = true;
+	}
+
+	if (vkEndCommandBuffer(frame.commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Could not record command buffer");
+	}
+}
+
+void VulkanApplication::recordDraws(VkCommandBuffer commandBuffer, const FrameResources& frame, RenderPassId pass, uint32_t imageIndex,
+	CullPhase phase, bool depthOnly, size_t firstDraw, size_t lastDraw, DrawStats& outStats)
+{
+	// Secondaries inherit the render pass, but no other state
+	VkCommandBufferInheritanceInfo inheritanceInfo = { };
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderGraph.getRenderPass(pass);
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = renderGraph.getFramebuffer(pass, imageIndex);
+
+	VkCommandBufferBeginInfo beginInfo = { };
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	// Draw into the part of the scene image this frame's resolution covers
+	VkViewport viewport = { };
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(renderExtent.width);
+	viewport.height = static_cast<float>(renderExtent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = { };
+	scissor.offset = { 0, 0 };
+	scissor.extent = renderExtent;
+
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	// Every mesh lives in the same vertex / index buffers, and every instance in the same instance buffer.
+	// With GPU culling, only the instances that survived culling are read. Depth only reads positions.
+	VkBuffer vertexBuffers[] = { depthOnly ? positionBuffer : vertexBuffer, gpuCullingEnabled ? culledInstanceBuffer : frame.instanceBuffer };
+	VkPipeline pipeline = depthOnly ? depthPrepassPipeline : graphicsPipeline;
+	VkDeviceSize offsets[] = { 0, 0 };
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+	// The frame's set, and the bindless textures every material indexes into
+	VkDescriptorSet descriptorSets[] = { frame.descriptorSet, bindlessDescriptorSet };
+
+	// GPU culled draws come from buffers the CPU never sees, so state is bound once up front
+	if (gpuCullingEnabled && firstDraw != lastDraw)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 
+			0, 2, descriptorSets, 0, nullptr);
+		outStats.binds += 3;
+		outStats.unsortedBinds += 3;
+	}
+
+	// Each culling phase has its own batches, draw commands and count
+	uint32_t batchCount = static_cast<uint32_t>(scene.getBatches().size());
+	VkDeviceSize batchOffset = static_cast<VkDeviceSize>(phase) * batchCount * sizeof(GpuDrawBatch);
+	VkDeviceSize commandOffset = static_cast<VkDeviceSize>(phase) * batchCount * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize countOffset = static_cast<VkDeviceSize>(phase) * sizeof(uint32_t);
+
+	if (firstDraw == lastDraw)
+	{
+		// Nothing to draw
+	}
+	else if (gpuCullingEnabled && cmdDrawIndexedIndirectCount)
+	{
+		// Draws were compacted on the GPU; the GPU also supplies the count
+		cmdDrawIndexedIndirectCount(commandBuffer,
+			drawCommandBuffer, commandOffset,
+			drawCountBuffer, countOffset,
+			batchCount,
+			sizeof(VkDrawIndexedIndirectCommand));
+		outStats.draws++;
+	}
+	else if (gpuCullingEnabled && multiDrawIndirectSupported)
+	{
+		// One draw per batch. Batches with no visible instances draw nothing.
+		vkCmdDrawIndexedIndirect(commandBuffer, drawBatchBuffer, batchOffset, batchCount, sizeof(GpuDrawBatch));
+		outStats.draws++;
+	}
+	else if (gpuCullingEnabled)
+	{
+		for (size_t batch = firstDraw; batch < lastDraw; ++batch)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, drawBatchBuffer, batchOffset + batch * sizeof(GpuDrawBatch), 1, sizeof(GpuDrawBatch));
+		}
+		outStats.draws += lastDraw - firstDraw;
+	}
+	else
+	{
+		// One instanced draw per mesh / material batch, with only the visible instances. Draws are in
+		// sort key order, and state is only bound when a key field differs from the last draw's.
+		// Secondaries start with nothing bound, so the first draw binds everything.
+		uint64_t boundKey = 0;
+		for (size_t i = firstDraw; i < lastDraw; ++i)
+		{
+			uint64_t key = sortedDraws[i].key;
+			DrawBinds binds = getDrawBinds(key, boundKey, i == firstDraw);
+
+			// There's only the one pipeline per pass so far
+			if (binds.pipeline)
+			{
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			}
+
+			if (binds.descriptorSets)
+			{
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+					0, 2, descriptorSets, 0, nullptr);
+			}
+
+			if (binds.vertexBuffers)
+			{
+				vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+			}
+
+			outStats.binds += binds.count();
+			boundKey = key;
+
+			const DrawBatch& batch = visibleBatches[sortedDraws[i].index];
+			const MeshInfo& mesh = scene.getMesh(batch.mesh);
+			vkCmdDrawIndexed(commandBuffer,
+				mesh.indexCount,
+				batch.instanceCount,
+				mesh.firstIndex,
+				mesh.vertexOffset,
+				batch.firstInstance);
+			outStats.draws++;
+		}
+
+		// The same range of draws, with the same rules, in the order culling produced them
+		uint64_t unsortedBoundKey = 0;
+		for (size_t i = firstDraw; i < lastDraw; ++i)
+		{
+			outStats.unsortedBinds += getDrawBinds(drawKeys[i], unsortedBoundKey, i == firstDraw).count();
+			unsortedBoundKey = drawKeys[i];
+		}
+	}
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Could not record secondary command buffer");
+	}
+}
+
+VulkanApplication::DrawBinds VulkanApplication::getDrawBinds(uint64_t key, uint64_t boundKey, bool first)
+{
+	DrawBinds binds;
+	binds.pipeline = first || DrawSort::getPipeline(key) != DrawSort::getPipeline(boundKey);
+
+	// Materials pick their texture from the bindless set, so sets only change with the pipeline
+	binds.descriptorSets = binds.pipeline;
+
+	// Every mesh shares the vertex buffer, so a change of mesh alone doesn't need a rebind
+	binds.vertexBuffers = first;
+	return binds;
+}
+
+void VulkanApplication::initInstanceBuffer()
+{
+	// Leave headroom, so adding a few objects doesn't force a reallocation
+	instanceBufferCapacity = std::max<size_t>(scene.getInstances().size() * 2, 1024);
+
+	std::vector<uint32_t> queues = {
+static_cast<uint32_t>(queueIndices.graphics)
+	};
+
+	for (FrameResources& frame : frames)
+	{
+		if (!createVkBuffer(frame.instanceBuffer,
+			frame.instanceBufferMemory,
+			device,
+			physicalDevice,
+			instanceBufferCapacity * sizeof(InstanceData),
+			queues,
+			VK_SHARING_MODE_EXCLUSIVE,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		{
+			throw std::runtime_error("failed to create instance buffer");
+		}
+
+		// Stays mapped for the lifetime of the buffer
+		if (vkMapMemory(device, frame.instanceBufferMemory, 0, VK_WHOLE_SIZE, 0, &frame.instanceBufferMapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to map instance buffer");
+		}
+
+		// Filled in when the frame next comes round
+		frame.dirtyBegin = 0;
+		frame.dirtyEnd = static_cast<uint32_t>(scene.getInstances().size());
+
+		// Shadows draw every instance, whatever the camera sees, so they get their own copy
+		if (!createVkBuffer(frame.shadowInstanceBuffer,
+			frame.shadowInstanceBufferMemory,
+			device,
+			physicalDevice,
+			instanceBufferCapacity * sizeof(InstanceData),
+			queues,
+			VK_SHARING_MODE_EXCLUSIVE,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		{
+			throw std::runtime_error("failed to create shadow instance buffer");
+		}
+
+		if (vkMapMemory(device, frame.shadowInstanceBufferMemory, 0, VK_WHOLE_SIZE, 0, &frame.shadowInstanceBufferMapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to map shadow instance buffer");
+		}
+	}
+}
+
+void VulkanApplication::updateInstanceBuffer(FrameResources& frame)
+{
+	if (scene.updateBatches())
+	{
+		bool instancesGrew = scene.getInstances().size() > instanceBufferCapacity;
+		if (instancesGrew)
+		{
+			// Grow. The old buffers may still be read by in-flight frames.
+			for (FrameResources& retiredFrame : frames)
+			{
+				VkBuffer oldBuffer = retiredFrame.instanceBuffer;
+				VkDeviceMemory oldMemory = retiredFrame.instanceBufferMemory;
+				VkBuffer oldShadowBuffer = retiredFrame.shadowInstanceBuffer;
+				VkDeviceMemory oldShadowMemory = retiredFrame.shadowInstanceBufferMemory;
+				retireObject([this, oldBuffer, oldMemory, oldShadowBuffer, oldShadowMemory]()
+				{
+					vkDestroyBuffer(device, oldBuffer, nullptr);
+					vkFreeMemory(device, oldMemory, nullptr);
+					vkDestroyBuffer(device, oldShadowBuffer, nullptr);
+					vkFreeMemory(device, oldShadowMemory, nullptr);
+				});
+			}
+
+			initInstanceBuffer();
+		}
+
+		if (gpuCullingEnabled)
+		{
+			// Culling buffers are sized to match the instance buffer, and reference it
+			if (instancesGrew || scene.getBatches().size() > batchBufferCapacity)
+			{
+				retireCullBuffers();
+				initCullBuffers();
+			}
+
+			for (FrameResources& staleFrame : frames)
+			{
+				staleFrame.cullBatchesStale = true;
+			}
+		}
+
+		// Instances were reordered, so every frame's copy is out of date
+		for (FrameResources& staleFrame : frames)
+		{
+			staleFrame.dirtyBegin = 0;
+			staleFrame.dirtyEnd = static_cast<uint32_t>(scene.getInstances().size());
+		}
+		scene.clearDirtyInstances();
+	}
+
+	// CPU culling rewrites the visible part of the instance buffer every frame anyway
+	if (!gpuCullingEnabled)
+	{
+		scene.clearDirtyInstances();
+		return;
+	}
+
+	// Other frames' buffers may still be in use, so they catch up when their turn comes
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+	if (scene.getDirtyInstanceRange(firstInstance, instanceCount))
+	{
+		for (FrameResources& dirtyFrame : frames)
+		{
+			if (dirtyFrame.dirtyEnd <= dirtyFrame.dirtyBegin)
+			{
+				dirtyFrame.dirtyBegin = firstInstance;
+				dirtyFrame.dirtyEnd = firstInstance + instanceCount;
+			}
+			else
+			{
+				dirtyFrame.dirtyBegin = std::min(dirtyFrame.dirtyBegin, firstInstance);
+				dirtyFrame.dirtyEnd = std::max(dirtyFrame.dirtyEnd, firstInstance + instanceCount);
+			}
+		}
+
+		scene.clearDirtyInstances();
+	}
+
+	if (frame.dirtyBegin < frame.dirtyEnd)
+	{
+		memcpy(static_cast<InstanceData*>(frame.instanceBufferMapped) + frame.dirtyBegin,
+			scene.getInstances().data() + frame.dirtyBegin,
+			(frame.dirtyEnd - frame.dirtyBegin) * sizeof(InstanceData));
+
+		frame.dirtyBegin = 0;
+		frame.dirtyEnd = 0;
+	}
+
+	if (frame.cullBatchesStale)
+	{
+		writeCullBatches(frame);
+		frame.cullBatchesStale = false;
+	}
+
+	if (frame.cullPyramidStale)
+	{
+		writeCullPyramidDescriptor(frame);
+		frame.cullPyramidStale = false;
+	}
+}
+
+void VulkanApplication::initLightBuffers()
+{
+	lightBufferCapacity = std::max<size_t>(lights.size(), 1);
+
+	std::vector<uint32_t> queues = {
+static_cast<uint32_t>(queueIndices.graphics)
+	};
+
+	for (FrameResources& frame : frames)
+	{
+		if (!createVkBuffer(frame.lightBuffer,
+			frame.lightBufferMemory,
+			device,
+			physicalDevice,
+			lightBufferCapacity * sizeof(GpuLight),
+			queues,
+			VK_SHARING_MODE_EXCLUSIVE,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		{
+			throw std::runtime_error("failed to create light buffer");
+		}
+
+		// Stays mapped for the lifetime of the buffer
+		if (vkMapMemory(device, frame.lightBufferMemory, 0, VK_WHOLE_SIZE, 0, &frame.lightBufferMapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to map light buffer");
+		}
+
+		// Only ever touched by the GPU
+		if (!createVkBuffer(frame.clusterBuffer,
+			frame.clusterBufferMemory,
+			device,
+			physicalDevice,
+			ClusteredLighting::clusterBufferSize,
+			queues,
+			VK_SHARING_MODE_EXCLUSIVE,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+		{
+			throw std::runtime_error("failed to create cluster buffer");
+		}
+	}
+}
+
+void VulkanApplication::initLightBinPipeline()
+{
+	VkDescriptorSetLayoutBinding lightsBinding = { };
+	lightsBinding.binding = 0;
+	lightsBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	lightsBinding.descriptorCount = 1;
+	lightsBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutBinding clustersBinding = lightsBinding;
+	clustersBinding.binding = 1;
+
+	lightBinDescriptorSetLayout = descriptorAllocator.getLayout({ lightsBinding, clustersBinding });
+
+	VkPushConstantRange pushConstantRange = { };
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(LightBinPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = { };
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &lightBinDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &lightBinPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create light binning pipeline layout");
+	}
+
+	std::string errors;
+	if (!buildComputePipeline(lightBinningShaderPath, lightBinPipelineLayout, lightBinPipeline, errors))
+	{
+		throw std::runtime_error("Failed to create light binning pipeline!\n" + errors);
+	}
+}
+
+void VulkanApplication::updateLightBuffer(FrameResources& frame)
+{
+	// Lights past the buffer's capacity are left out
+	size_t lightCount = std::min(lights.size(), lightBufferCapacity);
+	if (lightCount > 0)
+	{
+		memcpy(frame.lightBufferMapped, lights.data(), lightCount * sizeof(GpuLight));
+	}
+	lightBinConstants.lightCount = static_cast<uint32_t>(lightCount);
+}
+
+void VulkanApplication::recordLightBinning(VkCommandBuffer commandBuffer, const FrameResources& frame)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightBinPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightBinPipelineLayout,
+		0, 1, &frame.lightBinDescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, lightBinPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+		0, sizeof(LightBinPushConstants), &lightBinConstants);
+	vkCmdDispatch(commandBuffer,
+		(ClusteredLighting::clusterCount + ClusteredLighting::binWorkgroupSize - 1) / ClusteredLighting::binWorkgroupSize, 1, 1);
+
+	// Fragment shaders in every later pass read the light lists
+	VkBufferMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = frame.clusterBuffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void VulkanApplication::loadSkinnedMeshes()
+{
+	// A tentacle: a thin square tube standing on the ground, bent by a chain of joints. There's a
+	// ring of vertices at each joint, moved by that joint alone, and one halfway between each pair,
+	// moved by both.
+	const uint32_t segmentCount = 6;
+	const uint32_t jointCount = segmentCount + 1;
+	const uint32_t ringCount = segmentCount * 2 + 1;
+	const float height = 0.6f;
+	const float halfWidth = 0.03f;
+	const float segmentLength = height / segmentCount;
+
+	std::vector<Vertex3D> vertices;
+	std::vector<SkinVertex> meshSkinVertices;
+	for (uint32_t ring = 0; ring < ringCount; ++ring)
+	{
+		float z = ring * segmentLength * 0.5f;
+		uint32_t joint = ring / 2;
+		bool between = ring % 2 == 1;
+
+		// Corners go counterclockwise seen from above, with normals pointing straight out of them
+		for (uint32_t corner = 0; corner < 4; ++corner)
+		{
+			float angle = glm::radians(45.0f + 90.0f * corner);
+			glm::vec3 normal(std::cos(angle), std::sin(angle), 0.0f);
+
+			Vertex3D vertex;
+			vertex.pos = normal * (halfWidth * std::sqrt(2.0f)) + glm::vec3(0.0f, 0.0f, z);
+			vertex.color = glm::vec3(1.0f);
+			vertex.texCoord = glm::vec2(corner / 4.0f, z / height);
+			vertex.normal = normal;
+			vertices.push_back(vertex);
+
+			SkinVertex skinVertex = { };
+			skinVertex.position = vertex.pos;
+			skinVertex.normal = normal;
+			skinVertex.joints = joint | ((between ? joint + 1 : joint) << 8);
+			skinVertex.weights = between ? glm::vec4(0.5f, 0.5f, 0.0f, 0.0f) : glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+			meshSkinVertices.push_back(skinVertex);
+		}
+	}
+
+	std::vector<uint32_t> indices;
+	for (uint32_t ring = 0; ring + 1 < ringCount; ++ring)
+	{
+		for (uint32_t corner = 0; corner < 4; ++corner)
+		{
+			uint32_t a = ring * 4 + corner;
+			uint32_t b = ring * 4 + (corner + 1) % 4;
+			uint32_t quad[] = { a, b, b + 4, b + 4, a + 4, a };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+
+	Skeleton skeleton;
+	for (uint32_t joint = 0; joint < jointCount; ++joint)
+	{
+		skeleton.parents.push_back(static_cast<int32_t>(joint) - 1);
+		skeleton.inverseBindMatrices.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -(joint * segmentLength))));
+	}
+
+	// Each joint sways in a circle, a little behind its parent, so waves run up the tentacle
+	const uint32_t keyCount = 17;
+	const float swayAngle = glm::radians(12.0f);
+
+	AnimationClip clip;
+	clip.jointCount = jointCount;
+	clip.duration = 2.0f;
+	for (uint32_t key = 0; key < keyCount; ++key)
+	{
+		clip.keyTimes.push_back(clip.duration * key / (keyCount - 1));
+	}
+
+	for (uint32_t joint = 0; joint < jointCount; ++joint)
+	{
+		for (uint32_t key = 0; key < keyCount; ++key)
+		{
+			float phase = glm::two_pi<float>() * key / (keyCount - 1) - joint * 0.6f;
+
+			JointPose pose;
+			pose.translation = glm::vec3(0.0f, 0.0f, joint > 0 ? segmentLength : 0.0f);
+			pose.rotation = joint > 0 ?
+				glm::angleAxis(swayAngle * std::sin(phase), glm::vec3(1.0f, 0.0f, 0.0f)) *
+				glm::angleAxis(swayAngle * std::cos(phase), glm::vec3(0.0f, 1.0f, 0.0f)) :
+				glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			pose.scale = glm::vec3(1.0f);
+			clip.keys.push_back(pose);
+		}
+	}
+
+	SkeletonId skeletonId = animation.addSkeleton(skeleton);
+	ClipId clipId = animation.addClip(clip);
+
+	uint32_t sourceFirstVertex = static_cast<uint32_t>(skinVertices.size());
+	skinVertices.insert(skinVertices.end(), meshSkinVertices.begin(), meshSkinVertices.end());
+
+	// However it bends, the tentacle can't reach further than its height from its base
+	Aabb bounds;
+	bounds.min = glm::vec3(-height, -height, 0.0f);
+	bounds.max = glm::vec3(height, height, height);
+
+	// A field of them on the ground, out of step with each other. Each is skinned into its own copy
+	// of the mesh, so each is its own batch.
+	const int gridSize = 16;
+	const float spacing = 0.25f;
+	for (int y = 0; y < gridSize; ++y)
+	{
+		for (int x = 0; x < gridSize; ++x)
+		{
+			MeshId mesh = scene.addMesh(vertices, indices);
+			scene.setMeshBounds(mesh, bounds);
+
+			glm::vec3 position((x - gridSize / 2 + 0.5f) * spacing, (y - gridSize / 2 + 0.5f) * spacing, -1.0f);
+			scene.addObject(mesh, 0, glm::translate(glm::mat4(1.0f), position));
+
+			AnimatedId animated = animation.addInstance(skeletonId, clipId, x * 0.37f + y * 0.61f, 1.0f);
+
+			GpuSkinnedInstance instance;
+			instance.sourceFirstVertex = sourceFirstVertex;
+			instance.vertexCount = static_cast<uint32_t>(vertices.size());
+			instance.outputFirstVertex = static_cast<uint32_t>(scene.getMesh(mesh).vertexOffset);
+			instance.firstJoint = animation.getFirstJoint(animated);
+			skinnedInstances.push_back(instance);
+
+			maxSkinnedVertexCount = std::max(maxSkinnedVertexCount, instance.vertexCount);
+		}
+	}
+}
+
+void VulkanApplication::initSkinning()
+{
+	// Bind poses and instances never change, so they're uploaded once. Buffers can't be empty.
+	SkinVertex noVertex = { };
+	GpuSkinnedInstance noInstance = { };
+
+	createDeviceBuffer(skinVertices.empty() ? &noVertex : skinVertices.data(),
+		std::max<size_t>(skinVertices.size(), 1) * sizeof(SkinVertex),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		skinVertexBuffer,
+		skinVertexBufferMemory);
+
+	createDeviceBuffer(skinnedInstances.empty() ? &noInstance : skinnedInstances.data(),
+		std::max<size_t>(skinnedInstances.size(), 1) * sizeof(GpuSkinnedInstance),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		skinnedInstanceBuffer,
+		skinnedInstanceBufferMemory);
+
+	std::vector<uint32_t> queues = {
+static_cast<uint32_t>(queueIndices.graphics)
+	};
+
+	for (FrameResources& frame : frames)
+	{
+		if (!createVkBuffer(frame.paletteBuffer,
+			frame.paletteBufferMemory,
+			device,
+			physicalDevice,
+			std::max<size_t>(animation.getJointCount(), 1) * sizeof(glm::mat4),
+			queues,
+			VK_SHARING_MODE_EXCLUSIVE,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		{
+			throw std::runtime_error("failed to create palette buffer");
+		}
+
+		// Stays mapped for the lifetime of the buffer
+		if (vkMapMemory(device, frame.paletteBufferMemory, 0, VK_WHOLE_SIZE, 0, &frame.paletteBufferMapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to map palette buffer");
+		}
+	}
+
+	// Skin vertices, instances, palette, then the vertex and position buffers written to
+	std::vector<VkDescriptorSetLayoutBinding> bindings(5);
+	for (uint32_t i = 0; i < bindings.size(); ++i)
+	{
+		bindings[i] = { };
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	skinningDescriptorSetLayout = descriptorAllocator.getLayout(bindings);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = { };
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &skinningDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &skinningPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create skinning pipeline layout");
+	}
+
+	std::string errors;
+	if (!buildComputePipeline(skinningShaderPath, skinningPipelineLayout, skinningPipeline, errors))
+	{
+		throw std::runtime_error("Failed to create skinning pipeline!\n" + errors);
+	}
+}
+
+void VulkanApplication::updateSkinning(FrameResources& frame)
+{
+	// Sampled into system memory first; joints read their parents' matrices back while sampling
+	animation.update(animationTime);
+
+	const std::vector<glm::mat4>& palette = animation.getPalette();
+	if (!palette.empty())
+	{
+		memcpy(frame.paletteBufferMapped, palette.data(), palette.size() * sizeof(glm::mat4));
+	}
+}
+
+void VulkanApplication::recordSkinning(VkCommandBuffer commandBuffer, const FrameResources& frame)
+{
+	if (skinnedInstances.empty())
+	{
+		return;
+	}
+
+	// The previous frame may still be drawing from the vertices about to be overwritten
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinningPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinningPipelineLayout,
+		0, 1, &frame.skinningDescriptorSet, 0, nullptr);
+	vkCmdDispatch(commandBuffer,
+		(maxSkinnedVertexCount + skinningWorkgroupSize - 1) / skinningWorkgroupSize,
+		static_cast<uint32_t>(skinnedInstances.size()),
+		1);
+
+	// Every later pass fetches the skinned vertices
+	VkBufferMemoryBarrier barriers[2] = { };
+	VkBuffer buffers[] = { vertexBuffer, positionBuffer };
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barriers[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barriers[i].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[i].buffer = buffers[i];
+		barriers[i].offset = 0;
+		barriers[i].size = VK_WHOLE_SIZE;
+	}
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		0, 0, nullptr, 2, barriers, 0, nullptr);
+}
+
+void VulkanApplication::initParticles()
+{
+	// Particles themselves start out as garbage; nothing reads a slot until it's emitted into
+	std::vector<uint32_t> queues = {
+static_cast<uint32_t>(queueIndices.graphics)
+	};
+
+	if (!createVkBuffer(particleBuffer,
+		particleBufferMemory,
+		device,
+		physicalDevice,
+		GpuParticles::capacity * sizeof(GpuParticle),
+		queues,
+		VK_SHARING_MODE_EXCLUSIVE,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+	{
+		throw std::runtime_error("failed to create particle buffer");
+	}
+
+	std::vector<uint32_t> indices = GpuParticles::getInitialIndices();
+	createDeviceBuffer(indices.data(),
+		GpuParticles::indexBufferSize,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		particleIndexBuffer,
+		particleIndexBufferMemory);
+
+	GpuParticleState state = GpuParticles::getInitialState();
+	createDeviceBuffer(&state,
+		sizeof(state),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		particleStateBuffer,
+		particleStateBufferMemory);
+
+	// Particles, indices, state, then the uniform buffer the draw reads the camera from
+	std::vector<VkDescriptorSetLayoutBinding> bindings(4);
+	for (uint32_t i = 0; i < bindings.size(); ++i)
+	{
+		bindings[i] = { };
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+	}
+	bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[3].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	particleDescriptorSetLayout = descriptorAllocator.getLayout(bindings);
+
+	VkPushConstantRange pushConstantRange = { };
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(ParticlePushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = { };
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &particleDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &particlePipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create particle pipeline layout");
+	}
+
+	std::string errors;
+	if (!buildComputePipeline(particleBeginShaderPath, particlePipelineLayout, particleBeginPipeline, errors) ||
+		!buildComputePipeline(particleEmitShaderPath, particlePipelineLayout, particleEmitPipeline, errors) ||
+		!buildComputePipeline(particleSimulateShaderPath, particlePipelineLayout, particleSimulatePipeline, errors))
+	{
+		throw std::runtime_error("Failed to create particle pipelines!\n" + errors);
+	}
+}
+
+bool VulkanApplication::buildParticlePipeline(VkPipeline& outPipeline, std::string& outErrors)
+{
+	VkShaderModule vertShaderModule;
+	VkShaderModule fragShaderModule;
+
+	if (!loadShaderModule(particleVertShaderPath, vertShaderModule, outErrors))
+	{
+		return false;
+	}
+
+	if (!loadShaderModule(particleFragShaderPath, fragShaderModule, outErrors))
+	{
+		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+		return false;
+	}
+
+	VkPipelineShaderStageCreateInfo shaderStages[2] = { };
+	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStages[0].module = vertShaderModule;
+	shaderStages[0].pName = "main";
+	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStages[1].module = fragShaderModule;
+	shaderStages[1].pName = "main";
+
+	// Quads are made from the vertex and instance index alone
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo = { };
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = { };
+	inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssemblyInfo.primitiveRestartEnable = false;
+
+	// Set to the dynamic resolution render extent when drawing, like the main pipeline
+	VkPipelineViewportStateCreateInfo viewportStateInfo = { };
+	viewportStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportStateInfo.viewportCount = 1;
+	viewportStateInfo.pViewports = nullptr;
+	viewportStateInfo.scissorCount = 1;
+	viewportStateInfo.pScissors = nullptr;
+
+	VkPipelineRasterizationStateCreateInfo rasterizerInfo = { };
+	rasterizerInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizerInfo.lineWidth = 1.0f;
+	rasterizerInfo.cullMode = VK_CULL_MODE_NONE;
+	rasterizerInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampleInfo = { };
+	multisampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampleInfo.minSampleShading = 1.0f;
+
+	// Hidden by the scene, but never by each other, so they needn't be sorted
+	VkPipelineDepthStencilStateCreateInfo depthStencil = { };
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = VK_FALSE;
+	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	depthStencil.minDepthBounds = 0.0f;
+	depthStencil.maxDepthBounds = 1.0f;
+
+	// Additive, which doesn't depend on draw order either
+	VkPipelineColorBlendAttachmentState colorBlendAttachmentInfo = { };
+	colorBlendAttachmentInfo.colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
+		VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT;
+	colorBlendAttachmentInfo.blendEnable = VK_TRUE;
+	colorBlendAttachmentInfo.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachmentInfo.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachmentInfo.colorBlendOp = VK_BLEND_OP_ADD;
+	colorBlendAttachmentInfo.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	colorBlendAttachmentInfo.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachmentInfo.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	VkPipelineColorBlendStateCreateInfo colorBlendingInfo = { };
+	colorBlendingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlendingInfo.logicOpEnable = VK_FALSE;
+	colorBlendingInfo.attachmentCount = 1;
+	colorBlendingInfo.pAttachments = &colorBlendAttachmentInfo;
+
+	VkDynamicState dynamicStates[] =
+	{
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR
+	};
+
+	VkPipelineDynamicStateCreateInfo dynamicStateInfo = { };
+	dynamicStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicStateInfo.dynamicStateCount = 2;
+	dynamicStateInfo.pDynamicStates = dynamicStates;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = { };
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = shaderStages;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
+	pipelineInfo.pViewportState = &viewportStateInfo;
+	pipelineInfo.pRasterizationState = &rasterizerInfo;
+	pipelineInfo.pMultisampleState = &multisampleInfo;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlendingInfo;
+	pipelineInfo.pDynamicState = &dynamicStateInfo;
+	pipelineInfo.layout = particlePipelineLayout;
+	pipelineInfo.renderPass = renderGraph.getRenderPass(particlePass);
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &outPipeline);
+
+	vkDestroyShaderModule(device, vertShaderModule, nullptr);
+	vkDestroyShaderModule(device, fragShaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		outErrors = "vkCreateGraphicsPipelines failed";
+		return false;
+	}
+
+	return true;
+}
+
+void VulkanApplication::updateParticles()
+{
+	// A fountain in the middle of the quad grid, falling onto the ground
+	gpuParticles.update(animationTime, glm::vec3(0.0f, 0.0f, 0.05f));
+}
+
+void VulkanApplication::recordParticleSimulation(VkCommandBuffer commandBuffer, const FrameResources& frame)
+{
+	const ParticlePushConstants& constants = gpuParticles.getPushConstants();
+
+	// The previous frame's draw may still be reading the lists and arguments about to be rewritten
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particlePipelineLayout,
+		0, 1, &frame.particleDescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, particlePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT,
+		0, sizeof(ParticlePushConstants), &constants);
+
+	// Every step reads what the one before wrote, and the dispatches read the arguments it wrote
+	VkMemoryBarrier stepBarrier = { };
+	stepBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	stepBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	stepBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleBeginPipeline);
+	vkCmdDispatch(commandBuffer, 1, 1, 1);
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &stepBarrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleEmitPipeline);
+	vkCmdDispatchIndirect(commandBuffer, particleStateBuffer, offsetof(GpuParticleState, emitGroups));
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &stepBarrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleSimulatePipeline);
+	vkCmdDispatchIndirect(commandBuffer, particleStateBuffer, offsetof(GpuParticleState, simulateGroups));
+
+	// The draw reads its instance count, the survivors and their particles
+	VkMemoryBarrier drawBarrier = { };
+	drawBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+		0, 1, &drawBarrier, 0, nullptr, 0, nullptr);
+}
+
+void VulkanApplication::recordParticles(VkCommandBuffer commandBuffer, const FrameResources& frame)
+{
+	const ParticlePushConstants& constants = gpuParticles.getPushConstants();
+
+	VkViewport viewport = { };
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(renderExtent.width);
+	viewport.height = static_cast<float>(renderExtent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = { };
+	scissor.offset = { 0, 0 };
+	scissor.extent = renderExtent;
+
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particlePipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particlePipelineLayout,
+		0, 1, &frame.particleDescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, particlePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT,
+		0, sizeof(ParticlePushConstants), &constants);
+
+	// One instance per survivor, counted by simulation
+	vkCmdDrawIndirect(commandBuffer, particleStateBuffer, offsetof(GpuParticleState, drawArgs), 1, sizeof(VkDrawIndirectCommand));
+}
+
+void VulkanApplication::initSprites()
+{
+	// A few shapes drawn procedurally into the atlas: a soft disc, a ring, a diamond and a square
+	// outline. White, so sprite colors tint them.
+	const uint32_t shapeSize = 32;
+	const uint32_t shapeCount = 4;
+
+	SpriteAtlas atlas(256, 256);
+	std::vector<uint32_t> shape(shapeSize * shapeSize);
+	for (uint32_t kind = 0; kind < shapeCount; ++kind)
+	{
+		for (uint32_t y = 0; y < shapeSize; ++y)
+		{
+			for (uint32_t x = 0; x < shapeSize; ++x)
+			{
+				// Pixel center, from -1 to 1 across the shape
+				glm::vec2 p = (glm::vec2(static_cast<float>(x), static_cast<float>(y)) + 0.5f) / (shapeSize * 0.5f) - 1.0f;
+				float radius = glm::length(p);
+				float box = std::max(std::abs(p.x), std::abs(p.y));
+
+				float coverage = 0.0f;
+				switch (kind)
+				{
+				case 0: coverage = 1.0f - radius; break;
+				case 1: coverage = 1.0f - std::abs(radius - 0.75f) * 8.0f; break;
+				case 2: coverage = (1.0f - std::abs(p.x) - std::abs(p.y)) * 8.0f; break;
+				default: coverage = 1.0f - std::abs(box - 0.85f) * 10.0f; break;
+				}
+
+				shape[y * shapeSize + x] = SpriteBatch::packColor(glm::vec4(1.0f, 1.0f, 1.0f, std::min(std::max(coverage, 0.0f), 1.0f)));
+			}
+		}
+
+		spriteShapes.push_back(atlas.getUvRect(atlas.add(shape.data(), shapeSize, shapeSize)));
+	}
+
+	uploadTexture(atlas.getPixels().data(), atlas.getWidth(), atlas.getHeight(),
+		spriteAtlasImage, spriteAtlasImageMemory, spriteAtlasImageView);
+	setMaterialTexture(spriteAtlasTextureSlot, spriteAtlasImageView);
+
+	std::vector<uint32_t> queues = {
+static_cast<uint32_t>(queueIndices.graphics)
+	};
+
+	for (FrameResources& frame : frames)
+	{
+		if (!createVkBuffer(frame.spriteBuffer,
+			frame.spriteBufferMemory,
+			device,
+			physicalDevice,
+			maxSpritesPerFrame * sizeof(GpuSprite),
+			queues,
+			VK_SHARING_MODE_EXCLUSIVE,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		{
+			throw std::runtime_error("failed to create sprite buffer");
+		}
+
+		// Stays mapped for the lifetime of the buffer
+		if (vkMapMemory(device, frame.spriteBufferMemory, 0, VK_WHOLE_SIZE, 0, &frame.spriteBufferMapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to map sprite buffer");
+		}
+	}
+
+	// Set 0 is the sampler, set 1 the bindless textures. The texture and screen size are push constants.
+	VkDescriptorSetLayoutBinding samplerBinding = { };
+	samplerBinding.binding = 0;
+	samplerBinding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	samplerBinding.descriptorCount = 1;
+	samplerBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	spriteDescriptorSetLayout = descriptorAllocator.getLayout({ samplerBinding });
+
+	VkPushConstantRange pushConstantRange = { };
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(SpritePushConstants);
+
+	VkDescriptorSetLayout setLayouts[] = { spriteDescriptorSetLayout, bindlessDescriptorSetLayout };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = { };
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 2;
+	pipelineLayoutInfo.pSetLayouts = setLayouts;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &spritePipelineLayout) != VK_SUCCESS)
 	{
-		throw std::runtime_error("Could not create transfer command pool");
+		throw std::runtime_error("Failed to create sprite pipeline layout");
 	}
 }
 
-void VulkanApplication::initVertexBuffers()
+bool VulkanApplication::buildSpritePipeline(VkPipeline& outPipeline, std::string& outErrors)
 {
-	// Allow both graphics and transfer queues to access this buffer.
-	// If we used the graphics queue for both ops, you'd use exclusive mode.
-	std::vector<uint32_t> vertexQueues = {
+	VkShaderModule vertShaderModule;
+	VkShaderModule fragShaderModule;
+
+	if (!loadShaderModule(spriteVertShaderPath, vertShaderModule, outErrors))
+	{
+		return false;
+	}
+
+	if (!loadShaderModule(spriteFragShaderPath, fragShaderModule, outErrors))
+	{
+		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+		return false;
+	}
+
+	// Constant 0 sizes the bindless texture array to match its descriptor set layout
+	VkSpecializationMapEntry textureCapacityEntry = { };
+	textureCapacityEntry.constantID = 0;
+	textureCapacityEntry.offset = 0;
+	textureCapacityEntry.size = sizeof(uint32_t);
+
+	VkSpecializationInfo fragSpecializationInfo = { };
+	fragSpecializationInfo.mapEntryCount = 1;
+	fragSpecializationInfo.pMapEntries = &textureCapacityEntry;
+	fragSpecializationInfo.dataSize = sizeof(uint32_t);
+	fragSpecializationInfo.pData = &bindlessTextureCapacity;
+
+	VkPipelineShaderStageCreateInfo shaderStages[2] = { };
+	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStages[0].module = vertShaderModule;
+	shaderStages[0].pName = "main";
+	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStages[1].module = fragShaderModule;
+	shaderStages[1].pName = "main";
+	shaderStages[1].pSpecializationInfo = &fragSpecializationInfo;
+
+	// Every attribute is per instance; corners come from the vertex index
+	VkVertexInputBindingDescription bindingDescription = VulkanUtil::getSpriteBindingDescription();
+	std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions = VulkanUtil::getSpriteAttributeDescriptions();
+
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo = { };
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputInfo.vertexBindingDescriptionCount = 1;
+	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = { };
+	inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssemblyInfo.primitiveRestartEnable = false;
+
+	// Always the whole backbuffer, and rebuilt with the swapchain
+	VkViewport viewport = { };
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)swapchainExtent.width;
+	viewport.height = (float)swapchainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = { };
+	scissor.offset = { 0,0 };
+	scissor.extent = swapchainExtent;
+
+	VkPipelineViewportStateCreateInfo viewportStateInfo = { };
+	viewportStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportStateInfo.viewportCount = 1;
+	viewportStateInfo.pViewports = &viewport;
+	viewportStateInfo.scissorCount = 1;
+	viewportStateInfo.pScissors = &scissor;
+
+	VkPipelineRasterizationStateCreateInfo rasterizerInfo = { };
+	rasterizerInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizerInfo.lineWidth = 1.0f;
+	rasterizerInfo.cullMode = VK_CULL_MODE_NONE;
+	rasterizerInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampleInfo = { };
+	multisampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampleInfo.minSampleShading = 1.0f;
+
+	// No depth; sprites are drawn in the order they're sorted in, alpha blended over what's below
+	VkPipelineColorBlendAttachmentState colorBlendAttachmentInfo = { };
+	colorBlendAttachmentInfo.colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
+		VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT |
+		VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachmentInfo.blendEnable = VK_TRUE;
+	colorBlendAttachmentInfo.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	colorBlendAttachmentInfo.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	colorBlendAttachmentInfo.colorBlendOp = VK_BLEND_OP_ADD;
+	colorBlendAttachmentInfo.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachmentInfo.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	colorBlendAttachmentInfo.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	VkPipelineColorBlendStateCreateInfo colorBlendingInfo = { };
+	colorBlendingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlendingInfo.logicOpEnable = VK_FALSE;
+	colorBlendingInfo.attachmentCount = 1;
+	colorBlendingInfo.pAttachments = &colorBlendAttachmentInfo;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = { };
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = shaderStages;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
+	pipelineInfo.pViewportState = &viewportStateInfo;
+	pipelineInfo.pRasterizationState = &rasterizerInfo;
+	pipelineInfo.pMultisampleState = &multisampleInfo;
+	pipelineInfo.pDepthStencilState = nullptr;
+	pipelineInfo.pColorBlendState = &colorBlendingInfo;
+	pipelineInfo.pDynamicState = nullptr;
+	pipelineInfo.layout = spritePipelineLayout;
+	pipelineInfo.renderPass = renderGraph.getRenderPass(spritePass);
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &outPipeline);
+
+	vkDestroyShaderModule(device, vertShaderModule, nullptr);
+	vkDestroyShaderModule(device, fragShaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		outErrors = "vkCreateGraphicsPipelines failed";
+		return false;
+	}
+
+	return true;
+}
+
+void VulkanApplication::updateSprites(FrameResources& frame)
+{
+	spriteBatch.clear();
+
+	float width = static_cast<float>(swapchainExtent.width);
+	float height = static_cast<float>(swapchainExtent.height);
+
+	// A swarm of small shapes drifting over the screen, in the bottom layer. Each sprite's phases,
+	// speeds and color are fixed fractions picked from its index.
+	for (uint32_t i = 0; i < swarmSpriteCount; ++i)
+	{
+		float u = std::fmod(i * 0.6180340f, 1.0f);
+		float v = std::fmod(i * 0.4142136f, 1.0f);
+		float w = std::fmod(i * 0.7320508f, 1.0f);
+
+		glm::vec2 position(
+			(0.5f + 0.48f * std::sin(animationTime * (0.1f + 0.2f * u) + glm::two_pi<float>() * v)) * width,
+			(0.5f + 0.48f * std::cos(animationTime * (0.1f + 0.2f * v) + glm::two_pi<float>() * w)) * height);
+		glm::vec4 color(0.5f + 0.5f * u, 0.5f + 0.5f * v, 0.5f + 0.5f * w, 0.6f);
+
+		spriteBatch.add(position, glm::vec2(4.0f + 6.0f * w), animationTime * (u - 0.5f) * 4.0f,
+			spriteShapes[i % spriteShapes.size()], SpriteBatch::packColor(color), spriteAtlasTextureSlot, 0);
+	}
+
+	// A row of cards showing the statue texture over the swarm, each with a frame from the atlas on top
+	const uint32_t cardCount = 8;
+	const float cardSize = 64.0f;
+	uint32_t white = SpriteBatch::packColor(glm::vec4(1.0f));
+	for (uint32_t i = 0; i < cardCount; ++i)
+	{
+		glm::vec2 position((i + 0.5f) * width / cardCount, height - cardSize);
+		float rotation = 0.1f * std::sin(animationTime + i);
+		spriteBatch.add(position, glm::vec2(cardSize), rotation, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), white, 0, 1);
+		spriteBatch.add(position, glm::vec2(cardSize * 1.1f), rotation, spriteShapes[3], white, spriteAtlasTextureSlot, 2);
+	}
+
+	spriteBatch.build(static_cast<GpuSprite*>(frame.spriteBufferMapped), maxSpritesPerFrame);
+}
+
+void VulkanApplication::recordSprites(VkCommandBuffer commandBuffer, const FrameResources& frame)
+{
+	DescriptorWrite write = { };
+	write.binding = 0;
+	write.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+	write.image.sampler = textureImageSampler;
+
+	VkDescriptorSet descriptorSets[] = { descriptorAllocator.getSet(spriteDescriptorSetLayout, { write }), bindlessDescriptorSet };
+
+	VkDeviceSize offset = 0;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, spritePipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, spritePipelineLayout, 0, 2, descriptorSets, 0, nullptr);
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &frame.spriteBuffer, &offset);
+
+	SpritePushConstants constants;
+	constants.screenScale = glm::vec2(2.0f / swapchainExtent.width, 2.0f / swapchainExtent.height);
+
+	// One draw per run of sprites sharing a texture, however many sprites are in it
+	for (const SpriteDrawRun& run : spriteBatch.getRuns())
+	{
+		constants.textureSlot = run.texture;
+		vkCmdPushConstants(commandBuffer, spritePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+			0, sizeof(constants), &constants);
+		vkCmdDraw(commandBuffer, 6, run.instanceCount, 0, run.firstInstance);
+	}
+}
+
+void VulkanApplication::createDeviceBuffer(const void* data, size_t size, VkBufferUsageFlags usage, VkBuffer& outBuffer, VkDeviceMemory& outMemory)
+{
+	// Filled on the transfer queue, used on the graphics queue
+	std::vector<uint32_t> queues = {
 static_cast<uint32_t>(queueIndices.graphics),
 static_cast<uint32_t>(queueIndices.transfer)
 	};
-	vertexBufferSize = sizeof(vertices[0]) * vertices.size();
 
-	if (!createVkBuffer(vertexBuffer,
-		vertexBufferMemory,
+	if (!createVkBuffer(outBuffer,
+		outMemory,
 		device,
 		physicalDevice,
-		vertexBufferSize,
-		vertexQueues,
+		size,
+		queues,
 		VK_SHARING_MODE_CONCURRENT,
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
 	{
-		throw std::runtime_error("failed to create vertex buffer");
+		throw std::runtime_error("failed to create device buffer");
 	}
 
-	std::vector<uint32_t> vertexStagingQueues = {
-static_cast<uint32_t>(queueIndices.transfer)
-	};
-	vertexStagingBufferSize = sizeof(vertices[0]) * vertices.size();
-
-	if (!createVkBuffer(vertexStagingBuffer,
-		vertexStagingMemory,
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingMemory;
+	if (!createVkBuffer(stagingBuffer,
+		stagingMemory,
 		device,
 		physicalDevice,
-		vertexStagingBufferSize,
-		vertexStagingQueues,
-		VK_SHARING_MODE_EXCLUSIVE,
+		size,
+		queues,
+		VK_SHARING_MODE_CONCURRENT,
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
 	{
-		throw std::runtime_error("failed to create vertex staging buffer");
+		throw std::runtime_error("failed to create staging buffer");
+	}
+
+	void* mapped;
+	vkMapMemory(device, stagingMemory, 0, static_cast<VkDeviceSize>(size), 0, &mapped);
+	memcpy(mapped, data, size);
+	vkUnmapMemory(device, stagingMemory);
+
+	bool copied = copyBuffer(stagingBuffer, outBuffer, size);
+
+	vkDestroyBuffer(device, stagingBuffer, nullptr);
+	vkFreeMemory(device, stagingMemory, nullptr);
+
+	if (!copied)
+	{
+		throw std::runtime_error("failed to fill device buffer");
 	}
 }
 
-void VulkanApplication::initIndexBuffers()
-{		
-	// Allow both graphics and transfer queues to access this buffer.
-	// If we used the graphics queue for both ops, you'd use exclusive mode.
-	std::vector<uint32_t> indexQueues = {
-static_cast<uint32_t>(queueIndices.graphics),
-static_cast<uint32_t>(queueIndices.transfer)
+void VulkanApplication::initCullPipelines()
+{
+	// Binding layout is shared by both culling shaders; each uses a subset
+	std::array<VkDescriptorSetLayoutBinding, 9> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); ++i)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[i].pImmutableSamplers = nullptr;
+	}
+	// Camera matrices come from the main UBO
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[7].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER; // Depth pyramid
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = { };
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &cullDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create culling descriptor set layout");
+	}
+
+	// One set per frame, plus room for retired sets, which live on until in-flight frames finish
+	uint32_t maxCullSets = 4 * maxFramesInFlight;
+	std::array<VkDescriptorPoolSize, 3> poolSizes;
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = maxCullSets;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = maxCullSets * 7;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[2].descriptorCount = maxCullSets;
+
+	VkDescriptorPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = maxCullSets;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &cullDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create culling descriptor pool");
+	}
+
+	// Element counts and the culling phase go in push constants
+	VkPushConstantRange pushConstantRange = { };
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = { };
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &cullDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create culling pipeline layout");
+	}
+
+	// Depth pyramid downsampling reads one level and writes the next
+	std::array<VkDescriptorSetLayoutBinding, 2> pyramidBindings = {};
+	pyramidBindings[0].binding = 0;
+	pyramidBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	pyramidBindings[0].descriptorCount = 1;
+	pyramidBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pyramidBindings[1].binding = 1;
+	pyramidBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	pyramidBindings[1].descriptorCount = 1;
+	pyramidBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	layoutInfo.bindingCount = static_cast<uint32_t>(pyramidBindings.size());
+	layoutInfo.pBindings = pyramidBindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &depthPyramidDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid descriptor set layout");
+	}
+
+	pipelineLayoutInfo.pSetLayouts = &depthPyramidDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = nullptr;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &depthPyramidPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid pipeline layout");
+	}
+
+	// Pyramid texels are read exactly, never filtered
+	VkSamplerCreateInfo samplerInfo = { };
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.anisotropyEnable = VK_FALSE;
+	samplerInfo.maxAnisotropy = 1.0f;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = static_cast<float>(maxDepthPyramidLevels);
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &depthPyramidSampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid sampler");
+	}
+
+	std::string errors;
+	if (!buildComputePipeline(cullInstancesShaderPath, cullPipelineLayout, cullPipeline, errors) ||
+		!buildComputePipeline(compactDrawsShaderPath, cullPipelineLayout, compactDrawsPipeline, errors) ||
+		!buildComputePipeline(depthPyramidShaderPath, depthPyramidPipelineLayout, depthPyramidPipeline, errors))
+	{
+		throw std::runtime_error("Failed to create culling pipelines!\n" + errors);
+	}
+}
+
+bool VulkanApplication::buildComputePipeline(const std::string& path, VkPipelineLayout layout, VkPipeline& outPipeline, std::string& outErrors)
+{
+	VkShaderModule shaderModule;
+	if (!loadShaderModule(path, shaderModule, outErrors))
+	{
+		return false;
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo = { };
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = layout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &outPipeline);
+
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		outErrors = "vkCreateComputePipelines failed for " + path;
+		return false;
+	}
+
+	return true;
+}
+
+void VulkanApplication::initCullBuffers()
+{
+	batchBufferCapacity = std::max<size_t>(scene.getBatches().size() * 2, 64);
+
+	std::vector<uint32_t> queues = {
+static_cast<uint32_t>(queueIndices.graphics)
 	};
-	indexBufferSize = sizeof(indices[0]) * indices.size();
 
-	if (!createVkBuffer(indexBuffer,
-		indexBufferMemory,
+	// GPU-written outputs. Batches, draw commands and counts are kept per culling phase.
+	if (!createVkBuffer(drawBatchBuffer,
+		drawBatchBufferMemory,
+		device,
+		physicalDevice,
+		CullPhaseCount * batchBufferCapacity * sizeof(GpuDrawBatch),
+		queues,
+		VK_SHARING_MODE_EXCLUSIVE,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+	{
+		throw std::runtime_error("failed to create draw batch buffer");
+	}
+
+	if (!createVkBuffer(drawCommandBuffer,
+		drawCommandBufferMemory,
+		device,
+		physicalDevice,
+		CullPhaseCount * batchBufferCapacity * sizeof(VkDrawIndexedIndirectCommand),
+		queues,
+		VK_SHARING_MODE_EXCLUSIVE,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+	{
+		throw std::runtime_error("failed to create draw command buffer");
+	}
+
+	if (!createVkBuffer(drawCountBuffer,
+		drawCountBufferMemory,
 		device,
 		physicalDevice,
-		indexBufferSize,
-		indexQueues,
-		VK_SHARING_MODE_CONCURRENT,
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		CullPhaseCount * sizeof(uint32_t),
+		queues,
+		VK_SHARING_MODE_EXCLUSIVE,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
 	{
-		throw std::runtime_error("failed to create index buffer");
+		throw std::runtime_error("failed to create draw count buffer");
 	}
 
-	std::vector<uint32_t> indexStagingQueues = {
-static_cast<uint32_t>(queueIndices.transfer)
-	};
-	indexStagingBufferSize = sizeof(indices[0]) * indices.size();
+	if (!createVkBuffer(culledInstanceBuffer,
+		culledInstanceBufferMemory,
+		device,
+		physicalDevice,
+		instanceBufferCapacity * sizeof(InstanceData),
+		queues,
+		VK_SHARING_MODE_EXCLUSIVE,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+	{
+		throw std::runtime_error("failed to create culled instance buffer");
+	}
 
-	if (!createVkBuffer(indexStagingBuffer,
-		indexStagingMemory,
+	if (!createVkBuffer(occlusionStateBuffer,
+		occlusionStateBufferMemory,
 		device,
 		physicalDevice,
-		indexStagingBufferSize,
-		indexStagingQueues,
+		instanceBufferCapacity * sizeof(uint32_t),
+		queues,
 		VK_SHARING_MODE_EXCLUSIVE,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
 	{
-		throw std::runtime_error("failed to create index staging buffer");
+		throw std::runtime_error("failed to create occlusion state buffer");
 	}
-}
 
-void VulkanApplication::loadModel()
-{
-	/*
-		std::string path = "Content/Models/chalet.obj";
-		if (!ObjUtil::loadObj(path, vertices, indices))
+	// CPU-written inputs, one copy per frame so a frame in flight never sees them change
+	for (FrameResources& frame : frames)
+	{
+		if (!createVkBuffer(frame.batchBuffer,
+			frame.batchBufferMemory,
+			device,
+			physicalDevice,
+			batchBufferCapacity * sizeof(GpuDrawBatch),
+			queues,
+			VK_SHARING_MODE_EXCLUSIVE,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ||
+			vkMapMemory(device, frame.batchBufferMemory, 0, VK_WHOLE_SIZE, 0, &frame.batchBufferMapped) != VK_SUCCESS)
 		{
-			throw std::runtime_error("Failed to load model at path: " + path);
+			throw std::runtime_error("failed to create culling batch buffer");
 		}
-	*/
 
-	vertices = {
-{{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
-{{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
-{{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
-{{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}},
+		if (!createVkBuffer(frame.instanceBatchBuffer,
+			frame.instanceBatchBufferMemory,
+			device,
+			physicalDevice,
+			instanceBufferCapacity * sizeof(uint32_t),
+			queues,
+			VK_SHARING_MODE_EXCLUSIVE,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ||
+			vkMapMemory(device, frame.instanceBatchBufferMemory, 0, VK_WHOLE_SIZE, 0, &frame.instanceBatchBufferMapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create culling instance batch buffer");
+		}
 
-{{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
-{{0.5f, -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
-{{0.5f, 0.5f, -0.5f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
-{{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}}
-	};
+		frame.cullBatchesStale = true;
+		frame.cullPyramidStale = true;
 
-	indices = {
-0, 1, 2, 2, 3, 0,
-4, 5, 6, 6, 7, 4
-	};
+		VkDescriptorSetAllocateInfo allocInfo = { };
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = cullDescriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &cullDescriptorSetLayout;
 
-}
+		if (vkAllocateDescriptorSets(device, &allocInfo, &frame.cullDescriptorSet) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate culling descriptor set");
+		}
 
-#pragma optimize("gtsy", off)
-void VulkanApplication::fillIndexBuffer()
-{
-	void* data;
-	std::cout << "DOING!!" << std::endl;
-	// Transfer to staging memory first:
-	vkMapMemory(device, indexStagingMemory, 0, 
-		static_cast<VkDeviceSize>(indexStagingBufferSize), 0, &data);
+		std::array<VkDescriptorBufferInfo, 8> bufferInfos = {};
+		bufferInfos[0] = { frame.uniformBuffer, 0, sizeof(UniformBufferObject) };
+		bufferInfos[1] = { frame.instanceBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[2] = { frame.instanceBatchBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[3] = { drawBatchBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[4] = { culledInstanceBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[5] = { drawCommandBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[6] = { drawCountBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[7] = { occlusionStateBuffer, 0, VK_WHOLE_SIZE };
+
+		// Binding 7, the depth pyramid, is written separately since it changes with the swapchain
+		std::array<VkWriteDescriptorSet, 8> descriptorWrites = {};
+		for (uint32_t i = 0; i < descriptorWrites.size(); ++i)
+		{
+			descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[i].dstSet = frame.cullDescriptorSet;
+			descriptorWrites[i].dstBinding = i < 7 ? i : i + 1;
+			descriptorWrites[i].dstArrayElement = 0;
+			descriptorWrites[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[i].descriptorCount = 1;
+			descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+		}
 
-	memcpy(data, indices.data(), indexStagingBufferSize);
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+}
 
-	// Note: For some type of memory, you would need to call vkFlushMappedMemoryRanges after writing,
-	// to ensure the write makes it to the device. This isn't necessery because we specified the 
-	// COHERENT bit. 
-	//
-	// Similarly, if reading memory, you would need to call vkInvalidateMappedMemoryRanges before
-	// reading, if the memory is not coherent.
+void VulkanApplication::writeCullPyramidDescriptor(FrameResources& frame)
+{
+	VkDescriptorImageInfo imageInfo = { };
+	imageInfo.sampler = depthPyramidSampler;
+	imageInfo.imageView = depthPyramidView;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-	vkUnmapMemory(device, indexStagingMemory);
+	VkWriteDescriptorSet descriptorWrite = { };
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = frame.cullDescriptorSet;
+	descriptorWrite.dstBinding = 7;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pImageInfo = &imageInfo;
 
-	// Copy into device memory
-	assert(copyBuffer(indexStagingBuffer, indexBuffer, indexStagingBufferSize));
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
 }
-#pragma optimize("gtsy", on)
 
-#pragma optimize("gtsy", off)
-void VulkanApplication::fillVertexBuffer()
+void VulkanApplication::initDepthPyramid()
 {
-	void* data;
-	std::cout << "BOING!!" << std::endl;
-	// Transfer to staging memory first:
-	vkMapMemory(device, vertexStagingMemory, 0, static_cast<VkDeviceSize>(vertexStagingBufferSize), 0, &data);
+	// Level 0 is half the swapchain, so each of its texels covers a 2x2 block of depth
+	depthPyramidExtent.width = std::max(1u, swapchainExtent.width / 2);
+	depthPyramidExtent.height = std::max(1u, swapchainExtent.height / 2);
 
-	memcpy(data, vertices.data(), vertexStagingBufferSize);
+	uint32_t levelCount = 0;
+	while ((std::max(depthPyramidExtent.width, depthPyramidExtent.height) >> levelCount) > 0 &&
+		levelCount < maxDepthPyramidLevels)
+	{
+		levelCount++;
+	}
 
-	// Note: For some type of memory, you would need to call vkFlushMappedMemoryRanges after writing,
-	// to ensure the write makes it to the device. This isn't necessery because we specified the 
-	// COHERENT bit. 
-	//
-	// Similarly, if reading memory, you would need to call vkInvalidateMappedMemoryRanges before
-	// reading, if the memory is not coherent.	
+	VkImage image;
+	VkDeviceMemory memory;
+	if (!createVkImage(image,
+		memory,
+		device,
+		physicalDevice,
+		depthPyramidExtent.width,
+		depthPyramidExtent.height,
+		VK_FORMAT_R32_SFLOAT,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		levelCount))
+	{
+		throw std::runtime_error("Failed to create depth pyramid");
+	}
+	depthPyramid.reset(device, image);
+	depthPyramidMemory.reset(device, memory);
 
-	vkUnmapMemory(device, vertexStagingMemory);
+	VkImageView view;
+	if (!createVkImageView(depthPyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, view, 0, levelCount))
+	{
+		throw std::runtime_error("Failed to create depth pyramid view");
+	}
+	depthPyramidView.reset(device, view);
 
-	// Copy into device memory
-	assert(copyBuffer(vertexStagingBuffer, vertexBuffer, vertexStagingBufferSize));
+	// Each level is written through its own view
+	depthPyramidLevelViews.resize(levelCount);
+	for (uint32_t level = 0; level < levelCount; ++level)
+	{
+		if (!createVkImageView(depthPyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, view, level, 1))
+		{
+			throw std::runtime_error("Failed to create depth pyramid level view");
+		}
+		depthPyramidLevelViews[level].reset(device, view);
+	}
+
+	// One set per level. The old pyramid's pool is retired with it, since its sets may still be in use.
+	std::array<VkDescriptorPoolSize, 2> poolSizes;
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = maxDepthPyramidLevels;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = maxDepthPyramidLevels;
+
+	VkDescriptorPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = 0;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = maxDepthPyramidLevels;
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid descriptor pool");
+	}
+	depthPyramidDescriptorPool.reset(device, pool);
+
+	// Cleared in the next frame's command buffer rather than a submit of its own, which would mean
+	// waiting for the queue
+	depthPyramidNeedsClear = true;
 }
-#pragma optimize("gtsy", on)
 
-void VulkanApplication::initCommandBuffers()
+void VulkanApplication::recordDepthPyramidClear(VkCommandBuffer commandBuffer)
 {
-	commandBuffers.resize(swapchainFramebuffers.size());
+	VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, static_cast<uint32_t>(depthPyramidLevelViews.size()), 0, 1 };
 
-	VkCommandBufferAllocateInfo allocInfo = { };
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = graphicsCommandPool;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+	VkImageMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = depthPyramid;
+	barrier.subresourceRange = range;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkClearColorValue farDepth = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+	vkCmdClearColorImage(commandBuffer, depthPyramid, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &farDepth, 1, &range);
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void VulkanApplication::writeDepthPyramidDescriptors(VkImageView depthView)
+{
+	uint32_t levelCount = static_cast<uint32_t>(depthPyramidLevelViews.size());
+
+	std::vector<VkDescriptorSetLayout> layouts(levelCount, depthPyramidDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = depthPyramidDescriptorPool;
+	allocInfo.descriptorSetCount = levelCount;
+	allocInfo.pSetLayouts = layouts.data();
 
-	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+	depthPyramidDescriptorSets.resize(levelCount);
+	if (vkAllocateDescriptorSets(device, &allocInfo, depthPyramidDescriptorSets.data()) != VK_SUCCESS)
 	{
-		throw std::runtime_error("Could not allocate command buffers");
+		throw std::runtime_error("Failed to allocate depth pyramid descriptor sets");
 	}
 
-	for (size_t i = 0; i < commandBuffers.size(); ++i)
+	for (uint32_t level = 0; level < levelCount; ++level)
 	{
-		VkCommandBufferBeginInfo beginInfo = { };
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		// Indicates that CB may be used while pending execution - i.e., submitting draw commands
-		// while previous frame is still drawing		
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		beginInfo.pInheritanceInfo = nullptr;
-
-		// Reset the buffer
-		vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+		// Level 0 reduces the depth buffer, every other level the one above it
+		VkDescriptorImageInfo sourceInfo = { };
+		sourceInfo.sampler = depthPyramidSampler;
+		if (level == 0)
+		{
+			sourceInfo.imageView = depthView;
+			sourceInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		}
+		else
+		{
+			sourceInfo.imageView = depthPyramidLevelViews[level - 1];
+			sourceInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		}
 
-		VkRenderPassBeginInfo renderPassInfo = { };
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapchainFramebuffers[i];
+		VkDescriptorImageInfo destinationInfo = { };
+		destinationInfo.imageView = depthPyramidLevelViews[level];
+		destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = depthPyramidDescriptorSets[level];
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].pImageInfo = &sourceInfo;
+
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = depthPyramidDescriptorSets[level];
+		descriptorWrites[1].dstBinding = 1;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].pImageInfo = &destinationInfo;
+
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+}
 
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = swapchainExtent;
+void VulkanApplication::destroyDepthPyramid()
+{
+	// Destroying the pool frees its sets
+	retireObject(std::move(depthPyramidDescriptorPool));
+	depthPyramidDescriptorSets.clear();
 
-		std::array<VkClearValue, 2> clearValues = {};
-		clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-		clearValues[1].depthStencil = { 1.0f, 0 };
-		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-		renderPassInfo.pClearValues = clearValues.data();
+	for (UniqueImageView& view : depthPyramidLevelViews)
+	{
+		retireObject(std::move(view));
+	}
+	depthPyramidLevelViews.clear();
 
-		// VULKAN COMMANDS
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	retireObject(std::move(depthPyramidView));
+	retireObject(std::move(depthPyramid));
+	retireObject(std::move(depthPyramidMemory));
+}
 
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+void VulkanApplication::recordDepthPyramid(VkCommandBuffer commandBuffer)
+{
+	// The render graph has already put the whole pyramid in GENERAL and the depth buffer in
+	// SHADER_READ_ONLY_OPTIMAL. Only the dependencies between levels are left to handle.
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipeline);
 
-		VkBuffer vertexBuffers[] = { vertexBuffer };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 
-			0, 1, &descriptorSet, 0, nullptr);
+	for (uint32_t level = 0; level < depthPyramidDescriptorSets.size(); ++level)
+	{
+		uint32_t width = std::max(1u, depthPyramidExtent.width >> level);
+		uint32_t height = std::max(1u, depthPyramidExtent.height >> level);
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipelineLayout,
+			0, 1, &depthPyramidDescriptorSets[level], 0, nullptr);
+		vkCmdDispatch(commandBuffer,
+			(width + depthPyramidWorkgroupSize - 1) / depthPyramidWorkgroupSize,
+			(height + depthPyramidWorkgroupSize - 1) / depthPyramidWorkgroupSize,
+			1);
+
+		// The next level reads this one
+		VkImageMemoryBarrier barrier = { };
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = depthPyramid;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+}
 
-		// Draw contents of vertex buffer
-		// vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
-		
-		// Draw using index buffer
-		vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+void VulkanApplication::retireCullBuffers()
+{
+	std::vector<std::pair<VkBuffer, VkDeviceMemory>> buffers = {
+{ drawBatchBuffer, drawBatchBufferMemory },
+{ drawCommandBuffer, drawCommandBufferMemory },
+{ drawCountBuffer, drawCountBufferMemory },
+{ culledInstanceBuffer, culledInstanceBufferMemory },
+{ occlusionStateBuffer, occlusionStateBufferMemory }
+	};
+	std::vector<VkDescriptorSet> oldSets;
 
-		vkCmdEndRenderPass(commandBuffers[i]);
-		// END VULKAN COMMANDS
+	for (const FrameResources& frame : frames)
+	{
+		buffers.push_back({ frame.batchBuffer, frame.batchBufferMemory });
+		buffers.push_back({ frame.instanceBatchBuffer, frame.instanceBatchBufferMemory });
+		oldSets.push_back(frame.cullDescriptorSet);
+	}
 
-		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
+	retireObject([this, buffers, oldSets]()
+	{
+		vkFreeDescriptorSets(device, cullDescriptorPool, static_cast<uint32_t>(oldSets.size()), oldSets.data());
+		for (const auto& buffer : buffers)
 		{
-			throw std::runtime_error("Could not record command buffer");
+			vkDestroyBuffer(device, buffer.first, nullptr);
+			vkFreeMemory(device, buffer.second, nullptr);
 		}
+	});
+}
+
+void VulkanApplication::writeCullBatches(FrameResources& frame)
+{
+	// instanceCount starts at zero; the culling shader counts visible instances into it
+	GpuDrawBatch* gpuBatches = static_cast<GpuDrawBatch*>(frame.batchBufferMapped);
+	const std::vector<DrawBatch>& batches = scene.getBatches();
+	for (size_t i = 0; i < batches.size(); ++i)
+	{
+		const MeshInfo& mesh = scene.getMesh(batches[i].mesh);
+
+		GpuDrawBatch gpuBatch = { };
+		gpuBatch.indexCount = mesh.indexCount;
+		gpuBatch.instanceCount = 0;
+		gpuBatch.firstIndex = mesh.firstIndex;
+		gpuBatch.vertexOffset = mesh.vertexOffset;
+		gpuBatch.firstInstance = batches[i].firstInstance;
+		gpuBatch.boundingSphere = mesh.boundingSphere;
+		gpuBatches[i] = gpuBatch;
 	}
+
+	const std::vector<uint32_t>& instanceBatches = scene.getInstanceBatches();
+	memcpy(frame.instanceBatchBufferMapped, instanceBatches.data(), instanceBatches.size() * sizeof(uint32_t));
 }
 
-void VulkanApplication::initDepthResources()
+void VulkanApplication::recordGpuCulling(VkCommandBuffer commandBuffer, const FrameResources& frame, CullPhase phase)
 {
+	CullPushConstants constants;
+	constants.instanceCount = static_cast<uint32_t>(scene.getInstances().size());
+	constants.batchCount = static_cast<uint32_t>(scene.getBatches().size());
+	constants.phase = phase;
+	// The depth pyramid only covers the rendered part of the depth buffer: last frame's for the
+	// early phase, this frame's for the late phase. The rest holds cleared depth, so is never occluding.
+	const VkExtent2D& pyramidRenderExtent = phase == CullPhaseEarly ? previousRenderExtent : renderExtent;
+	constants.screenWidth = pyramidRenderExtent.width;
+	constants.screenHeight = pyramidRenderExtent.height;
+
+	if (constants.batchCount == 0)
+	{
+		return;
+	}
+
+	if (phase == CullPhaseEarly)
+	{
+		// Reset per-batch instance counts and the draw counts for both phases. The previous
+		// frame's indirect reads must finish before these are overwritten.
+		VkMemoryBarrier resetBarrier = { };
+		resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		resetBarrier.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		resetBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &resetBarrier, 0, nullptr, 0, nullptr);
+
+		// Each phase gets its own copy of the batches
+		std::array<VkBufferCopy, CullPhaseCount> copyRegions;
+		for (uint32_t i = 0; i < CullPhaseCount; ++i)
+		{
+			copyRegions[i].srcOffset = 0;
+			copyRegions[i].dstOffset = i * constants.batchCount * sizeof(GpuDrawBatch);
+			copyRegions[i].size = constants.batchCount * sizeof(GpuDrawBatch);
+		}
+		vkCmdCopyBuffer(commandBuffer, frame.batchBuffer, drawBatchBuffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+		vkCmdFillBuffer(commandBuffer, drawCountBuffer, 0, CullPhaseCount * sizeof(uint32_t), 0);
+
+		VkMemoryBarrier transferBarrier = { };
+		transferBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		transferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		transferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &transferBarrier, 0, nullptr, 0, nullptr);
+	}
+	else
+	{
+		// The late phase reads the early phase's occlusion states and batch counts
+		VkMemoryBarrier earlyBarrier = { };
+		earlyBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		earlyBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		earlyBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &earlyBarrier, 0, nullptr, 0, nullptr);
+	}
 
-	// 32-bit depth and 8-bit stencil. Tutorial has code for selecting based on device caps;
-	// I'm skipping for now	
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout,
+		0, 1, &frame.cullDescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+
+	// Cull instances, counting visible ones per batch
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdDispatch(commandBuffer, (constants.instanceCount + cullWorkgroupSize - 1) / cullWorkgroupSize, 1, 1);
+
+	VkMemoryBarrier cullBarrier = { };
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+	// Pack non-empty batches into draw commands
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compactDrawsPipeline);
+	vkCmdDispatch(commandBuffer, (constants.batchCount + cullWorkgroupSize - 1) / cullWorkgroupSize, 1, 1);
+
+	// Draws read the commands, count and culled instances
+	VkMemoryBarrier drawBarrier = { };
+	drawBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		0, 1, &drawBarrier, 0, nullptr, 0, nullptr);
+}
 
-	if (!createVkImage(
-		depthImage,
-		depthMemory,
-		device,
-		physicalDevice,
-		swapchainExtent.width,
-		swapchainExtent.height,
-		depthImageFormat,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-	))
+void VulkanApplication::cullInstancesCpu(FrameResources& frame)
+{
+	Frustum frustum = Frustum::fromMatrix(cullMatrix);
+	FrustumCulling::cullSpheresParallel(frustum, scene.getInstanceBounds(), visibleInstances);
+
+	// Occluders are drawn with this frame's camera, so results are never a frame late
+	if (softwareOcclusionEnabled && !occluders.empty())
 	{
-		throw std::runtime_error("Failed to create depth buffer image");
+		softwareOcclusion.beginFrame();
+		for (const std::pair<ObjectId, OccluderMeshId>& occluder : occluders)
+		{
+			softwareOcclusion.addOccluder(occluder.second, scene.getTransform(occluder.first));
+		}
+		softwareOcclusion.render(cullMatrix);
+		softwareOcclusion.removeOccluded(scene.getInstanceBounds(), visibleInstances);
 	}
 
-	if (!createVkImageView(depthImage, depthImageFormat, VK_IMAGE_ASPECT_DEPTH_BIT, depthImageView))
+	// Visible indices come out sorted, so instances of a batch stay together
+	const std::vector<InstanceData>& instances = scene.getInstances();
+	const std::vector<uint32_t>& instanceBatches = scene.getInstanceBatches();
+	const std::vector<DrawBatch>& batches = scene.getBatches();
+	InstanceData* mapped = static_cast<InstanceData*>(frame.instanceBufferMapped);
+
+	visibleBatches.clear();
+	uint32_t currentBatch = 0xFFFFFFFF;
+	for (uint32_t i = 0; i < visibleInstances.size(); ++i)
 	{
-		throw std::runtime_error("Failed to create depth buffer image view");
+		uint32_t instance = visibleInstances[i];
+		if (instanceBatches[instance] != currentBatch)
+		{
+			currentBatch = instanceBatches[instance];
+
+			DrawBatch batch = batches[currentBatch];
+			batch.firstInstance = i;
+			batch.instanceCount = 0;
+			visibleBatches.push_back(batch);
+		}
+
+		visibleBatches.back().instanceCount++;
+		mapped[i] = instances[instance];
 	}
+}
 
-	if (!transitionImageLayout(
-		depthImage,
-		depthImageFormat,
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-		0,
-		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
-	))
+void VulkanApplication::sortDraws()
+{
+	const std::vector<InstanceData>& instances = scene.getInstances();
+
+	sortedDraws.resize(visibleBatches.size());
+	drawKeys.resize(visibleBatches.size());
+	for (uint32_t i = 0; i < visibleBatches.size(); ++i)
 	{
-		throw std::runtime_error("Depth image transition failed!");
+		const DrawBatch& batch = visibleBatches[i];
+
+		// Clip w is the distance along the view direction. glm is column-major, so w is row 3.
+		float nearestDepth = cameraFar;
+		for (uint32_t j = batch.firstInstance; j < batch.firstInstance + batch.instanceCount; ++j)
+		{
+			const glm::vec4& position = instances[visibleInstances[j]].model[3];
+			float depth = cullMatrix[0][3] * position.x + cullMatrix[1][3] * position.y +
+				cullMatrix[2][3] * position.z + cullMatrix[3][3] * position.w;
+			nearestDepth = std::min(nearestDepth, depth);
+		}
+
+		// One pass and pipeline for now
+		sortedDraws[i].key = DrawSort::makeKey(0, 0, batch.mesh,
+			DrawSort::getDepthBucket(nearestDepth, cameraNear, cameraFar));
+		sortedDraws[i].index = i;
+		drawKeys[i] = sortedDraws[i].key;
 	}
+
+	DrawSort::radixSort(sortedDraws, sortScratch);
 }
 
 void VulkanApplication::initSynchro()
@@ -1013,10 +4573,23 @@ void VulkanApplication::initSynchro()
 	VkSemaphoreCreateInfo semInfo = { };
 	semInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	if (vkCreateSemaphore(device, &semInfo, nullptr, &imageAvailableSem) != VK_SUCCESS ||
-		vkCreateSemaphore(device, &semInfo, nullptr, &renderFinishedSem) != VK_SUCCESS)
+	// Fences start signaled, so waiting on a frame that was never submitted returns immediately
+	VkFenceCreateInfo fenceInfo = { };
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (FrameResources& frame : frames)
 	{
-		throw std::runtime_error("Failed to create semaphores");
+		if (vkCreateSemaphore(device, &semInfo, nullptr, &frame.imageAvailableSem) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semInfo, nullptr, &frame.renderFinishedSem) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create semaphores");
+		}
+
+		if (vkCreateFence(device, &fenceInfo, nullptr, &frame.inFlightFence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create fences");
+		}
 	}
 }
 
@@ -1027,22 +4600,24 @@ void VulkanApplication::initUniformBuffer()
 	std::vector<uint32_t> queues = {
 static_cast<uint32_t>(queueIndices.graphics)
 	};
-	uinformBufferSize = sizeof(UniformBufferObject);
-
-	// Host will write to uniform buffer directly, as we expect it to change vert often
-	bool result = createVkBuffer(uniformBuffer,
-		uniformBufferMemory,
-		device,
-		physicalDevice,
-		uinformBufferSize,
-		queues,
-		VK_SHARING_MODE_EXCLUSIVE,
-		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-	if (!result)
+	for (FrameResources& frame : frames)
 	{
-		throw std::runtime_error("failed to create uniform buffer");
+		// Host will write to uniform buffer directly, as we expect it to change vert often
+		bool result = createVkBuffer(frame.uniformBuffer,
+			frame.uniformBufferMemory,
+			device,
+			physicalDevice,
+			bufferSize,
+			queues,
+			VK_SHARING_MODE_EXCLUSIVE,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		if (!result || vkMapMemory(device, frame.uniformBufferMemory, 0, bufferSize, 0, &frame.uniformBufferMapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create uniform buffer");
+		}
 	}
 }
 
@@ -1054,110 +4629,306 @@ void VulkanApplication::initDescriptorSetLayout()
 	uboLayoutBinding.binding = 0;
 	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT; // Fragments read the cluster parameters
 	uboLayoutBinding.pImmutableSamplers = nullptr;
 
+	// Textures themselves are in the bindless set; they all share this sampler
 	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
 	samplerLayoutBinding.binding = 1;
 	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
 	samplerLayoutBinding.pImmutableSamplers = nullptr;
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, samplerLayoutBinding };
+	// Lights, and each cluster's list of them, for clustered lighting
+	VkDescriptorSetLayoutBinding lightsLayoutBinding = { };
+	lightsLayoutBinding.binding = 2;
+	lightsLayoutBinding.descriptorCount = 1;
+	lightsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	lightsLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutBinding clustersLayoutBinding = lightsLayoutBinding;
+	clustersLayoutBinding.binding = 3;
+
+	// The frame's shadow atlas, with its compare sampler
+	VkDescriptorSetLayoutBinding shadowMapLayoutBinding = { };
+	shadowMapLayoutBinding.binding = 4;
+	shadowMapLayoutBinding.descriptorCount = 1;
+	shadowMapLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	shadowMapLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, samplerLayoutBinding, lightsLayoutBinding, clustersLayoutBinding,
+		shadowMapLayoutBinding };
+
+	descriptorSetLayout = descriptorAllocator.getLayout(bindings);
+}
+
+void VulkanApplication::initBindlessTextures()
+{
+	// Stay within what one shader stage and one set may hold
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	bindlessTextureCapacity = std::min(maxBindlessTextures, std::min(
+		deviceProperties.limits.maxPerStageDescriptorSampledImages,
+		deviceProperties.limits.maxDescriptorSetSampledImages));
+
+	// Update-after-bind sets have limits of their own
+	if (descriptorIndexingSupported)
+	{
+		PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)
+			vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+
+		VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = { };
+		indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+		VkPhysicalDeviceProperties2KHR properties2 = { };
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+		properties2.pNext = &indexingProperties;
+		getProperties2(physicalDevice, &properties2);
+
+		bindlessTextureCapacity = std::min(maxBindlessTextures, std::min(
+			indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+			indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages));
+	}
+
+	bindlessTextureViews.assign(bindlessTextureCapacity, VK_NULL_HANDLE);
+
+	VkDescriptorSetLayoutBinding textureBinding = { };
+	textureBinding.binding = 0;
+	textureBinding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	textureBinding.descriptorCount = bindlessTextureCapacity;
+	textureBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// Slots without a texture are fine as long as no draw reads them, and slots can be written
+	// while command buffers using the set are pending
+	VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+		VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = { };
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	bindingFlagsInfo.bindingCount = 1;
+	bindingFlagsInfo.pBindingFlags = &bindingFlags;
 
 	VkDescriptorSetLayoutCreateInfo layoutInfo = { };
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-	layoutInfo.pBindings = bindings.data();
-
-	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &textureBinding;
+	if (descriptorIndexingSupported)
 	{
-		throw std::runtime_error("Failed to created descriptor set layout");
+		layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+		layoutInfo.pNext = &bindingFlagsInfo;
 	}
-}
 
-void VulkanApplication::initDescriptorPool()
-{
-	std::array <VkDescriptorPoolSize, 2> poolSizes;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &bindlessDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create bindless texture descriptor set layout");
+	}
 
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = 1;
-	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = 1;
+	VkDescriptorPoolSize poolSize = { };
+	poolSize.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	poolSize.descriptorCount = bindlessTextureCapacity;
 
 	VkDescriptorPoolCreateInfo poolInfo = { };
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
 	poolInfo.maxSets = 1;
+	if (descriptorIndexingSupported)
+	{
+		poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+	}
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &bindlessDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create bindless texture descriptor pool");
+	}
+
+	// One set for the whole run, shared by every frame
+	VkDescriptorSetAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = bindlessDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &bindlessDescriptorSetLayout;
+
+	if (vkAllocateDescriptorSets(device, &allocInfo, &bindlessDescriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate bindless texture descriptor set");
+	}
+}
+
+void VulkanApplication::setMaterialTexture(MaterialId material, VkImageView view)
+{
+	if (material >= bindlessTextureCapacity)
+	{
+		throw std::runtime_error("VulkanApplication::setMaterialTexture -- material is beyond the bindless texture capacity");
+	}
+
+	// Without partial binding, the whole array must be valid before it's first used. Empty slots
+	// get this texture as a placeholder until their material's texture is set.
+	bool fillEmpty = !descriptorIndexingSupported;
+
+	std::vector<uint32_t> slots;
+	for (uint32_t slot = 0; slot < bindlessTextureCapacity; ++slot)
+	{
+		if (slot == material || (fillEmpty && bindlessTextureViews[slot] == VK_NULL_HANDLE))
+		{
+			slots.push_back(slot);
+			bindlessTextureViews[slot] = view;
+		}
+	}
+
+	VkDescriptorImageInfo imageInfo = { };
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfo.imageView = view;
+	imageInfo.sampler = VK_NULL_HANDLE;
 
-	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+	std::vector<VkWriteDescriptorSet> descriptorWrites(slots.size());
+	for (size_t i = 0; i < slots.size(); ++i)
 	{
-		throw std::runtime_error("failed to create descriptor pool");
+		descriptorWrites[i] = { };
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = bindlessDescriptorSet;
+		descriptorWrites[i].dstBinding = 0;
+		descriptorWrites[i].dstArrayElement = slots[i];
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pImageInfo = &imageInfo;
 	}
+
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
-void VulkanApplication::initDescriptorSet()
+void VulkanApplication::updateFrameDescriptors(FrameResources& frame)
 {
-	VkDescriptorSetLayout layouts[] = { descriptorSetLayout };
-	VkDescriptorSetAllocateInfo allocInfo = { };
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = layouts;
+	// Sets from the last time this frame came round are done with, so its pools can be reset
+	descriptorAllocator.beginFrame(currentFrame);
+
+	std::vector<DescriptorWrite> writes(5);
+
+	writes[0] = { };
+	writes[0].binding = 0;
+	writes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	writes[0].buffer.buffer = frame.uniformBuffer;
+	writes[0].buffer.offset = 0;
+	writes[0].buffer.range = sizeof(UniformBufferObject);
+
+	writes[1] = { };
+	writes[1].binding = 1;
+	writes[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+	writes[1].image.sampler = textureImageSampler;
+
+	writes[2] = { };
+	writes[2].binding = 2;
+	writes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writes[2].buffer.buffer = frame.lightBuffer;
+	writes[2].buffer.offset = 0;
+	writes[2].buffer.range = VK_WHOLE_SIZE;
+
+	writes[3] = { };
+	writes[3].binding = 3;
+	writes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writes[3].buffer.buffer = frame.clusterBuffer;
+	writes[3].buffer.offset = 0;
+	writes[3].buffer.range = VK_WHOLE_SIZE;
+
+	// The render graph has put the shadow map in SHADER_READ_ONLY_OPTIMAL by the time the main passes run
+	writes[4] = { };
+	writes[4].binding = 4;
+	writes[4].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[4].image.sampler = shadowSampler;
+	writes[4].image.imageView = renderGraph.getImageView(shadowMap, 0);
+	writes[4].image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	// Textures are in the bindless set
+	frame.descriptorSet = descriptorAllocator.getSet(descriptorSetLayout, writes);
+
+	// Binning writes the same buffers the frame's draws read
+	std::vector<DescriptorWrite> lightBinWrites = { writes[2], writes[3] };
+	lightBinWrites[0].binding = 0;
+	lightBinWrites[1].binding = 1;
+	frame.lightBinDescriptorSet = descriptorAllocator.getSet(lightBinDescriptorSetLayout, lightBinWrites);
+
+	std::vector<DescriptorWrite> skinningWrites(5);
+	VkBuffer skinningBuffers[] = { skinVertexBuffer, skinnedInstanceBuffer, frame.paletteBuffer, vertexBuffer, positionBuffer };
+	for (uint32_t i = 0; i < skinningWrites.size(); ++i)
+	{
+		skinningWrites[i] = { };
+		skinningWrites[i].binding = i;
+		skinningWrites[i].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		skinningWrites[i].buffer.buffer = skinningBuffers[i];
+		skinningWrites[i].buffer.offset = 0;
+		skinningWrites[i].buffer.range = VK_WHOLE_SIZE;
+	}
+	frame.skinningDescriptorSet = descriptorAllocator.getSet(skinningDescriptorSetLayout, skinningWrites);
 
-	// descriptor set is automatically cleand up with descriptor pool
-	if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
+	// Particle buffers are shared by every frame; only the uniform buffer is the frame's own
+	std::vector<DescriptorWrite> particleWrites(4);
+	VkBuffer particleBuffers[] = { particleBuffer, particleIndexBuffer, particleStateBuffer };
+	for (uint32_t i = 0; i < 3; ++i)
 	{
-		throw std::runtime_error("failed to created descriptor set");
+		particleWrites[i] = { };
+		particleWrites[i].binding = i;
+		particleWrites[i].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		particleWrites[i].buffer.buffer = particleBuffers[i];
+		particleWrites[i].buffer.offset = 0;
+		particleWrites[i].buffer.range = VK_WHOLE_SIZE;
 	}
+	particleWrites[3] = writes[0];
+	particleWrites[3].binding = 3;
+	frame.particleDescriptorSet = descriptorAllocator.getSet(particleDescriptorSetLayout, particleWrites);
+}
 
-	// Configure descriptors contained in set:
-	
-	VkDescriptorBufferInfo bufferInfo = { };
-	bufferInfo.buffer = uniformBuffer;
-	bufferInfo.offset = 0;
-	bufferInfo.range = sizeof(UniformBufferObject);
+void VulkanApplication::createTextureImage()
+{
+	// Rethrows if the image failed to load
+	JobSystem::getDefault().wait(textureLoads);
+	uploadTexture(statueImage->data(), static_cast<uint32_t>(statueImage->width), static_cast<uint32_t>(statueImage->height),
+		textureImage, textureImageMemory, textureImageView);
+	statueImage.reset();
 
-	VkDescriptorImageInfo imageInfo = {};
-	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	imageInfo.imageView = textureImageView;
-	imageInfo.sampler = textureImageSampler;
+	// Create a sampler for the texture:
 
-	std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+	VkSamplerCreateInfo samplerInfo = { };
 	
-	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[0].dstSet = descriptorSet;
-	descriptorWrites[0].dstBinding = 0;
-	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[0].descriptorCount = 1;
-	descriptorWrites[0].pBufferInfo = &bufferInfo;
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+
+	// Mag is for oversampled textures -- more fragments than texels
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	// Min is for undersampled textures -- more texels than fragments
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+
+	// How to sample image if dimensions are exceeded
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+	// Anisotropic filtering settings are easy :)
+	samplerInfo.anisotropyEnable = VK_TRUE;
+	samplerInfo.maxAnisotropy = 16;
+
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
 	
-	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[1].dstSet = descriptorSet;
-	descriptorWrites[1].dstBinding = 1;
-	descriptorWrites[1].dstArrayElement = 0;
-	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptorWrites[1].descriptorCount = 1;
-	descriptorWrites[1].pImageInfo = &imageInfo;
-
-	vkUpdateDescriptorSets(
-		device,
-		static_cast<uint32_t>(descriptorWrites.size()),
-		descriptorWrites.data(),
-		0,
-		nullptr
-	);
+	// If false, coordinates are normalized; they must go [0, 1)
+	samplerInfo.unnormalizedCoordinates = VK_FALSE; 
+
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.mipLodBias = 0.0f;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = 0.0f;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &textureImageSampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Could not create texture image sampler");
+	}
 }
 
-void VulkanApplication::createTextureImage()
+void VulkanApplication::uploadTexture(const void* pixels, uint32_t width, uint32_t height, VkImage& outImage, VkDeviceMemory& outMemory, VkImageView& outView)
 {
-	STB_RGBA_Image image("Content/Textures/statue.jpg");
-	// size_t textureStagingBufferSize = image.width * image.height * image.components;
 	// Multiply by 4 for rgba
-	size_t textureStagingBufferSize = image.width * image.height * 4;
+	size_t textureStagingBufferSize = static_cast<size_t>(width) * height * 4;
 	VkBuffer textureStagingBuffer;
 	VkDeviceMemory textureStagingMemory;
 
@@ -1178,12 +4949,12 @@ static_cast<uint32_t>(queueIndices.transfer)
 		throw std::runtime_error("Failed to create texture staging buffer");
 	}
 	
-	if (!createVkImage(textureImage,
-		textureImageMemory,
+	if (!createVkImage(outImage,
+		outMemory,
 		device,
 		physicalDevice,
-		image.width,
-		image.height,
+		width,
+		height,
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
@@ -1199,11 +4970,11 @@ static_cast<uint32_t>(queueIndices.transfer)
 		assert(false && "Failed to map vulkan memory");
 	}
 
-	memcpy(data, image.data(), textureStagingBufferSize);
+	memcpy(data, pixels, textureStagingBufferSize);
 	vkUnmapMemory(device, textureStagingMemory);
 
 	if (!transitionImageLayout(
-		textureImage,
+		outImage,
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_LAYOUT_UNDEFINED,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
@@ -1218,9 +4989,9 @@ static_cast<uint32_t>(queueIndices.transfer)
 
 	if (!copyBufferToImage(
 		textureStagingBuffer,
-		textureImage,
-		static_cast<uint32_t>(image.width),
-		static_cast<uint32_t>(image.height)
+		outImage,
+		width,
+		height
 	))
 	{
 		throw std::runtime_error("Failed to copy buffer to image");
@@ -1228,7 +4999,7 @@ static_cast<uint32_t>(queueIndices.transfer)
 
 	// transition layout for use with shader:
 	if (!transitionImageLayout(
-		textureImage,
+		outImage,
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
@@ -1246,89 +5017,105 @@ static_cast<uint32_t>(queueIndices.transfer)
 	vkFreeMemory(device, textureStagingMemory, nullptr);
 
 	// Create the image view:
-	if (!createVkImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, textureImageView))
+	if (!createVkImageView(outImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, outView))
 	{
 		throw std::runtime_error("Could not create texture image view");
 	}
+}
 
-	// Create a sampler for the texture:
-
-	VkSamplerCreateInfo samplerInfo = { };
-	
-	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-
-	// Mag is for oversampled textures -- more fragments than texels
-	samplerInfo.magFilter = VK_FILTER_LINEAR;
-	// Min is for undersampled textures -- more texels than fragments
-	samplerInfo.minFilter = VK_FILTER_LINEAR;
-
-	// How to sample image if dimensions are exceeded
-	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-
-	// Anisotropic filtering settings are easy :)
-	samplerInfo.anisotropyEnable = VK_TRUE;
-	samplerInfo.maxAnisotropy = 16;
-
-	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-	
-	// If false, coordinates are normalized; they must go [0, 1)
-	samplerInfo.unnormalizedCoordinates = VK_FALSE; 
-
-	samplerInfo.compareEnable = VK_FALSE;
-	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+void VulkanApplication::recreateSwapchain()
+{
+	// Frames in flight keep using the old objects, which are retired rather than destroyed, so
+	// nothing here waits for the device
+	VkSwapchainKHR oldSwapchain = swapchain;
+	cleanupSwapchain();
 
-	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-	samplerInfo.mipLodBias = 0.0f;
-	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = 0.0f;
+	// Call everything that depends on swapchain or image size
+	initSwapchain(oldSwapchain);
+	initImageViews();
+	initRenderGraph();
+	initGraphicsPipeline();
 
-	if (vkCreateSampler(device, &samplerInfo, nullptr, &textureImageSampler) != VK_SUCCESS)
+	// The depth pyramid was recreated at the new size. Each frame's set is repointed once the
+	// frame's fence says it's no longer in use.
+	if (gpuCullingEnabled)
 	{
-		throw std::runtime_error("Could not create texture image sampler");
+		for (FrameResources& frame : frames)
+		{
+			frame.cullPyramidStale = true;
+		}
 	}
 }
 
-void VulkanApplication::recreateSwapchain()
+void VulkanApplication::updateRenderScale(FrameResources& frame)
 {
-	vkDeviceWaitIdle(device);
+	// The frame's fence has signaled, so its timestamps are ready. Results wrap at the valid bits.
+	if (dynamicResolutionEnabled && frame.timestampsWritten)
+	{
+		uint64_t timestamps[2];
+		if (vkGetQueryPoolResults(device, frame.timestampQueryPool, 0, 2, sizeof(timestamps), timestamps,
+			sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+			dynamicResolution.update(static_cast<float>(ticks * static_cast<double>(timestampPeriod) / 1.0e6));
+		}
+	}
 
-	cleanupSwapchain();
+	// Occlusion culling reads a depth pyramid drawn at last frame's extent
+	previousRenderExtent = renderExtent;
 
-	// Call everything that depends on swapchain or image size
-	initSwapchain();
-	initImageViews();
-	createRenderPass();
-	initGraphicsPipeline();
-	initDepthResources();
-	initFramebuffers();
-	initCommandBuffers();
+	float scale = dynamicResolution.getScale();
+	renderExtent.width = std::max(1u, std::min(swapchainExtent.width, static_cast<uint32_t>(swapchainExtent.width * scale + 0.5f)));
+	renderExtent.height = std::max(1u, std::min(swapchainExtent.height, static_cast<uint32_t>(swapchainExtent.height * scale + 0.5f)));
 }
 
-void VulkanApplication::updateUniformBuffer()
+void VulkanApplication::updateUniformBuffer(FrameResources& frame)
 {
-	static auto startTime = std::chrono::high_resolution_clock::now();
+	// Everything that moves follows the simulation's clock, so it all stops together if it stalls
+	SimulationState state = simulation.getInterpolatedState();
+	animationTime = static_cast<float>(state.time);
 
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() / 1000.0f;
+	// The scene spins around its root transform; the UBO's model matrix is left as identity
+	transforms.setRotation(sceneRoot, glm::angleAxis(state.sceneAngle, glm::vec3(0.0f, 0.0f, 1.0f)));
+	updateTransforms();
 
 	UniformBufferObject ubo = { };	
-	ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	ubo.model = glm::mat4(1.0f);
 
 	ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
 	// 45 degree vertical FOV, aspect ratio as per window size, near plane at 1.0, far at 10.0
-	ubo.proj = glm::perspective(glm::radians(45.0f), swapchainExtent.width / (float)swapchainExtent.height, 0.1f, 10.0f);
+	ubo.proj = glm::perspective(glm::radians(45.0f), swapchainExtent.width / (float)swapchainExtent.height, cameraNear, cameraFar);
 
 	// In openGL, y-coordinate of clip is inverted. GLM expects this
 	ubo.proj[1][1] *= -1;
 
+	cullMatrix = ubo.proj * ubo.view * ubo.model;
+
+	// Early occlusion culling tests against last frame's depth, so needs last frame's camera
+	ubo.previousViewProj = previousViewProj;
+	previousViewProj = ubo.proj * ubo.view;
+
+	// Fragments find their cluster from their pixel in the rendered area, and their view depth
+	ubo.clusterParams = glm::vec4(renderExtent.width, renderExtent.height, cameraNear, cameraFar);
+
+	// Cascades stay put until the camera leaves them, so cached static shadows stay valid
+	shadowCascades.update(ubo.view, ubo.proj, cameraNear, cameraFar, sunDirection);
+	for (uint32_t i = 0; i < ShadowCascades::cascadeCount; ++i)
+	{
+		ubo.shadowViewProj[i] = shadowCascades.getCascade(i).viewProj;
+		ubo.cascadeSplits[i] = shadowCascades.getCascade(i).splitDepth;
+	}
+	ubo.sunDirection = glm::vec4(sunDirection, 0.0f);
+	ubo.sunColor = glm::vec4(sunColor, 1.0f);
+
+	lightBinConstants.view = ubo.view;
+	lightBinConstants.tanHalfFov = glm::vec2(1.0f / ubo.proj[0][0], 1.0f / std::abs(ubo.proj[1][1]));
+	lightBinConstants.nearPlane = cameraNear;
+	lightBinConstants.farPlane = cameraFar;
+
 	// GLM vectors can be copied directly; their format is compatible with shader inputs
-	void* data;
-	vkMapMemory(device, uniformBufferMemory, 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(device, uniformBufferMemory);
+	memcpy(frame.uniformBufferMapped, &ubo, sizeof(ubo));
 }
 
 bool VulkanApplication::transitionImageLayout(
@@ -1365,7 +5152,9 @@ bool VulkanApplication::transitionImageLayout(
 	barrier.srcAccessMask = srcAccessMask;
 	barrier.dstAccessMask = dstAccessMask;
 
-	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+	// Depth images use the depth aspect whatever layout they go to, e.g. to be sampled
+	bool depthFormat = format == depthImageFormat || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL || depthFormat)
 	{
 		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
 		if (format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT)
@@ -1446,13 +5235,13 @@ uint32_t VulkanApplication::findMemoryType(uint32_t typeFilter,
 	throw std::runtime_error("no GPU memory type matching the requested filter was found");
 }
 
-VkShaderModule VulkanApplication::createShaderModule(const std::vector<char>& bytecode, 
+VkShaderModule VulkanApplication::createShaderModule(const std::vector<uint32_t>& spirv,
 	VkDevice& device)
 {
 	VkShaderModuleCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = bytecode.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(bytecode.data());
+	createInfo.codeSize = spirv.size() * sizeof(uint32_t);
+	createInfo.pCode = spirv.data();
 
 	VkShaderModule shaderModule;
 	if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
@@ -1463,6 +5252,18 @@ VkShaderModule VulkanApplication::createShaderModule(const std::vector<char>& by
 	return shaderModule;
 }
 
+bool VulkanApplication::loadShaderModule(const std::string& path, VkShaderModule& outModule, std::string& outErrors)
+{
+	std::vector<uint32_t> spirv;
+	if (!shaderCompiler.compileFile(path, spirv, outErrors))
+	{
+		return false;
+	}
+
+	outModule = createShaderModule(spirv, device);
+	return true;
+}
+
 uint32_t VulkanApplication::calcSuitabilityScore(const VkPhysicalDevice& device, const VkSurfaceKHR& surface) const
 {
 	VkPhysicalDeviceProperties deviceProperties;
@@ -1742,7 +5543,8 @@ bool VulkanApplication::createVkImage(VkImage& image,
 	VkFormat format,
 	VkImageTiling tiling,
 	VkImageUsageFlags usageFlags,
-	VkMemoryPropertyFlags memPropFlags)
+	VkMemoryPropertyFlags memPropFlags,
+	uint32_t mipLevels)
 {	
 	VkImageCreateInfo imageInfo = { };
 
@@ -1751,7 +5553,7 @@ bool VulkanApplication::createVkImage(VkImage& image,
 	imageInfo.extent.width = static_cast<uint32_t>(width);
 	imageInfo.extent.height = static_cast<uint32_t>(height);
 	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
+	imageInfo.mipLevels = mipLevels;
 	imageInfo.arrayLayers = 1;
 	imageInfo.format = format;
 
@@ -1790,7 +5592,7 @@ bool VulkanApplication::createVkImage(VkImage& image,
 	return true;
 }
 
-bool VulkanApplication::createVkImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView& outImageView)
+bool VulkanApplication::createVkImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView& outImageView, uint32_t baseMipLevel, uint32_t levelCount)
 {
 	VkImageViewCreateInfo viewInfo = {};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1798,8 +5600,8 @@ bool VulkanApplication::createVkImageView(VkImage image, VkFormat format, VkImag
 	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	viewInfo.format = format;
 	viewInfo.subresourceRange.aspectMask = aspectFlags;
-	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+	viewInfo.subresourceRange.levelCount = levelCount;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 
@@ -1900,6 +5702,44 @@ bool VulkanApplication::checkDeviceExtensionSupport(const VkPhysicalDevice& devi
 	return true;
 }
 
+bool VulkanApplication::isInstanceExtensionAvailable(const char* extensionName) const
+{
+	uint32_t extensionCount;
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto& extension : availableExtensions)
+	{
+		if (strcmp(extension.extensionName, extensionName) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool VulkanApplication::isDeviceExtensionAvailable(const VkPhysicalDevice& device, const char* extensionName) const
+{
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto& extension : availableExtensions)
+	{
+		if (strcmp(extension.extensionName, extensionName) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
 // Callback for validation layers
 VKAPI_ATTR VkBool32 VKAPI_CALL VulkanApplication::debugCallback(
 	VkDebugReportFlagsEXT flags,
@@ -1960,10 +5800,127 @@ void VulkanApplication::onWindowResized(GLFWwindow* window, int width, int heigh
 	app->recreateSwapchain();
 }
 
+TransformId VulkanApplication::addObjectTransform(ObjectId object, TransformId parent, const glm::vec3& translation, const glm::vec3& scale)
+{
+	TransformId node = transforms.addNode(parent, translation, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), scale);
+
+	if (transformObjects.size() <= node)
+	{
+		transformObjects.resize(node + 1, invalidObject);
+	}
+	transformObjects[node] = object;
+
+	return node;
+}
+
+void VulkanApplication::applyRenderCommands()
+{
+	// Commands pushed while this runs wait for the next frame, so a busy producer can't keep it here
+	RenderCommand command;
+	for (size_t i = 0; i < RenderCommandQueue::capacity && renderCommands.pop(command); ++i)
+	{
+		if (command.type == RenderCommand::CreateObject)
+		{
+			if (renderHandleObjects.size() <= command.object)
+			{
+				renderHandleObjects.resize(command.object + 1, invalidObject);
+				renderHandleTransforms.resize(command.object + 1, TransformHierarchy::invalidTransform);
+			}
+
+			ObjectId object = scene.addObject(command.mesh, command.material, glm::mat4(1.0f));
+			TransformId node = addObjectTransform(object, TransformHierarchy::invalidTransform, command.position, command.scale);
+			transforms.setRotation(node, command.rotation);
+
+			renderHandleObjects[command.object] = object;
+			renderHandleTransforms[command.object] = node;
+		}
+		else
+		{
+			// Commands for objects already destroyed are dropped
+			if (command.object >= renderHandleObjects.size() || renderHandleObjects[command.object] == invalidObject)
+			{
+				continue;
+			}
+
+			TransformId node = renderHandleTransforms[command.object];
+			if (command.type == RenderCommand::SetObjectTransform)
+			{
+				transforms.setTranslation(node, command.position);
+				transforms.setRotation(node, command.rotation);
+				transforms.setScale(node, command.scale);
+			}
+			else
+			{
+				scene.removeObject(renderHandleObjects[command.object]);
+				transforms.removeNode(node);
+				transformObjects[node] = invalidObject;
+
+				renderHandleObjects[command.object] = invalidObject;
+				renderHandleTransforms[command.object] = TransformHierarchy::invalidTransform;
+				renderCommands.releaseHandle(command.object);
+			}
+		}
+
+		appliedRenderCommandCount++;
+	}
+}
+
+void VulkanApplication::updateTransforms()
+{
+	transforms.update();
+
+	// Only nodes under something that moved are visited, so static objects cost nothing here
+	for (TransformId node : transforms.getUpdatedNodes())
+	{
+		if (node < transformObjects.size() && transformObjects[node] != invalidObject)
+		{
+			scene.setTransform(transformObjects[node], transforms.getWorldMatrix(node));
+		}
+	}
+}
+
+void VulkanApplication::onMouseButton(GLFWwindow* window, int button, int action, int mods)
+{
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+	{
+		VulkanApplication* app = reinterpret_cast<VulkanApplication*>(glfwGetWindowUserPointer(window));
+		app->pickObjectAtCursor();
+	}
+}
+
+void VulkanApplication::pickObjectAtCursor()
+{
+	double cursorX, cursorY;
+	glfwGetCursorPos(window, &cursorX, &cursorY);
+
+	// Cursor to normalized device coordinates. The projection already flips y for Vulkan.
+	float ndcX = 2.0f * static_cast<float>(cursorX) / swapchainExtent.width - 1.0f;
+	float ndcY = 2.0f * static_cast<float>(cursorY) / swapchainExtent.height - 1.0f;
+
+	// Unproject points on the near and far planes into scene space
+	glm::mat4 inverseMatrix = glm::inverse(cullMatrix);
+	glm::vec4 nearPoint = inverseMatrix * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverseMatrix * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 end = glm::vec3(farPoint) / farPoint.w;
+
+	Ray ray(origin, glm::normalize(end - origin));
+
+	ObjectId object;
+	float distance;
+	if (scene.raycast(ray, glm::length(end - origin), object, distance))
+	{
+		std::cout << "Picked object " << object << " at distance " << distance << std::endl;
+	}
+	else
+	{
+		std::cout << "Picked nothing" << std::endl;
+	}
+}
+
 void VulkanApplication::mainLoop()
 {
 	// Don't show window until the first frame is drawn (otherwise you get a very bright white window)
-	updateUniformBuffer();
 	drawFrame();
 	glfwShowWindow(window);
 
@@ -1971,8 +5928,14 @@ void VulkanApplication::mainLoop()
 	{
 		glfwPollEvents();
 
-		// Tick();
-		updateUniformBuffer();
+		reloadChangedShaders();
+
+		// The simulation ticks on its own thread, and picks up the latest input on its next tick
+		SimulationInput input;
+		input.spin = (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS ? 1.0f : 0.0f) -
+			(glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS ? 1.0f : 0.0f);
+		simulation.setInput(input);
+
 		drawFrame();
 	}
 
@@ -1986,47 +5949,70 @@ void VulkanApplication::drawFrame()
 	// 2. Execute command buffer with that image attached
 	// 3. Return image to swap chain
 
+	FrameResources& frame = frames[currentFrame];
+
 	uint32_t imageIndex = 0xDEADBEEF;
 	uint64_t timeout = std::numeric_limits<uint64_t>::max();
 
+	// Wait for the last submission that used this frame's resources -- this way game tick, etc,
+	// and recording the next frame can continue while the previous frame renders
+	vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, timeout);
+
+	// Only changes the scene on the CPU, so it's done before acquiring, which can skip the rest
+	// of the frame (e.g. while minimized), to keep the queue from filling up
+	applyRenderCommands();
+
 	// Get next image from swapchain, signal imageAvailableSem when done. Records into imageIndex
 	VkResult result = vkAcquireNextImageKHR(device,
 		swapchain,
 		timeout,
-		imageAvailableSem,
+		frame.imageAvailableSem,
 		VK_NULL_HANDLE,
 		&imageIndex);
 	
 	if (result == VK_ERROR_OUT_OF_DATE_KHR)
 	{
-		// Something changed, and the swapchain is no longer compatible -- recreate it
+		// Something changed, and the swapchain is no longer compatible -- recreate it and
+		// try again next frame
 		recreateSwapchain();
+		return;
 	}
  	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
 	{
 		throw std::runtime_error("could not get next swapchain image");
 	}
 
-	// Wait for queue to go idle from drawing LAST frame -- this way game tick,
-	// etc, can continue while previous frame renders
-	result = vkQueueWaitIdle(presentQueue);
+	vkResetFences(device, 1, &frame.inFlightFence);
 
-	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
-	{
-		// At this point, recreate also if swapchain is suboptimal,
-		recreateSwapchain();
-	} 
-	else if (result != VK_SUCCESS)
+	// Frames old enough to have passed the fence are done with their retired objects
+	destroyRetiredObjects();
+
+	updateFrameDescriptors(frame);
+	updateRenderScale(frame);
+	updateUniformBuffer(frame);
+
+	// ... and this frame's instance and light buffers are free to be written
+	updateInstanceBuffer(frame);
+	updateLightBuffer(frame);
+	updateSkinning(frame);
+	updateParticles();
+	updateSprites(frame);
+	updateShadows(frame);
+
+	if (!gpuCullingEnabled)
 	{
-		throw std::runtime_error("failed to present swap chain image");
+		cullInstancesCpu(frame);
+		sortDraws();
 	}
+
+	recordCommandBuffer(frame, imageIndex);
 	
 	// Submit draw commands:
 	VkSubmitInfo submitInfo = { };
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 	// Semaphores to wait on - command buffer will not execute until these signal
-	VkSemaphore waitSems[] = { imageAvailableSem };
+	VkSemaphore waitSems[] = { frame.imageAvailableSem };
 
 	// Stages to wait at. We want to wait before writing colors to the image (but other stuff can get started -- 
 	// e.g., vertex shaders, which don't need an image to write on yet. Note that each mask corresponds 
@@ -2037,18 +6023,18 @@ void VulkanApplication::drawFrame()
 	submitInfo.pWaitSemaphores = waitSems;
 	submitInfo.pWaitDstStageMask = waitStages;
 	
-	// Now register the command buffer we want to execute. This should correspond
-	// to a swapchain index	
+	// Now register the command buffer we want to execute, recorded for this swapchain image
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+	submitInfo.pCommandBuffers = &frame.commandBuffer;
 
 	// Semaphore to signal once the command buffer is done executing
-	VkSemaphore signalSemaphores[] = { renderFinishedSem };
+	VkSemaphore signalSemaphores[] = { frame.renderFinishedSem };
 
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+	// The fence tells us when this frame's resources can be reused
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame.inFlightFence) != VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to submit to graphics queue");
 	}
@@ -2069,48 +6055,89 @@ void VulkanApplication::drawFrame()
 	// Individual results for each swapchain - not needed, since there is only one
 	presentInfo.pResults = nullptr;
 	
-	vkQueuePresentKHR(presentQueue, &presentInfo);
+	result = vkQueuePresentKHR(presentQueue, &presentInfo);
+
+	++frameCount;
+	currentFrame = (currentFrame + 1) % maxFramesInFlight;
+
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+	{
+		// At this point, recreate also if swapchain is suboptimal,
+		recreateSwapchain();
+	} 
+	else if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to present swap chain image");
+	}
 }
 
 void VulkanApplication::cleanupSwapchain()
 {
-	for (auto& fb : swapchainFramebuffers)
+	// Everything here may be in use by frames in flight, so it's retired, and destroyed once they finish
+	retireObject(UniquePipeline(device, graphicsPipeline));
+	if (depthPrepassEnabled)
 	{
-		vkDestroyFramebuffer(device, fb, nullptr);
+		retireObject(UniquePipeline(device, depthPrepassPipeline));
 	}
+	retireObject(UniquePipelineLayout(device, pipelineLayout));
+
+	retireObject(UniquePipeline(device, upscalePipeline));
+	retireObject(UniquePipeline(device, particlePipeline));
+	retireObject(UniquePipeline(device, spritePipeline));
+
+	// Built against the Shadows pass's render pass
+	retireObject(UniquePipeline(device, shadowPipeline));
+	retireObject(UniquePipeline(device, shadowCopyPipeline));
+	retireObject(UniquePipelineLayout(device, upscalePipelineLayout));
+
+	// Render passes, framebuffers and the depth buffer. The graph is moved out, so a new one can be
+	// declared straight away.
+	std::shared_ptr<RenderGraph> oldRenderGraph(new RenderGraph(std::move(renderGraph)));
+	renderGraph = RenderGraph();
+	retireObject([oldRenderGraph]()
+	{
+		oldRenderGraph->destroy();
+	});
 
-	vkFreeCommandBuffers(device, graphicsCommandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-
-	// Clean up shaders
-	vkDestroyShaderModule(device, vertShaderModule, nullptr);
-	vkDestroyShaderModule(device, fragShaderModule, nullptr);
-
-	vkDestroyPipeline(device, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-	vkDestroyRenderPass(device, renderPass, nullptr);
+	if (gpuCullingEnabled)
+	{
+		destroyDepthPyramid();
+	}
 
 	// Clean up swapchain first, it may require glfw to still be alive (not sure)
-	for (auto& view : swapchainViews)
+	for (VkImageView view : swapchainViews)
 	{
-		vkDestroyImageView(device, view, nullptr);
+		retireObject(UniqueImageView(device, view));
 	}
+	swapchainViews.clear();
 
-	vkDestroySwapchainKHR(device, swapchain, nullptr);
+	retireObject(std::move(swapchain));
 }
 
 void VulkanApplication::cleanup()
 {
 	std::cout << "Beginning Vulkan teardown... " << std::endl;
 
+	// Culling buffers go through the retire list too, so they're freed before their descriptor pool
+	if (gpuCullingEnabled)
+	{
+		retireCullBuffers();
+	}
+
 	cleanupSwapchain();
 
-	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	// Device is idle by now, so everything retired can go
+	deletionQueue.destroyAll();
+
+	descriptorAllocator.destroy();
 
 	// Clean up buffers
 	vkDestroyBuffer(device, vertexBuffer, nullptr);
 	vkFreeMemory(device, vertexBufferMemory, nullptr);
 
+	vkDestroyBuffer(device, positionBuffer, nullptr);
+	vkFreeMemory(device, positionBufferMemory, nullptr);
+
 	vkDestroyBuffer(device, vertexStagingBuffer, nullptr);
 	vkFreeMemory(device, vertexStagingMemory, nullptr);
 
@@ -2120,23 +6147,108 @@ void VulkanApplication::cleanup()
 	vkDestroyBuffer(device, indexStagingBuffer, nullptr);
 	vkFreeMemory(device, indexStagingMemory, nullptr);
 
-	vkDestroyBuffer(device, uniformBuffer, nullptr);
-	vkFreeMemory(device, uniformBufferMemory, nullptr);
-		
-	// Depth buffer
-	vkDestroyImage(device, depthImage, nullptr);
-	vkFreeMemory(device, depthMemory, nullptr);
-	vkDestroyImageView(device, depthImageView, nullptr);
+	for (FrameResources& frame : frames)
+	{
+		vkDestroyBuffer(device, frame.uniformBuffer, nullptr);
+		vkFreeMemory(device, frame.uniformBufferMemory, nullptr);
+
+		vkDestroyBuffer(device, frame.instanceBuffer, nullptr);
+		vkFreeMemory(device, frame.instanceBufferMemory, nullptr);
+		vkDestroyBuffer(device, frame.shadowInstanceBuffer, nullptr);
+		vkFreeMemory(device, frame.shadowInstanceBufferMemory, nullptr);
+
+		vkDestroyBuffer(device, frame.lightBuffer, nullptr);
+		vkFreeMemory(device, frame.lightBufferMemory, nullptr);
+		vkDestroyBuffer(device, frame.clusterBuffer, nullptr);
+		vkFreeMemory(device, frame.clusterBufferMemory, nullptr);
+
+		vkDestroyBuffer(device, frame.paletteBuffer, nullptr);
+		vkFreeMemory(device, frame.paletteBufferMemory, nullptr);
+
+		vkDestroyBuffer(device, frame.spriteBuffer, nullptr);
+		vkFreeMemory(device, frame.spriteBufferMemory, nullptr);
+	}
 
+	vkDestroyPipeline(device, lightBinPipeline, nullptr);
+	vkDestroyPipelineLayout(device, lightBinPipelineLayout, nullptr);
+
+	vkDestroyBuffer(device, skinVertexBuffer, nullptr);
+	vkFreeMemory(device, skinVertexBufferMemory, nullptr);
+	vkDestroyBuffer(device, skinnedInstanceBuffer, nullptr);
+	vkFreeMemory(device, skinnedInstanceBufferMemory, nullptr);
+	vkDestroyPipeline(device, skinningPipeline, nullptr);
+	vkDestroyPipelineLayout(device, skinningPipelineLayout, nullptr);
+
+	vkDestroyBuffer(device, particleBuffer, nullptr);
+	vkFreeMemory(device, particleBufferMemory, nullptr);
+	vkDestroyBuffer(device, particleIndexBuffer, nullptr);
+	vkFreeMemory(device, particleIndexBufferMemory, nullptr);
+	vkDestroyBuffer(device, particleStateBuffer, nullptr);
+	vkFreeMemory(device, particleStateBufferMemory, nullptr);
+	vkDestroyPipeline(device, particleBeginPipeline, nullptr);
+	vkDestroyPipeline(device, particleEmitPipeline, nullptr);
+	vkDestroyPipeline(device, particleSimulatePipeline, nullptr);
+	vkDestroyPipelineLayout(device, particlePipelineLayout, nullptr);
+
+	vkDestroyPipelineLayout(device, spritePipelineLayout, nullptr);
+
+	if (gpuCullingEnabled)
+	{
+		vkDestroyPipeline(device, cullPipeline, nullptr);
+		vkDestroyPipeline(device, compactDrawsPipeline, nullptr);
+		vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+		vkDestroyDescriptorPool(device, cullDescriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, cullDescriptorSetLayout, nullptr);
+
+		vkDestroyPipeline(device, depthPyramidPipeline, nullptr);
+		vkDestroyPipelineLayout(device, depthPyramidPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, depthPyramidDescriptorSetLayout, nullptr);
+		vkDestroySampler(device, depthPyramidSampler, nullptr);
+	}
+		
 	// Clean up textures
 	vkDestroyImage(device, textureImage, nullptr);
 	vkFreeMemory(device, textureImageMemory, nullptr);
 	vkDestroyImageView(device, textureImageView, nullptr);
 	vkDestroySampler(device, textureImageSampler, nullptr);
 
-	// Clean up synchro stuff
-	vkDestroySemaphore(device, imageAvailableSem, nullptr);
-	vkDestroySemaphore(device, renderFinishedSem, nullptr);
+	vkDestroyImageView(device, spriteAtlasImageView, nullptr);
+	vkDestroyImage(device, spriteAtlasImage, nullptr);
+	vkFreeMemory(device, spriteAtlasImageMemory, nullptr);
+
+	vkDestroyDescriptorPool(device, bindlessDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, bindlessDescriptorSetLayout, nullptr);
+
+	vkDestroySampler(device, upscaleSampler, nullptr);
+
+	vkDestroyFramebuffer(device, shadowCacheFramebuffer, nullptr);
+	vkDestroyRenderPass(device, shadowCacheRenderPass, nullptr);
+	vkDestroyImageView(device, shadowCacheImageView, nullptr);
+	vkDestroyImage(device, shadowCacheImage, nullptr);
+	vkFreeMemory(device, shadowCacheImageMemory, nullptr);
+	vkDestroyPipelineLayout(device, shadowPipelineLayout, nullptr);
+	vkDestroyPipelineLayout(device, shadowCopyPipelineLayout, nullptr);
+	vkDestroySampler(device, shadowCacheSampler, nullptr);
+	vkDestroySampler(device, shadowSampler, nullptr);
+
+	// Clean up synchro stuff, and per-frame command pools along with their command buffers
+	for (FrameResources& frame : frames)
+	{
+		vkDestroySemaphore(device, frame.imageAvailableSem, nullptr);
+		vkDestroySemaphore(device, frame.renderFinishedSem, nullptr);
+		vkDestroyFence(device, frame.inFlightFence, nullptr);
+
+		if (frame.timestampQueryPool != VK_NULL_HANDLE)
+		{
+			vkDestroyQueryPool(device, frame.timestampQueryPool, nullptr);
+		}
+
+		vkDestroyCommandPool(device, frame.commandPool, nullptr);
+		for (VkCommandPool threadPool : frame.threadCommandPools)
+		{
+			vkDestroyCommandPool(device, threadPool, nullptr);
+		}
+	}
 
 	vkDestroyCommandPool(device, graphicsCommandPool, nullptr);
 	vkDestroyCommandPool(device, transferCommandPool, nullptr);
@@ -2157,24 +6269,3 @@ void VulkanApplication::cleanup()
 	glfwTerminate();
 }
 
-std::vector<char> VulkanApplication::readFileBytes(const std::string& filename)
-{
-	// Open file starting at the end, in binary
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-	
-	if (!file.is_open())
-	{
-		throw std::runtime_error("Could not open file");
-	}
-
-	// At end, use this to determine file size
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
-
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-	file.close();
-
-	return buffer;
-}
-
@@ -11,6 +11,7 @@
 #include <vector>
 #include <string>
 #include <chrono>
+#include <deque>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW\glfw3.h>
@@ -24,6 +25,26 @@
 
 #include "render_types.h"
 #include "vulkan_util.h"
+#include "shader_compiler.h"
+#include "file_watcher.h"
+#include "scene.h"
+#include "frustum_culling.h"
+#include "transform_hierarchy.h"
+#include "render_graph.h"
+#include "software_occlusion.h"
+#include "draw_sort.h"
+#include "descriptor_allocator.h"
+#include "dynamic_resolution.h"
+#include "clustered_lighting.h"
+#include "shadow_cascades.h"
+#include "animation.h"
+#include "gpu_particles.h"
+#include "sprite_batch.h"
+#include "job_system.h"
+#include "simulation.h"
+#include "render_commands.h"
+#include "deletion_queue.h"
+#include "image.h"
 
 // Requested debug flags
 const VkDebugReportFlagsEXT debugFlags = // VK_DEBUG_REPORT_DEBUG_BIT_EXT |
@@ -60,11 +81,51 @@ public: // methods
 		windowWidth(800),
 		windowHeight(600),
 		physicalDevice(VK_NULL_HANDLE),
-		depthImageFormat(VK_FORMAT_D32_SFLOAT)
+		depthImageFormat(VK_FORMAT_D32_SFLOAT),
+		shaderCompiler("Cache/Shaders"),
+		shaderWatcher(std::chrono::milliseconds(250)),
+		frames(maxFramesInFlight),
+		currentFrame(0),
+		frameCount(0),
+		gpuCullingEnabled(true),
+		depthPrepassEnabled(true),
+		sunDirection(glm::normalize(glm::vec3(0.3f, 0.2f, -1.0f))),
+		sunColor(0.8f, 0.75f, 0.65f),
+		shadowStaticVersion(0),
+		dynamicResolution(1000.0f / 60.0f, 0.5f, 1.0f),
+		dynamicResolutionEnabled(false),
+		timestampPeriod(0.0f),
+		timestampMask(0),
+		lightBufferCapacity(0),
+		animationTime(0.0f),
+		maxSkinnedVertexCount(0),
+		gpuParticles(240000.0f, 4.0f),
+		multiDrawIndirectSupported(false),
+		physicalDeviceProperties2Enabled(false),
+		descriptorIndexingSupported(false),
+		bindlessTextureCapacity(0),
+		cmdDrawIndexedIndirectCount(nullptr),
+		depthPyramidNeedsClear(false),
+		cullMatrix(1.0f),
+		previousViewProj(1.0f),
+		softwareOcclusion(256, 128),
+		softwareOcclusionEnabled(SoftwareOcclusion::isSupported()),
+		drawStats(),
+		sceneRoot(TransformHierarchy::invalidTransform),
+		quadMesh(0),
+		appliedRenderCommandCount(0)
 	{ }
 
 	~VulkanApplication()
-	{ }
+	{
+		// If startup failed early, texture decoding may still be going, and writing into this
+		try
+		{
+			JobSystem::getDefault().wait(textureLoads);
+		}
+		catch (const std::exception&)
+		{ }
+	}
 
 	// Copy / moves disallowed
 	VulkanApplication(const VulkanApplication& other)          = delete;
@@ -85,6 +146,7 @@ protected: // classes
 			graphics(-1),
 			present(-1),
 			transfer(-1),
+			compute(-1),
 			queueFamilyCount(0)
 		{ }
 		
@@ -103,6 +165,10 @@ protected: // classes
 			{
 				return false;
 			}
+			if (compute < 0)
+			{
+				return false;
+			}
 			
 			return true;
 		}
@@ -119,16 +185,39 @@ protected: // classes
 			{
 				if (queueFamilies[i].queueCount > 0)
 				{
-					// check graphics
+					// check graphics. Prefer a family that can also do compute, so compute work
+					// (e.g. GPU culling) can be recorded in the same command buffers as drawing.
+					// Vulkan guarantees such a family exists if any family supports graphics.
 					VkQueueFlags graphicsSupport = queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT;
-					if (graphicsSupport)
+					VkQueueFlags computeSupport = queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT;
+					if (graphicsSupport && (graphics < 0 || computeSupport))
 					{
 						graphics = i;
-						break;
+						if (computeSupport)
+						{
+							break;
+						}
 					}
 				}	
 			}
 
+			// Compute goes on the graphics family if it can
+			if (graphics >= 0 && (queueFamilies[graphics].queueFlags & VK_QUEUE_COMPUTE_BIT))
+			{
+				compute = graphics;
+			}
+			else
+			{
+				for (int i = 0; i < queueFamilies.size(); ++i)
+				{
+					if (queueFamilies[i].queueCount > 0 && (queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT))
+					{
+						compute = i;
+						break;
+					}
+				}
+			}
+
 			for (int i = 0; i < queueFamilies.size(); ++i)
 			{
 				if (queueFamilies[i].queueCount > 0)
@@ -178,6 +267,7 @@ protected: // classes
 		int graphics;
 		int present;
 		int transfer;
+		int compute;
 		uint32_t queueFamilyCount;
 	};
 
@@ -215,16 +305,143 @@ protected: // classes
 		}
 	};
 
+	// Pipelines built by buildGraphicsPipeline
+	enum GraphicsPipelineType
+	{
+		GraphicsPipelineMain,
+		GraphicsPipelineDepthPrepass,
+		GraphicsPipelineShadow
+	};
+
+	// A pipeline that is rebuilt whenever one of its shader sources changes on disk
+	struct HotReloadPipeline
+	{
+		std::vector<std::string> shaderPaths;
+		VkPipeline* pipeline;
+		std::function<bool(VkPipeline&, std::string&)> build;
+	};
+
+	// Everything a single frame in flight records into or writes from the CPU. A frame's
+	// resources are reused maxFramesInFlight frames later, once its fence has signaled.
+	struct FrameResources
+	{
+		VkFence inFlightFence;
+		VkSemaphore imageAvailableSem;
+		VkSemaphore renderFinishedSem;
+
+		// Primary command buffer, recorded from scratch every frame
+		VkCommandPool commandPool;
+		VkCommandBuffer commandBuffer;
+
+		// One pool and secondary command buffer per recording thread. Each records a share of the draws.
+		// With GPU culling, late phase draws go in a second set of secondaries from the same pools.
+		std::vector<VkCommandPool> threadCommandPools;
+		std::vector<VkCommandBuffer> threadCommandBuffers;
+		std::vector<VkCommandBuffer> lateThreadCommandBuffers;
+		std::vector<VkCommandBuffer> prepassThreadCommandBuffers; // Depth prepass only
+		std::vector<VkCommandBuffer> latePrepassThreadCommandBuffers; // Depth prepass with GPU culling only
+		size_t secondaryCount; // Secondaries recorded this frame, in each set
+
+		// Persistently mapped
+		VkBuffer uniformBuffer;
+		VkDeviceMemory uniformBufferMemory;
+		void* uniformBufferMapped;
+		VkDescriptorSet descriptorSet; // From descriptorAllocator, so only valid for the frame it was set up in
+
+		VkBuffer instanceBuffer;
+		VkDeviceMemory instanceBufferMemory;
+		void* instanceBufferMapped;
+
+		// Half-open range of instances changed since this frame's instance buffer was last written
+		uint32_t dirtyBegin;
+		uint32_t dirtyEnd;
+
+		// GPU culling inputs. One GpuDrawBatch per batch with instanceCount zeroed, copied into
+		// drawBatchBuffer every frame, and the batch index of each instance.
+		VkBuffer batchBuffer;
+		VkDeviceMemory batchBufferMemory;
+		void* batchBufferMapped;
+		VkBuffer instanceBatchBuffer;
+		VkDeviceMemory instanceBatchBufferMemory;
+		void* instanceBatchBufferMapped;
+		bool cullBatchesStale; // Batch layout changed since the inputs were written
+		bool cullPyramidStale; // Depth pyramid was recreated since the set was written
+		VkDescriptorSet cullDescriptorSet;
+
+		// Clustered lighting. Every light, written from the CPU each frame, and each cluster's light
+		// list, written by the binning pass and read when shading.
+		VkBuffer lightBuffer;
+		VkDeviceMemory lightBufferMemory;
+		void* lightBufferMapped;
+		VkBuffer clusterBuffer;
+		VkDeviceMemory clusterBufferMemory;
+		VkDescriptorSet lightBinDescriptorSet; // From descriptorAllocator, like descriptorSet
+
+		// Skinning matrices of every animated instance, sampled on the CPU each frame
+		VkBuffer paletteBuffer;
+		VkDeviceMemory paletteBufferMemory;
+		void* paletteBufferMapped;
+		VkDescriptorSet skinningDescriptorSet; // From descriptorAllocator, like descriptorSet
+
+		// Particle buffers, and this frame's uniform buffer for drawing
+		VkDescriptorSet particleDescriptorSet; // From descriptorAllocator, like descriptorSet
+
+		// Sprite instances, sorted into draw order each frame
+		VkBuffer spriteBuffer;
+		VkDeviceMemory spriteBufferMemory;
+		void* spriteBufferMapped;
+
+		// Shadow caster instances, in scene batch order. Dynamic instances are written every frame,
+		// static ones only when the frame redraws the static shadow cache.
+		VkBuffer shadowInstanceBuffer;
+		VkDeviceMemory shadowInstanceBufferMemory;
+		void* shadowInstanceBufferMapped;
+
+		// Timestamps at the start and end of the frame's commands, for dynamic resolution
+		VkQueryPool timestampQueryPool;
+		bool timestampsWritten; // False until the frame is first submitted, so there's nothing to read
+	};
+
+	// State binds and draw calls recorded, to see how many binds sorting saves
+	struct DrawStats
+	{
+		uint64_t draws;
+		uint64_t binds; // Pipeline, descriptor set and vertex buffer binds
+		uint64_t unsortedBinds; // Binds the same draws would have made in visibleBatches order
+	};
+
+	// State a CPU culled draw has to bind before drawing
+	struct DrawBinds
+	{
+		bool pipeline;
+		bool descriptorSets;
+		bool vertexBuffers;
+
+		uint32_t count() const { return pipeline + descriptorSets + vertexBuffers; }
+	};
+
 	// Passes uniform paramters to shaders
 	struct UniformBufferObject
 	{
 		glm::mat4 model;
 		glm::mat4 view;
 		glm::mat4 proj;
+		glm::mat4 previousViewProj; // Last frame's proj * view, which the depth pyramid was drawn with
+		glm::vec4 clusterParams; // Render extent in xy, near and far planes in z and w, for finding a fragment's cluster
+		glm::mat4 shadowViewProj[ShadowCascades::cascadeCount];
+		glm::vec4 cascadeSplits; // View depth each cascade covers up to
+		glm::vec4 sunDirection; // The way sunlight travels
+		glm::vec4 sunColor;
 	};
 
 protected: // data
 
+	// Frames the CPU may record ahead of the GPU
+	static const uint32_t maxFramesInFlight = 2;
+
+	// Draws each recording thread should get at minimum; fewer aren't worth a thread
+	static const size_t minDrawsPerThread = 64;
+
 	GLFWwindow* window;
 	uint32_t windowWidth = 800;
 	uint32_t windowHeight = 600;
@@ -237,12 +454,11 @@ protected: // data
 	QueueFamilyIndices queueIndices;
 	VkSurfaceKHR surface;
 
-	// UBO descriptors
-	VkDescriptorPool descriptorPool;
-	VkDescriptorSet descriptorSet;
+	// Descriptor sets that only live for a frame, e.g. each frame's UBO set. Also owns descriptorSetLayout.
+	DescriptorAllocator descriptorAllocator;
 
 	// swapchain
-	VkSwapchainKHR swapchain;
+	UniqueSwapchain swapchain;
 	std::vector<VkImage> swapchainImages;
 	std::vector<VkImageView> swapchainViews;
 	VkFormat swapchainFormat;
@@ -256,25 +472,161 @@ protected: // data
 	VkQueue presentQueue;
 	// for schlepping memory around
 	VkQueue transferQueue;
-
-	// Shader modules
-	VkShaderModule vertShaderModule;
-	VkShaderModule fragShaderModule;
+	// for compute dispatches. Usually the same family as graphics.
+	VkQueue computeQueue;
+
+	// Shaders are compiled at runtime from GLSL source, and rebuilt when the source changes
+	ShaderCompiler shaderCompiler;
+	FileWatcher shaderWatcher;
+	std::vector<HotReloadPipeline> hotReloadPipelines;
+
+	// Passes making up a frame. Owns the depth buffer, render passes and framebuffers,
+	// and is rebuilt along with the swapchain.
+	RenderGraph renderGraph;
+	RenderPassId mainPass;
+	RenderPassId lateMainPass; // Draws what late culling finds, with GPU culling only
+
+	// Depth prepass. Each main pass is preceded by a depth-only pass drawing the same objects from a
+	// position-only stream, and then shades only the nearest surface, with an EQUAL depth test.
+	bool depthPrepassEnabled;
+	RenderPassId depthPrepassPass;
+	RenderPassId lateDepthPrepassPass; // With GPU culling only
+	VkRenderPass depthPrepassRenderPass; // Owned by renderGraph
+	VkPipeline depthPrepassPipeline;
+
+	// Cascaded shadow maps for the sun. Static casters are drawn into shadowCacheImage, which is kept
+	// between frames, only when a cascade is refit or static objects change. Every frame the Shadows
+	// pass copies the cache into the shadowMap atlas and draws dynamic casters over it.
+	glm::vec3 sunDirection; // The way the light travels
+	glm::vec3 sunColor;
+	ShadowCascades shadowCascades;
+	uint32_t shadowStaticVersion; // Scene static version the cache was last drawn with
+	VkImage shadowCacheImage;
+	VkDeviceMemory shadowCacheImageMemory;
+	VkImageView shadowCacheImageView;
+	VkRenderPass shadowCacheRenderPass;
+	VkFramebuffer shadowCacheFramebuffer;
+	RenderPassId shadowPass;
+	RenderResourceId shadowMap;
+	VkRenderPass shadowRenderPass; // Shadows pass's, owned by renderGraph. Compatible with shadowCacheRenderPass.
+	VkPipelineLayout shadowPipelineLayout;
+	VkPipeline shadowPipeline;
+	VkDescriptorSetLayout shadowCopyDescriptorSetLayout; // Owned by descriptorAllocator
+	VkPipelineLayout shadowCopyPipelineLayout;
+	VkPipeline shadowCopyPipeline;
+	VkSampler shadowCacheSampler; // Nearest, for copying
+	VkSampler shadowSampler; // Depth compare, for shading
+
+	// Dynamic resolution. The scene is drawn into the top-left renderExtent of sceneColor, which is
+	// swapchain sized, then stretched over the backbuffer. renderExtent follows measured GPU frame
+	// time, and only the viewport changes with it, so no pipeline or image is rebuilt when it does.
+	DynamicResolution dynamicResolution;
+	bool dynamicResolutionEnabled; // Needs timestamps on the graphics queue
+	VkExtent2D renderExtent;
+	VkExtent2D previousRenderExtent; // Last frame's, which the depth pyramid was drawn at
+	float timestampPeriod; // Nanoseconds per timestamp tick
+	uint64_t timestampMask; // Bits of a timestamp that are valid
+	RenderResourceId sceneColor;
+	RenderPassId upscalePass;
+	VkDescriptorSetLayout upscaleDescriptorSetLayout; // Owned by descriptorAllocator
+	VkPipelineLayout upscalePipelineLayout;
+	VkPipeline upscalePipeline;
+	VkSampler upscaleSampler;
+
+	// Clustered forward lighting. A compute pass bins lights into clusters of the view frustum
+	// each frame, before anything is drawn; see ClusteredLighting.
+	std::vector<GpuLight> lights;
+	size_t lightBufferCapacity; // Lights each frame's light buffer holds
+	LightBinPushConstants lightBinConstants; // Camera for binning, from the last UBO update
+	VkDescriptorSetLayout lightBinDescriptorSetLayout; // Owned by descriptorAllocator
+	VkPipelineLayout lightBinPipelineLayout;
+	VkPipeline lightBinPipeline;
+
+	// Skinned meshes. Animations are sampled on worker threads into each frame's palette, then a
+	// compute pass skins every animated instance into its own copy of its mesh in the vertex and
+	// position buffers. Every pass draws those like any other mesh, so nothing is skinned twice.
+	AnimationSystem animation;
+	float animationTime; // Seconds, from the last UBO update
+	std::vector<SkinVertex> skinVertices; // Bind pose of every skinned mesh
+	std::vector<GpuSkinnedInstance> skinnedInstances;
+	uint32_t maxSkinnedVertexCount; // Of any skinned instance, which sets the width of the dispatch
+	VkBuffer skinVertexBuffer;
+	VkDeviceMemory skinVertexBufferMemory;
+	VkBuffer skinnedInstanceBuffer;
+	VkDeviceMemory skinnedInstanceBufferMemory;
+	VkDescriptorSetLayout skinningDescriptorSetLayout; // Owned by descriptorAllocator
+	VkPipelineLayout skinningPipelineLayout;
+	VkPipeline skinningPipeline;
+
+	// GPU particles. Compute passes emit, simulate and compact them, and the survivors are drawn
+	// over the scene with an indirect draw whose instance count the GPU wrote; see GpuParticles.
+	// The buffers are only ever touched by the GPU, so they're shared between frames in flight.
+	GpuParticles gpuParticles;
+	VkBuffer particleBuffer;
+	VkDeviceMemory particleBufferMemory;
+	VkBuffer particleIndexBuffer; // Free slots, then both alive lists
+	VkDeviceMemory particleIndexBufferMemory;
+	VkBuffer particleStateBuffer; // GpuParticleState, also read as indirect arguments
+	VkDeviceMemory particleStateBufferMemory;
+	VkDescriptorSetLayout particleDescriptorSetLayout; // Owned by descriptorAllocator
+	VkPipelineLayout particlePipelineLayout; // Shared by the compute and draw pipelines
+	VkPipeline particleBeginPipeline;
+	VkPipeline particleEmitPipeline;
+	VkPipeline particleSimulatePipeline;
+	RenderPassId particlePass;
+	VkPipeline particlePipeline; // Draws; built against particlePass's render pass
+
+	// 2D sprites, drawn over the upscaled scene at full resolution. Sprites are collected into
+	// spriteBatch each frame, written in draw order into the frame's sprite buffer, and drawn with
+	// one instanced call per run of sprites sharing a texture; see SpriteBatch.
+	SpriteBatch spriteBatch;
+	std::vector<glm::vec4> spriteShapes; // Uv rects of the shapes in the sprite atlas
+	VkImage spriteAtlasImage;
+	VkDeviceMemory spriteAtlasImageMemory;
+	VkImageView spriteAtlasImageView;
+	VkDescriptorSetLayout spriteDescriptorSetLayout; // Owned by descriptorAllocator
+	VkPipelineLayout spritePipelineLayout;
+	RenderPassId spritePass;
+	VkPipeline spritePipeline; // Built against spritePass's render pass
 
 	// Pipeline
-	VkRenderPass renderPass;
+	VkRenderPass renderPass; // Main pass's render pass, owned by renderGraph
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkPipelineLayout pipelineLayout;
 	VkPipeline graphicsPipeline;
 
-	// Vertex buffer
-	std::vector<Vertex3D> vertices;
+	// Objects to draw, and the meshes they use
+	Scene scene;
+
+	// Object placement. Objects made at load hang off sceneRoot; ones from render commands are
+	// roots of their own. World matrices of moved nodes are copied into the scene each frame.
+	TransformHierarchy transforms;
+	TransformId sceneRoot;
+	std::vector<ObjectId> transformObjects; // Object driven by each transform node, if any
+	MeshId quadMesh;
+
+	// Scene changes submitted from other threads, applied at the start of each frame. Handles
+	// map to the object and transform node made for them, or invalid ones once destroyed.
+	// Declared before the simulation, so it outlives the simulation thread.
+	RenderCommandQueue renderCommands;
+	std::vector<ObjectId> renderHandleObjects;
+	std::vector<TransformId> renderHandleTransforms;
+	uint64_t appliedRenderCommandCount;
+
+	// Game logic, ticking at a fixed rate on its own thread. Each frame shows its state
+	// interpolated to the frame's time.
+	Simulation simulation;
 
 	// Vertex buffers hold actual vertices to draw
 	size_t vertexBufferSize;
 	VkBuffer vertexBuffer;
 	VkDeviceMemory vertexBufferMemory;
 
+	// Just the positions from the vertex buffer, for the depth prepass and shadows
+	size_t positionBufferSize;
+	VkBuffer positionBuffer;
+	VkDeviceMemory positionBufferMemory;
+
 	// Staging buffer for vertex data; can be mapped by CPU.
 	// Vertex data is then transfered to the vertex buffer.
 	// This is because CPU-mappable memory is often not the fastest for rendering.
@@ -282,14 +634,6 @@ protected: // data
 	VkBuffer vertexStagingBuffer;
 	VkDeviceMemory vertexStagingMemory;
 
-	// Holds shader uniform params
-	size_t uinformBufferSize;
-	VkBuffer uniformBuffer;
-	VkDeviceMemory uniformBufferMemory;
-
-	// Vertex index buffer 
-	std::vector<uint32_t> indices;
-
 	// Index buffer holds indices of vertices used in triangles
 	size_t indexBufferSize;
 	VkBuffer indexBuffer;
@@ -299,30 +643,119 @@ protected: // data
 	VkBuffer indexStagingBuffer;
 	VkDeviceMemory indexStagingMemory;
 
-	// Depth buffer:
-	VkImage depthImage;
-	VkDeviceMemory depthMemory;
-	VkImageView depthImageView;
+	// Capacity of each frame's instance buffer. These hold per-instance data for every object in
+	// the scene, and are host visible since transforms are expected to change every frame.
+	size_t instanceBufferCapacity;
+
+	// GPU culling. A compute pass tests every instance against the view frustum, writes the
+	// visible ones to culledInstanceBuffer and builds indirect draw commands, so drawing the
+	// scene costs the CPU the same no matter how many objects there are.
+	bool gpuCullingEnabled;
+
+	// Device support for GPU-driven drawing
+	bool multiDrawIndirectSupported;
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount; // null if VK_KHR_draw_indirect_count is missing
+
+	VkDescriptorSetLayout cullDescriptorSetLayout;
+	VkDescriptorPool cullDescriptorPool;
+	VkPipelineLayout cullPipelineLayout;
+	VkPipeline cullPipeline;
+	VkPipeline compactDrawsPipeline;
+
+	// Capacity of the per-batch culling buffers
+	size_t batchBufferCapacity;
+
+	// Written by the culling shaders every frame. Shared between frames in flight, since
+	// barriers order each frame's culling after the previous frame's draws.
+	VkBuffer drawBatchBuffer;
+	VkDeviceMemory drawBatchBufferMemory;
+	VkBuffer drawCommandBuffer;
+	VkDeviceMemory drawCommandBufferMemory;
+	VkBuffer drawCountBuffer;
+	VkDeviceMemory drawCountBufferMemory;
+	VkBuffer culledInstanceBuffer;
+	VkDeviceMemory culledInstanceBufferMemory;
+	VkBuffer occlusionStateBuffer; // Early phase result per instance
+	VkDeviceMemory occlusionStateBufferMemory;
+
+	// Occlusion culling. The depth pyramid is half the swapchain size at level 0, and each texel
+	// holds the farthest depth of what it covers. It's built after the early draws and kept for
+	// the next frame's early culling, so it's an imported render graph image.
+	// Recreated with the swapchain, and retired rather than destroyed, so they're owned by wrappers.
+	UniqueImage depthPyramid;
+	UniqueDeviceMemory depthPyramidMemory;
+	UniqueImageView depthPyramidView; // Every level, for culling
+	std::vector<UniqueImageView> depthPyramidLevelViews;
+	VkExtent2D depthPyramidExtent;
+	VkSampler depthPyramidSampler;
+	VkDescriptorSetLayout depthPyramidDescriptorSetLayout;
+	UniqueDescriptorPool depthPyramidDescriptorPool; // Each pyramid's own, so its sets retire with it
+	std::vector<VkDescriptorSet> depthPyramidDescriptorSets; // One per level
+	bool depthPyramidNeedsClear; // Cleared by the next frame, before anything reads it
+	VkPipelineLayout depthPyramidPipelineLayout;
+	VkPipeline depthPyramidPipeline;
+	glm::mat4 previousViewProj;
+
+	// CPU culling, used when GPU culling isn't available. Visible instances are packed into
+	// the frame's instance buffer, and only visible batches are drawn.
+	glm::mat4 cullMatrix; // proj * view * model from the last UBO update
+	std::vector<uint32_t> visibleInstances;
+	std::vector<DrawBatch> visibleBatches;
+
+	// Visible batches in sort key order, so draws sharing state are recorded together
+	std::vector<DrawSort::SortItem> sortedDraws;
+	std::vector<uint64_t> drawKeys; // Each visible batch's key, in visibleBatches order
+	std::vector<DrawSort::SortItem> sortScratch;
+
+	// Per recording thread for the current frame, and totals since startup
+	std::vector<DrawStats> threadDrawStats;
+	DrawStats drawStats;
+
+	// Occlusion culling for the CPU path. A few occluder objects are rasterized into a coarse
+	// depth buffer each frame, and frustum-visible instances hidden behind them are dropped.
+	// Occluder objects must stay in the scene while they are registered.
+	SoftwareOcclusion softwareOcclusion;
+	bool softwareOcclusionEnabled;
+	std::vector<std::pair<ObjectId, OccluderMeshId>> occluders;
+
+	// Depth buffer format. The image is a transient render graph image.
 	VkFormat depthImageFormat;
 
 	// Texture stuff:
+	// Textures are decoded on the job system while Vulkan starts up, then uploaded once it's ready
+	JobCounter textureLoads;
+	std::unique_ptr<STB_RGBA_Image> statueImage;
+
 	VkImage textureImage;
 	VkDeviceMemory textureImageMemory;
 	VkImageView textureImageView;
-	VkSampler textureImageSampler;
+	VkSampler textureImageSampler; // Shared by every bindless texture
 
+	// Bindless textures. Every texture lives in one big sampled image array in its own set, which
+	// the fragment shader indexes by material, so drawing another texture never switches sets.
+	// With descriptor indexing the array is partially bound and can be written while in use.
+	bool physicalDeviceProperties2Enabled; // VK_KHR_get_physical_device_properties2, to query the features
+	bool descriptorIndexingSupported;
+	uint32_t bindlessTextureCapacity;
+	VkDescriptorSetLayout bindlessDescriptorSetLayout;
+	VkDescriptorPool bindlessDescriptorPool;
+	VkDescriptorSet bindlessDescriptorSet;
+	std::vector<VkImageView> bindlessTextureViews; // Per material, null if not set
 
-	// Framebuffers
-	std::vector <VkFramebuffer> swapchainFramebuffers;
 
-	// Command pool / buffers
+	// Command pools for one-off commands. Per-frame command buffers live in frames.
 	VkCommandPool graphicsCommandPool;
 	VkCommandPool transferCommandPool;
-	std::vector<VkCommandBuffer> commandBuffers;
 
-	// Rendering synchronoization 
-	VkSemaphore imageAvailableSem;
-	VkSemaphore renderFinishedSem;
+	// Per-frame command buffers, synchronization and CPU-written buffers, indexed by currentFrame
+	std::vector<FrameResources> frames;
+	uint32_t currentFrame;
+
+	// Number of frames submitted so far
+	uint64_t frameCount;
+
+	// Objects waiting for the GPU to finish with them
+	FrameDeletionQueue deletionQueue;
 
 
 private: // methods
@@ -348,7 +781,7 @@ private: // methods
 	void initQueuesAndDevice();
 
 	// set up the swapchain
-	void initSwapchain();
+	void initSwapchain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
 
 	// Clean up previously-created swapchain
 	void cleanupSwapchain();
@@ -359,20 +792,76 @@ private: // methods
 	// Set up image views to use in swapchain
 	void initImageViews();
 
-	// Create render passes - how color and depth buffers are used
-	void createRenderPass();
+	// Declare the frame's passes and the images they use, and compile them into render passes,
+	// framebuffers and barriers
+	void initRenderGraph();
 
 	// Configure pipeline	
 	void initGraphicsPipeline();
 
-	// Set up framebuffers
-	void initFramebuffers();
+	// Build the main graphics pipeline, or one of the depth-only ones, from the current shader
+	// sources. Returns false, with compiler output in outErrors, if a shader fails to compile.
+	bool buildGraphicsPipeline(GraphicsPipelineType type, VkPipeline& outPipeline, std::string& outErrors);
 
-	// Set up command pool
-	void initCommandPools();
+	// Give a main pass its depth: written, or only tested when a prepass has already written it
+	void setMainPassDepth(RenderPassId pass, RenderResourceId depth, VkAttachmentLoadOp loadOp);
+
+	// Set up the timestamp queries frame times are measured with, and what upscaling needs that
+	// doesn't depend on the swapchain
+	void initDynamicResolution();
+
+	// Build the pipeline that stretches the scene over the backbuffer, from the current shader sources
+	bool buildUpscalePipeline(VkPipeline& outPipeline, std::string& outErrors);
+
+	// Stretch the rendered part of sceneColor over the backbuffer
+	void recordUpscale(VkCommandBuffer commandBuffer);
+
+	// Feed the GPU time of the frame's last submission to dynamicResolution, and pick the extent to
+	// render this frame at. Must be called once the frame's previous submission has finished.
+	void updateRenderScale(FrameResources& frame);
+
+	// Set up the static shadow cache, its render pass, and the samplers and layouts shadows use
+	// that don't depend on the swapchain
+	void initShadows();
+
+	// Build the pipeline that copies the static shadow cache into the shadow map
+	bool buildShadowCopyPipeline(VkPipeline& outPipeline, std::string& outErrors);
+
+	// Mark the static shadow cache stale if static objects changed, and write this frame's shadow caster
+	// instances. Must be called after updateUniformBuffer, which fits the cascades, and updateInstanceBuffer.
+	void updateShadows(FrameResources& frame);
 
-	// Set up depth buffer
-	void initDepthResources();
+	// Redraw static casters into the cascades of the shadow cache that are stale. Must be outside a render pass.
+	void recordStaticShadows(VkCommandBuffer commandBuffer, const FrameResources& frame);
+
+	// Copy the static shadow cache into the shadow map, and draw dynamic casters over it
+	void recordShadows(VkCommandBuffer commandBuffer, const FrameResources& frame);
+
+	// Draw the static or dynamic shadow casters into one cascade of whichever atlas is being rendered to.
+	// The shadow pipeline and buffers must already be bound.
+	void recordShadowCasters(VkCommandBuffer commandBuffer, uint32_t cascade, bool isStatic);
+
+	// Register pipelines with the shader watcher, so they can be rebuilt when their sources change
+	void initShaderHotReload();
+
+	// Rebuild any pipelines whose shader sources changed. Old pipelines are retired, not destroyed,
+	// since in-flight frames may still be using them.
+	void reloadChangedShaders();
+
+	// Destroy an object once all frames submitted so far have completed
+	void retireObject(std::function<void()> destroy);
+
+	template <typename T, void (VKAPI_PTR* destroyFunc)(VkDevice, T, const VkAllocationCallbacks*)>
+	void retireObject(VulkanDestructWrapper<T, destroyFunc>&& object)
+	{
+		deletionQueue.retire(frameCount, std::move(object));
+	}
+
+	// Destroy retired objects that are no longer in use by the GPU
+	void destroyRetiredObjects();
+
+	// Set up command pools, including each frame's per-thread pools
+	void initCommandPools();
 
 	// Set up vertex buffers
 	void initVertexBuffers();
@@ -380,23 +869,165 @@ private: // methods
 	// Set up index buffers
 	void initIndexBuffers();
 
-	// Set up command buffers
+	// Allocate each frame's primary and per-thread secondary command buffers
 	void initCommandBuffers();
 
-	// Set up UBO
+	// Record the frame's primary command buffer, drawing into the swapchain image at imageIndex.
+	// Draws are split across threads, each recording a secondary command buffer.
+	void recordCommandBuffer(FrameResources& frame, uint32_t imageIndex);
+
+	// Record draws [firstDraw, lastDraw) into a secondary command buffer that continues the given
+	// render graph pass. A draw is one batch, or all batches when the GPU supplies the draw count.
+	// With GPU culling, phase picks which culling phase's draws to make. depthOnly draws with the
+	// depth prepass pipeline. Binds and draws recorded are added to outStats.
+	void recordDraws(VkCommandBuffer commandBuffer, const FrameResources& frame, RenderPassId pass, uint32_t imageIndex,
+		CullPhase phase, bool depthOnly, size_t firstDraw, size_t lastDraw, DrawStats& outStats);
+
+	// What a draw with key needs to bind after a draw with boundKey. first is the first draw in
+	// its command buffer, which starts with nothing bound.
+	static DrawBinds getDrawBinds(uint64_t key, uint64_t boundKey, bool first);
+
+	// Set up each frame's instance buffer, sized for the current scene plus some headroom
+	void initInstanceBuffer();
+
+	// Set up each frame's light and cluster buffers, with room for every light in lights
+	void initLightBuffers();
+
+	// Set up the light binning pipeline and its descriptor layout
+	void initLightBinPipeline();
+
+	// Copy lights into the frame's light buffer. Must be called once the frame's previous submission has finished.
+	void updateLightBuffer(FrameResources& frame);
+
+	// Record binning the frame's lights into its clusters. Must be outside a render pass.
+	void recordLightBinning(VkCommandBuffer commandBuffer, const FrameResources& frame);
+
+	// Add procedural skinned meshes to the scene, each animated instance with its own copy of its mesh
+	void loadSkinnedMeshes();
+
+	// Upload skinned meshes' bind poses, and set up each frame's palette and the skinning pipeline
+	void initSkinning();
+
+	// Sample every animation into the frame's palette. Must be called once the frame's previous
+	// submission has finished.
+	void updateSkinning(FrameResources& frame);
+
+	// Record skinning every animated instance into the vertex and position buffers. Must be outside a render pass.
+	void recordSkinning(VkCommandBuffer commandBuffer, const FrameResources& frame);
+
+	// Set up the particle buffers with every slot free, and the particle compute pipelines
+	void initParticles();
+
+	// Build the pipeline that draws particles, from the current shader sources
+	bool buildParticlePipeline(VkPipeline& outPipeline, std::string& outErrors);
+
+	// Step the particle system to the last UBO update's time. Must be called once per recorded frame.
+	void updateParticles();
+
+	// Record emitting, simulating and compacting particles. Must be outside a render pass.
+	void recordParticleSimulation(VkCommandBuffer commandBuffer, const FrameResources& frame);
+
+	// Draw the particles simulation left alive, inside the Particles pass
+	void recordParticles(VkCommandBuffer commandBuffer, const FrameResources& frame);
+
+	// Build the sprite atlas, and set up each frame's sprite buffer and the sprite pipeline layout
+	void initSprites();
+
+	// Build the pipeline that draws sprites, from the current shader sources
+	bool buildSpritePipeline(VkPipeline& outPipeline, std::string& outErrors);
+
+	// Collect this frame's sprites and write them into the frame's sprite buffer. Must be called
+	// once the frame's previous submission has finished.
+	void updateSprites(FrameResources& frame);
+
+	// Draw the frame's sprites, inside the Sprites pass
+	void recordSprites(VkCommandBuffer commandBuffer, const FrameResources& frame);
+
+	// Create a device local buffer holding size bytes of data, through a staging buffer
+	void createDeviceBuffer(const void* data, size_t size, VkBufferUsageFlags usage, VkBuffer& outBuffer, VkDeviceMemory& outMemory);
+
+	// Rebuild batches if needed, and bring the frame's instance buffer and culling inputs up to date.
+	// Must be called once the frame's previous submission has finished.
+	void updateInstanceBuffer(FrameResources& frame);
+
+	// Set up descriptor layouts and compute pipelines for GPU culling and the depth pyramid
+	void initCullPipelines();
+
+	// Build a compute pipeline from the GLSL file at path
+	bool buildComputePipeline(const std::string& path, VkPipelineLayout layout, VkPipeline& outPipeline, std::string& outErrors);
+
+	// Create the culling buffers and each frame's descriptor set, sized for the current instance and batch capacity
+	void initCullBuffers();
+
+	// Retire the culling buffers and descriptor sets, e.g. before growing them
+	void retireCullBuffers();
+
+	// Point the frame's culling descriptor set at the current depth pyramid. Only once the frame's
+	// fence has signaled, since the set may be in use until then.
+	void writeCullPyramidDescriptor(FrameResources& frame);
+
+	// Create the depth pyramid for the current swapchain size. The next frame clears it to the far
+	// plane, so nothing is occluded until it has been drawn.
+	void initDepthPyramid();
+
+	// Point the downsample descriptor sets at the depth buffer and pyramid levels
+	void writeDepthPyramidDescriptors(VkImageView depthView);
+
+	// Retire the pyramid, its views and its descriptor sets, which in-flight frames may still use
+	void destroyDepthPyramid();
+
+	// Clear a new pyramid to the far plane and leave it in the layout culling reads it in
+	void recordDepthPyramidClear(VkCommandBuffer commandBuffer);
+
+	// Record the downsample of the depth buffer into every level of the pyramid
+	void recordDepthPyramid(VkCommandBuffer commandBuffer);
+
+	// Write the frame's per-batch and per-instance culling inputs for the current scene batches
+	void writeCullBatches(FrameResources& frame);
+
+	// Record one phase's culling dispatches. Must be outside a render pass.
+	void recordGpuCulling(VkCommandBuffer commandBuffer, const FrameResources& frame, CullPhase phase);
+
+	// Frustum cull the scene on the CPU, and pack visible instances into the frame's instance buffer
+	// as visibleBatches. Must be called once the frame's previous submission has finished.
+	void cullInstancesCpu(FrameResources& frame);
+
+	// Build a sort key for each visible batch and sort them into sortedDraws. Within a pipeline and
+	// mesh, batches whose nearest instance is closer come first.
+	void sortDraws();
+
+	// Cast a ray through the cursor and report the object under it
+	void pickObjectAtCursor();
+
+	// Attach a new transform node to an object, so the object follows it
+	TransformId addObjectTransform(ObjectId object, TransformId parent, const glm::vec3& translation, const glm::vec3& scale);
+
+	// Recompute moved transforms and push their world matrices to the scene
+	void updateTransforms();
+
+	// Apply every command submitted to renderCommands since the last frame
+	void applyRenderCommands();
+
+	// Set up a UBO for each frame
 	void initUniformBuffer();
 
-	// Set up semaphores / other synchro stuff
+	// Set up semaphores and fences for each frame
 	void initSynchro();
 
 	// Set up UBO descriptor set
 	void initDescriptorSetLayout();
 
-	// Create pool for allocating descriptor sets
-	void initDescriptorPool();
+	// Set up the bindless texture array's layout, pool and set, sized to what the device allows
+	void initBindlessTextures();
 
-	// Create set of descriptors
-	void initDescriptorSet();
+	// Point material's slot in the bindless texture array at view. Without descriptor indexing,
+	// every slot must be valid and can't change while in use: the first texture set also fills
+	// every empty slot, and this must only be called while no frames are in flight.
+	void setMaterialTexture(MaterialId material, VkImageView view);
+
+	// Get the frame's descriptor set from this frame's descriptor pools. Must be called once the
+	// frame's previous submission has finished.
+	void updateFrameDescriptors(FrameResources& frame);
 
 	void loadModel();
 
@@ -408,16 +1039,21 @@ private: // methods
 
 	void createTextureImage();
 
-	// Update uniform buffer based on application state
-	void updateUniformBuffer();
+	// Create a sampled texture from RGBA8 pixels, through a staging buffer, and leave it ready for
+	// fragment shaders to read
+	void uploadTexture(const void* pixels, uint32_t width, uint32_t height, VkImage& outImage, VkDeviceMemory& outMemory, VkImageView& outView);
+
+	// Update the frame's uniform buffer based on application state
+	void updateUniformBuffer(FrameResources& frame);
 
 	// Choose the best available type of GPU memory
 	static uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkPhysicalDevice& physicalDevice);
 
-	// create shader module from raw bytecode
-	VkShaderModule createShaderModule(const std::vector<char>& bytecode, VkDevice& device);
+	// create shader module from SPIR-V words
+	VkShaderModule createShaderModule(const std::vector<uint32_t>& spirv, VkDevice& device);
 
-	static std::vector<char> readFileBytes(const std::string& filename);
+	// Compile the GLSL file at path and wrap it in a shader module. Returns false on compile failure.
+	bool loadShaderModule(const std::string& path, VkShaderModule& outModule, std::string& outErrors);
 
 	uint32_t calcSuitabilityScore(const VkPhysicalDevice& device, const VkSurfaceKHR& surface) const;
 	
@@ -437,6 +1073,12 @@ private: // methods
 
 	bool checkDeviceExtensionSupport(const VkPhysicalDevice& device) const;
 
+	// Check for a single, optional device extension
+	bool isDeviceExtensionAvailable(const VkPhysicalDevice& device, const char* extensionName) const;
+
+	// Check for a single, optional instance extension
+	bool isInstanceExtensionAvailable(const char* extensionName) const;
+
 	static VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 
 	// Choose the swap chain presentation mode. Currently using mailbox so we can use tripple buffering.
@@ -469,7 +1111,8 @@ private: // methods
 		VkFormat format,
 		VkImageTiling tiling,
 		VkImageUsageFlags usageFlags,
-		VkMemoryPropertyFlags memPropFlags
+		VkMemoryPropertyFlags memPropFlags,
+		uint32_t mipLevels = 1
 	);
 
 	// Create a command buffer that is executed once
@@ -498,7 +1141,9 @@ private: // methods
 		VkImage image,
 		VkFormat format,
 		VkImageAspectFlags aspectFlags,
-		VkImageView& outImageView
+		VkImageView& outImageView,
+		uint32_t baseMipLevel = 0,
+		uint32_t levelCount = 1
 	);
 
 	bool copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
@@ -518,6 +1163,8 @@ private: // methods
 
 	static void onWindowResized(GLFWwindow* window, int width, int height);
 
+	static void onMouseButton(GLFWwindow* window, int button, int action, int mods);
+
 	void mainLoop();
 
 	void drawFrame();
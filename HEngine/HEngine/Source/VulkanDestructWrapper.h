@@ -1,26 +1,102 @@
 #pragma once
 
-#include <functional>
+#include <utility>
 #include <vulkan\vulkan.h>
 
 // RAII wrapper class for Vulkan objects. Vulkan is a C API, so there are no destructors.
 // By wrapping Vulkan objects in instances of this class, we can ensure proper destruction.
-template <typename T>
+// The destroy function is a template parameter, so a wrapper is just the handle and its device.
+// Wrappers can be moved but not copied, since only one of them can destroy the object.
+template <typename T, void (VKAPI_PTR* destroyFunc)(VkDevice, T, const VkAllocationCallbacks*)>
 class VulkanDestructWrapper
 {
 
 public:
 
-	// Default constructor, deleter does nothing
-	VulkanDestructWrapper() 
+	// Default constructor, holds nothing
+	VulkanDestructWrapper()
 		:
-		VulkanDestructWrapper([](T, VkAllocationCallbacks*) {}) { }
+		device(VK_NULL_HANDLE),
+		handle(VK_NULL_HANDLE)
+	{ }
 
-	//	VulkanDestructWrapper(const VulkanDestructWrapper<VkInstance>& instance, std::function<void(VkInstance, T, VkAllocationCallbacks*> deletefn))
+	// Take ownership of handle, which was created on device
+	VulkanDestructWrapper(VkDevice _device, T _handle)
+		:
+		device(_device),
+		handle(_handle)
+	{ }
+
+	~VulkanDestructWrapper()
+	{
+		reset();
+	}
+
+	VulkanDestructWrapper(VulkanDestructWrapper&& other)
+		:
+		device(other.device),
+		handle(other.release())
+	{ }
+
+	VulkanDestructWrapper& operator=(VulkanDestructWrapper&& rhs)
+	{
+		if (this != &rhs)
+		{
+			reset();
+			device = rhs.device;
+			handle = rhs.release();
+		}
+		return *this;
+	}
+
+	// Copies disallowed
+	VulkanDestructWrapper(const VulkanDestructWrapper& other)          = delete;
+	VulkanDestructWrapper& operator=(const VulkanDestructWrapper& rhs) = delete;
+
+	T get() const { return handle; }
+
+	// So a wrapper can be passed straight to Vulkan functions
+	operator T() const { return handle; }
+
+	// Destroy the object now, if there is one
+	void reset()
+	{
+		if (handle != VK_NULL_HANDLE)
+		{
+			destroyFunc(device, handle, nullptr);
+			handle = VK_NULL_HANDLE;
+		}
+	}
+
+	// Destroy the current object, if any, and take ownership of handle
+	void reset(VkDevice _device, T _handle)
+	{
+		reset();
+		device = _device;
+		handle = _handle;
+	}
 
+	// Give up ownership without destroying the object
+	T release()
+	{
+		T released = handle;
+		handle = VK_NULL_HANDLE;
+		return released;
+	}
 
 private:
 
+	VkDevice device;
+	T handle;
 
+};
 
-};
\ No newline at end of file
+typedef VulkanDestructWrapper<VkBuffer, vkDestroyBuffer> UniqueBuffer;
+typedef VulkanDestructWrapper<VkDeviceMemory, vkFreeMemory> UniqueDeviceMemory;
+typedef VulkanDestructWrapper<VkImage, vkDestroyImage> UniqueImage;
+typedef VulkanDestructWrapper<VkImageView, vkDestroyImageView> UniqueImageView;
+typedef VulkanDestructWrapper<VkSampler, vkDestroySampler> UniqueSampler;
+typedef VulkanDestructWrapper<VkDescriptorPool, vkDestroyDescriptorPool> UniqueDescriptorPool;
+typedef VulkanDestructWrapper<VkPipeline, vkDestroyPipeline> UniquePipeline;
+typedef VulkanDestructWrapper<VkPipelineLayout, vkDestroyPipelineLayout> UniquePipelineLayout;
+typedef VulkanDestructWrapper<VkSwapchainKHR, vkDestroySwapchainKHR> UniqueSwapchain;
@@ -0,0 +1,120 @@
+#include "animation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "parallel_util.h"
+
+// Fewer instances than this per thread aren't worth the thread
+static const size_t minInstancesPerThread = 16;
+
+SkeletonId AnimationSystem::addSkeleton(const Skeleton& skeleton)
+{
+	if (skeleton.parents.size() != skeleton.inverseBindMatrices.size())
+	{
+		throw std::runtime_error("AnimationSystem::addSkeleton -- every joint needs an inverse bind matrix");
+	}
+
+	for (size_t joint = 0; joint < skeleton.parents.size(); ++joint)
+	{
+		if (skeleton.parents[joint] >= static_cast<int32_t>(joint))
+		{
+			throw std::runtime_error("AnimationSystem::addSkeleton -- parents must come before their children");
+		}
+	}
+
+	skeletons.push_back(skeleton);
+	return static_cast<SkeletonId>(skeletons.size() - 1);
+}
+
+ClipId AnimationSystem::addClip(const AnimationClip& clip)
+{
+	if (clip.keyTimes.empty() || clip.keys.size() != clip.keyTimes.size() * clip.jointCount || clip.duration <= 0.0f)
+	{
+		throw std::runtime_error("AnimationSystem::addClip -- clip needs keys for every joint, and a duration");
+	}
+
+	clips.push_back(clip);
+	return static_cast<ClipId>(clips.size() - 1);
+}
+
+AnimatedId AnimationSystem::addInstance(SkeletonId skeleton, ClipId clip, float timeOffset, float speed)
+{
+	if (skeleton >= skeletons.size() || clip >= clips.size() ||
+		clips[clip].jointCount != skeletons[skeleton].parents.size())
+	{
+		throw std::runtime_error("AnimationSystem::addInstance -- clip doesn't match skeleton");
+	}
+
+	Instance instance;
+	instance.skeleton = skeleton;
+	instance.clip = clip;
+	instance.timeOffset = timeOffset;
+	instance.speed = speed;
+	instance.firstJoint = static_cast<uint32_t>(palette.size());
+	instances.push_back(instance);
+
+	palette.resize(palette.size() + clips[clip].jointCount, glm::mat4(1.0f));
+	return static_cast<AnimatedId>(instances.size() - 1);
+}
+
+void AnimationSystem::update(float time)
+{
+	// Instances don't share anything they write, so ranges of them can be sampled independently
+	glm::mat4* outPalette = palette.data();
+	ParallelUtil::parallelFor(instances.size(), minInstancesPerThread, 1, [this, time, outPalette](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const Instance& instance = instances[i];
+			sampleClip(skeletons[instance.skeleton], clips[instance.clip], instance.timeOffset + time * instance.speed,
+				outPalette + instance.firstJoint);
+		}
+	});
+}
+
+void AnimationSystem::sampleClip(const Skeleton& skeleton, const AnimationClip& clip, float clipTime, glm::mat4* outPalette)
+{
+	// Find the keys either side of the looped time
+	float t = std::fmod(clipTime, clip.duration);
+	if (t < 0.0f)
+	{
+		t += clip.duration;
+	}
+
+	size_t keyCount = clip.keyTimes.size();
+	size_t next = std::upper_bound(clip.keyTimes.begin(), clip.keyTimes.end(), t) - clip.keyTimes.begin();
+	size_t previous = next > 0 ? next - 1 : 0;
+	next = std::min(next, keyCount - 1);
+
+	float span = clip.keyTimes[next] - clip.keyTimes[previous];
+	float blend = span > 0.0f ? (t - clip.keyTimes[previous]) / span : 0.0f;
+
+	// Model-space joint matrices first. Parents come before children, so each parent is done by the
+	// time its children need it.
+	for (uint32_t joint = 0; joint < clip.jointCount; ++joint)
+	{
+		const JointPose& a = clip.keys[joint * keyCount + previous];
+		const JointPose& b = clip.keys[joint * keyCount + next];
+
+		glm::vec3 translation = glm::mix(a.translation, b.translation, blend);
+		glm::quat rotation = glm::slerp(a.rotation, b.rotation, blend);
+		glm::vec3 scale = glm::mix(a.scale, b.scale, blend);
+
+		glm::mat4 local = glm::mat4_cast(rotation);
+		local[0] *= scale.x;
+		local[1] *= scale.y;
+		local[2] *= scale.z;
+		local[3] = glm::vec4(translation, 1.0f);
+
+		int32_t parent = skeleton.parents[joint];
+		outPalette[joint] = parent >= 0 ? outPalette[parent] * local : local;
+	}
+
+	// Then from the bind pose to the sampled pose, which is what skinning wants
+	for (uint32_t joint = 0; joint < clip.jointCount; ++joint)
+	{
+		outPalette[joint] = outPalette[joint] * skeleton.inverseBindMatrices[joint];
+	}
+}
@@ -0,0 +1,88 @@
+/* Defines skeletal animation. A Skeleton is a tree of joints; an AnimationClip holds keyframed
+   local poses for every joint. AnimationSystem plays clips on any number of instances, and samples
+   them all into one palette of skinning matrices per frame, split across worker threads. The
+   palette is what skinning reads: each instance's joints are a contiguous range of it. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+typedef uint32_t SkeletonId;
+typedef uint32_t ClipId;
+typedef uint32_t AnimatedId;
+
+struct Skeleton
+{
+	// Parent of each joint, or -1 for a root. Parents come before their children.
+	std::vector<int32_t> parents;
+
+	// Model space to each joint's space in the bind pose
+	std::vector<glm::mat4> inverseBindMatrices;
+};
+
+// A joint's transform relative to its parent
+struct JointPose
+{
+	glm::vec3 translation;
+	glm::quat rotation;
+	glm::vec3 scale;
+};
+
+struct AnimationClip
+{
+	uint32_t jointCount;
+
+	// Times of the keys, ascending, in [0, duration]. Clips loop, so the last key should match the first.
+	std::vector<float> keyTimes;
+	float duration;
+
+	// keyTimes.size() poses per joint, joint by joint
+	std::vector<JointPose> keys;
+};
+
+class AnimationSystem
+{
+public:
+	SkeletonId addSkeleton(const Skeleton& skeleton);
+
+	ClipId addClip(const AnimationClip& clip);
+
+	// Play clip, looping, on a new instance of skeleton. The clip starts timeOffset seconds in and
+	// plays at speed. The instance's joints take the next entries of the palette, one per joint.
+	AnimatedId addInstance(SkeletonId skeleton, ClipId clip, float timeOffset, float speed);
+
+	// First of the instance's joints in the palette
+	uint32_t getFirstJoint(AnimatedId instance) const { return instances[instance].firstJoint; }
+
+	size_t getInstanceCount() const { return instances.size(); }
+
+	// Entries in the palette, for every instance
+	uint32_t getJointCount() const { return static_cast<uint32_t>(palette.size()); }
+
+	// Sample every instance's clip at time, in seconds, into the palette
+	void update(float time);
+
+	// Skinning matrices of every instance's joints. Valid after update()
+	const std::vector<glm::mat4>& getPalette() const { return palette; }
+
+	// Sample clip at clipTime, looping, into outPalette, which holds a matrix per joint of skeleton
+	static void sampleClip(const Skeleton& skeleton, const AnimationClip& clip, float clipTime, glm::mat4* outPalette);
+
+private:
+	struct Instance
+	{
+		SkeletonId skeleton;
+		ClipId clip;
+		float timeOffset;
+		float speed;
+		uint32_t firstJoint;
+	};
+
+	std::vector<Skeleton> skeletons;
+	std::vector<AnimationClip> clips;
+	std::vector<Instance> instances;
+	std::vector<glm::mat4> palette;
+};
@@ -0,0 +1,508 @@
+#include "benchmarks.h"
+
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <functional>
+#include <thread>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "bounds.h"
+#include "bvh.h"
+#include "ecs.h"
+#include "ecs_systems.h"
+#include "frustum_culling.h"
+#include "job_system.h"
+#include "parallel_util.h"
+#include "software_occlusion.h"
+
+namespace Benchmarks
+{
+	// Runs func a few times and returns the best time in milliseconds, which is the least noisy
+	static double timeBest(int runs, const std::function<void()>& func)
+	{
+		double best = std::numeric_limits<double>::max();
+		for (int i = 0; i < runs; ++i)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			func();
+			auto end = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		return best;
+	}
+
+	static void printResult(const std::string& name, double ms, size_t objectCount, double baselineMs)
+	{
+		std::cout << std::left << std::setw(24) << name
+			<< std::right << std::fixed << std::setprecision(3) << std::setw(10) << ms << " ms"
+			<< std::setw(10) << std::setprecision(1) << (objectCount / 1000.0) / ms << " M obj/s"
+			<< std::setw(8) << std::setprecision(2) << baselineMs / ms << "x" << std::endl;
+	}
+
+	// Some arithmetic per item, so jobs are bound by compute rather than memory bandwidth
+	static void processItems(float* items, size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			float x = static_cast<float>(i);
+			for (int j = 0; j < 32; ++j)
+			{
+				x = std::sqrt(x * 1.0001f + 1.0f);
+			}
+			items[i] = x;
+		}
+	}
+
+	void runCullingBenchmark(size_t objectCount)
+	{
+		const int runs = 10;
+
+		// Objects scattered through a cube around a camera at the origin, so roughly a
+		// quarter of them are visible
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> radius(0.1f, 2.0f);
+
+		SphereBoundsArray bounds;
+		bounds.resize(objectCount);
+		for (size_t i = 0; i < objectCount; ++i)
+		{
+			bounds.set(i, glm::vec4(position(rng), position(rng), position(rng), radius(rng)));
+		}
+
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 proj = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.1f, 150.0f);
+		Frustum frustum = Frustum::fromMatrix(proj * view);
+
+		std::vector<uint32_t> visible(bounds.paddedSize());
+		size_t expectedCount = 0;
+		size_t visibleCount = 0;
+
+		std::cout << "Frustum culling, " << objectCount << " spheres, best of " << runs << " runs" << std::endl;
+
+		double scalarMs = timeBest(runs, [&]()
+		{
+			expectedCount = FrustumCulling::cullSpheres(frustum, bounds, 0, bounds.paddedSize(), visible.data(), FrustumCulling::Scalar);
+		});
+		std::vector<uint32_t> expected(visible.begin(), visible.begin() + expectedCount);
+		printResult("Scalar", scalarMs, objectCount, scalarMs);
+
+		auto check = [&](const std::string& name)
+		{
+			if (visibleCount != expectedCount || !std::equal(expected.begin(), expected.end(), visible.begin()))
+			{
+				std::cout << "  MISMATCH: " << name << " found " << visibleCount << " visible, expected " << expectedCount << std::endl;
+			}
+		};
+
+		double sseMs = timeBest(runs, [&]()
+		{
+			visibleCount = FrustumCulling::cullSpheres(frustum, bounds, 0, bounds.paddedSize(), visible.data(), FrustumCulling::SSE);
+		});
+		printResult("SSE", sseMs, objectCount, scalarMs);
+		check("SSE");
+
+		if (FrustumCulling::getSupportedSimdLevel() >= FrustumCulling::AVX)
+		{
+			double avxMs = timeBest(runs, [&]()
+			{
+				visibleCount = FrustumCulling::cullSpheres(frustum, bounds, 0, bounds.paddedSize(), visible.data(), FrustumCulling::AVX);
+			});
+			printResult("AVX", avxMs, objectCount, scalarMs);
+			check("AVX");
+		}
+
+		std::vector<uint32_t> parallelVisible;
+		double parallelMs = timeBest(runs, [&]()
+		{
+			FrustumCulling::cullSpheresParallel(frustum, bounds, parallelVisible);
+		});
+		std::copy(parallelVisible.begin(), parallelVisible.end(), visible.begin());
+		visibleCount = parallelVisible.size();
+		printResult("Parallel (" + std::to_string(ParallelUtil::getThreadCount()) + " threads)", parallelMs, objectCount, scalarMs);
+		check("Parallel");
+
+		std::cout << expectedCount << " visible (" << std::setprecision(1) << 100.0 * expectedCount / objectCount << "%)" << std::endl;
+	}
+
+	void runBvhBenchmark(size_t objectCount)
+	{
+		const int runs = 10;
+		const int rayCount = 1000;
+
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> size(0.1f, 2.0f);
+		std::uniform_real_distribution<float> offset(-0.5f, 0.5f);
+
+		std::vector<Aabb> boxes(objectCount);
+		for (Aabb& box : boxes)
+		{
+			glm::vec3 center(position(rng), position(rng), position(rng));
+			glm::vec3 halfExtent(size(rng), size(rng), size(rng));
+			box.min = center - halfExtent;
+			box.max = center + halfExtent;
+		}
+
+		std::vector<Ray> rays;
+		for (int i = 0; i < rayCount; ++i)
+		{
+			glm::vec3 origin(position(rng), position(rng), position(rng));
+			glm::vec3 direction(position(rng), position(rng), position(rng));
+			rays.push_back(Ray(origin, glm::normalize(direction)));
+		}
+
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 proj = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.1f, 150.0f);
+		Frustum frustum = Frustum::fromMatrix(proj * view);
+
+		std::cout << "BVH, " << objectCount << " boxes, best of " << runs << " runs" << std::endl;
+
+		Bvh bvh;
+		double buildMs = timeBest(runs, [&]()
+		{
+			bvh.build(boxes);
+		});
+		std::cout << "Build: " << std::fixed << std::setprecision(3) << buildMs << " ms, " << bvh.getNodeCount() << " nodes" << std::endl;
+
+		// Jitter every box a little, as if everything moved for a frame
+		std::vector<Aabb> movedBoxes = boxes;
+		for (Aabb& box : movedBoxes)
+		{
+			glm::vec3 delta(offset(rng), offset(rng), offset(rng));
+			box.min += delta;
+			box.max += delta;
+		}
+
+		double refitMs = timeBest(runs, [&]()
+		{
+			bvh.refit(movedBoxes);
+		});
+		std::cout << "Refit: " << refitMs << " ms, cost ratio " << std::setprecision(2) << bvh.getCostRatio() << std::endl;
+		bvh.build(boxes);
+
+		// Frustum query, against testing every box
+		std::vector<uint32_t> results;
+		size_t linearCount = 0;
+		double linearFrustumMs = timeBest(runs, [&]()
+		{
+			linearCount = 0;
+			for (const Aabb& box : boxes)
+			{
+				uint32_t planeMask = (1u << Frustum::PlaneCount) - 1;
+				linearCount += frustum.test(box, planeMask) != Frustum::Outside ? 1 : 0;
+			}
+		});
+		double bvhFrustumMs = timeBest(runs, [&]()
+		{
+			results.clear();
+			bvh.queryFrustum(frustum, results);
+		});
+		std::cout << std::setprecision(3) << "Frustum: linear " << linearFrustumMs << " ms, BVH " << bvhFrustumMs << " ms ("
+			<< results.size() << " visible" << (results.size() == linearCount ? "" : ", MISMATCH") << ")" << std::endl;
+
+		// Closest-hit ray casts, against testing every box
+		int linearHits = 0;
+		double linearRayMs = timeBest(runs, [&]()
+		{
+			linearHits = 0;
+			for (const Ray& ray : rays)
+			{
+				float closest = std::numeric_limits<float>::max();
+				for (const Aabb& box : boxes)
+				{
+					float distance = ray.intersect(box, closest);
+					if (distance >= 0.0f)
+					{
+						closest = distance;
+					}
+				}
+				linearHits += closest < std::numeric_limits<float>::max() ? 1 : 0;
+			}
+		});
+		int bvhHits = 0;
+		double bvhRayMs = timeBest(runs, [&]()
+		{
+			bvhHits = 0;
+			for (const Ray& ray : rays)
+			{
+				uint32_t item;
+				float distance;
+				bvhHits += bvh.raycast(ray, std::numeric_limits<float>::max(), item, distance) ? 1 : 0;
+			}
+		});
+		std::cout << "Raycast x" << rayCount << ": linear " << linearRayMs << " ms, BVH " << bvhRayMs << " ms ("
+			<< bvhHits << " hits" << (bvhHits == linearHits ? "" : ", MISMATCH") << ")" << std::endl;
+
+		double sphereMs = timeBest(runs, [&]()
+		{
+			results.clear();
+			bvh.querySphere(glm::vec3(0.0f), 10.0f, results);
+		});
+		std::cout << "Radius query: " << sphereMs << " ms (" << results.size() << " found)" << std::endl;
+	}
+
+	void runOcclusionBenchmark(size_t objectCount)
+	{
+		const int runs = 10;
+		const int occluderCount = 16;
+
+		if (!SoftwareOcclusion::isSupported())
+		{
+			std::cout << "Software occlusion needs AVX2, which this CPU doesn't have" << std::endl;
+			return;
+		}
+
+		// Same scene as the culling benchmark
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> radius(0.1f, 2.0f);
+
+		SphereBoundsArray bounds;
+		bounds.resize(objectCount);
+		for (size_t i = 0; i < objectCount; ++i)
+		{
+			bounds.set(i, glm::vec4(position(rng), position(rng), position(rng), radius(rng)));
+		}
+
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 proj = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.1f, 150.0f);
+		Frustum frustum = Frustum::fromMatrix(proj * view);
+
+		// A unit cube, as ObjUtil::loadObj would give it
+		std::vector<Vertex3D> cubeVertices(8);
+		for (uint32_t i = 0; i < 8; ++i)
+		{
+			cubeVertices[i].pos = glm::vec3((i & 1) ? 0.5f : -0.5f, (i & 2) ? 0.5f : -0.5f, (i & 4) ? 0.5f : -0.5f);
+		}
+		std::vector<uint32_t> cubeIndices = {
+			0, 1, 3, 3, 2, 0,
+			4, 6, 7, 7, 5, 4,
+			0, 4, 5, 5, 1, 0,
+			2, 3, 7, 7, 6, 2,
+			0, 2, 6, 6, 4, 0,
+			1, 5, 7, 7, 3, 1
+		};
+
+		SoftwareOcclusion occlusion(256, 128);
+		OccluderMeshId cube = occlusion.addOccluderMesh(cubeVertices, cubeIndices);
+
+		// A row of buildings in front of the camera
+		std::vector<glm::mat4> occluderTransforms;
+		for (int i = 0; i < occluderCount; ++i)
+		{
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3((i - occluderCount / 2) * 6.0f, 0.0f, -20.0f));
+			occluderTransforms.push_back(glm::scale(transform, glm::vec3(5.0f, 30.0f, 5.0f)));
+		}
+
+		std::vector<uint32_t> frustumVisible;
+		FrustumCulling::cullSpheresParallel(frustum, bounds, frustumVisible);
+
+		std::cout << "Software occlusion, " << occluderCount << " occluders, " << frustumVisible.size()
+			<< " spheres after frustum culling, best of " << runs << " runs" << std::endl;
+
+		double renderMs = timeBest(runs, [&]()
+		{
+			occlusion.beginFrame();
+			for (const glm::mat4& transform : occluderTransforms)
+			{
+				occlusion.addOccluder(cube, transform);
+			}
+			occlusion.render(proj * view);
+		});
+		std::cout << "Rasterize " << occlusion.getTriangleCount() << " triangles at " << occlusion.getWidth() << "x" << occlusion.getHeight()
+			<< ": " << std::fixed << std::setprecision(3) << renderMs << " ms" << std::endl;
+
+		std::vector<uint32_t> visible;
+		double testMs = timeBest(runs, [&]()
+		{
+			visible = frustumVisible;
+			occlusion.removeOccluded(bounds, visible);
+		});
+		std::cout << "Test: " << testMs << " ms, " << frustumVisible.size() - visible.size() << " occluded ("
+			<< std::setprecision(1) << 100.0 * (frustumVisible.size() - visible.size()) / std::max<size_t>(frustumVisible.size(), 1) << "%)" << std::endl;
+	}
+
+	void runJobSystemBenchmark(size_t itemCount)
+	{
+		const int runs = 10;
+		const size_t itemsPerJob = 256;
+
+		std::vector<unsigned> threadCounts;
+		unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+		{
+			threadCounts.push_back(threads);
+		}
+		threadCounts.push_back(maxThreads);
+
+		std::vector<float> items(itemCount);
+
+		std::cout << "Job system, " << itemCount << " items, best of " << runs << " runs" << std::endl;
+
+		// Even split: one range per thread
+		double baselineMs = 0.0;
+		for (unsigned threads : threadCounts)
+		{
+			JobSystem jobs(threads);
+			double ms = timeBest(runs, [&]()
+			{
+				jobs.parallelFor(itemCount, itemsPerJob, 1, [&](size_t begin, size_t end)
+				{
+					processItems(items.data(), begin, end);
+				});
+			});
+			baselineMs = threads == 1 ? ms : baselineMs;
+			printResult("parallelFor, " + std::to_string(threads) + " threads", ms, itemCount, baselineMs);
+		}
+
+		// Recursive split down to itemsPerJob. Each job queues its second half and does the first
+		// itself, so most jobs start in one queue and have to be stolen to spread out.
+		size_t jobCount = (itemCount + itemsPerJob - 1) / itemsPerJob;
+		for (unsigned threads : threadCounts)
+		{
+			JobSystem jobs(threads);
+			JobCounter counter;
+
+			std::function<void(size_t, size_t)> split = [&](size_t begin, size_t end)
+			{
+				while (end - begin > itemsPerJob)
+				{
+					size_t middle = begin + (end - begin) / 2;
+					jobs.run([&split, middle, end]()
+					{
+						split(middle, end);
+					}, &counter);
+					end = middle;
+				}
+				processItems(items.data(), begin, end);
+			};
+
+			double ms = timeBest(runs, [&]()
+			{
+				split(0, itemCount);
+				jobs.wait(counter);
+			});
+			baselineMs = threads == 1 ? ms : baselineMs;
+			printResult("~" + std::to_string(jobCount) + " jobs, " + std::to_string(threads) + " threads", ms, itemCount, baselineMs);
+		}
+	}
+
+	void runEcsBenchmark(size_t entityCount)
+	{
+		const int runs = 10;
+		const float deltaTime = 1.0f / 60.0f;
+
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> radius(0.1f, 2.0f);
+
+		EntityWorld world;
+		EcsComponents ids = EcsSystems::registerComponents(world);
+		ComponentMask mask = componentBit(ids.transform) | componentBit(ids.velocity) | componentBit(ids.worldMatrix) |
+			componentBit(ids.localBounds) | componentBit(ids.worldBounds) | componentBit(ids.visibility) |
+			componentBit(ids.render) | componentBit(ids.animation);
+
+		// The same entities as individually allocated objects, visited in a shuffled order as
+		// they would be after a while of objects coming and going
+		struct GameObject
+		{
+			TransformComponent transform;
+			VelocityComponent velocity;
+			WorldMatrixComponent worldMatrix;
+			LocalBoundsComponent localBounds;
+			WorldBoundsComponent worldBounds;
+			VisibilityComponent visibility;
+			RenderComponent render;
+			AnimationComponent animation;
+		};
+		std::vector<std::unique_ptr<GameObject>> objects;
+
+		for (size_t i = 0; i < entityCount; ++i)
+		{
+			EntityId entity = world.createEntity(mask);
+			TransformComponent& transform = world.get<TransformComponent>(entity, ids.transform);
+			transform.position = glm::vec3(position(rng), position(rng), position(rng));
+			transform.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			transform.scale = 1.0f;
+			world.get<VelocityComponent>(entity, ids.velocity).linear = glm::vec3(unit(rng), unit(rng), unit(rng));
+			world.get<VelocityComponent>(entity, ids.velocity).angular = glm::vec3(0.0f, 0.0f, unit(rng));
+			world.get<LocalBoundsComponent>(entity, ids.localBounds).sphere = glm::vec4(0.0f, 0.0f, 0.0f, radius(rng));
+			world.get<RenderComponent>(entity, ids.render).material = static_cast<uint32_t>(i % 4);
+			world.get<AnimationComponent>(entity, ids.animation).speed = 1.0f;
+			world.get<AnimationComponent>(entity, ids.animation).duration = 2.0f;
+
+			std::unique_ptr<GameObject> object(new GameObject());
+			object->transform = transform;
+			object->velocity = world.get<VelocityComponent>(entity, ids.velocity);
+			objects.push_back(std::move(object));
+		}
+		std::shuffle(objects.begin(), objects.end(), rng);
+
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 proj = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.1f, 150.0f);
+		Frustum frustum = Frustum::fromMatrix(proj * view);
+
+		std::cout << "ECS, " << entityCount << " entities in " << world.getArchetypeCount() << " archetype(s), "
+			<< (entityCount * sizeof(GameObject)) / (1024 * 1024) << " MB of components, best of " << runs << " runs" << std::endl;
+
+		// Movement and world matrices, the same work both ways
+		double pointerMs = timeBest(runs, [&]()
+		{
+			for (const std::unique_ptr<GameObject>& object : objects)
+			{
+				TransformComponent& transform = object->transform;
+				transform.position += object->velocity.linear * deltaTime;
+				glm::quat spin(0.0f, object->velocity.angular.x, object->velocity.angular.y, object->velocity.angular.z);
+				transform.rotation = glm::normalize(transform.rotation + (spin * transform.rotation) * (0.5f * deltaTime));
+
+				glm::mat4 matrix = glm::mat4_cast(transform.rotation);
+				matrix[0] *= transform.scale;
+				matrix[1] *= transform.scale;
+				matrix[2] *= transform.scale;
+				matrix[3] = glm::vec4(transform.position, 1.0f);
+				object->worldMatrix.world = matrix;
+			}
+		});
+		printResult("Pointers, 1 thread", pointerMs, entityCount, pointerMs);
+
+		double transformMs = timeBest(runs, [&]()
+		{
+			EcsSystems::integrateVelocities(world, ids, deltaTime);
+			EcsSystems::updateTransforms(world, ids);
+		});
+		printResult("ECS transforms", transformMs, entityCount, pointerMs);
+
+		// The rest against the ECS transform update
+		size_t visibleCount = 0;
+		double cullMs = timeBest(runs, [&]()
+		{
+			visibleCount = EcsSystems::cull(world, ids, frustum);
+		});
+		printResult("ECS culling", cullMs, entityCount, transformMs);
+
+		std::vector<InstanceData> instances;
+		double extractMs = timeBest(runs, [&]()
+		{
+			EcsSystems::extractInstances(world, ids, instances);
+		});
+		printResult("ECS render extraction", extractMs, entityCount, transformMs);
+
+		double animationMs = timeBest(runs, [&]()
+		{
+			EcsSystems::updateAnimations(world, ids, deltaTime);
+		});
+		printResult("ECS animation", animationMs, entityCount, transformMs);
+
+		std::cout << visibleCount << " visible, " << instances.size() << " instances extracted"
+			<< (visibleCount == instances.size() ? "" : ", MISMATCH") << " on " << ParallelUtil::getThreadCount() << " threads" << std::endl;
+	}
+};
\ No newline at end of file
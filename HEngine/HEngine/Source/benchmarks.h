@@ -0,0 +1,26 @@
+// Micro-benchmarks for engine systems. Run with command line flags, see main.cpp.
+
+#pragma once
+
+#include <cstddef>
+
+namespace Benchmarks
+{
+	// Frustum cull objectCount random spheres with each SIMD level, single- and multithreaded
+	void runCullingBenchmark(size_t objectCount);
+
+	// Build and refit a BVH over objectCount random boxes, and compare its queries with linear scans
+	void runBvhBenchmark(size_t objectCount);
+
+	// Rasterize a few occluders on the CPU and test objectCount random spheres against them,
+	// after frustum culling
+	void runOcclusionBenchmark(size_t objectCount);
+
+	// Run the same work on job systems of 1 to N threads: itemCount items split evenly with
+	// parallelFor, then split recursively into many small jobs that idle threads have to steal
+	void runJobSystemBenchmark(size_t itemCount);
+
+	// Run each ECS system over entityCount entities, and compare the transform update with the
+	// same data in individually allocated objects visited through pointers
+	void runEcsBenchmark(size_t entityCount);
+};
@@ -0,0 +1,169 @@
+#include "bounds.h"
+
+#include <algorithm>
+#include <limits>
+
+Aabb Aabb::empty()
+{
+	Aabb box;
+	box.min = glm::vec3(std::numeric_limits<float>::max());
+	box.max = glm::vec3(-std::numeric_limits<float>::max());
+	return box;
+}
+
+float Aabb::surfaceArea() const
+{
+	glm::vec3 size = max - min;
+	if (size.x < 0.0f || size.y < 0.0f || size.z < 0.0f)
+	{
+		return 0.0f;
+	}
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+bool Aabb::overlaps(const Aabb& box) const
+{
+	return min.x <= box.max.x && max.x >= box.min.x &&
+		min.y <= box.max.y && max.y >= box.min.y &&
+		min.z <= box.max.z && max.z >= box.min.z;
+}
+
+Ray::Ray(const glm::vec3& _origin, const glm::vec3& _direction)
+	:
+	origin(_origin),
+	direction(_direction)
+{
+	// Division by zero gives +-inf, which the slab test handles
+	invDirection = glm::vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+}
+
+float Ray::intersect(const Aabb& box, float maxDistance) const
+{
+	glm::vec3 t0 = (box.min - origin) * invDirection;
+	glm::vec3 t1 = (box.max - origin) * invDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+
+	return enter <= exit ? enter : -1.0f;
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4& matrix)
+{
+	// glm matrices are column-major; row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+	}
+
+	// Gribb / Hartmann. Clip space depth is -w..w, matching glm::perspective.
+	Frustum frustum;
+	frustum.planes[Left] = rows[3] + rows[0];
+	frustum.planes[Right] = rows[3] - rows[0];
+	frustum.planes[Bottom] = rows[3] + rows[1];
+	frustum.planes[Top] = rows[3] - rows[1];
+	frustum.planes[Near] = rows[3] + rows[2];
+	frustum.planes[Far] = rows[3] - rows[2];
+
+	// Normalize, so plane distances are real distances and can be compared against radii
+	for (glm::vec4& plane : frustum.planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+Frustum::TestResult Frustum::test(const Aabb& box, uint32_t& planeMask) const
+{
+	glm::vec3 center = box.center();
+	glm::vec3 halfExtent = box.extent() * 0.5f;
+
+	for (int i = 0; i < PlaneCount; ++i)
+	{
+		if ((planeMask & (1u << i)) == 0)
+		{
+			continue;
+		}
+
+		// Project the box onto the plane normal
+		glm::vec3 normal = glm::vec3(planes[i]);
+		float distance = glm::dot(normal, center) + planes[i].w;
+		float radius = glm::dot(halfExtent, glm::abs(normal));
+
+		if (distance < -radius)
+		{
+			return Outside;
+		}
+		if (distance >= radius)
+		{
+			// Fully in front of this plane; children don't need to test it again
+			planeMask &= ~(1u << i);
+		}
+	}
+
+	return planeMask == 0 ? Inside : Intersecting;
+}
+
+SphereBoundsArray::SphereBoundsArray()
+	:
+	count(0)
+{ }
+
+void SphereBoundsArray::resize(size_t newCount)
+{
+	size_t padded = (newCount + laneCount - 1) / laneCount * laneCount;
+
+	centerX.resize(padded, 0.0f);
+	centerY.resize(padded, 0.0f);
+	centerZ.resize(padded, 0.0f);
+	radius.resize(padded);
+
+	// A radius of -max fails every plane test, so padding is never reported visible
+	std::fill(radius.begin() + newCount, radius.end(), -std::numeric_limits<float>::max());
+
+	count = newCount;
+}
+
+void SphereBoundsArray::set(size_t index, const glm::vec4& sphere)
+{
+	centerX[index] = sphere.x;
+	centerY[index] = sphere.y;
+	centerZ[index] = sphere.z;
+	radius[index] = sphere.w;
+}
+
+glm::vec4 SphereBoundsArray::get(size_t index) const
+{
+	return glm::vec4(centerX[index], centerY[index], centerZ[index], radius[index]);
+}
+
+glm::vec4 transformBoundingSphere(const glm::vec4& sphere, const glm::mat4& transform)
+{
+	glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(sphere), 1.0f));
+
+	float scale = std::max(glm::length(glm::vec3(transform[0])),
+		std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+	return glm::vec4(center, sphere.w * scale);
+}
+
+Aabb transformAabb(const Aabb& box, const glm::mat4& transform)
+{
+	// Arvo's method: transform the center, and sum the absolute contribution of each axis to the extent
+	glm::vec3 center = glm::vec3(transform * glm::vec4(box.center(), 1.0f));
+	glm::vec3 halfExtent = box.extent() * 0.5f;
+
+	glm::vec3 newHalfExtent =
+		glm::abs(glm::vec3(transform[0])) * halfExtent.x +
+		glm::abs(glm::vec3(transform[1])) * halfExtent.y +
+		glm::abs(glm::vec3(transform[2])) * halfExtent.z;
+
+	Aabb result;
+	result.min = center - newHalfExtent;
+	result.max = center + newHalfExtent;
+	return result;
+}
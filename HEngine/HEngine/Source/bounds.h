@@ -0,0 +1,129 @@
+/* Bounding volume types used for visibility tests. Bounds for many objects are stored as a
+   structure of arrays, so they can be tested several at a time with SIMD. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Axis-aligned bounding box
+struct Aabb
+{
+	glm::vec3 min;
+	glm::vec3 max;
+
+	// An empty box; growing it by any point or box gives that point or box
+	static Aabb empty();
+
+	// Inline, since builds call these in their innermost loops
+	void grow(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void grow(const Aabb& box)
+	{
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+
+	glm::vec3 center() const { return (min + max) * 0.5f; }
+	glm::vec3 extent() const { return max - min; }
+
+	// Used by the SAH; empty boxes have zero area
+	float surfaceArea() const;
+
+	bool overlaps(const Aabb& box) const;
+};
+
+// Ray with a precomputed reciprocal direction, for slab tests
+struct Ray
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+	glm::vec3 invDirection;
+
+	Ray(const glm::vec3& _origin, const glm::vec3& _direction);
+
+	// Distance along the ray to where it enters box, or a negative value if it misses
+	// or the entry point is beyond maxDistance
+	float intersect(const Aabb& box, float maxDistance) const;
+};
+
+// Six planes, each stored as (normal, distance) with the normal pointing into the frustum.
+// A point p is inside a plane when dot(normal, p) + distance >= 0.
+struct Frustum
+{
+	enum Plane
+	{
+		Left,
+		Right,
+		Bottom,
+		Top,
+		Near,
+		Far,
+		PlaneCount
+	};
+
+	glm::vec4 planes[PlaneCount];
+
+	// Extract planes from a combined projection * view (* model) matrix. Planes end up in the
+	// space the matrix transforms from, so passing proj * view gives world-space planes.
+	static Frustum fromMatrix(const glm::mat4& matrix);
+
+	enum TestResult
+	{
+		Outside,
+		Intersecting,
+		Inside
+	};
+
+	// Classify a box against the planes in planeMask (bit i for plane i). On return, planeMask
+	// holds only the planes the box straddles; children of an Inside box need no tests at all.
+	TestResult test(const Aabb& box, uint32_t& planeMask) const;
+};
+
+// Bounding spheres stored as separate center / radius arrays.
+// Storage is padded to a multiple of laneCount with spheres that never pass a plane test,
+// so SIMD loops can always process full groups.
+class SphereBoundsArray
+{
+public:
+	// Widest SIMD group the culling code processes at once
+	static const size_t laneCount = 8;
+
+	SphereBoundsArray();
+
+	// Number of real spheres, not counting padding
+	size_t size() const { return count; }
+
+	// Size including padding, always a multiple of laneCount
+	size_t paddedSize() const { return radius.size(); }
+
+	void resize(size_t newCount);
+
+	// xyz is the center, w the radius
+	void set(size_t index, const glm::vec4& sphere);
+	glm::vec4 get(size_t index) const;
+
+	const float* getCenterX() const { return centerX.data(); }
+	const float* getCenterY() const { return centerY.data(); }
+	const float* getCenterZ() const { return centerZ.data(); }
+	const float* getRadius() const { return radius.data(); }
+
+private:
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+	size_t count;
+};
+
+// Transform a local-space sphere. The radius is scaled by the largest axis scale, so the result
+// stays conservative under non-uniform scale.
+glm::vec4 transformBoundingSphere(const glm::vec4& sphere, const glm::mat4& transform);
+
+// Transform a box, giving the axis-aligned box around the result
+Aabb transformAabb(const Aabb& box, const glm::mat4& transform);
@@ -0,0 +1,475 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <limits>
+
+// Split candidates per axis. More bins barely improve the tree, but slow the build.
+static const int binCount = 12;
+
+// Relative cost of visiting a node versus testing an item
+static const float traversalCost = 1.0f;
+
+// Queries use a fixed-size stack, which grows by at most one entry per level. Nodes this deep
+// are left as leaves, which only happens for pathological item layouts.
+static const int maxStackDepth = 64;
+static const uint32_t maxDepth = maxStackDepth - 2;
+
+Bvh::Bvh()
+	:
+	builtCost(0.0f),
+	currentCost(0.0f)
+{ }
+
+void Bvh::build(const std::vector<Aabb>& itemBounds)
+{
+	nodes.clear();
+	itemIndices.resize(itemBounds.size());
+	itemBoxes.resize(itemBounds.size());
+
+	if (itemBounds.empty())
+	{
+		builtCost = currentCost = 0.0f;
+		return;
+	}
+
+	// Worst case is one item per leaf
+	nodes.reserve(itemBounds.size() * 2);
+
+	std::vector<glm::vec3> centroids(itemBounds.size());
+	for (uint32_t i = 0; i < itemBounds.size(); ++i)
+	{
+		itemIndices[i] = i;
+		centroids[i] = itemBounds[i].center();
+	}
+
+	Node root;
+	root.first = 0;
+	root.count = static_cast<uint32_t>(itemBounds.size());
+	Aabb rootBounds = Aabb::empty();
+	for (const Aabb& box : itemBounds)
+	{
+		rootBounds.grow(box);
+	}
+	setBounds(root, rootBounds);
+	nodes.push_back(root);
+
+	// Subdivide with an explicit stack of (node, depth); children always land after their parent
+	std::vector<std::pair<uint32_t, uint32_t>> stack;
+	stack.push_back(std::make_pair(0u, 0u));
+	while (!stack.empty())
+	{
+		uint32_t nodeIndex = stack.back().first;
+		uint32_t depth = stack.back().second;
+		stack.pop_back();
+
+		int axis;
+		float position;
+		if (depth >= maxDepth || !findSplit(nodes[nodeIndex], itemBounds, centroids, axis, position))
+		{
+			continue;
+		}
+
+		// Partition the node's items around the split
+		uint32_t first = nodes[nodeIndex].first;
+		uint32_t count = nodes[nodeIndex].count;
+		uint32_t* begin = itemIndices.data() + first;
+		uint32_t* middle = std::partition(begin, begin + count, [&](uint32_t item)
+		{
+			return centroids[item][axis] < position;
+		});
+		uint32_t leftCount = static_cast<uint32_t>(middle - begin);
+
+		if (leftCount == 0 || leftCount == count)
+		{
+			continue;
+		}
+
+		Node children[2];
+		children[0].first = first;
+		children[0].count = leftCount;
+		children[1].first = first + leftCount;
+		children[1].count = count - leftCount;
+
+		for (Node& child : children)
+		{
+			Aabb childBounds = Aabb::empty();
+			for (uint32_t i = child.first; i < child.first + child.count; ++i)
+			{
+				childBounds.grow(itemBounds[itemIndices[i]]);
+			}
+			setBounds(child, childBounds);
+		}
+
+		uint32_t leftIndex = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(children[0]);
+		nodes.push_back(children[1]);
+
+		nodes[nodeIndex].first = leftIndex;
+		nodes[nodeIndex].count = 0;
+
+		stack.push_back(std::make_pair(leftIndex, depth + 1));
+		stack.push_back(std::make_pair(leftIndex + 1, depth + 1));
+	}
+
+	for (uint32_t i = 0; i < itemIndices.size(); ++i)
+	{
+		itemBoxes[i] = itemBounds[itemIndices[i]];
+	}
+
+	builtCost = computeCost();
+	currentCost = builtCost;
+}
+
+bool Bvh::findSplit(const Node& node,
+	const std::vector<Aabb>& itemBounds,
+	const std::vector<glm::vec3>& centroids,
+	int& outAxis,
+	float& outPosition) const
+{
+	if (node.count <= 2)
+	{
+		return false;
+	}
+
+	struct Bin
+	{
+		Aabb bounds;
+		uint32_t count;
+	};
+
+	float bestCost = std::numeric_limits<float>::max();
+
+	// Bin by centroid rather than box, so large items don't all land in the middle bins
+	Aabb centroidBounds = Aabb::empty();
+	for (uint32_t i = node.first; i < node.first + node.count; ++i)
+	{
+		centroidBounds.grow(centroids[itemIndices[i]]);
+	}
+
+	// Bin all three axes in one pass over the items, since reading them is the expensive part
+	Bin bins[3][binCount];
+	float scale[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float axisSize = centroidBounds.max[axis] - centroidBounds.min[axis];
+		scale[axis] = axisSize > 0.0f ? binCount / axisSize : 0.0f;
+
+		for (Bin& bin : bins[axis])
+		{
+			bin.bounds = Aabb::empty();
+			bin.count = 0;
+		}
+	}
+
+	for (uint32_t i = node.first; i < node.first + node.count; ++i)
+	{
+		uint32_t item = itemIndices[i];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			int bin = std::min(binCount - 1, static_cast<int>((centroids[item][axis] - centroidBounds.min[axis]) * scale[axis]));
+			bins[axis][bin].count++;
+			bins[axis][bin].bounds.grow(itemBounds[item]);
+		}
+	}
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		// All centroids in one spot; no split along this axis separates anything
+		if (scale[axis] == 0.0f)
+		{
+			continue;
+		}
+
+		// Sweep from both sides to get the area and count left and right of each plane
+		float leftArea[binCount - 1];
+		uint32_t leftCount[binCount - 1];
+		Aabb sweepBounds = Aabb::empty();
+		uint32_t sweepCount = 0;
+		for (int i = 0; i < binCount - 1; ++i)
+		{
+			sweepBounds.grow(bins[axis][i].bounds);
+			sweepCount += bins[axis][i].count;
+			leftArea[i] = sweepBounds.surfaceArea();
+			leftCount[i] = sweepCount;
+		}
+
+		sweepBounds = Aabb::empty();
+		sweepCount = 0;
+		for (int i = binCount - 1; i > 0; --i)
+		{
+			sweepBounds.grow(bins[axis][i].bounds);
+			sweepCount += bins[axis][i].count;
+
+			float cost = leftArea[i - 1] * leftCount[i - 1] + sweepBounds.surfaceArea() * sweepCount;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				outAxis = axis;
+				outPosition = centroidBounds.min[axis] + i / scale[axis];
+			}
+		}
+	}
+
+	// Compare against the cost of leaving the node as a leaf
+	float nodeArea = getBounds(node).surfaceArea();
+	float leafCost = nodeArea * node.count;
+	return bestCost + traversalCost * nodeArea < leafCost;
+}
+
+void Bvh::refit(const std::vector<Aabb>& itemBounds)
+{
+	for (uint32_t i = 0; i < itemIndices.size(); ++i)
+	{
+		itemBoxes[i] = itemBounds[itemIndices[i]];
+	}
+
+	// Children come after their parents, so walking backwards visits children first
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		Node& node = nodes[i];
+		Aabb bounds = Aabb::empty();
+		if (node.count > 0)
+		{
+			for (uint32_t item = node.first; item < node.first + node.count; ++item)
+			{
+				bounds.grow(itemBoxes[item]);
+			}
+		}
+		else
+		{
+			bounds.grow(getBounds(nodes[node.first]));
+			bounds.grow(getBounds(nodes[node.first + 1]));
+		}
+		setBounds(node, bounds);
+	}
+
+	currentCost = computeCost();
+}
+
+float Bvh::getCostRatio() const
+{
+	return builtCost > 0.0f ? currentCost / builtCost : 1.0f;
+}
+
+float Bvh::computeCost() const
+{
+	if (nodes.empty())
+	{
+		return 0.0f;
+	}
+
+	// Expected cost of a random ray query: each node's cost weighted by the chance of reaching it
+	float cost = 0.0f;
+	for (const Node& node : nodes)
+	{
+		float area = getBounds(node).surfaceArea();
+		cost += node.count > 0 ? area * node.count : area * traversalCost;
+	}
+
+	float rootArea = getBounds(nodes[0]).surfaceArea();
+	return rootArea > 0.0f ? cost / rootArea : cost;
+}
+
+void Bvh::queryFrustum(const Frustum& frustum, std::vector<uint32_t>& outItems) const
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	// Each entry carries the planes its node still straddles. Once a node is fully inside,
+	// the mask is empty and everything below it is accepted without plane tests.
+	struct Entry
+	{
+		uint32_t node;
+		uint32_t planeMask;
+	};
+
+	Entry stack[maxStackDepth];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, (1u << Frustum::PlaneCount) - 1 };
+
+	while (stackSize > 0)
+	{
+		Entry entry = stack[--stackSize];
+		const Node& node = nodes[entry.node];
+
+		uint32_t planeMask = entry.planeMask;
+		if (planeMask != 0 && frustum.test(getBounds(node), planeMask) == Frustum::Outside)
+		{
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				uint32_t itemMask = planeMask;
+				if (itemMask == 0 || frustum.test(itemBoxes[i], itemMask) != Frustum::Outside)
+				{
+					outItems.push_back(itemIndices[i]);
+				}
+			}
+		}
+		else
+		{
+			stack[stackSize++] = { node.first + 1, planeMask };
+			stack[stackSize++] = { node.first, planeMask };
+		}
+	}
+}
+
+void Bvh::queryOverlap(const Aabb& box, std::vector<uint32_t>& outItems) const
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	uint32_t stack[maxStackDepth];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const Node& node = nodes[stack[--stackSize]];
+		if (!getBounds(node).overlaps(box))
+		{
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				if (itemBoxes[i].overlaps(box))
+				{
+					outItems.push_back(itemIndices[i]);
+				}
+			}
+		}
+		else
+		{
+			stack[stackSize++] = node.first + 1;
+			stack[stackSize++] = node.first;
+		}
+	}
+}
+
+void Bvh::querySphere(const glm::vec3& center, float radius, std::vector<uint32_t>& outItems) const
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	float radiusSquared = radius * radius;
+	auto distanceSquared = [&center](const Aabb& box)
+	{
+		glm::vec3 closest = glm::clamp(center, box.min, box.max);
+		return glm::dot(closest - center, closest - center);
+	};
+
+	uint32_t stack[maxStackDepth];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const Node& node = nodes[stack[--stackSize]];
+		if (distanceSquared(getBounds(node)) > radiusSquared)
+		{
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				if (distanceSquared(itemBoxes[i]) <= radiusSquared)
+				{
+					outItems.push_back(itemIndices[i]);
+				}
+			}
+		}
+		else
+		{
+			stack[stackSize++] = node.first + 1;
+			stack[stackSize++] = node.first;
+		}
+	}
+}
+
+bool Bvh::raycast(const Ray& ray, float maxDistance, uint32_t& outItem, float& outDistance) const
+{
+	if (nodes.empty() || ray.intersect(getBounds(nodes[0]), maxDistance) < 0.0f)
+	{
+		return false;
+	}
+
+	bool hit = false;
+	float closest = maxDistance;
+
+	uint32_t stack[maxStackDepth];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const Node& node = nodes[stack[--stackSize]];
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				float distance = ray.intersect(itemBoxes[i], closest);
+				if (distance >= 0.0f)
+				{
+					hit = true;
+					closest = distance;
+					outItem = itemIndices[i];
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first, so hits there cut off the search of the other.
+		// Children are tested before pushing, against the closest hit so far.
+		uint32_t nearChild = node.first;
+		uint32_t farChild = node.first + 1;
+		float nearDistance = ray.intersect(getBounds(nodes[nearChild]), closest);
+		float farDistance = ray.intersect(getBounds(nodes[farChild]), closest);
+
+		if (farDistance >= 0.0f && (nearDistance < 0.0f || farDistance < nearDistance))
+		{
+			std::swap(nearChild, farChild);
+			std::swap(nearDistance, farDistance);
+		}
+
+		if (farDistance >= 0.0f)
+		{
+			stack[stackSize++] = farChild;
+		}
+		if (nearDistance >= 0.0f)
+		{
+			stack[stackSize++] = nearChild;
+		}
+	}
+
+	outDistance = closest;
+	return hit;
+}
+
+Aabb Bvh::getBounds(const Node& node)
+{
+	Aabb box;
+	box.min = node.boundsMin;
+	box.max = node.boundsMax;
+	return box;
+}
+
+void Bvh::setBounds(Node& node, const Aabb& box)
+{
+	node.boundsMin = box.min;
+	node.boundsMax = box.max;
+}
@@ -0,0 +1,75 @@
+/* Defines Bvh, a bounding volume hierarchy over a set of boxes. Built with a binned SAH and stored
+   as a flat node array; supports refitting for moving items, and frustum, ray and proximity queries. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "bounds.h"
+
+class Bvh
+{
+public:
+	// 32 bytes, so two nodes share a cache line. Children are always allocated as a pair,
+	// after their parent.
+	struct Node
+	{
+		glm::vec3 boundsMin;
+		uint32_t first; // Interior: index of the left child, the right is first + 1. Leaf: first item slot.
+		glm::vec3 boundsMax;
+		uint32_t count; // Items in a leaf; 0 for interior nodes
+	};
+
+	Bvh();
+
+	// Build over itemBounds. Items are referred to by their index in itemBounds.
+	void build(const std::vector<Aabb>& itemBounds);
+
+	// Update bounds after items moved, keeping the tree structure. itemBounds must hold the same
+	// items as at build time. Much cheaper than a build, but the tree gets worse as items
+	// move further from where they were; see getCostRatio().
+	void refit(const std::vector<Aabb>& itemBounds);
+
+	// SAH cost of the tree relative to when it was built. Rebuild once this grows too large.
+	float getCostRatio() const;
+
+	// Items whose boxes intersect the frustum
+	void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& outItems) const;
+
+	// Items whose boxes overlap box
+	void queryOverlap(const Aabb& box, std::vector<uint32_t>& outItems) const;
+
+	// Items whose boxes come within radius of center
+	void querySphere(const glm::vec3& center, float radius, std::vector<uint32_t>& outItems) const;
+
+	// Closest item whose box the ray hits within maxDistance. Returns false if there's none.
+	bool raycast(const Ray& ray, float maxDistance, uint32_t& outItem, float& outDistance) const;
+
+	bool isEmpty() const { return nodes.empty(); }
+	size_t getNodeCount() const { return nodes.size(); }
+	const std::vector<Node>& getNodes() const { return nodes; }
+
+private:
+	// Find the best binned SAH split for a node. Returns false if keeping it as a leaf is cheaper.
+	bool findSplit(const Node& node,
+		const std::vector<Aabb>& itemBounds,
+		const std::vector<glm::vec3>& centroids,
+		int& outAxis,
+		float& outPosition) const;
+
+	float computeCost() const;
+
+	static Aabb getBounds(const Node& node);
+	static void setBounds(Node& node, const Aabb& box);
+
+private:
+	std::vector<Node> nodes;
+
+	// Item index for each leaf slot, and the item's box, in leaf order
+	std::vector<uint32_t> itemIndices;
+	std::vector<Aabb> itemBoxes;
+
+	float builtCost;
+	float currentCost;
+};
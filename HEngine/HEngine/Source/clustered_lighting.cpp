@@ -0,0 +1,35 @@
+#include "clustered_lighting.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ClusteredLighting
+{
+	GpuLight makePointLight(const glm::vec3& position, float radius, const glm::vec3& color)
+	{
+		GpuLight light = { };
+		light.position = position;
+		light.radius = radius;
+		light.color = color;
+		light.type = LightTypePoint;
+		light.direction = glm::vec3(0.0f, 0.0f, -1.0f);
+
+		// Every direction is inside the cone
+		light.cosOuterAngle = -1.0f;
+		light.cosInnerAngle = -1.0f;
+		return light;
+	}
+
+	GpuLight makeSpotLight(const glm::vec3& position, const glm::vec3& direction, float radius, const glm::vec3& color,
+		float innerAngle, float outerAngle)
+	{
+		GpuLight light = makePointLight(position, radius, color);
+		light.type = LightTypeSpot;
+		light.direction = glm::normalize(direction);
+
+		// The shader fades between the two, so they mustn't be equal
+		light.cosOuterAngle = std::cos(outerAngle);
+		light.cosInnerAngle = std::max(std::cos(std::min(innerAngle, outerAngle)), light.cosOuterAngle + 1e-4f);
+		return light;
+	}
+};
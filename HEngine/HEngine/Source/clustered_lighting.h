@@ -0,0 +1,39 @@
+/* Defines the cluster grid used for clustered forward lighting, and helpers for making lights.
+   The view frustum is split into a grid of clusters: tiles across the screen, and depth slices
+   spaced exponentially between the near and far planes, so clusters stay roughly cube shaped.
+   Each frame a compute pass bins every light into the clusters its sphere touches, and each
+   fragment only loops over its own cluster's lights. */
+
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "render_types.h"
+
+namespace ClusteredLighting
+{
+	// Must match LightBinning.comp and HelloTriangle.frag
+	static const uint32_t clusterCountX = 16;
+	static const uint32_t clusterCountY = 9;
+	static const uint32_t clusterCountZ = 24;
+	static const uint32_t clusterCount = clusterCountX * clusterCountY * clusterCountZ;
+
+	// Lights a cluster can hold. Beyond this, lights are dropped, which bounds per-fragment cost
+	// however many lights the scene has.
+	static const uint32_t maxLightsPerCluster = 128;
+
+	// Threads per workgroup in the binning shader, one per cluster
+	static const uint32_t binWorkgroupSize = 64;
+
+	// Bytes in a cluster buffer: each cluster's light count, then each cluster's light indices
+	static const size_t clusterBufferSize = sizeof(uint32_t) * clusterCount * (1 + maxLightsPerCluster);
+
+	// color is linear RGB, already scaled by intensity. The light falls off to nothing at radius.
+	GpuLight makePointLight(const glm::vec3& position, float radius, const glm::vec3& color);
+
+	// As a point light, but only lighting a cone along direction. Angles are from the cone's
+	// axis, in radians: fully lit inside innerAngle, fading out to nothing at outerAngle.
+	GpuLight makeSpotLight(const glm::vec3& position, const glm::vec3& direction, float radius, const glm::vec3& color,
+		float innerAngle, float outerAngle);
+};
@@ -0,0 +1,27 @@
+#include "deletion_queue.h"
+
+void FrameDeletionQueue::retire(uint64_t frame, std::function<void()> destroy)
+{
+	RetiredObject object;
+	object.frame = frame;
+	object.destroy = std::move(destroy);
+	retired.push_back(std::move(object));
+}
+
+void FrameDeletionQueue::destroyCompleted(uint64_t completedFrames)
+{
+	while (!retired.empty() && retired.front().frame <= completedFrames)
+	{
+		retired.front().destroy();
+		retired.pop_front();
+	}
+}
+
+void FrameDeletionQueue::destroyAll()
+{
+	for (RetiredObject& object : retired)
+	{
+		object.destroy();
+	}
+	retired.clear();
+}
@@ -0,0 +1,59 @@
+/* Defines FrameDeletionQueue, which holds on to objects that frames still on the GPU may be using
+   until those frames have finished. Each object is retired with the number of the first frame
+   that won't use it, and the renderer reports how many frames have finished as their fences
+   signal, so freeing a resource never has to wait for the device to go idle. */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include "VulkanDestructWrapper.h"
+
+class FrameDeletionQueue
+{
+public:
+	FrameDeletionQueue() { }
+
+	FrameDeletionQueue(const FrameDeletionQueue&) = delete;
+	FrameDeletionQueue& operator=(const FrameDeletionQueue&) = delete;
+
+	// Call destroy once every frame before frame has finished. frame must not go backwards.
+	void retire(uint64_t frame, std::function<void()> destroy);
+
+	// As above, taking ownership of a wrapped Vulkan object
+	template <typename T, void (VKAPI_PTR* destroyFunc)(VkDevice, T, const VkAllocationCallbacks*)>
+	void retire(uint64_t frame, VulkanDestructWrapper<T, destroyFunc>&& object);
+
+	// Frames [0, completedFrames) have finished. Destroys everything they were the last to use.
+	void destroyCompleted(uint64_t completedFrames);
+
+	// Destroy everything, e.g. once the device is idle at shutdown. Must be called before the
+	// device is destroyed.
+	void destroyAll();
+
+	size_t getPendingCount() const { return retired.size(); }
+
+private:
+	struct RetiredObject
+	{
+		uint64_t frame;
+		std::function<void()> destroy;
+	};
+
+	// Oldest first
+	std::deque<RetiredObject> retired;
+};
+
+template <typename T, void (VKAPI_PTR* destroyFunc)(VkDevice, T, const VkAllocationCallbacks*)>
+void FrameDeletionQueue::retire(uint64_t frame, VulkanDestructWrapper<T, destroyFunc>&& object)
+{
+	// std::function has to be copyable, so the wrapper is shared by the copies
+	std::shared_ptr<VulkanDestructWrapper<T, destroyFunc>> owned(new VulkanDestructWrapper<T, destroyFunc>(std::move(object)));
+	retire(frame, [owned]()
+	{
+		owned->reset();
+	});
+}
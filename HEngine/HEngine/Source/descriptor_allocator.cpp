@@ -0,0 +1,395 @@
+#include "descriptor_allocator.h"
+
+#include <stdexcept>
+
+// Descriptors of each type per set, on average, that a pool is sized for
+static const std::pair<VkDescriptorType, float> poolRatios[] =
+{
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 0.5f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0.5f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f }
+};
+
+static const size_t poolTypeCount = sizeof(poolRatios) / sizeof(poolRatios[0]);
+
+// Index of type in poolRatios, or poolTypeCount if pools don't hold it
+static size_t getPoolTypeIndex(VkDescriptorType type)
+{
+	size_t index = 0;
+	while (index < poolTypeCount && poolRatios[index].first != type)
+	{
+		++index;
+	}
+	return index;
+}
+
+// FNV-1a, fed one field at a time so struct padding never affects the hash
+static const uint64_t fnvPrime = 0x100000001b3ull;
+static const uint64_t fnvOffset = 0xcbf29ce484222325ull;
+
+template <typename T>
+static void hashValue(uint64_t& hash, const T& value)
+{
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+	for (size_t i = 0; i < sizeof(T); ++i)
+	{
+		hash ^= bytes[i];
+		hash *= fnvPrime;
+	}
+}
+
+static bool isImageDescriptor(VkDescriptorType type)
+{
+	return type == VK_DESCRIPTOR_TYPE_SAMPLER ||
+		type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ||
+		type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
+		type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE ||
+		type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+}
+
+DescriptorAllocator::DescriptorAllocator()
+	:
+	device(VK_NULL_HANDLE),
+	currentFrame(0)
+{ }
+
+void DescriptorAllocator::init(VkDevice _device, uint32_t frameCount)
+{
+	device = _device;
+	frames.resize(frameCount);
+	for (FramePools& frame : frames)
+	{
+		frame.pools.push_back(createPool());
+		frame.currentPool = 0;
+	}
+	currentFrame = 0;
+}
+
+void DescriptorAllocator::destroy()
+{
+	if (device == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	// Sets go with their pools
+	for (FramePools& frame : frames)
+	{
+		for (const Pool& pool : frame.pools)
+		{
+			vkDestroyDescriptorPool(device, pool.pool, nullptr);
+		}
+	}
+	frames.clear();
+
+	for (auto& layout : layouts)
+	{
+		vkDestroyDescriptorSetLayout(device, layout.second.second, nullptr);
+	}
+	layouts.clear();
+	layoutCounts.clear();
+
+	device = VK_NULL_HANDLE;
+}
+
+VkDescriptorSetLayout DescriptorAllocator::getLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	uint64_t hash = hashLayout(bindings);
+
+	auto range = layouts.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		const std::vector<VkDescriptorSetLayoutBinding>& cached = it->second.first;
+		if (cached.size() != bindings.size())
+		{
+			continue;
+		}
+
+		bool same = true;
+		for (size_t i = 0; i < bindings.size() && same; ++i)
+		{
+			same = cached[i].binding == bindings[i].binding &&
+				cached[i].descriptorType == bindings[i].descriptorType &&
+				cached[i].descriptorCount == bindings[i].descriptorCount &&
+				cached[i].stageFlags == bindings[i].stageFlags &&
+				cached[i].pImmutableSamplers == bindings[i].pImmutableSamplers;
+		}
+		if (same)
+		{
+			return it->second.second;
+		}
+	}
+
+	// Every set of the layout has to fit in a fresh pool, or allocating could never succeed
+	DescriptorCounts counts;
+	counts.sets = 1;
+	counts.descriptors.assign(poolTypeCount, 0);
+	for (const VkDescriptorSetLayoutBinding& binding : bindings)
+	{
+		size_t typeIndex = getPoolTypeIndex(binding.descriptorType);
+		if (typeIndex == poolTypeCount)
+		{
+			throw std::runtime_error("DescriptorAllocator::getLayout -- descriptor type isn't pooled");
+		}
+		counts.descriptors[typeIndex] += binding.descriptorCount;
+	}
+	if (!fits(getPoolCapacity(), counts))
+	{
+		throw std::runtime_error("DescriptorAllocator::getLayout -- a set with these bindings doesn't fit in a pool");
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = { };
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	VkDescriptorSetLayout layout;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("DescriptorAllocator::getLayout -- failed to create descriptor set layout");
+	}
+
+	layouts.emplace(hash, std::make_pair(bindings, layout));
+	layoutCounts[layout] = counts;
+	return layout;
+}
+
+void DescriptorAllocator::beginFrame(uint32_t frame)
+{
+	currentFrame = frame;
+	FramePools& pools = frames[currentFrame];
+
+	// Pools are kept, so once a frame has enough of them allocating never creates more
+	for (size_t i = 0; i <= pools.currentPool; ++i)
+	{
+		vkResetDescriptorPool(device, pools.pools[i].pool, 0);
+		pools.pools[i].left = getPoolCapacity();
+	}
+	pools.currentPool = 0;
+	pools.sets.clear();
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout)
+{
+	FramePools& pools = frames[currentFrame];
+
+	auto counts = layoutCounts.find(layout);
+	if (counts == layoutCounts.end())
+	{
+		throw std::runtime_error("DescriptorAllocator::allocate -- layout didn't come from getLayout");
+	}
+	const DescriptorCounts& needed = counts->second;
+
+	// Current pool can't hold the set -- move on to the next in the chain, adding one if this is the
+	// furthest the frame has got. getLayout made sure the set fits in an empty pool.
+	if (!fits(pools.pools[pools.currentPool].left, needed))
+	{
+		pools.currentPool++;
+		if (pools.currentPool == pools.pools.size())
+		{
+			pools.pools.push_back(createPool());
+		}
+	}
+
+	Pool& pool = pools.pools[pools.currentPool];
+
+	VkDescriptorSetAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = pool.pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	// With the pool known to have room, any failure is a real one
+	VkDescriptorSet set;
+	if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("DescriptorAllocator::allocate -- failed to allocate descriptor set");
+	}
+
+	pool.left.sets -= needed.sets;
+	for (size_t i = 0; i < poolTypeCount; ++i)
+	{
+		pool.left.descriptors[i] -= needed.descriptors[i];
+	}
+
+	return set;
+}
+
+VkDescriptorSet DescriptorAllocator::getSet(VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes)
+{
+	FramePools& pools = frames[currentFrame];
+	uint64_t hash = hashSet(layout, writes);
+
+	auto range = pools.sets.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (isSameSet(it->second, layout, writes))
+		{
+			return it->second.set;
+		}
+	}
+
+	VkDescriptorSet set = allocate(layout);
+
+	std::vector<VkWriteDescriptorSet> descriptorWrites(writes.size());
+	for (size_t i = 0; i < writes.size(); ++i)
+	{
+		VkWriteDescriptorSet& descriptorWrite = descriptorWrites[i];
+		descriptorWrite = { };
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = set;
+		descriptorWrite.dstBinding = writes[i].binding;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorType = writes[i].type;
+		descriptorWrite.descriptorCount = 1;
+		if (isImageDescriptor(writes[i].type))
+		{
+			descriptorWrite.pImageInfo = &writes[i].image;
+		}
+		else
+		{
+			descriptorWrite.pBufferInfo = &writes[i].buffer;
+		}
+	}
+
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+	CachedSet cached = { layout, writes, set };
+	pools.sets.emplace(hash, cached);
+	return set;
+}
+
+size_t DescriptorAllocator::getPoolCount() const
+{
+	size_t count = 0;
+	for (const FramePools& frame : frames)
+	{
+		count += frame.pools.size();
+	}
+	return count;
+}
+
+DescriptorAllocator::Pool DescriptorAllocator::createPool()
+{
+	Pool pool;
+	pool.left = getPoolCapacity();
+
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	for (size_t i = 0; i < poolTypeCount; ++i)
+	{
+		VkDescriptorPoolSize poolSize = { };
+		poolSize.type = poolRatios[i].first;
+		poolSize.descriptorCount = pool.left.descriptors[i];
+		poolSizes.push_back(poolSize);
+	}
+
+	// No FREE_DESCRIPTOR_SET_BIT: sets are only ever freed by resetting the whole pool
+	VkDescriptorPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = pool.left.sets;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool.pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("DescriptorAllocator::createPool -- failed to create descriptor pool");
+	}
+	return pool;
+}
+
+DescriptorAllocator::DescriptorCounts DescriptorAllocator::getPoolCapacity()
+{
+	DescriptorCounts capacity;
+	capacity.sets = setsPerPool;
+	for (const std::pair<VkDescriptorType, float>& ratio : poolRatios)
+	{
+		capacity.descriptors.push_back(static_cast<uint32_t>(ratio.second * setsPerPool));
+	}
+	return capacity;
+}
+
+bool DescriptorAllocator::fits(const DescriptorCounts& available, const DescriptorCounts& needed)
+{
+	if (needed.sets > available.sets)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < poolTypeCount; ++i)
+	{
+		if (needed.descriptors[i] > available.descriptors[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64_t DescriptorAllocator::hashLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	uint64_t hash = fnvOffset;
+	for (const VkDescriptorSetLayoutBinding& binding : bindings)
+	{
+		hashValue(hash, binding.binding);
+		hashValue(hash, binding.descriptorType);
+		hashValue(hash, binding.descriptorCount);
+		hashValue(hash, binding.stageFlags);
+		hashValue(hash, binding.pImmutableSamplers);
+	}
+	return hash;
+}
+
+uint64_t DescriptorAllocator::hashSet(VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes)
+{
+	uint64_t hash = fnvOffset;
+	hashValue(hash, layout);
+	for (const DescriptorWrite& write : writes)
+	{
+		hashValue(hash, write.binding);
+		hashValue(hash, write.type);
+		if (isImageDescriptor(write.type))
+		{
+			hashValue(hash, write.image.sampler);
+			hashValue(hash, write.image.imageView);
+			hashValue(hash, write.image.imageLayout);
+		}
+		else
+		{
+			hashValue(hash, write.buffer.buffer);
+			hashValue(hash, write.buffer.offset);
+			hashValue(hash, write.buffer.range);
+		}
+	}
+	return hash;
+}
+
+bool DescriptorAllocator::isSameSet(const CachedSet& cached, VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes)
+{
+	if (cached.layout != layout || cached.writes.size() != writes.size())
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < writes.size(); ++i)
+	{
+		const DescriptorWrite& a = cached.writes[i];
+		const DescriptorWrite& b = writes[i];
+		if (a.binding != b.binding || a.type != b.type)
+		{
+			return false;
+		}
+
+		bool same = isImageDescriptor(a.type) ?
+			a.image.sampler == b.image.sampler && a.image.imageView == b.image.imageView && a.image.imageLayout == b.image.imageLayout :
+			a.buffer.buffer == b.buffer.buffer && a.buffer.offset == b.buffer.offset && a.buffer.range == b.buffer.range;
+		if (!same)
+		{
+			return false;
+		}
+	}
+	return true;
+}
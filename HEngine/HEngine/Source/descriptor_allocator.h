@@ -0,0 +1,102 @@
+/* Defines DescriptorAllocator, which hands out descriptor sets that live for one frame. Each frame in
+   flight has a chain of pools that are reset wholesale when the frame comes round again, so allocating
+   is a bump from the current pool. Layouts with identical bindings, and sets with identical contents
+   within a frame, are created once and reused. Each pool keeps count of what it has left, so a set is
+   only ever allocated from a pool that can hold it; Vulkan 1.0 doesn't allow overflowing a pool. */
+
+#pragma once
+
+#define VK_USE_PLATFORM_WIN32_KHR
+#include <vulkan\vulkan.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// One descriptor to write into a set. Fill in buffer or image, depending on type.
+struct DescriptorWrite
+{
+	uint32_t binding;
+	VkDescriptorType type;
+	VkDescriptorBufferInfo buffer;
+	VkDescriptorImageInfo image;
+};
+
+class DescriptorAllocator
+{
+public:
+	// Sets each pool in the chain can hold. Pools are sized for this many sets of a typical layout.
+	static const uint32_t setsPerPool = 256;
+
+	DescriptorAllocator();
+
+	void init(VkDevice device, uint32_t frameCount);
+
+	// Destroy every pool and cached layout
+	void destroy();
+
+	// A layout with these bindings, created the first time it's asked for. The allocator owns it, and
+	// only allocates sets with layouts that came from here.
+	VkDescriptorSetLayout getLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+	// Start allocating for frame, resetting its pools. Sets allocated the last time this frame came
+	// round must no longer be in use.
+	void beginFrame(uint32_t frame);
+
+	// A new, unwritten set, valid until the current frame comes round again
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+	// A set with these contents. Asking again this frame with the same layout and writes returns the same set.
+	VkDescriptorSet getSet(VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes);
+
+	// Pools in every frame's chain. Stops growing once each frame has enough for its busiest frame.
+	size_t getPoolCount() const;
+
+private:
+	struct CachedSet
+	{
+		VkDescriptorSetLayout layout;
+		std::vector<DescriptorWrite> writes;
+		VkDescriptorSet set;
+	};
+
+	// Sets, and descriptors of each pooled type in poolRatios order. For a pool, what it has left;
+	// for a layout, what one set takes.
+	struct DescriptorCounts
+	{
+		uint32_t sets;
+		std::vector<uint32_t> descriptors;
+	};
+
+	struct Pool
+	{
+		VkDescriptorPool pool;
+		DescriptorCounts left;
+	};
+
+	struct FramePools
+	{
+		std::vector<Pool> pools;
+		size_t currentPool;
+
+		// Sets allocated through getSet this frame, by hash of their contents
+		std::unordered_multimap<uint64_t, CachedSet> sets;
+	};
+
+	Pool createPool();
+
+	static DescriptorCounts getPoolCapacity();
+	static bool fits(const DescriptorCounts& available, const DescriptorCounts& needed);
+
+	static uint64_t hashLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+	static uint64_t hashSet(VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes);
+	static bool isSameSet(const CachedSet& cached, VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes);
+
+private:
+	VkDevice device;
+	std::vector<FramePools> frames;
+	uint32_t currentFrame;
+
+	std::unordered_multimap<uint64_t, std::pair<std::vector<VkDescriptorSetLayoutBinding>, VkDescriptorSetLayout>> layouts;
+	std::unordered_map<VkDescriptorSetLayout, DescriptorCounts> layoutCounts;
+};
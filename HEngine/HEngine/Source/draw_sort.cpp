@@ -0,0 +1,100 @@
+#include "draw_sort.h"
+
+#include <algorithm>
+#include <array>
+
+#include "parallel_util.h"
+
+// 8 bits per pass, so per-thread histograms stay in L1
+static const uint32_t radixBits = 8;
+static const uint32_t radixSize = 1u << radixBits;
+static const uint64_t radixMask = radixSize - 1;
+
+// Below this many items per thread, spreading work costs more than it saves
+static const size_t minItemsPerThread = 16384;
+
+namespace DrawSort
+{
+	uint32_t getDepthBucket(float viewDepth, float nearPlane, float farPlane)
+	{
+		const uint32_t maxBucket = (1u << depthBits) - 1;
+
+		float t = (viewDepth - nearPlane) / (farPlane - nearPlane);
+		t = std::min(std::max(t, 0.0f), 1.0f);
+		return static_cast<uint32_t>(t * maxBucket);
+	}
+
+	void radixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch)
+	{
+		size_t count = items.size();
+		scratch.resize(count);
+		if (count < 2)
+		{
+			return;
+		}
+
+		// Digits every key agrees on don't need a pass. With few pipelines and materials, most don't.
+		uint64_t differingBits = 0;
+		for (const SortItem& item : items)
+		{
+			differingBits |= item.key ^ items[0].key;
+		}
+
+		size_t maxRanges = ParallelUtil::getThreadCount();
+		std::vector<std::array<size_t, radixSize>> histograms(maxRanges);
+
+		SortItem* source = items.data();
+		SortItem* destination = scratch.data();
+
+		for (uint32_t shift = 0; shift < 64; shift += radixBits)
+		{
+			if (((differingBits >> shift) & radixMask) == 0)
+			{
+				continue;
+			}
+
+			// Count each range's digits
+			size_t rangeCount = ParallelUtil::parallelForRanges(count, maxRanges, minItemsPerThread,
+				[&](size_t range, size_t begin, size_t end)
+			{
+				std::array<size_t, radixSize>& histogram = histograms[range];
+				histogram.fill(0);
+				for (size_t i = begin; i < end; ++i)
+				{
+					histogram[(source[i].key >> shift) & radixMask]++;
+				}
+			});
+
+			// Turn counts into write offsets. Digit-major, then range order, keeps the sort stable.
+			size_t offset = 0;
+			for (uint32_t digit = 0; digit < radixSize; ++digit)
+			{
+				for (size_t range = 0; range < rangeCount; ++range)
+				{
+					size_t digitCount = histograms[range][digit];
+					histograms[range][digit] = offset;
+					offset += digitCount;
+				}
+			}
+
+			// Same arguments, so the same ranges as the counting pass
+			ParallelUtil::parallelForRanges(count, maxRanges, minItemsPerThread,
+				[&](size_t range, size_t begin, size_t end)
+			{
+				std::array<size_t, radixSize>& offsets = histograms[range];
+				for (size_t i = begin; i < end; ++i)
+				{
+					destination[offsets[(source[i].key >> shift) & radixMask]++] = source[i];
+				}
+			});
+
+			std::swap(source, destination);
+		}
+
+		// An odd number of passes leaves the result in scratch
+		if (source != items.data())
+		{
+			items.swap(scratch);
+		}
+	}
+};
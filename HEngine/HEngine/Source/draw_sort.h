@@ -0,0 +1,53 @@
+/* Sort keys for draws. Each draw's state is packed into a 64-bit key, most expensive state change
+   first, so sorting the keys groups draws that can share binds. Keys are sorted with a stable LSD
+   radix sort that skips digits every key agrees on, and spreads large sorts across threads. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+namespace DrawSort
+{
+	// Field widths, from the most significant bits down. Depth comes last, so within a state
+	// group opaque draws go front to back. There's no descriptor set field: materials index the
+	// bindless textures, so every draw in a pipeline shares the same sets.
+	static const uint32_t passBits = 4;
+	static const uint32_t pipelineBits = 12;
+	static const uint32_t meshBits = 16;
+	static const uint32_t depthBits = 16;
+
+	static const uint32_t depthShift = 0;
+	static const uint32_t meshShift = depthShift + depthBits;
+	static const uint32_t pipelineShift = meshShift + meshBits;
+	static const uint32_t passShift = pipelineShift + pipelineBits;
+
+	// Values wider than their field are truncated
+	inline uint64_t makeKey(uint32_t pass, uint32_t pipeline, uint32_t mesh, uint32_t depthBucket)
+	{
+		return (static_cast<uint64_t>(pass & ((1u << passBits) - 1)) << passShift) |
+			(static_cast<uint64_t>(pipeline & ((1u << pipelineBits) - 1)) << pipelineShift) |
+			(static_cast<uint64_t>(mesh & ((1u << meshBits) - 1)) << meshShift) |
+			(static_cast<uint64_t>(depthBucket & ((1u << depthBits) - 1)) << depthShift);
+	}
+
+	inline uint32_t getPass(uint64_t key) { return static_cast<uint32_t>(key >> passShift) & ((1u << passBits) - 1); }
+	inline uint32_t getPipeline(uint64_t key) { return static_cast<uint32_t>(key >> pipelineShift) & ((1u << pipelineBits) - 1); }
+	inline uint32_t getMesh(uint64_t key) { return static_cast<uint32_t>(key >> meshShift) & ((1u << meshBits) - 1); }
+	inline uint32_t getDepthBucket(uint64_t key) { return static_cast<uint32_t>(key >> depthShift) & ((1u << depthBits) - 1); }
+
+	// Quantize a view-space distance in [nearPlane, farPlane] to a depth bucket; nearer is smaller.
+	// Distances outside the range are clamped.
+	uint32_t getDepthBucket(float viewDepth, float nearPlane, float farPlane);
+
+	// A key, and the index of the draw it belongs to
+	struct SortItem
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+
+	// Sort items by key, keeping the original order of equal keys. scratch is resized to match
+	// items and can be reused between calls to avoid allocating.
+	void radixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch);
+};
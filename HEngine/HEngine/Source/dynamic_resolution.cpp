@@ -0,0 +1,50 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Weight of the newest frame time in the running average
+static const float smoothing = 0.2f;
+
+// Aim a little under the budget, so spikes don't immediately go over it
+static const float headroom = 0.9f;
+
+// Changes smaller than this aren't worth a visible resolution change
+static const float minScaleChange = 0.02f;
+
+// Most the scale moves in one frame. Dropping is allowed to be faster than recovering.
+static const float maxScaleDecrease = 0.1f;
+static const float maxScaleIncrease = 0.05f;
+
+DynamicResolution::DynamicResolution(float targetMilliseconds, float _minScale, float _maxScale)
+	:
+	target(targetMilliseconds),
+	minScale(_minScale),
+	maxScale(_maxScale),
+	scale(_maxScale),
+	smoothedMilliseconds(-1.0f)
+{ }
+
+float DynamicResolution::update(float gpuMilliseconds)
+{
+	if (gpuMilliseconds <= 0.0f)
+	{
+		return scale;
+	}
+
+	smoothedMilliseconds = smoothedMilliseconds < 0.0f ? gpuMilliseconds :
+		smoothedMilliseconds + (gpuMilliseconds - smoothedMilliseconds) * smoothing;
+
+	// Cost goes with pixel count, so scale by the square root of how far off budget we are
+	float desired = scale * std::sqrt(target * headroom / smoothedMilliseconds);
+	desired = std::min(std::max(desired, scale - maxScaleDecrease), scale + maxScaleIncrease);
+	desired = std::min(std::max(desired, minScale), maxScale);
+
+	// Always settle exactly on the limits, even by less than the minimum change
+	if (std::abs(desired - scale) >= minScaleChange || desired == minScale || desired == maxScale)
+	{
+		scale = desired;
+	}
+
+	return scale;
+}
@@ -0,0 +1,28 @@
+/* Defines DynamicResolution, which picks the scale to render the scene at from measured GPU frame
+   times, so frame time stays near a budget. GPU cost is taken to be proportional to pixel count,
+   i.e. to the square of the scale. Times are smoothed and small changes ignored, so the
+   resolution doesn't flicker from frame to frame. */
+
+#pragma once
+
+class DynamicResolution
+{
+public:
+	// Scale is per axis, in [minScale, maxScale], and starts at maxScale
+	DynamicResolution(float targetMilliseconds, float minScale, float maxScale);
+
+	// Feed the GPU time of a finished frame. Returns the scale to render the next frame at.
+	float update(float gpuMilliseconds);
+
+	float getScale() const { return scale; }
+	float getSmoothedMilliseconds() const { return smoothedMilliseconds; }
+
+	void setTargetMilliseconds(float targetMilliseconds) { target = targetMilliseconds; }
+
+private:
+	float target;
+	float minScale;
+	float maxScale;
+	float scale;
+	float smoothedMilliseconds; // Negative until the first update
+};
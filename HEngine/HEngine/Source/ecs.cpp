@@ -0,0 +1,266 @@
+#include "ecs.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+// Component arrays start on cache lines, so a chunk's arrays never share one
+static const size_t arrayAlignment = 64;
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+EntityChunk::EntityChunk(const uint32_t* _offsets, uint32_t _entitiesOffset)
+	:
+	storage(new uint8_t[EntityWorld::chunkSize + arrayAlignment]),
+	offsets(_offsets),
+	entitiesOffset(_entitiesOffset),
+	count(0)
+{
+	data = storage.get() + (arrayAlignment - reinterpret_cast<uintptr_t>(storage.get()) % arrayAlignment) % arrayAlignment;
+}
+
+EntityWorld::EntityWorld()
+	:
+	entityCount(0)
+{ }
+
+ComponentId EntityWorld::addComponentType(std::type_index type, size_t size, size_t alignment)
+{
+	if (componentIds.count(type) != 0)
+	{
+		throw std::runtime_error("EntityWorld::registerComponent -- component type already registered");
+	}
+	if (alignment > arrayAlignment)
+	{
+		throw std::runtime_error("EntityWorld::registerComponent -- component alignment too large");
+	}
+	if (components.size() >= maxComponents)
+	{
+		throw std::runtime_error("EntityWorld::registerComponent -- too many component types");
+	}
+
+	ComponentInfo info;
+	info.size = size;
+	info.alignment = alignment;
+	components.push_back(info);
+
+	ComponentId id = static_cast<ComponentId>(components.size() - 1);
+	componentIds[type] = id;
+	return id;
+}
+
+uint32_t EntityWorld::getArchetype(ComponentMask mask)
+{
+	auto found = archetypeIndices.find(mask);
+	if (found != archetypeIndices.end())
+	{
+		return found->second;
+	}
+
+	// Unregistered components would have no size, so their arrays would overlap others
+	ComponentMask registered = components.size() < maxComponents ? componentBit(static_cast<ComponentId>(components.size())) - 1 : ~ComponentMask(0);
+	if (mask & ~registered)
+	{
+		throw std::runtime_error("EntityWorld -- mask has components that aren't registered");
+	}
+
+	std::unique_ptr<Archetype> archetype(new Archetype());
+	archetype->mask = mask;
+	std::fill(std::begin(archetype->offsets), std::end(archetype->offsets), 0);
+
+	// Fit as many entities as the chunk holds with every array padded out to a cache line
+	size_t entitySize = sizeof(EntityId);
+	size_t arrayCount = 1;
+	for (ComponentId component = 0; component < components.size(); ++component)
+	{
+		if (mask & componentBit(component))
+		{
+			entitySize += components[component].size;
+			arrayCount++;
+		}
+	}
+
+	size_t capacity = (EntityWorld::chunkSize - arrayCount * arrayAlignment) / entitySize;
+	if (capacity == 0)
+	{
+		throw std::runtime_error("EntityWorld -- components too big to fit an entity in a chunk");
+	}
+	archetype->capacity = static_cast<uint32_t>(capacity);
+
+	size_t offset = 0;
+	for (ComponentId component = 0; component < components.size(); ++component)
+	{
+		if (mask & componentBit(component))
+		{
+			archetype->offsets[component] = static_cast<uint32_t>(offset);
+			offset = alignUp(offset + components[component].size * capacity, arrayAlignment);
+		}
+	}
+	archetype->entitiesOffset = static_cast<uint32_t>(offset);
+
+	archetypes.push_back(std::move(archetype));
+	uint32_t index = static_cast<uint32_t>(archetypes.size() - 1);
+	archetypeIndices[mask] = index;
+	return index;
+}
+
+EntityWorld::EntityRecord EntityWorld::allocate(uint32_t archetypeIndex, EntityId entity)
+{
+	Archetype& archetype = *archetypes[archetypeIndex];
+	if (archetype.chunks.empty() || archetype.chunks.back()->count == archetype.capacity)
+	{
+		archetype.chunks.push_back(std::unique_ptr<EntityChunk>(new EntityChunk(archetype.offsets, archetype.entitiesOffset)));
+	}
+
+	EntityChunk& chunk = *archetype.chunks.back();
+
+	EntityRecord record;
+	record.archetype = archetypeIndex;
+	record.chunk = static_cast<uint32_t>(archetype.chunks.size() - 1);
+	record.row = chunk.count++;
+
+	reinterpret_cast<EntityId*>(chunk.data + chunk.entitiesOffset)[record.row] = entity;
+	for (ComponentId component = 0; component < components.size(); ++component)
+	{
+		if (archetype.mask & componentBit(component))
+		{
+			memset(getComponentData(record, component), 0, components[component].size);
+		}
+	}
+
+	return record;
+}
+
+void EntityWorld::release(const EntityRecord& record)
+{
+	Archetype& archetype = *archetypes[record.archetype];
+	EntityChunk& chunk = *archetype.chunks[record.chunk];
+	EntityChunk& lastChunk = *archetype.chunks.back();
+
+	EntityRecord last;
+	last.archetype = record.archetype;
+	last.chunk = static_cast<uint32_t>(archetype.chunks.size() - 1);
+	last.row = lastChunk.count - 1;
+
+	// Keeps every chunk but the last full, so iteration never skips holes
+	if (last.chunk != record.chunk || last.row != record.row)
+	{
+		for (ComponentId component = 0; component < components.size(); ++component)
+		{
+			if (archetype.mask & componentBit(component))
+			{
+				memcpy(getComponentData(record, component), getComponentData(last, component), components[component].size);
+			}
+		}
+
+		EntityId moved = lastChunk.getEntities()[last.row];
+		reinterpret_cast<EntityId*>(chunk.data + chunk.entitiesOffset)[record.row] = moved;
+		records[moved] = record;
+	}
+
+	lastChunk.count--;
+	if (lastChunk.count == 0)
+	{
+		archetype.chunks.pop_back();
+	}
+}
+
+EntityId EntityWorld::createEntity(ComponentMask mask)
+{
+	// Before taking an id, so a bad mask doesn't leave one half-made
+	uint32_t archetype = getArchetype(mask);
+
+	EntityId entity;
+	if (!freeIds.empty())
+	{
+		entity = freeIds.back();
+		freeIds.pop_back();
+	}
+	else
+	{
+		entity = static_cast<EntityId>(records.size());
+		records.push_back(EntityRecord());
+	}
+
+	records[entity] = allocate(archetype, entity);
+	entityCount++;
+	return entity;
+}
+
+void EntityWorld::destroyEntity(EntityId entity)
+{
+	release(records[entity]);
+	freeIds.push_back(entity);
+	entityCount--;
+}
+
+void EntityWorld::addComponents(EntityId entity, ComponentMask mask)
+{
+	moveEntity(entity, getComponents(entity) | mask);
+}
+
+void EntityWorld::removeComponents(EntityId entity, ComponentMask mask)
+{
+	moveEntity(entity, getComponents(entity) & ~mask);
+}
+
+void EntityWorld::moveEntity(EntityId entity, ComponentMask newMask)
+{
+	EntityRecord oldRecord = records[entity];
+	ComponentMask oldMask = archetypes[oldRecord.archetype]->mask;
+	if (newMask == oldMask)
+	{
+		return;
+	}
+
+	EntityRecord newRecord = allocate(getArchetype(newMask), entity);
+	for (ComponentId component = 0; component < components.size(); ++component)
+	{
+		if (oldMask & newMask & componentBit(component))
+		{
+			memcpy(getComponentData(newRecord, component), getComponentData(oldRecord, component), components[component].size);
+		}
+	}
+
+	release(oldRecord);
+	records[entity] = newRecord;
+}
+
+void* EntityWorld::getComponentData(const EntityRecord& record, ComponentId component) const
+{
+	const Archetype& archetype = *archetypes[record.archetype];
+	EntityChunk& chunk = *archetype.chunks[record.chunk];
+	return chunk.data + archetype.offsets[component] + components[component].size * record.row;
+}
+
+void EntityWorld::getChunks(ComponentMask mask, std::vector<EntityChunk*>& outChunks)
+{
+	for (const std::unique_ptr<Archetype>& archetype : archetypes)
+	{
+		if ((archetype->mask & mask) == mask)
+		{
+			for (const std::unique_ptr<EntityChunk>& chunk : archetype->chunks)
+			{
+				outChunks.push_back(chunk.get());
+			}
+		}
+	}
+}
+
+void EntityWorld::getChunks(ComponentMask mask, std::vector<const EntityChunk*>& outChunks) const
+{
+	for (const std::unique_ptr<Archetype>& archetype : archetypes)
+	{
+		if ((archetype->mask & mask) == mask)
+		{
+			for (const std::unique_ptr<EntityChunk>& chunk : archetype->chunks)
+			{
+				outChunks.push_back(chunk.get());
+			}
+		}
+	}
+}
@@ -0,0 +1,226 @@
+/* Defines EntityWorld, an entity-component store. Entities with the same set of components share
+   an archetype, and an archetype's entities are packed into fixed-size chunks. Each chunk holds
+   one array per component (structure of arrays), so a system that reads two components of a
+   million entities streams through two dense arrays per chunk instead of chasing pointers.
+   Components are plain data, moved around with memcpy. */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include "parallel_util.h"
+
+typedef uint32_t EntityId;
+typedef uint32_t ComponentId;
+typedef uint64_t ComponentMask; // Bit i set for component i
+
+static const EntityId invalidEntity = 0xFFFFFFFF;
+
+inline ComponentMask componentBit(ComponentId component) { return ComponentMask(1) << component; }
+
+class EntityWorld;
+
+// Up to EntityWorld::chunkSize bytes of entities sharing an archetype
+class EntityChunk
+{
+public:
+	uint32_t getCount() const { return count; }
+
+	const EntityId* getEntities() const { return reinterpret_cast<const EntityId*>(data + entitiesOffset); }
+
+	// The chunk's array of a component, which its archetype must have
+	template <typename T>
+	T* get(ComponentId component) { return reinterpret_cast<T*>(data + offsets[component]); }
+
+	template <typename T>
+	const T* get(ComponentId component) const { return reinterpret_cast<const T*>(data + offsets[component]); }
+
+private:
+	friend class EntityWorld;
+
+	EntityChunk(const uint32_t* offsets, uint32_t entitiesOffset);
+
+	// Storage is over-allocated so data can start on a cache line
+	std::unique_ptr<uint8_t[]> storage;
+	uint8_t* data;
+
+	const uint32_t* offsets; // The archetype's, by component
+	uint32_t entitiesOffset;
+	uint32_t count;
+};
+
+class EntityWorld
+{
+public:
+	static const size_t chunkSize = 16 * 1024;
+	static const uint32_t maxComponents = 64;
+
+	EntityWorld();
+
+	EntityWorld(const EntityWorld&) = delete;
+	EntityWorld& operator=(const EntityWorld&) = delete;
+
+	// Give a component type an id. Each type can be registered once per world.
+	template <typename T>
+	ComponentId registerComponent();
+
+	// Create an entity with the given components, zero-initialized
+	EntityId createEntity(ComponentMask components);
+
+	void destroyEntity(EntityId entity);
+
+	// Moves the entity to the archetype with the new set of components. Components it keeps are
+	// copied across; components it gains are zero-initialized.
+	void addComponents(EntityId entity, ComponentMask components);
+	void removeComponents(EntityId entity, ComponentMask components);
+
+	ComponentMask getComponents(EntityId entity) const { return archetypes[records[entity].archetype]->mask; }
+
+	bool hasComponent(EntityId entity, ComponentId component) const { return (getComponents(entity) & componentBit(component)) != 0; }
+
+	// Only valid until entities are created, destroyed or change components
+	template <typename T>
+	T& get(EntityId entity, ComponentId component);
+
+	size_t getEntityCount() const { return entityCount; }
+	size_t getArchetypeCount() const { return archetypes.size(); }
+
+	// Chunks holding entities with every component in mask, in archetype order
+	void getChunks(ComponentMask mask, std::vector<EntityChunk*>& outChunks);
+	void getChunks(ComponentMask mask, std::vector<const EntityChunk*>& outChunks) const;
+
+	// Call func(EntityChunk&) on every chunk of entities with every component in mask. On a const
+	// world, func gets a const EntityChunk&.
+	template <typename Func>
+	void forEachChunk(ComponentMask mask, Func func);
+	template <typename Func>
+	void forEachChunk(ComponentMask mask, Func func) const;
+
+	// As above, with chunks split across threads. func must only write to its own chunk.
+	template <typename Func>
+	void parallelForEachChunk(ComponentMask mask, Func func);
+	template <typename Func>
+	void parallelForEachChunk(ComponentMask mask, Func func) const;
+
+private:
+	struct ComponentInfo
+	{
+		size_t size;
+		size_t alignment;
+	};
+
+	// Every entity with exactly the same components. Only the last chunk can be partly full.
+	struct Archetype
+	{
+		ComponentMask mask;
+		uint32_t capacity; // Entities per chunk
+		uint32_t offsets[maxComponents]; // Byte offset of each component's array in a chunk
+		uint32_t entitiesOffset;
+		std::vector<std::unique_ptr<EntityChunk>> chunks;
+	};
+
+	// Where an entity's components are
+	struct EntityRecord
+	{
+		uint32_t archetype;
+		uint32_t chunk;
+		uint32_t row;
+	};
+
+	ComponentId addComponentType(std::type_index type, size_t size, size_t alignment);
+
+	uint32_t getArchetype(ComponentMask mask);
+
+	// Append a zeroed entity to an archetype, without touching records
+	EntityRecord allocate(uint32_t archetype, EntityId entity);
+
+	// Remove the entity at record, moving the archetype's last entity into its place
+	void release(const EntityRecord& record);
+
+	void moveEntity(EntityId entity, ComponentMask newMask);
+
+	void* getComponentData(const EntityRecord& record, ComponentId component) const;
+
+private:
+	std::vector<ComponentInfo> components;
+	std::unordered_map<std::type_index, ComponentId> componentIds;
+
+	std::vector<std::unique_ptr<Archetype>> archetypes;
+	std::unordered_map<ComponentMask, uint32_t> archetypeIndices;
+
+	// By entity id. Ids of destroyed entities are reused.
+	std::vector<EntityRecord> records;
+	std::vector<EntityId> freeIds;
+	size_t entityCount;
+};
+
+template <typename T>
+ComponentId EntityWorld::registerComponent()
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Components are moved with memcpy, so must be trivially copyable");
+	return addComponentType(std::type_index(typeid(T)), sizeof(T), alignof(T));
+}
+
+template <typename T>
+T& EntityWorld::get(EntityId entity, ComponentId component)
+{
+	return *static_cast<T*>(getComponentData(records[entity], component));
+}
+
+template <typename Func>
+void EntityWorld::forEachChunk(ComponentMask mask, Func func)
+{
+	std::vector<EntityChunk*> chunks;
+	getChunks(mask, chunks);
+	for (EntityChunk* chunk : chunks)
+	{
+		func(*chunk);
+	}
+}
+
+template <typename Func>
+void EntityWorld::forEachChunk(ComponentMask mask, Func func) const
+{
+	std::vector<const EntityChunk*> chunks;
+	getChunks(mask, chunks);
+	for (const EntityChunk* chunk : chunks)
+	{
+		func(*chunk);
+	}
+}
+
+template <typename Func>
+void EntityWorld::parallelForEachChunk(ComponentMask mask, Func func)
+{
+	std::vector<EntityChunk*> chunks;
+	getChunks(mask, chunks);
+
+	ParallelUtil::parallelFor(chunks.size(), 1, 1, [&chunks, &func](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			func(*chunks[i]);
+		}
+	});
+}
+
+template <typename Func>
+void EntityWorld::parallelForEachChunk(ComponentMask mask, Func func) const
+{
+	std::vector<const EntityChunk*> chunks;
+	getChunks(mask, chunks);
+
+	ParallelUtil::parallelFor(chunks.size(), 1, 1, [&chunks, &func](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			func(*chunks[i]);
+		}
+	});
+}
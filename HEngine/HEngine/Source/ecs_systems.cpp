@@ -0,0 +1,177 @@
+#include "ecs_systems.h"
+
+#include <atomic>
+#include <cmath>
+
+namespace EcsSystems
+{
+	EcsComponents registerComponents(EntityWorld& world)
+	{
+		EcsComponents ids;
+		ids.transform = world.registerComponent<TransformComponent>();
+		ids.velocity = world.registerComponent<VelocityComponent>();
+		ids.worldMatrix = world.registerComponent<WorldMatrixComponent>();
+		ids.localBounds = world.registerComponent<LocalBoundsComponent>();
+		ids.worldBounds = world.registerComponent<WorldBoundsComponent>();
+		ids.visibility = world.registerComponent<VisibilityComponent>();
+		ids.render = world.registerComponent<RenderComponent>();
+		ids.animation = world.registerComponent<AnimationComponent>();
+		return ids;
+	}
+
+	void integrateVelocities(EntityWorld& world, const EcsComponents& ids, float deltaTime)
+	{
+		ComponentMask mask = componentBit(ids.transform) | componentBit(ids.velocity);
+		world.parallelForEachChunk(mask, [&ids, deltaTime](EntityChunk& chunk)
+		{
+			TransformComponent* transforms = chunk.get<TransformComponent>(ids.transform);
+			const VelocityComponent* velocities = chunk.get<VelocityComponent>(ids.velocity);
+			for (uint32_t i = 0; i < chunk.getCount(); ++i)
+			{
+				TransformComponent& transform = transforms[i];
+				const VelocityComponent& velocity = velocities[i];
+				transform.position += velocity.linear * deltaTime;
+
+				// First order rotation step; small enough per frame that renormalizing keeps it accurate
+				glm::quat spin(0.0f, velocity.angular.x, velocity.angular.y, velocity.angular.z);
+				transform.rotation = glm::normalize(transform.rotation + (spin * transform.rotation) * (0.5f * deltaTime));
+			}
+		});
+	}
+
+	void updateTransforms(EntityWorld& world, const EcsComponents& ids)
+	{
+		ComponentMask mask = componentBit(ids.transform) | componentBit(ids.worldMatrix);
+		ComponentMask boundsMask = componentBit(ids.localBounds) | componentBit(ids.worldBounds);
+		world.parallelForEachChunk(mask, [&ids, boundsMask](EntityChunk& chunk)
+		{
+			const TransformComponent* transforms = chunk.get<TransformComponent>(ids.transform);
+			WorldMatrixComponent* matrices = chunk.get<WorldMatrixComponent>(ids.worldMatrix);
+			for (uint32_t i = 0; i < chunk.getCount(); ++i)
+			{
+				const TransformComponent& transform = transforms[i];
+				glm::mat4 world = glm::mat4_cast(transform.rotation);
+				world[0] *= transform.scale;
+				world[1] *= transform.scale;
+				world[2] *= transform.scale;
+				world[3] = glm::vec4(transform.position, 1.0f);
+				matrices[i].world = world;
+			}
+		});
+
+		// Bounds only need the transform, not the matrix, so they're a separate, narrower pass
+		world.parallelForEachChunk(componentBit(ids.transform) | boundsMask, [&ids](EntityChunk& chunk)
+		{
+			const TransformComponent* transforms = chunk.get<TransformComponent>(ids.transform);
+			const LocalBoundsComponent* localBounds = chunk.get<LocalBoundsComponent>(ids.localBounds);
+			WorldBoundsComponent* worldBounds = chunk.get<WorldBoundsComponent>(ids.worldBounds);
+			for (uint32_t i = 0; i < chunk.getCount(); ++i)
+			{
+				const TransformComponent& transform = transforms[i];
+				glm::vec3 center = transform.position + transform.rotation * (glm::vec3(localBounds[i].sphere) * transform.scale);
+				worldBounds[i].sphere = glm::vec4(center, localBounds[i].sphere.w * transform.scale);
+			}
+		});
+	}
+
+	size_t cull(EntityWorld& world, const EcsComponents& ids, const Frustum& frustum)
+	{
+		std::atomic<size_t> visibleCount(0);
+
+		ComponentMask mask = componentBit(ids.worldBounds) | componentBit(ids.visibility);
+		world.parallelForEachChunk(mask, [&ids, &frustum, &visibleCount](EntityChunk& chunk)
+		{
+			const WorldBoundsComponent* bounds = chunk.get<WorldBoundsComponent>(ids.worldBounds);
+			VisibilityComponent* visibility = chunk.get<VisibilityComponent>(ids.visibility);
+
+			size_t chunkVisible = 0;
+			for (uint32_t i = 0; i < chunk.getCount(); ++i)
+			{
+				const glm::vec4& sphere = bounds[i].sphere;
+				bool visible = true;
+				for (uint32_t plane = 0; plane < Frustum::PlaneCount; ++plane)
+				{
+					const glm::vec4& p = frustum.planes[plane];
+					visible = visible && p.x * sphere.x + p.y * sphere.y + p.z * sphere.z + p.w >= -sphere.w;
+				}
+				visibility[i].visible = visible ? 1 : 0;
+				chunkVisible += visible ? 1 : 0;
+			}
+
+			visibleCount += chunkVisible;
+		});
+
+		return visibleCount;
+	}
+
+	void extractInstances(const EntityWorld& world, const EcsComponents& ids, std::vector<InstanceData>& outInstances)
+	{
+		ComponentMask mask = componentBit(ids.worldMatrix) | componentBit(ids.visibility) | componentBit(ids.render);
+		std::vector<const EntityChunk*> chunks;
+		world.getChunks(mask, chunks);
+
+		// Count each chunk's visible entities, so every chunk knows where its instances go and
+		// chunks can be written in parallel
+		std::vector<size_t> offsets(chunks.size() + 1, 0);
+		ParallelUtil::parallelFor(chunks.size(), 1, 1, [&](size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; ++c)
+			{
+				const VisibilityComponent* visibility = chunks[c]->get<VisibilityComponent>(ids.visibility);
+				size_t count = 0;
+				for (uint32_t i = 0; i < chunks[c]->getCount(); ++i)
+				{
+					count += visibility[i].visible;
+				}
+				offsets[c + 1] = count;
+			}
+		});
+
+		for (size_t c = 0; c < chunks.size(); ++c)
+		{
+			offsets[c + 1] += offsets[c];
+		}
+		outInstances.resize(offsets.back());
+
+		ParallelUtil::parallelFor(chunks.size(), 1, 1, [&](size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; ++c)
+			{
+				const WorldMatrixComponent* matrices = chunks[c]->get<WorldMatrixComponent>(ids.worldMatrix);
+				const VisibilityComponent* visibility = chunks[c]->get<VisibilityComponent>(ids.visibility);
+				const RenderComponent* renders = chunks[c]->get<RenderComponent>(ids.render);
+
+				InstanceData* out = outInstances.data() + offsets[c];
+				for (uint32_t i = 0; i < chunks[c]->getCount(); ++i)
+				{
+					if (visibility[i].visible)
+					{
+						out->model = matrices[i].world;
+						out->material = renders[i].material;
+						out++;
+					}
+				}
+			}
+		});
+	}
+
+	void updateAnimations(EntityWorld& world, const EcsComponents& ids, float deltaTime)
+	{
+		world.parallelForEachChunk(componentBit(ids.animation), [&ids, deltaTime](EntityChunk& chunk)
+		{
+			AnimationComponent* animations = chunk.get<AnimationComponent>(ids.animation);
+			for (uint32_t i = 0; i < chunk.getCount(); ++i)
+			{
+				AnimationComponent& animation = animations[i];
+				animation.time += deltaTime * animation.speed;
+
+				// Speeds can be negative, to play backwards
+				if (animation.time >= animation.duration || animation.time < 0.0f)
+				{
+					animation.time = std::fmod(animation.time, animation.duration);
+					animation.time += animation.time < 0.0f ? animation.duration : 0.0f;
+				}
+			}
+		});
+	}
+};
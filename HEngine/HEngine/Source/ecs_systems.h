@@ -0,0 +1,97 @@
+/* Components and systems for entities in an EntityWorld: movement, transforms, frustum culling,
+   render extraction and animation clocks. Each system runs over every matching chunk in parallel,
+   touching only the component arrays it needs. */
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "ecs.h"
+#include "bounds.h"
+#include "render_types.h"
+
+// Placement relative to the world. Entities don't have parents; TransformHierarchy is for that.
+struct TransformComponent
+{
+	glm::quat rotation;
+	glm::vec3 position;
+	float scale;
+};
+
+struct VelocityComponent
+{
+	glm::vec3 linear; // Units per second
+	float padding0;
+	glm::vec3 angular; // Rotation axis scaled by radians per second
+	float padding1;
+};
+
+struct WorldMatrixComponent
+{
+	glm::mat4 world;
+};
+
+// Bounding sphere, xyz center and w radius
+struct LocalBoundsComponent
+{
+	glm::vec4 sphere;
+};
+
+struct WorldBoundsComponent
+{
+	glm::vec4 sphere;
+};
+
+struct VisibilityComponent
+{
+	uint32_t visible; // Set by EcsSystems::cull
+};
+
+struct RenderComponent
+{
+	uint32_t material;
+};
+
+// Clock for a looping animation clip
+struct AnimationComponent
+{
+	float time; // Seconds into the clip
+	float speed;
+	float duration; // Must be positive
+	uint32_t clip;
+};
+
+// Ids of the components above in one world
+struct EcsComponents
+{
+	ComponentId transform;
+	ComponentId velocity;
+	ComponentId worldMatrix;
+	ComponentId localBounds;
+	ComponentId worldBounds;
+	ComponentId visibility;
+	ComponentId render;
+	ComponentId animation;
+};
+
+namespace EcsSystems
+{
+	EcsComponents registerComponents(EntityWorld& world);
+
+	// Move entities with a transform and velocity
+	void integrateVelocities(EntityWorld& world, const EcsComponents& ids, float deltaTime);
+
+	// Build world matrices from transforms, and world bounds from local bounds where entities have both
+	void updateTransforms(EntityWorld& world, const EcsComponents& ids);
+
+	// Flag entities whose world bounds are in the frustum. Returns the number visible.
+	size_t cull(EntityWorld& world, const EcsComponents& ids, const Frustum& frustum);
+
+	// Write instance data for every visible renderable entity, in chunk order
+	void extractInstances(const EntityWorld& world, const EcsComponents& ids, std::vector<InstanceData>& outInstances);
+
+	// Advance animation clocks, looping each clip
+	void updateAnimations(EntityWorld& world, const EcsComponents& ids, float deltaTime);
+};
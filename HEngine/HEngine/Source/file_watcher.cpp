@@ -0,0 +1,62 @@
+#include "file_watcher.h"
+
+namespace fs = std::experimental::filesystem;
+
+FileWatcher::FileWatcher(std::chrono::milliseconds _pollInterval)
+	:
+	pollInterval(_pollInterval),
+	lastPoll(std::chrono::steady_clock::now())
+{ }
+
+void FileWatcher::watch(const std::string& path)
+{
+	for (const WatchedFile& file : files)
+	{
+		if (file.path == path)
+		{
+			return;
+		}
+	}
+
+	WatchedFile file;
+	file.path = path;
+	file.lastWriteTime = getWriteTime(path);
+	files.push_back(file);
+}
+
+std::vector<std::string> FileWatcher::poll()
+{
+	std::vector<std::string> changed;
+
+	auto now = std::chrono::steady_clock::now();
+	if (now - lastPoll < pollInterval)
+	{
+		return changed;
+	}
+	lastPoll = now;
+
+	for (WatchedFile& file : files)
+	{
+		fs::file_time_type writeTime = getWriteTime(file.path);
+
+		// Files that are missing (e.g. mid-save in some editors) are picked up once they reappear
+		if (writeTime != fs::file_time_type::min() && writeTime != file.lastWriteTime)
+		{
+			file.lastWriteTime = writeTime;
+			changed.push_back(file.path);
+		}
+	}
+
+	return changed;
+}
+
+fs::file_time_type FileWatcher::getWriteTime(const std::string& path)
+{
+	std::error_code err;
+	fs::file_time_type writeTime = fs::last_write_time(path, err);
+	if (err)
+	{
+		return fs::file_time_type::min();
+	}
+	return writeTime;
+}
@@ -0,0 +1,35 @@
+/* Polls a set of files for modification. Used for hot-reloading assets, e.g. shaders. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <experimental/filesystem>
+
+class FileWatcher
+{
+public:
+	// Files are only checked once per pollInterval, so calling poll() every frame is cheap.
+	FileWatcher(std::chrono::milliseconds pollInterval);
+
+	// Start watching a file. Watching the same path twice has no effect.
+	void watch(const std::string& path);
+
+	// Returns the paths that were modified since the last time they were checked.
+	std::vector<std::string> poll();
+
+private:
+	struct WatchedFile
+	{
+		std::string path;
+		std::experimental::filesystem::file_time_type lastWriteTime;
+	};
+
+	static std::experimental::filesystem::file_time_type getWriteTime(const std::string& path);
+
+private:
+	std::vector<WatchedFile> files;
+	std::chrono::milliseconds pollInterval;
+	std::chrono::steady_clock::time_point lastPoll;
+};
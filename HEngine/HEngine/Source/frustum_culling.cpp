@@ -0,0 +1,232 @@
+#include "frustum_culling.h"
+
+#include <algorithm>
+#include <atomic>
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "parallel_util.h"
+
+// Below this many spheres per thread, spreading work costs more than it saves
+static const size_t minSpheresPerThread = 16384;
+
+namespace FrustumCulling
+{
+	static size_t cullSpheresScalar(const Frustum& frustum, const SphereBoundsArray& bounds, size_t first, size_t last, uint32_t* outVisible)
+	{
+		const float* centerX = bounds.getCenterX();
+		const float* centerY = bounds.getCenterY();
+		const float* centerZ = bounds.getCenterZ();
+		const float* radius = bounds.getRadius();
+
+		size_t visibleCount = 0;
+		for (size_t i = first; i < last; ++i)
+		{
+			bool visible = true;
+			for (const glm::vec4& plane : frustum.planes)
+			{
+				float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+				if (distance < -radius[i])
+				{
+					visible = false;
+					break;
+				}
+			}
+
+			// Write unconditionally and only advance on a hit; avoids a hard-to-predict branch
+			outVisible[visibleCount] = static_cast<uint32_t>(i);
+			visibleCount += visible ? 1 : 0;
+		}
+
+		return visibleCount;
+	}
+
+	static size_t cullSpheresSSE(const Frustum& frustum, const SphereBoundsArray& bounds, size_t first, size_t last, uint32_t* outVisible)
+	{
+		const float* centerX = bounds.getCenterX();
+		const float* centerY = bounds.getCenterY();
+		const float* centerZ = bounds.getCenterZ();
+		const float* radius = bounds.getRadius();
+
+		// Broadcast each plane component once, outside the loop
+		__m128 planeX[Frustum::PlaneCount];
+		__m128 planeY[Frustum::PlaneCount];
+		__m128 planeZ[Frustum::PlaneCount];
+		__m128 planeW[Frustum::PlaneCount];
+		for (int p = 0; p < Frustum::PlaneCount; ++p)
+		{
+			planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+		}
+
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+
+		size_t visibleCount = 0;
+		for (size_t i = first; i < last; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(centerX + i);
+			__m128 y = _mm_loadu_ps(centerY + i);
+			__m128 z = _mm_loadu_ps(centerZ + i);
+			__m128 negRadius = _mm_xor_ps(_mm_loadu_ps(radius + i), signMask);
+
+			// A lane stays visible while distance >= -radius for every plane
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < Frustum::PlaneCount; ++p)
+			{
+				__m128 distance = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(x, planeX[p]), _mm_mul_ps(y, planeY[p])),
+					_mm_add_ps(_mm_mul_ps(z, planeZ[p]), planeW[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				outVisible[visibleCount] = static_cast<uint32_t>(i) + lane;
+				visibleCount += (mask >> lane) & 1;
+			}
+		}
+
+		return visibleCount;
+	}
+
+	static size_t cullSpheresAVX(const Frustum& frustum, const SphereBoundsArray& bounds, size_t first, size_t last, uint32_t* outVisible)
+	{
+		const float* centerX = bounds.getCenterX();
+		const float* centerY = bounds.getCenterY();
+		const float* centerZ = bounds.getCenterZ();
+		const float* radius = bounds.getRadius();
+
+		__m256 planeX[Frustum::PlaneCount];
+		__m256 planeY[Frustum::PlaneCount];
+		__m256 planeZ[Frustum::PlaneCount];
+		__m256 planeW[Frustum::PlaneCount];
+		for (int p = 0; p < Frustum::PlaneCount; ++p)
+		{
+			planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+		}
+
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+		size_t visibleCount = 0;
+		for (size_t i = first; i < last; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(centerX + i);
+			__m256 y = _mm256_loadu_ps(centerY + i);
+			__m256 z = _mm256_loadu_ps(centerZ + i);
+			__m256 negRadius = _mm256_xor_ps(_mm256_loadu_ps(radius + i), signMask);
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < Frustum::PlaneCount; ++p)
+			{
+				__m256 distance = _mm256_add_ps(
+					_mm256_add_ps(_mm256_mul_ps(x, planeX[p]), _mm256_mul_ps(y, planeY[p])),
+					_mm256_add_ps(_mm256_mul_ps(z, planeZ[p]), planeW[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+			}
+
+			// Most groups are either fully in or fully out; skip the per-lane writes for those
+			int mask = _mm256_movemask_ps(inside);
+			if (mask == 0)
+			{
+				continue;
+			}
+
+			for (uint32_t lane = 0; lane < 8; ++lane)
+			{
+				outVisible[visibleCount] = static_cast<uint32_t>(i) + lane;
+				visibleCount += (mask >> lane) & 1;
+			}
+		}
+
+		// AVX -> SSE transitions are expensive on some CPUs
+		_mm256_zeroupper();
+
+		return visibleCount;
+	}
+
+	SimdLevel getSupportedSimdLevel()
+	{
+		static const SimdLevel level = []()
+		{
+			int info[4];
+			__cpuid(info, 1);
+
+			// AVX needs CPU support, and the OS saving YMM registers (OSXSAVE + XCR0 bits 1 and 2)
+			bool avx = (info[2] & (1 << 28)) != 0;
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			if (avx && osxsave && (_xgetbv(0) & 0x6) == 0x6)
+			{
+				return AVX;
+			}
+
+			// SSE2 is part of x64
+			return SSE;
+		}();
+
+		return level;
+	}
+
+	size_t cullSpheres(const Frustum& frustum,
+		const SphereBoundsArray& bounds,
+		size_t first,
+		size_t last,
+		uint32_t* outVisible,
+		SimdLevel simdLevel)
+	{
+		switch (simdLevel)
+		{
+		case AVX:
+			return cullSpheresAVX(frustum, bounds, first, last, outVisible);
+		case SSE:
+			return cullSpheresSSE(frustum, bounds, first, last, outVisible);
+		default:
+			return cullSpheresScalar(frustum, bounds, first, last, outVisible);
+		}
+	}
+
+	void cullSpheres(const Frustum& frustum, const SphereBoundsArray& bounds, std::vector<uint32_t>& outVisible)
+	{
+		outVisible.resize(bounds.paddedSize());
+		size_t visibleCount = cullSpheres(frustum, bounds, 0, bounds.paddedSize(), outVisible.data(), getSupportedSimdLevel());
+		outVisible.resize(visibleCount);
+	}
+
+	void cullSpheresParallel(const Frustum& frustum, const SphereBoundsArray& bounds, std::vector<uint32_t>& outVisible)
+	{
+		SimdLevel simdLevel = getSupportedSimdLevel();
+		size_t paddedSize = bounds.paddedSize();
+
+		// Each range writes its results at its own offset, so threads never share output.
+		// Ranges are then packed together in order.
+		outVisible.resize(paddedSize);
+
+		std::vector<std::pair<size_t, size_t>> ranges(ParallelUtil::getThreadCount());
+		std::atomic<size_t> rangeCount(0);
+
+		ParallelUtil::parallelFor(paddedSize, minSpheresPerThread, SphereBoundsArray::laneCount, [&](size_t begin, size_t end)
+		{
+			size_t visibleCount = cullSpheres(frustum, bounds, begin, end, outVisible.data() + begin, simdLevel);
+			ranges[rangeCount++] = std::make_pair(begin, visibleCount);
+		});
+
+		std::sort(ranges.begin(), ranges.begin() + rangeCount);
+
+		size_t totalVisible = 0;
+		for (size_t i = 0; i < rangeCount; ++i)
+		{
+			// Ranges are in order, so this never overwrites results that haven't been moved yet
+			std::copy(outVisible.begin() + ranges[i].first,
+				outVisible.begin() + ranges[i].first + ranges[i].second,
+				outVisible.begin() + totalVisible);
+			totalVisible += ranges[i].second;
+		}
+
+		outVisible.resize(totalVisible);
+	}
+};
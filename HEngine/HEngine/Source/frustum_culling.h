@@ -0,0 +1,38 @@
+/* CPU frustum culling over SphereBoundsArray. Spheres are tested 4 (SSE) or 8 (AVX) at a time,
+   and large arrays are split across threads. Output is a compact list of visible indices. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "bounds.h"
+
+namespace FrustumCulling
+{
+	enum SimdLevel
+	{
+		Scalar,
+		SSE,
+		AVX
+	};
+
+	// Widest instruction set supported by this CPU (and OS, for AVX)
+	SimdLevel getSupportedSimdLevel();
+
+	// Test spheres [first, last) and write the indices of visible ones to outVisible, in order.
+	// first must be a multiple of SphereBoundsArray::laneCount and last must not exceed paddedSize().
+	// outVisible must have room for (last - first) indices. Returns the number written.
+	size_t cullSpheres(const Frustum& frustum,
+		const SphereBoundsArray& bounds,
+		size_t first,
+		size_t last,
+		uint32_t* outVisible,
+		SimdLevel simdLevel);
+
+	// Single-threaded cull of the whole array, using the best supported SIMD level
+	void cullSpheres(const Frustum& frustum, const SphereBoundsArray& bounds, std::vector<uint32_t>& outVisible);
+
+	// Multithreaded cull of the whole array. Small arrays are culled on the calling thread.
+	void cullSpheresParallel(const Frustum& frustum, const SphereBoundsArray& bounds, std::vector<uint32_t>& outVisible);
+};
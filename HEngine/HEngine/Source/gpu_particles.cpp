@@ -0,0 +1,54 @@
+#include "gpu_particles.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+// Longest step simulated at once. After a hitch, particles slow down rather than jump, and a
+// burst of emission can't use up every free slot.
+static const float maxDeltaTime = 0.1f;
+
+GpuParticles::GpuParticles(float emitRate, float lifetime)
+	:
+	emitRate(emitRate),
+	lifetime(lifetime),
+	lastTime(-1.0f),
+	emitRemainder(0.0f),
+	constants()
+{ }
+
+void GpuParticles::update(float time, const glm::vec3& emitterPosition)
+{
+	float deltaTime = lastTime < 0.0f ? 0.0f : std::min(time - lastTime, maxDeltaTime);
+	lastTime = time;
+
+	// Whole particles only; the rest is emitted in a later frame
+	float emit = emitRate * deltaTime + emitRemainder;
+	float wholeEmit = std::floor(emit);
+	emitRemainder = emit - wholeEmit;
+
+	constants.emitterPosition = emitterPosition;
+	constants.deltaTime = deltaTime;
+	constants.time = time;
+	constants.lifetime = lifetime;
+	constants.emitCount = std::min(static_cast<uint32_t>(wholeEmit), capacity);
+
+	// Last frame's survivors were written to the other list, so that's the one simulated now
+	constants.currentList ^= 1;
+}
+
+GpuParticleState GpuParticles::getInitialState()
+{
+	GpuParticleState state = { };
+	state.drawArgs[0] = 6; // Two triangles per particle
+	state.deadCount = capacity;
+	return state;
+}
+
+std::vector<uint32_t> GpuParticles::getInitialIndices()
+{
+	// Alive lists start empty, so only the free slots need filling in
+	std::vector<uint32_t> indices(capacity * 3, 0);
+	std::iota(indices.begin(), indices.begin() + capacity, 0);
+	return indices;
+}
@@ -0,0 +1,48 @@
+/* Defines GpuParticles, the CPU side of the GPU particle system. Particles live entirely in GPU
+   buffers. Each frame a compute pass hands free slots to newly emitted particles, moves every living
+   particle, and compacts the survivors into a fresh list, returning the rest to the free slots. The
+   survivors are drawn as instanced quads, with an indirect draw whose instance count simulation
+   wrote. The CPU only works out how many particles to emit, and sends that as push constants, so it
+   does the same work and uploads nothing, however many particles are alive. */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "render_types.h"
+
+class GpuParticles
+{
+public:
+	// Particles that can be alive at once. Must match the particle shaders.
+	static const uint32_t capacity = 1 << 20;
+
+	// Threads per workgroup in the emit and simulate shaders. Must match them and ParticleBegin.comp.
+	static const uint32_t workgroupSize = 64;
+
+	// Bytes in the index buffer: the free slots, then the two alive lists simulation ping-pongs between
+	static const size_t indexBufferSize = sizeof(uint32_t) * capacity * 3;
+
+	// emitRate is particles per second. Each lives for up to lifetime seconds.
+	GpuParticles(float emitRate, float lifetime);
+
+	// Step to time, in seconds since startup, emitting from emitterPosition. Called once per frame
+	// that's recorded, since the alive lists swap every call.
+	void update(float time, const glm::vec3& emitterPosition);
+
+	// This frame's step, for every particle shader
+	const ParticlePushConstants& getPushConstants() const { return constants; }
+
+	// Initial buffer contents: nothing alive, and every slot free
+	static GpuParticleState getInitialState();
+	static std::vector<uint32_t> getInitialIndices();
+
+private:
+	float emitRate;
+	float lifetime;
+	float lastTime; // Negative until the first update
+	float emitRemainder; // Fraction of a particle carried over to the next frame
+	ParticlePushConstants constants;
+};
@@ -0,0 +1,327 @@
+#include "job_system.h"
+
+// Times an idle worker looks for work, yielding in between, before going to sleep
+static const int idleSpinCount = 64;
+
+// The system and queue the calling thread works for, if it's a worker
+static thread_local JobSystem* currentSystem = nullptr;
+static thread_local uint32_t currentWorker = 0;
+
+JobCounter::JobCounter()
+	:
+	pending(0)
+{ }
+
+JobSystem::WorkQueue::WorkQueue()
+	:
+	top(0),
+	bottom(0)
+{ }
+
+bool JobSystem::WorkQueue::push(Job* job)
+{
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= capacity)
+	{
+		return false;
+	}
+
+	jobs[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+Job* JobSystem::WorkQueue::pop()
+{
+	// Claim the bottom job before looking at top, so a thief can't take it at the same time unnoticed
+	int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = jobs[b & (capacity - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		// Last job, which thieves may be after too. Whoever moves top first gets it.
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			job = nullptr;
+		}
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	return job;
+}
+
+Job* JobSystem::WorkQueue::steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+	{
+		return nullptr;
+	}
+
+	Job* job = jobs[t & (capacity - 1)].load(std::memory_order_relaxed);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		return nullptr;
+	}
+
+	return job;
+}
+
+JobSystem::JobSystem(unsigned _threadCount)
+	:
+	threadCount(std::max(_threadCount, 1u)),
+	sharedJobCount(0),
+	sleepingWorkers(0),
+	queuedJobs(0),
+	quit(false)
+{
+	// Every queue has to exist before any worker starts stealing
+	for (unsigned i = 1; i < threadCount; ++i)
+	{
+		queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	}
+
+	for (uint32_t worker = 0; worker < queues.size(); ++worker)
+	{
+		threads.push_back(std::thread(&JobSystem::workerLoop, this, worker));
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	quit = true;
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		sleepCondition.notify_all();
+	}
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+JobSystem& JobSystem::getDefault()
+{
+	static JobSystem jobSystem(std::max(1u, std::thread::hardware_concurrency()));
+	return jobSystem;
+}
+
+void JobSystem::run(std::function<void()> func, JobCounter* counter, JobCounter* dependency)
+{
+	Job* job = new Job();
+	job->func = std::move(func);
+	job->counter = counter;
+
+	if (counter)
+	{
+		counter->pending.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (dependency)
+	{
+		// Whoever finishes the dependency's last job takes the lock to release its dependents,
+		// so checking under it can't miss that
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (dependency->pending.load(std::memory_order_acquire) != 0)
+		{
+			dependency->dependents.push_back(job);
+			return;
+		}
+	}
+
+	push(job);
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+	uint32_t worker = getCurrentWorker();
+	while (counter.pending.load(std::memory_order_acquire) != 0)
+	{
+		Job* job = findJob(worker);
+		if (job)
+		{
+			execute(job);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	// Also waits for the thread that finished the last job to let go of the counter
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(counter.mutex);
+		error = counter.error;
+		counter.error = nullptr;
+	}
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+void JobSystem::workerLoop(uint32_t worker)
+{
+	currentSystem = this;
+	currentWorker = worker;
+
+	int idleSpins = 0;
+	while (!quit.load(std::memory_order_acquire))
+	{
+		Job* job = findJob(worker);
+		if (job)
+		{
+			execute(job);
+			idleSpins = 0;
+			continue;
+		}
+
+		if (++idleSpins < idleSpinCount)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		// push() checks for sleepers after counting its job, and this checks for jobs after counting
+		// itself as a sleeper, so one of them always sees the other
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleepingWorkers++;
+		sleepCondition.wait(lock, [this]()
+		{
+			return queuedJobs.load() > 0 || quit.load();
+		});
+		sleepingWorkers--;
+		idleSpins = 0;
+	}
+}
+
+void JobSystem::push(Job* job)
+{
+	queuedJobs++;
+
+	uint32_t worker = getCurrentWorker();
+	if (worker == invalidWorker || !queues[worker]->push(job))
+	{
+		std::lock_guard<std::mutex> lock(sharedMutex);
+		sharedJobs.push_back(job);
+		sharedJobCount++;
+	}
+
+	if (sleepingWorkers.load() > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		sleepCondition.notify_one();
+	}
+}
+
+Job* JobSystem::findJob(uint32_t worker)
+{
+	// Own jobs first, newest first, since their data is most likely still in cache
+	Job* job = nullptr;
+	if (worker != invalidWorker)
+	{
+		job = queues[worker]->pop();
+	}
+
+	if (!job && sharedJobCount.load(std::memory_order_acquire) > 0)
+	{
+		std::lock_guard<std::mutex> lock(sharedMutex);
+		if (!sharedJobs.empty())
+		{
+			job = sharedJobs.front();
+			sharedJobs.pop_front();
+			sharedJobCount--;
+		}
+	}
+
+	// Then the oldest job of another worker, starting with the next one along so thieves spread out
+	size_t queueCount = queues.size();
+	size_t start = worker != invalidWorker ? worker + 1 : 0;
+	for (size_t i = 0; i < queueCount && !job; ++i)
+	{
+		size_t victim = (start + i) % queueCount;
+		if (victim != worker)
+		{
+			job = queues[victim]->steal();
+		}
+	}
+
+	if (job)
+	{
+		queuedJobs--;
+	}
+
+	return job;
+}
+
+void JobSystem::execute(Job* job)
+{
+	JobCounter* counter = job->counter;
+	if (!counter)
+	{
+		job->func();
+		delete job;
+		return;
+	}
+
+	std::exception_ptr error;
+	try
+	{
+		job->func();
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+	delete job;
+
+	// Jobs that aren't the counter's last can just decrement it. The last one holds the lock while
+	// it does, so wait() can't return, and the counter be destroyed, before it's done with it.
+	uint32_t pending = counter->pending.load(std::memory_order_relaxed);
+	while (pending > 1 && !error)
+	{
+		if (counter->pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+		{
+			return;
+		}
+	}
+
+	std::vector<Job*> ready;
+	{
+		std::lock_guard<std::mutex> lock(counter->mutex);
+		if (error && !counter->error)
+		{
+			counter->error = error;
+		}
+		if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			ready.swap(counter->dependents);
+		}
+	}
+
+	for (Job* dependent : ready)
+	{
+		push(dependent);
+	}
+}
+
+uint32_t JobSystem::getCurrentWorker() const
+{
+	return currentSystem == this ? currentWorker : invalidWorker;
+}
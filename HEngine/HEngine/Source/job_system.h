@@ -0,0 +1,226 @@
+/* Defines JobSystem, a pool of worker threads that run small jobs. Each worker owns a deque of jobs:
+   it pushes and pops at one end, and idle workers steal from the other, so work spreads out without
+   a shared queue everyone contends on. Threads that aren't workers submit through a shared queue.
+   Jobs report to a JobCounter, which can be waited on or used as another job's dependency. Waiting
+   threads run jobs instead of blocking, so jobs can wait on jobs they spawn. */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+struct Job;
+
+// Counts jobs that haven't finished. Must outlive the jobs that use it.
+class JobCounter
+{
+public:
+	JobCounter();
+
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+
+	bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+
+	std::atomic<uint32_t> pending;
+
+	// Guards the last decrement, so a waiter can't see zero and destroy the counter while it's in use
+	std::mutex mutex;
+
+	// Jobs that depend on this counter, run once it reaches zero
+	std::vector<Job*> dependents;
+
+	// First exception thrown by a job, rethrown by JobSystem::wait
+	std::exception_ptr error;
+};
+
+// A queued function and the counter it reports to
+struct Job
+{
+	std::function<void()> func;
+	JobCounter* counter;
+};
+
+class JobSystem
+{
+public:
+	// threadCount includes the thread that waits, so threadCount - 1 workers are started
+	explicit JobSystem(unsigned threadCount);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Shared by the whole engine, with a thread per hardware thread. Started on first use.
+	static JobSystem& getDefault();
+
+	// Threads that run jobs, counting one waiting thread
+	unsigned getThreadCount() const { return threadCount; }
+
+	// Queue func. If counter is given, it counts the job until it finishes. If dependency is given,
+	// the job doesn't start until dependency reaches zero. Jobs without a counter must not throw.
+	void run(std::function<void()> func, JobCounter* counter = nullptr, JobCounter* dependency = nullptr);
+
+	// Run jobs until counter reaches zero, then rethrow the first exception any of its jobs threw
+	void wait(JobCounter& counter);
+
+	// Split [0, count) into contiguous ranges of at least minRangeSize elements and call
+	// func(begin, end) on each, in parallel. Range boundaries are multiples of alignment.
+	// Blocks until every range is done; the calling thread processes the first range.
+	template <typename Func>
+	void parallelFor(size_t count, size_t minRangeSize, size_t alignment, Func func);
+
+	// Split [0, count) into at most maxRanges contiguous ranges of at least minRangeSize elements and
+	// call func(range, begin, end) on each, in parallel. range is in [0, maxRanges), so each range can
+	// own a slot of per-thread state. Returns the number of ranges used, always at least one.
+	template <typename Func>
+	size_t parallelForRanges(size_t count, size_t maxRanges, size_t minRangeSize, Func func);
+
+private:
+	// Fixed-size Chase-Lev deque. The owning worker pushes and pops at the bottom; any thread can
+	// steal from the top.
+	class WorkQueue
+	{
+	public:
+		static const int64_t capacity = 4096;
+
+		WorkQueue();
+
+		// Owner only. Returns false if the queue is full.
+		bool push(Job* job);
+
+		// Owner only. Newest job first, or nullptr if empty.
+		Job* pop();
+
+		// Any thread. Oldest job first, or nullptr if empty or another thread got there first.
+		Job* steal();
+
+	private:
+		// Top and bottom are kept on separate cache lines, since thieves write one and the owner the other
+		std::atomic<int64_t> top;
+		char topPadding[64 - sizeof(std::atomic<int64_t>)];
+		std::atomic<int64_t> bottom;
+		char bottomPadding[64 - sizeof(std::atomic<int64_t>)];
+		std::atomic<Job*> jobs[capacity];
+	};
+
+	void workerLoop(uint32_t worker);
+
+	// Queue a job that's ready to run, and wake a worker for it
+	void push(Job* job);
+
+	// A job to run, or nullptr if none could be found. worker is the calling thread's own queue,
+	// or invalidWorker for threads that aren't workers of this system.
+	Job* findJob(uint32_t worker);
+
+	void execute(Job* job);
+
+	// Index of the calling thread's queue, or invalidWorker
+	uint32_t getCurrentWorker() const;
+
+private:
+	static const uint32_t invalidWorker = 0xFFFFFFFF;
+
+	unsigned threadCount;
+
+	// One per worker thread
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	std::vector<std::thread> threads;
+
+	// Jobs from threads that aren't workers, and from workers whose queue is full
+	std::mutex sharedMutex;
+	std::deque<Job*> sharedJobs;
+	std::atomic<size_t> sharedJobCount;
+
+	// Workers sleep once there's nothing to steal, until a job is queued
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+	std::atomic<uint32_t> sleepingWorkers;
+	std::atomic<int64_t> queuedJobs;
+	std::atomic<bool> quit;
+};
+
+template <typename Func>
+void JobSystem::parallelFor(size_t count, size_t minRangeSize, size_t alignment, Func func)
+{
+	size_t rangeCount = std::min<size_t>(getThreadCount(), std::max<size_t>(count / std::max<size_t>(minRangeSize, 1), 1));
+	size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+	rangeSize = (rangeSize + alignment - 1) / alignment * alignment;
+
+	JobCounter counter;
+	for (size_t begin = rangeSize; begin < count; begin += rangeSize)
+	{
+		size_t end = std::min(begin + rangeSize, count);
+		run([&func, begin, end]()
+		{
+			func(begin, end);
+		}, &counter);
+	}
+
+	// The other ranges still reference func, so they have to finish even if this one throws
+	std::exception_ptr error;
+	try
+	{
+		func(0, std::min(rangeSize, count));
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	wait(counter);
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+template <typename Func>
+size_t JobSystem::parallelForRanges(size_t count, size_t maxRanges, size_t minRangeSize, Func func)
+{
+	size_t rangeCount = std::min<size_t>(std::max<size_t>(maxRanges, 1), std::max<size_t>(count / std::max<size_t>(minRangeSize, 1), 1));
+	size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+	rangeCount = rangeSize > 0 ? (count + rangeSize - 1) / rangeSize : 1;
+
+	JobCounter counter;
+	for (size_t range = 1; range < rangeCount; ++range)
+	{
+		size_t begin = range * rangeSize;
+		size_t end = std::min(begin + rangeSize, count);
+		run([&func, range, begin, end]()
+		{
+			func(range, begin, end);
+		}, &counter);
+	}
+
+	std::exception_ptr error;
+	try
+	{
+		func(0, 0, std::min(rangeSize, count));
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	wait(counter);
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	return rangeCount;
+}
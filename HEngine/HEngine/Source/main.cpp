@@ -10,8 +10,11 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <cstring>
 #include <VulkanApplication.h>
 
+#include "benchmarks.h"
+
 int launchVulkanApplication()
 {
 	VulkanApplication app;
@@ -33,8 +36,38 @@ int launchVulkanApplication()
 	return 0;
 }
 
-int main() 
+int main(int argc, char** argv) 
 {
+	// Benchmarks run instead of the application
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--bench-culling") == 0)
+		{
+			Benchmarks::runCullingBenchmark(1000000);
+			return EXIT_SUCCESS;
+		}
+		if (strcmp(argv[i], "--bench-bvh") == 0)
+		{
+			Benchmarks::runBvhBenchmark(1000000);
+			return EXIT_SUCCESS;
+		}
+		if (strcmp(argv[i], "--bench-occlusion") == 0)
+		{
+			Benchmarks::runOcclusionBenchmark(1000000);
+			return EXIT_SUCCESS;
+		}
+		if (strcmp(argv[i], "--bench-jobs") == 0)
+		{
+			Benchmarks::runJobSystemBenchmark(1000000);
+			return EXIT_SUCCESS;
+		}
+		if (strcmp(argv[i], "--bench-ecs") == 0)
+		{
+			Benchmarks::runEcsBenchmark(1000000);
+			return EXIT_SUCCESS;
+		}
+	}
+
 	/*
 #ifdef _DEBUG
 	_CrtSetDbgFlag ( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF ); 
@@ -0,0 +1,121 @@
+/* Defines MpmcQueue, a bounded lock-free queue that any number of threads can push to and pop from.
+   It's the same ring of sequenced cells as MpscQueue, but consumers also claim cells by bumping a
+   shared position with compare-exchange, so no thread takes a lock or waits on another unless two
+   race for the same cell. Use MpscQueue when only one thread pops; its pops are cheaper. */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+template <typename T>
+class MpmcQueue
+{
+public:
+	// capacity must be a power of two
+	explicit MpmcQueue(size_t capacity)
+		:
+		cells(new Cell[capacity]),
+		mask(capacity - 1),
+		enqueuePosition(0),
+		dequeuePosition(0)
+	{
+		if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+		{
+			throw std::runtime_error("MpmcQueue -- capacity must be a power of two");
+		}
+
+		for (size_t i = 0; i < capacity; ++i)
+		{
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	MpmcQueue(const MpmcQueue&) = delete;
+	MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+	size_t getCapacity() const { return mask + 1; }
+
+	// Any thread. Returns false if the queue is full.
+	bool tryPush(const T& value)
+	{
+		size_t position = enqueuePosition.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+			if (difference == 0)
+			{
+				// The cell is free; claim it, unless another producer got there first
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					cell.value = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				// Still holds a value from a lap ago that hasn't been popped
+				return false;
+			}
+			else
+			{
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Any thread. Returns false if the queue is empty, or the next value is still being written.
+	bool tryPop(T& outValue)
+	{
+		size_t position = dequeuePosition.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+
+			if (difference == 0)
+			{
+				// The cell is written; take it, unless another consumer got there first
+				if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					outValue = cell.value;
+
+					// Free for the producer that gets here on the next lap
+					cell.sequence.store(position + mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = dequeuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+
+	// Producers and consumers each have their own cache line
+	char producerPadding[64];
+	std::atomic<size_t> enqueuePosition;
+	char consumerPadding[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> dequeuePosition;
+};
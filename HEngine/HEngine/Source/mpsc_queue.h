@@ -0,0 +1,107 @@
+/* Defines MpscQueue, a bounded lock-free queue that any number of threads can push to and one
+   thread pops from. It's a ring of cells, each with a sequence number saying whether it's ready to
+   be written or read; producers claim cells by bumping a shared position with compare-exchange,
+   so they never take a lock or wait on each other unless they race for the same cell. Values
+   from any one thread come out in the order that thread pushed them. */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+template <typename T>
+class MpscQueue
+{
+public:
+	// capacity must be a power of two
+	explicit MpscQueue(size_t capacity)
+		:
+		cells(new Cell[capacity]),
+		mask(capacity - 1),
+		enqueuePosition(0),
+		dequeuePosition(0)
+	{
+		if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+		{
+			throw std::runtime_error("MpscQueue -- capacity must be a power of two");
+		}
+
+		for (size_t i = 0; i < capacity; ++i)
+		{
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	size_t getCapacity() const { return mask + 1; }
+
+	// Any thread. Returns false if the queue is full.
+	bool tryPush(const T& value)
+	{
+		size_t position = enqueuePosition.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+			if (difference == 0)
+			{
+				// The cell is free; claim it, unless another producer got there first
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					cell.value = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				// Still holds a value from a lap ago that hasn't been popped
+				return false;
+			}
+			else
+			{
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Consumer only. Returns false if the queue is empty, or the next value is still being written.
+	bool tryPop(T& outValue)
+	{
+		Cell& cell = cells[dequeuePosition & mask];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(dequeuePosition + 1) < 0)
+		{
+			return false;
+		}
+
+		outValue = cell.value;
+
+		// Free for the producer that gets here on the next lap
+		cell.sequence.store(dequeuePosition + mask + 1, std::memory_order_release);
+		dequeuePosition++;
+		return true;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+
+	// Producers and the consumer each have their own cache line
+	char producerPadding[64];
+	std::atomic<size_t> enqueuePosition;
+	char consumerPadding[64 - sizeof(std::atomic<size_t>)];
+	size_t dequeuePosition;
+};
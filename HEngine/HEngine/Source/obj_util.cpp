@@ -39,6 +39,20 @@ attrib.texcoords[2 * index.texcoord_index + 0],
 
 				vertex.color = { 1.0f, 1.0f, 1.0f };
 
+				// Files without normals get them pointing up (+Y, the camera's up); lighting will be flat, but defined
+				if (index.normal_index >= 0)
+				{
+					vertex.normal = {
+attrib.normals[3 * index.normal_index + 0],
+attrib.normals[3 * index.normal_index + 1],
+attrib.normals[3 * index.normal_index + 2]
+					};
+				}
+				else
+				{
+					vertex.normal = { 0.0f, 1.0f, 0.0f };
+				}
+
 				outVertices.push_back(vertex);
 				outIndices.push_back(static_cast<uint32_t>(outIndices.size()));
 			}
@@ -46,4 +60,21 @@ attrib.texcoords[2 * index.texcoord_index + 0],
 
 		return true;
 	}
+
+	bool loadObj(std::string path, std::vector<Vertex3D>& outVertices, std::vector<uint32_t>& outIndices, Aabb& outBounds)
+	{
+		size_t firstVertex = outVertices.size();
+		if (!loadObj(path, outVertices, outIndices))
+		{
+			return false;
+		}
+
+		outBounds = Aabb::empty();
+		for (size_t i = firstVertex; i < outVertices.size(); ++i)
+		{
+			outBounds.grow(outVertices[i].pos);
+		}
+
+		return true;
+	}
 };
\ No newline at end of file
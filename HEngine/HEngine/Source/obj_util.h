@@ -6,10 +6,14 @@
 #include <string>
 
 #include "render_types.h"
+#include "bounds.h"
 
 
 
 namespace ObjUtil
 {
 	bool loadObj(std::string path, std::vector<Vertex3D>& outVertices, std::vector<uint32_t>& outIndices);
+
+	// As above, also computing the bounds of the loaded vertices
+	bool loadObj(std::string path, std::vector<Vertex3D>& outVertices, std::vector<uint32_t>& outIndices, Aabb& outBounds);
 };
\ No newline at end of file
@@ -0,0 +1,32 @@
+// Helpers for splitting work across threads. Work runs on the engine's shared job system.
+
+#pragma once
+
+#include "job_system.h"
+
+namespace ParallelUtil
+{
+	// Number of threads data-parallel work is split across
+	inline unsigned getThreadCount()
+	{
+		return JobSystem::getDefault().getThreadCount();
+	}
+
+	// Split [0, count) into contiguous ranges of at least minRangeSize elements and call
+	// func(begin, end) on each, in parallel. Range boundaries are multiples of alignment.
+	// Blocks until every range is done; the calling thread processes the first range.
+	template <typename Func>
+	void parallelFor(size_t count, size_t minRangeSize, size_t alignment, Func func)
+	{
+		JobSystem::getDefault().parallelFor(count, minRangeSize, alignment, func);
+	}
+
+	// Split [0, count) into at most maxRanges contiguous ranges of at least minRangeSize elements and
+	// call func(range, begin, end) on each, in parallel. range is in [0, maxRanges), so each range can
+	// own a slot of per-thread state. Returns the number of ranges used, always at least one.
+	template <typename Func>
+	size_t parallelForRanges(size_t count, size_t maxRanges, size_t minRangeSize, Func func)
+	{
+		return JobSystem::getDefault().parallelForRanges(count, maxRanges, minRangeSize, func);
+	}
+};
@@ -0,0 +1,114 @@
+#include "render_commands.h"
+
+#include <thread>
+
+RenderCommandQueue::RenderCommandQueue()
+	:
+	commands(capacity),
+	closed(false),
+	fullCount(0),
+	freeHandles(capacity),
+	nextHandle(0)
+{ }
+
+RenderObjectHandle RenderCommandQueue::createObject(MeshId mesh, MaterialId material,
+	const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	RenderCommand command;
+	command.type = RenderCommand::CreateObject;
+	command.object = allocateHandle();
+	command.mesh = mesh;
+	command.material = material;
+	command.position = position;
+	command.rotation = rotation;
+	command.scale = scale;
+
+	// The queue is closed and won't be applied again, so the handle is never needed back
+	if (!submit(command))
+	{
+		return invalidRenderObject;
+	}
+
+	return command.object;
+}
+
+void RenderCommandQueue::setTransform(RenderObjectHandle object, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	RenderCommand command = { };
+	command.type = RenderCommand::SetObjectTransform;
+	command.object = object;
+	command.position = position;
+	command.rotation = rotation;
+	command.scale = scale;
+	submit(command);
+}
+
+void RenderCommandQueue::destroyObject(RenderObjectHandle object)
+{
+	// Lets a dropped create be destroyed like any other
+	if (object == invalidRenderObject)
+	{
+		return;
+	}
+
+	// The render thread releases the handle once it has applied this, so a create that reuses it
+	// is always submitted after the destroy
+	RenderCommand command = { };
+	command.type = RenderCommand::DestroyObject;
+	command.object = object;
+	submit(command);
+}
+
+void RenderCommandQueue::clear()
+{
+	RenderCommand command;
+	while (commands.tryPop(command))
+	{ }
+}
+
+void RenderCommandQueue::releaseHandle(RenderObjectHandle handle)
+{
+	// Held handles go first, so none wait forever behind newer ones
+	while (!heldHandles.empty() && freeHandles.tryPush(heldHandles.back()))
+	{
+		heldHandles.pop_back();
+	}
+
+	if (!heldHandles.empty() || !freeHandles.tryPush(handle))
+	{
+		heldHandles.push_back(handle);
+	}
+}
+
+bool RenderCommandQueue::submit(const RenderCommand& command)
+{
+	if (commands.tryPush(command))
+	{
+		return true;
+	}
+
+	// Only happens if the render thread has stalled, or a thread submits more in a frame than
+	// the queue holds
+	fullCount++;
+	while (!commands.tryPush(command))
+	{
+		if (closed)
+		{
+			return false;
+		}
+		std::this_thread::yield();
+	}
+
+	return true;
+}
+
+RenderObjectHandle RenderCommandQueue::allocateHandle()
+{
+	RenderObjectHandle handle;
+	if (freeHandles.tryPop(handle))
+	{
+		return handle;
+	}
+
+	return nextHandle.fetch_add(1, std::memory_order_relaxed);
+}
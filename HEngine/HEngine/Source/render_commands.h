@@ -0,0 +1,103 @@
+/* Defines RenderCommandQueue, the way game code on any thread changes what the renderer draws.
+   Calls record commands into a lock-free MpscQueue, and the render thread applies them at the
+   start of its next frame, so only the render thread ever touches the scene or Vulkan objects.
+   Objects are referred to by handles handed out when they're created, before the render thread
+   has made them, so game code never waits on it. Handles of destroyed objects are reused once the
+   render thread has applied the destroy; handing them out and back takes no locks either. */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "mpmc_queue.h"
+#include "mpsc_queue.h"
+#include "scene.h"
+
+typedef uint32_t RenderObjectHandle;
+
+static const RenderObjectHandle invalidRenderObject = 0xFFFFFFFF;
+
+struct RenderCommand
+{
+	enum Type
+	{
+		CreateObject,
+		SetObjectTransform,
+		DestroyObject
+	};
+
+	Type type;
+	RenderObjectHandle object;
+
+	// CreateObject only
+	MeshId mesh;
+	MaterialId material;
+
+	// CreateObject and SetObjectTransform
+	glm::vec3 position;
+	glm::quat rotation;
+	glm::vec3 scale;
+};
+
+class RenderCommandQueue
+{
+public:
+	// Commands the queue holds between frames. Must be a power of two.
+	static const size_t capacity = 1 << 16;
+
+	RenderCommandQueue();
+
+	RenderCommandQueue(const RenderCommandQueue&) = delete;
+	RenderCommandQueue& operator=(const RenderCommandQueue&) = delete;
+
+	// Any thread. If the queue is full, these wait for the render thread to make room, unless the
+	// queue is closed, in which case the command is dropped.
+
+	// Add an object to the scene, with no parent. The handle can be used straight away, and is
+	// invalidRenderObject if the command was dropped.
+	RenderObjectHandle createObject(MeshId mesh, MaterialId material,
+		const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+
+	void setTransform(RenderObjectHandle object, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+
+	// The handle must not be used again; a later createObject may get it back
+	void destroyObject(RenderObjectHandle object);
+
+	// Any thread. Stop waiting for room, e.g. because the render thread is about to stop draining
+	// the queue and a submitting thread needs to be joined.
+	void close() { closed = true; }
+
+	// Render thread only. Next command, or false if there are none ready.
+	bool pop(RenderCommand& outCommand) { return commands.tryPop(outCommand); }
+
+	// Render thread only. Throw away every command waiting to be applied.
+	void clear();
+
+	// Render thread only. Hand back the handle of an object whose destroy has been applied, so a
+	// later createObject can reuse it.
+	void releaseHandle(RenderObjectHandle handle);
+
+	// Times a submitting thread found the queue full
+	uint64_t getFullCount() const { return fullCount; }
+
+private:
+	// False if the queue was full and closed
+	bool submit(const RenderCommand& command);
+
+	RenderObjectHandle allocateHandle();
+
+private:
+	MpscQueue<RenderCommand> commands;
+	std::atomic<bool> closed;
+	std::atomic<uint64_t> fullCount;
+
+	// Released handles, popped by any thread creating an object. Ones that don't fit wait in
+	// heldHandles, which only the render thread touches, until there's room.
+	MpmcQueue<RenderObjectHandle> freeHandles;
+	std::vector<RenderObjectHandle> heldHandles;
+	std::atomic<RenderObjectHandle> nextHandle;
+};
@@ -0,0 +1,891 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+static const uint32_t noPass = std::numeric_limits<uint32_t>::max();
+static const uint32_t noMemoryBlock = std::numeric_limits<uint32_t>::max();
+
+static const VkAccessFlags writeAccessMask =
+	VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_SHADER_WRITE_BIT |
+	VK_ACCESS_TRANSFER_WRITE_BIT |
+	VK_ACCESS_HOST_WRITE_BIT |
+	VK_ACCESS_MEMORY_WRITE_BIT;
+
+// Find a device local memory type out of typeBits. Returns false if there is none.
+static bool findDeviceLocalMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeBits, uint32_t& outTypeIndex)
+{
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+	{
+		if ((typeBits & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+		{
+			outTypeIndex = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+RenderGraph::RenderGraph()
+	:
+	device(VK_NULL_HANDLE),
+	physicalDevice(VK_NULL_HANDLE),
+	compiled(false),
+	unaliasedMemorySize(0)
+{ }
+
+RenderResourceId RenderGraph::createImage(const std::string& name, const TransientImageDesc& desc)
+{
+	if (compiled)
+	{
+		throw std::runtime_error("RenderGraph::createImage -- graph is already compiled");
+	}
+
+	Resource resource = { };
+	resource.name = name;
+	resource.imported = false;
+	resource.format = desc.format;
+	resource.extent = desc.extent;
+	resource.subresourceRange = { getAspectMask(desc.format), 0, 1, 0, 1 };
+	resource.usage = desc.usage;
+	resource.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	resource.finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	resource.initialStages = 0;
+	resource.memoryBlock = noMemoryBlock;
+	resources.push_back(resource);
+
+	return static_cast<RenderResourceId>(resources.size() - 1);
+}
+
+RenderResourceId RenderGraph::importImage(const std::string& name, const ImportedImageDesc& desc)
+{
+	if (compiled)
+	{
+		throw std::runtime_error("RenderGraph::importImage -- graph is already compiled");
+	}
+	if (desc.images.empty() || desc.images.size() != desc.views.size())
+	{
+		throw std::runtime_error("RenderGraph::importImage -- need one view per image for " + name);
+	}
+
+	Resource resource = { };
+	resource.name = name;
+	resource.imported = true;
+	resource.images = desc.images;
+	resource.views = desc.views;
+	resource.format = desc.format;
+	resource.extent = desc.extent;
+	resource.subresourceRange = desc.subresourceRange;
+	resource.usage = 0;
+	resource.initialLayout = desc.initialLayout;
+	resource.finalLayout = desc.finalLayout;
+	resource.initialStages = desc.initialStages;
+	resource.memoryBlock = noMemoryBlock;
+	resources.push_back(resource);
+
+	return static_cast<RenderResourceId>(resources.size() - 1);
+}
+
+RenderPassId RenderGraph::addGraphicsPass(const std::string& name, RecordFunc record)
+{
+	if (compiled)
+	{
+		throw std::runtime_error("RenderGraph::addGraphicsPass -- graph is already compiled");
+	}
+
+	Pass pass;
+	pass.name = name;
+	pass.graphics = true;
+	pass.record = record;
+	pass.sideEffects = false;
+	pass.secondaryCommandBuffers = false;
+	pass.culled = false;
+	pass.barriers = { 0, 0, { } };
+	pass.renderPass = VK_NULL_HANDLE;
+	pass.extent = { 0, 0 };
+	passes.push_back(pass);
+
+	return static_cast<RenderPassId>(passes.size() - 1);
+}
+
+RenderPassId RenderGraph::addComputePass(const std::string& name, RecordFunc record)
+{
+	RenderPassId pass = addGraphicsPass(name, record);
+	passes[pass].graphics = false;
+	return pass;
+}
+
+void RenderGraph::addColorOutput(RenderPassId pass, RenderResourceId image, VkAttachmentLoadOp loadOp, const VkClearColorValue& clearColor)
+{
+	VkClearValue clearValue = { };
+	clearValue.color = clearColor;
+	addAccess(pass, image, ColorOutput, loadOp, clearValue, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+}
+
+void RenderGraph::setDepthOutput(RenderPassId pass, RenderResourceId image, VkAttachmentLoadOp loadOp, float clearDepth)
+{
+	VkClearValue clearValue = { };
+	clearValue.depthStencil = { clearDepth, 0 };
+	addAccess(pass, image, DepthOutput, loadOp, clearValue,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+}
+
+void RenderGraph::setDepthInput(RenderPassId pass, RenderResourceId image)
+{
+	addAccess(pass, image, DepthInput, VK_ATTACHMENT_LOAD_OP_LOAD, VkClearValue(),
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+}
+
+void RenderGraph::addTextureInput(RenderPassId pass, RenderResourceId image, VkPipelineStageFlags stages)
+{
+	addAccess(pass, image, TextureInput, VK_ATTACHMENT_LOAD_OP_LOAD, VkClearValue(), stages);
+}
+
+void RenderGraph::addStorageInput(RenderPassId pass, RenderResourceId image, VkPipelineStageFlags stages)
+{
+	addAccess(pass, image, StorageInput, VK_ATTACHMENT_LOAD_OP_LOAD, VkClearValue(), stages);
+}
+
+void RenderGraph::addStorageOutput(RenderPassId pass, RenderResourceId image, VkPipelineStageFlags stages)
+{
+	addAccess(pass, image, StorageOutput, VK_ATTACHMENT_LOAD_OP_DONT_CARE, VkClearValue(), stages);
+}
+
+void RenderGraph::setSideEffects(RenderPassId pass)
+{
+	passes[pass].sideEffects = true;
+}
+
+void RenderGraph::setSecondaryCommandBuffers(RenderPassId pass)
+{
+	passes[pass].secondaryCommandBuffers = true;
+}
+
+void RenderGraph::addAccess(RenderPassId pass, RenderResourceId image, AccessType type, VkAttachmentLoadOp loadOp, VkClearValue clearValue, VkPipelineStageFlags stages)
+{
+	if (compiled)
+	{
+		throw std::runtime_error("RenderGraph -- can't add accesses once the graph is compiled");
+	}
+	if (pass >= passes.size() || image >= resources.size())
+	{
+		throw std::runtime_error("RenderGraph -- invalid pass or image id");
+	}
+
+	bool attachment = type == ColorOutput || type == DepthOutput || type == DepthInput;
+	if (attachment && !passes[pass].graphics)
+	{
+		throw std::runtime_error("RenderGraph -- compute pass " + passes[pass].name + " can't have attachments");
+	}
+
+	ImageAccess access;
+	access.image = image;
+	access.type = type;
+	access.loadOp = loadOp;
+	access.clearValue = clearValue;
+	access.stages = stages;
+	passes[pass].accesses.push_back(access);
+}
+
+void RenderGraph::compile(VkDevice _device, VkPhysicalDevice _physicalDevice)
+{
+	// Compiling again would leak everything the first compile created
+	if (compiled)
+	{
+		throw std::runtime_error("RenderGraph::compile -- graph is already compiled");
+	}
+
+	device = _device;
+	physicalDevice = _physicalDevice;
+
+	cullPasses();
+	computeLifetimes();
+	createTransientImages();
+	allocateTransientMemory();
+
+	// The graph runs the same way every time, so the state an image is left in is also the state
+	// the next execution finds it in. Walk the passes once to learn the end states, then again
+	// starting from them.
+	std::vector<ImageState> startStates(resources.size());
+	for (size_t i = 0; i < resources.size(); ++i)
+	{
+		startStates[i] = { resources[i].initialLayout, 0, 0 };
+	}
+
+	std::vector<ImageState> endStates = buildBarriers(startStates);
+
+	for (size_t i = 0; i < resources.size(); ++i)
+	{
+		if (resources[i].imported)
+		{
+			startStates[i].stages = endStates[i].stages | resources[i].initialStages;
+			startStates[i].access = endStates[i].access & writeAccessMask;
+		}
+	}
+
+	// An aliased image inherits its memory from the image used before it, which in the first
+	// image's case is the last one, from the previous execution
+	for (const MemoryBlock& block : memoryBlocks)
+	{
+		for (size_t i = 0; i < block.images.size(); ++i)
+		{
+			RenderResourceId previous = block.images[(i + block.images.size() - 1) % block.images.size()];
+			startStates[block.images[i]].stages = endStates[previous].stages;
+			startStates[block.images[i]].access = endStates[previous].access & writeAccessMask;
+		}
+	}
+
+	buildBarriers(startStates);
+	createRenderPasses();
+
+	compiled = true;
+}
+
+void RenderGraph::cullPasses()
+{
+	// Walk backwards, keeping passes that write something a later pass (or someone after the graph)
+	// reads. An image stops being needed above a pass that overwrites it without reading it.
+	std::vector<bool> needed(resources.size(), false);
+	for (size_t i = 0; i < resources.size(); ++i)
+	{
+		needed[i] = resources[i].imported && resources[i].finalLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+	}
+
+	for (size_t p = passes.size(); p-- > 0;)
+	{
+		Pass& pass = passes[p];
+
+		bool writesNeeded = false;
+		for (const ImageAccess& access : pass.accesses)
+		{
+			bool writes = access.type == ColorOutput || access.type == DepthOutput || access.type == StorageOutput;
+			writesNeeded = writesNeeded || (writes && needed[access.image]);
+		}
+
+		pass.culled = !pass.sideEffects && !writesNeeded;
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		for (const ImageAccess& access : pass.accesses)
+		{
+			bool overwrites = access.type == StorageOutput ||
+				((access.type == ColorOutput || access.type == DepthOutput) && access.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD);
+			needed[access.image] = !overwrites;
+		}
+	}
+}
+
+void RenderGraph::computeLifetimes()
+{
+	for (Resource& resource : resources)
+	{
+		resource.firstPass = noPass;
+		resource.lastPass = 0;
+	}
+
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		if (passes[p].culled)
+		{
+			continue;
+		}
+
+		for (const ImageAccess& access : passes[p].accesses)
+		{
+			Resource& resource = resources[access.image];
+			resource.firstPass = std::min(resource.firstPass, p);
+			resource.lastPass = std::max(resource.lastPass, p);
+			resource.usage |= getUsage(access.type);
+		}
+	}
+}
+
+void RenderGraph::createTransientImages()
+{
+	unaliasedMemorySize = 0;
+
+	for (Resource& resource : resources)
+	{
+		// Images no surviving pass uses are never created
+		if (resource.imported || resource.firstPass > resource.lastPass)
+		{
+			continue;
+		}
+
+		VkImageCreateInfo imageInfo = { };
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent.width = resource.extent.width;
+		imageInfo.extent.height = resource.extent.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = resource.format;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = resource.usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkImage image;
+		if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+		{
+			throw std::runtime_error("RenderGraph -- failed to create image " + resource.name);
+		}
+
+		resource.images.push_back(image);
+		vkGetImageMemoryRequirements(device, image, &resource.memoryRequirements);
+		unaliasedMemorySize += resource.memoryRequirements.size;
+	}
+}
+
+void RenderGraph::allocateTransientMemory()
+{
+	std::vector<RenderResourceId> transients;
+	for (RenderResourceId i = 0; i < resources.size(); ++i)
+	{
+		if (!resources[i].imported && !resources[i].images.empty())
+		{
+			transients.push_back(i);
+		}
+	}
+
+	// Largest first, so smaller images fit into blocks that are already big enough
+	std::sort(transients.begin(), transients.end(), [this](RenderResourceId a, RenderResourceId b)
+	{
+		return resources[a].memoryRequirements.size > resources[b].memoryRequirements.size;
+	});
+
+	for (RenderResourceId id : transients)
+	{
+		Resource& resource = resources[id];
+
+		// Share a block with images whose lifetimes don't overlap this one's. Every image in a
+		// block is bound at offset 0, so alignment takes care of itself.
+		for (uint32_t b = 0; b < memoryBlocks.size() && resource.memoryBlock == noMemoryBlock; ++b)
+		{
+			MemoryBlock& block = memoryBlocks[b];
+
+			uint32_t typeIndex;
+			uint32_t typeBits = block.memoryTypeBits & resource.memoryRequirements.memoryTypeBits;
+			if (!findDeviceLocalMemoryType(physicalDevice, typeBits, typeIndex))
+			{
+				continue;
+			}
+
+			bool overlaps = false;
+			for (RenderResourceId other : block.images)
+			{
+				overlaps = overlaps || (resource.firstPass <= resources[other].lastPass && resources[other].firstPass <= resource.lastPass);
+			}
+
+			if (!overlaps)
+			{
+				resource.memoryBlock = b;
+				block.memoryTypeBits = typeBits;
+				block.size = std::max(block.size, resource.memoryRequirements.size);
+				block.images.push_back(id);
+			}
+		}
+
+		if (resource.memoryBlock == noMemoryBlock)
+		{
+			MemoryBlock block;
+			block.memory = VK_NULL_HANDLE;
+			block.size = resource.memoryRequirements.size;
+			block.memoryTypeBits = resource.memoryRequirements.memoryTypeBits;
+			block.images.push_back(id);
+
+			resource.memoryBlock = static_cast<uint32_t>(memoryBlocks.size());
+			memoryBlocks.push_back(block);
+		}
+	}
+
+	for (MemoryBlock& block : memoryBlocks)
+	{
+		std::sort(block.images.begin(), block.images.end(), [this](RenderResourceId a, RenderResourceId b)
+		{
+			return resources[a].firstPass < resources[b].firstPass;
+		});
+
+		VkMemoryAllocateInfo allocInfo = { };
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = block.size;
+
+		if (!findDeviceLocalMemoryType(physicalDevice, block.memoryTypeBits, allocInfo.memoryTypeIndex) ||
+			vkAllocateMemory(device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS)
+		{
+			throw std::runtime_error("RenderGraph -- failed to allocate transient image memory");
+		}
+
+		for (RenderResourceId id : block.images)
+		{
+			Resource& resource = resources[id];
+			vkBindImageMemory(device, resource.images[0], block.memory, 0);
+
+			VkImageViewCreateInfo viewInfo = { };
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = resource.images[0];
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = resource.format;
+			viewInfo.subresourceRange = resource.subresourceRange;
+
+			VkImageView view;
+			if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+			{
+				throw std::runtime_error("RenderGraph -- failed to create image view for " + resource.name);
+			}
+			resource.views.push_back(view);
+		}
+	}
+}
+
+std::vector<RenderGraph::ImageState> RenderGraph::buildBarriers(const std::vector<ImageState>& startStates)
+{
+	std::vector<ImageState> states = startStates;
+
+	for (Pass& pass : passes)
+	{
+		pass.barriers = { 0, 0, { } };
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		for (const ImageAccess& access : pass.accesses)
+		{
+			ImageState next = getAccessState(access);
+			ImageState& current = states[access.image];
+
+			// Reads after reads in the same layout don't need to wait on each other. A later write
+			// has to wait for all of them, though.
+			bool layoutChange = current.layout != next.layout;
+			bool hazard = isWriteAccess(current.access) || isWriteAccess(next.access);
+			if (!layoutChange && (!hazard || current.stages == 0))
+			{
+				current.stages |= next.stages;
+				current.access |= next.access;
+				continue;
+			}
+
+			// Attachments that are cleared or don't care don't need their old contents kept
+			bool discard = (access.type == ColorOutput || access.type == DepthOutput) && access.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD;
+
+			ImageBarrier barrier;
+			barrier.image = access.image;
+			barrier.oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : current.layout;
+			barrier.newLayout = next.layout;
+			barrier.srcAccess = current.access & writeAccessMask;
+			barrier.dstAccess = next.access;
+
+			pass.barriers.srcStages |= current.stages != 0 ? current.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			pass.barriers.dstStages |= next.stages;
+			pass.barriers.barriers.push_back(barrier);
+
+			current = next;
+		}
+	}
+
+	finalBarriers = { 0, 0, { } };
+	for (RenderResourceId i = 0; i < resources.size(); ++i)
+	{
+		const Resource& resource = resources[i];
+		ImageState& current = states[i];
+
+		if (!resource.imported || resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || resource.finalLayout == current.layout)
+		{
+			continue;
+		}
+
+		// Presentation is ordered by a semaphore, so nothing in the pipeline needs to wait
+		bool present = resource.finalLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+		ImageBarrier barrier;
+		barrier.image = i;
+		barrier.oldLayout = current.layout;
+		barrier.newLayout = resource.finalLayout;
+		barrier.srcAccess = current.access & writeAccessMask;
+		barrier.dstAccess = present ? 0 : VK_ACCESS_MEMORY_READ_BIT;
+
+		finalBarriers.srcStages |= current.stages != 0 ? current.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		finalBarriers.dstStages |= present ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		finalBarriers.barriers.push_back(barrier);
+
+		current.layout = barrier.newLayout;
+		current.stages = present ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		current.access = barrier.dstAccess;
+	}
+
+	return states;
+}
+
+void RenderGraph::createRenderPasses()
+{
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		Pass& pass = passes[p];
+		if (!pass.graphics || pass.culled)
+		{
+			continue;
+		}
+
+		// Colors first, in the order they were added, then depth
+		std::vector<const ImageAccess*> attachmentAccesses;
+		for (const ImageAccess& access : pass.accesses)
+		{
+			if (access.type == ColorOutput)
+			{
+				attachmentAccesses.push_back(&access);
+			}
+		}
+		uint32_t colorCount = static_cast<uint32_t>(attachmentAccesses.size());
+		for (const ImageAccess& access : pass.accesses)
+		{
+			if (access.type == DepthOutput || access.type == DepthInput)
+			{
+				attachmentAccesses.push_back(&access);
+			}
+		}
+
+		if (attachmentAccesses.empty())
+		{
+			throw std::runtime_error("RenderGraph -- graphics pass " + pass.name + " has no attachments");
+		}
+
+		std::vector<VkAttachmentDescription> attachments;
+		std::vector<VkAttachmentReference> references;
+		pass.clearValues.clear();
+		pass.extent = resources[attachmentAccesses[0]->image].extent;
+
+		for (uint32_t i = 0; i < attachmentAccesses.size(); ++i)
+		{
+			const ImageAccess& access = *attachmentAccesses[i];
+			const Resource& resource = resources[access.image];
+
+			// The graph's barriers do the layout transitions, so the render pass doesn't.
+			// Contents nothing reads again are never written back to memory.
+			VkImageLayout layout = getAccessState(access).layout;
+			bool store = isReadAfter(access.image, p);
+
+			VkAttachmentDescription attachment = { };
+			attachment.format = resource.format;
+			attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+			attachment.loadOp = access.loadOp;
+			attachment.storeOp = store ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attachment.initialLayout = layout;
+			attachment.finalLayout = layout;
+			attachments.push_back(attachment);
+
+			references.push_back({ i, layout });
+			pass.clearValues.push_back(access.clearValue);
+		}
+
+		VkSubpassDescription subpass = { };
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = colorCount;
+		subpass.pColorAttachments = references.data();
+		subpass.pDepthStencilAttachment = colorCount < references.size() ? &references[colorCount] : nullptr;
+
+		VkRenderPassCreateInfo renderPassInfo = { };
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = 0;
+		renderPassInfo.pDependencies = nullptr;
+
+		if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &pass.renderPass) != VK_SUCCESS)
+		{
+			throw std::runtime_error("RenderGraph -- failed to create render pass " + pass.name);
+		}
+
+		// One framebuffer per variant of the imported attachments, e.g. per swapchain image
+		size_t variantCount = 1;
+		for (const ImageAccess* access : attachmentAccesses)
+		{
+			variantCount = std::max(variantCount, resources[access->image].views.size());
+		}
+
+		pass.framebuffers.resize(variantCount);
+		for (uint32_t variant = 0; variant < variantCount; ++variant)
+		{
+			std::vector<VkImageView> views;
+			for (const ImageAccess* access : attachmentAccesses)
+			{
+				views.push_back(getImageView(access->image, variant));
+			}
+
+			VkFramebufferCreateInfo framebufferInfo = { };
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = pass.renderPass;
+			framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+			framebufferInfo.pAttachments = views.data();
+			framebufferInfo.width = pass.extent.width;
+			framebufferInfo.height = pass.extent.height;
+			framebufferInfo.layers = 1;
+
+			if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &pass.framebuffers[variant]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("RenderGraph -- failed to create framebuffer for " + pass.name);
+			}
+		}
+	}
+}
+
+bool RenderGraph::isReadAfter(RenderResourceId image, uint32_t pass) const
+{
+	for (uint32_t p = pass + 1; p < passes.size(); ++p)
+	{
+		if (passes[p].culled)
+		{
+			continue;
+		}
+
+		for (const ImageAccess& access : passes[p].accesses)
+		{
+			if (access.image != image)
+			{
+				continue;
+			}
+
+			bool overwrites = access.type == StorageOutput ||
+				((access.type == ColorOutput || access.type == DepthOutput) && access.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD);
+			return !overwrites;
+		}
+	}
+
+	return resources[image].imported && resources[image].finalLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, uint32_t variant) const
+{
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		const Pass& pass = passes[p];
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		recordBarriers(commandBuffer, pass.barriers, variant);
+
+		if (!pass.graphics)
+		{
+			pass.record(commandBuffer, variant);
+			continue;
+		}
+
+		VkRenderPassBeginInfo renderPassInfo = { };
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = pass.renderPass;
+		renderPassInfo.framebuffer = getFramebuffer(p, variant);
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = pass.extent;
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(pass.clearValues.size());
+		renderPassInfo.pClearValues = pass.clearValues.data();
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+			pass.secondaryCommandBuffers ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+		pass.record(commandBuffer, variant);
+		vkCmdEndRenderPass(commandBuffer);
+	}
+
+	recordBarriers(commandBuffer, finalBarriers, variant);
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch, uint32_t variant) const
+{
+	if (batch.barriers.empty())
+	{
+		return;
+	}
+
+	std::vector<VkImageMemoryBarrier> imageBarriers(batch.barriers.size());
+	for (size_t i = 0; i < batch.barriers.size(); ++i)
+	{
+		const ImageBarrier& barrier = batch.barriers[i];
+
+		VkImageMemoryBarrier& imageBarrier = imageBarriers[i];
+		imageBarrier = { };
+		imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageBarrier.oldLayout = barrier.oldLayout;
+		imageBarrier.newLayout = barrier.newLayout;
+		imageBarrier.srcAccessMask = barrier.srcAccess;
+		imageBarrier.dstAccessMask = barrier.dstAccess;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = getImage(barrier.image, variant);
+		imageBarrier.subresourceRange = resources[barrier.image].subresourceRange;
+	}
+
+	vkCmdPipelineBarrier(commandBuffer,
+		batch.srcStages, batch.dstStages,
+		0,
+		0, nullptr,
+		0, nullptr,
+		static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+void RenderGraph::destroy()
+{
+	if (device != VK_NULL_HANDLE)
+	{
+		for (Pass& pass : passes)
+		{
+			for (VkFramebuffer framebuffer : pass.framebuffers)
+			{
+				vkDestroyFramebuffer(device, framebuffer, nullptr);
+			}
+			if (pass.renderPass != VK_NULL_HANDLE)
+			{
+				vkDestroyRenderPass(device, pass.renderPass, nullptr);
+			}
+		}
+
+		for (Resource& resource : resources)
+		{
+			if (resource.imported)
+			{
+				continue;
+			}
+
+			for (VkImageView view : resource.views)
+			{
+				vkDestroyImageView(device, view, nullptr);
+			}
+			for (VkImage image : resource.images)
+			{
+				vkDestroyImage(device, image, nullptr);
+			}
+		}
+
+		for (MemoryBlock& block : memoryBlocks)
+		{
+			vkFreeMemory(device, block.memory, nullptr);
+		}
+	}
+
+	passes.clear();
+	resources.clear();
+	memoryBlocks.clear();
+	finalBarriers = { 0, 0, { } };
+	unaliasedMemorySize = 0;
+	compiled = false;
+}
+
+VkFramebuffer RenderGraph::getFramebuffer(RenderPassId pass, uint32_t variant) const
+{
+	const std::vector<VkFramebuffer>& framebuffers = passes[pass].framebuffers;
+	return framebuffers[variant < framebuffers.size() ? variant : 0];
+}
+
+VkImageView RenderGraph::getImageView(RenderResourceId image, uint32_t variant) const
+{
+	const std::vector<VkImageView>& views = resources[image].views;
+	return views[variant < views.size() ? variant : 0];
+}
+
+VkImage RenderGraph::getImage(RenderResourceId image, uint32_t variant) const
+{
+	const std::vector<VkImage>& images = resources[image].images;
+	return images[variant < images.size() ? variant : 0];
+}
+
+VkDeviceSize RenderGraph::getTransientMemorySize() const
+{
+	VkDeviceSize size = 0;
+	for (const MemoryBlock& block : memoryBlocks)
+	{
+		size += block.size;
+	}
+	return size;
+}
+
+RenderGraph::ImageState RenderGraph::getAccessState(const ImageAccess& access)
+{
+	ImageState state;
+	state.stages = access.stages;
+
+	switch (access.type)
+	{
+	case ColorOutput:
+		state.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		state.access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		break;
+	case DepthOutput:
+		state.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		state.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		break;
+	case DepthInput:
+		state.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		state.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+		break;
+	case TextureInput:
+		state.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		state.access = VK_ACCESS_SHADER_READ_BIT;
+		break;
+	case StorageInput:
+		state.layout = VK_IMAGE_LAYOUT_GENERAL;
+		state.access = VK_ACCESS_SHADER_READ_BIT;
+		break;
+	case StorageOutput:
+	default:
+		state.layout = VK_IMAGE_LAYOUT_GENERAL;
+		state.access = VK_ACCESS_SHADER_WRITE_BIT;
+		break;
+	}
+
+	return state;
+}
+
+VkImageAspectFlags RenderGraph::getAspectMask(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_X8_D24_UNORM_PACK32:
+	case VK_FORMAT_D32_SFLOAT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT;
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	default:
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
+
+VkImageUsageFlags RenderGraph::getUsage(AccessType type)
+{
+	switch (type)
+	{
+	case ColorOutput:
+		return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	case DepthOutput:
+	case DepthInput:
+		return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	case TextureInput:
+		return VK_IMAGE_USAGE_SAMPLED_BIT;
+	case StorageInput:
+	case StorageOutput:
+	default:
+		return VK_IMAGE_USAGE_STORAGE_BIT;
+	}
+}
+
+bool RenderGraph::isWriteAccess(VkAccessFlags access)
+{
+	return (access & writeAccessMask) != 0;
+}
@@ -0,0 +1,244 @@
+/* Defines RenderGraph, a frame described as a list of passes and the images they read and write.
+   The graph derives barriers and layout transitions between passes, skips passes whose results
+   are never used, and lets transient images whose lifetimes don't overlap share memory. */
+
+#pragma once
+
+#define VK_USE_PLATFORM_WIN32_KHR
+#include <vulkan\vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+typedef uint32_t RenderResourceId;
+typedef uint32_t RenderPassId;
+
+// An image the graph creates and owns. Its contents don't survive between executions, and its
+// memory may be shared with other transient images that are never in use at the same time.
+struct TransientImageDesc
+{
+	VkFormat format;
+	VkExtent2D extent;
+	VkImageUsageFlags usage; // On top of the usage implied by the passes that access it
+};
+
+// An image created outside the graph, e.g. a swapchain image or one that persists between frames
+struct ImportedImageDesc
+{
+	// One image and view per variant, e.g. per swapchain image. Images with a single
+	// entry are used for every variant.
+	std::vector<VkImage> images;
+	std::vector<VkImageView> views;
+	VkFormat format;
+	VkExtent2D extent;
+	VkImageSubresourceRange subresourceRange;
+
+	// Layout the image is in when the graph starts. UNDEFINED discards the contents.
+	VkImageLayout initialLayout;
+
+	// Layout to leave the image in. UNDEFINED if nothing reads the image after the graph, in
+	// which case passes that only write it are culled.
+	VkImageLayout finalLayout;
+
+	// Stages that must wait for whatever produced the image before the graph, e.g. the stage
+	// the swapchain acquire semaphore is waited at
+	VkPipelineStageFlags initialStages;
+};
+
+class RenderGraph
+{
+public:
+	// Records a pass's commands. Graphics passes are called inside their render pass.
+	// variant is the value passed to execute(), e.g. the swapchain image index.
+	typedef std::function<void(VkCommandBuffer commandBuffer, uint32_t variant)> RecordFunc;
+
+	RenderGraph();
+
+	// Declaring the graph. Passes run in the order they are added.
+
+	RenderResourceId createImage(const std::string& name, const TransientImageDesc& desc);
+
+	RenderResourceId importImage(const std::string& name, const ImportedImageDesc& desc);
+
+	RenderPassId addGraphicsPass(const std::string& name, RecordFunc record);
+
+	RenderPassId addComputePass(const std::string& name, RecordFunc record);
+
+	// Render into a color attachment. Attachments are numbered in the order they are added.
+	void addColorOutput(RenderPassId pass, RenderResourceId image, VkAttachmentLoadOp loadOp, const VkClearColorValue& clearColor);
+
+	// Depth test and write. The depth attachment comes after every color attachment.
+	void setDepthOutput(RenderPassId pass, RenderResourceId image, VkAttachmentLoadOp loadOp, float clearDepth);
+
+	// Depth test against an earlier pass's depth, without writing it
+	void setDepthInput(RenderPassId pass, RenderResourceId image);
+
+	// Sample the image in shaders running at stages
+	void addTextureInput(RenderPassId pass, RenderResourceId image, VkPipelineStageFlags stages);
+
+	// Read or write the image as a storage image in shaders running at stages
+	void addStorageInput(RenderPassId pass, RenderResourceId image, VkPipelineStageFlags stages);
+	void addStorageOutput(RenderPassId pass, RenderResourceId image, VkPipelineStageFlags stages);
+
+	// Keep the pass even if nothing reads its outputs, e.g. because it writes buffers the graph doesn't track
+	void setSideEffects(RenderPassId pass);
+
+	// The pass's record function only executes secondary command buffers
+	void setSecondaryCommandBuffers(RenderPassId pass);
+
+	// Cull passes, create transient images, render passes and framebuffers, and work out barriers.
+	// The graph can't be changed once compiled, until destroy() is called.
+	void compile(VkDevice device, VkPhysicalDevice physicalDevice);
+
+	// Record every pass that survived culling, with barriers in between
+	void execute(VkCommandBuffer commandBuffer, uint32_t variant) const;
+
+	// Destroy everything compile() created and forget the declared graph, so a new one can be declared
+	void destroy();
+
+	// Valid after compile()
+
+	VkRenderPass getRenderPass(RenderPassId pass) const { return passes[pass].renderPass; }
+	VkFramebuffer getFramebuffer(RenderPassId pass, uint32_t variant) const;
+	VkImageView getImageView(RenderResourceId image, uint32_t variant) const;
+	bool isPassCulled(RenderPassId pass) const { return passes[pass].culled; }
+
+	// Memory used by transient images, and what it would be without aliasing
+	VkDeviceSize getTransientMemorySize() const;
+	VkDeviceSize getUnaliasedMemorySize() const { return unaliasedMemorySize; }
+
+private:
+	enum AccessType
+	{
+		ColorOutput,
+		DepthOutput,
+		DepthInput,
+		TextureInput,
+		StorageInput,
+		StorageOutput
+	};
+
+	struct ImageAccess
+	{
+		RenderResourceId image;
+		AccessType type;
+		VkAttachmentLoadOp loadOp;
+		VkClearValue clearValue;
+		VkPipelineStageFlags stages;
+	};
+
+	// How an image was last used, or is about to be used
+	struct ImageState
+	{
+		VkImageLayout layout;
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+	};
+
+	struct ImageBarrier
+	{
+		RenderResourceId image;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+		VkAccessFlags srcAccess;
+		VkAccessFlags dstAccess;
+	};
+
+	// Barriers recorded with a single vkCmdPipelineBarrier
+	struct BarrierBatch
+	{
+		VkPipelineStageFlags srcStages;
+		VkPipelineStageFlags dstStages;
+		std::vector<ImageBarrier> barriers;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		bool graphics;
+		RecordFunc record;
+		std::vector<ImageAccess> accesses;
+		bool sideEffects;
+		bool secondaryCommandBuffers;
+
+		// Compiled
+		bool culled;
+		BarrierBatch barriers; // Before the pass
+		VkRenderPass renderPass;
+		std::vector<VkFramebuffer> framebuffers; // Per variant
+		VkExtent2D extent;
+		std::vector<VkClearValue> clearValues;
+	};
+
+	struct Resource
+	{
+		std::string name;
+		bool imported;
+		std::vector<VkImage> images;
+		std::vector<VkImageView> views;
+		VkFormat format;
+		VkExtent2D extent;
+		VkImageSubresourceRange subresourceRange;
+		VkImageUsageFlags usage;
+		VkImageLayout initialLayout;
+		VkImageLayout finalLayout;
+		VkPipelineStageFlags initialStages;
+
+		// Range of passes that use the image, or firstPass > lastPass if none do
+		uint32_t firstPass;
+		uint32_t lastPass;
+
+		// Transient only
+		VkMemoryRequirements memoryRequirements;
+		uint32_t memoryBlock;
+	};
+
+	// Memory shared by transient images with disjoint lifetimes, in order of use
+	struct MemoryBlock
+	{
+		VkDeviceMemory memory;
+		VkDeviceSize size;
+		uint32_t memoryTypeBits;
+		std::vector<RenderResourceId> images;
+	};
+
+	void addAccess(RenderPassId pass, RenderResourceId image, AccessType type, VkAttachmentLoadOp loadOp, VkClearValue clearValue, VkPipelineStageFlags stages);
+
+	void cullPasses();
+	void computeLifetimes();
+	void createTransientImages();
+	void allocateTransientMemory();
+
+	// Walk the passes, tracking each image's state and emitting barriers where it changes.
+	// Returns the state every image is left in.
+	std::vector<ImageState> buildBarriers(const std::vector<ImageState>& startStates);
+
+	void createRenderPasses();
+
+	// Whether anything reads the image after pass, in this execution or after the graph
+	bool isReadAfter(RenderResourceId image, uint32_t pass) const;
+
+	void recordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch, uint32_t variant) const;
+
+	VkImage getImage(RenderResourceId image, uint32_t variant) const;
+
+	static ImageState getAccessState(const ImageAccess& access);
+	static VkImageAspectFlags getAspectMask(VkFormat format);
+	static VkImageUsageFlags getUsage(AccessType type);
+	static bool isWriteAccess(VkAccessFlags access);
+
+private:
+	VkDevice device;
+	VkPhysicalDevice physicalDevice;
+	bool compiled;
+
+	std::vector<Pass> passes;
+	std::vector<Resource> resources;
+	std::vector<MemoryBlock> memoryBlocks;
+	VkDeviceSize unaliasedMemorySize;
+
+	// Transitions to each imported image's final layout, after the last pass
+	BarrierBatch finalBarriers;
+};
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <glm/glm.hpp>
 
 // Render-able 3D vertex
@@ -11,4 +12,154 @@ struct Vertex3D
 	glm::vec3 pos;
 	glm::vec3 color;	
 	glm::vec2 texCoord;
+	glm::vec3 normal;
+};
+
+// Per-instance data, fed to the vertex shader at VK_VERTEX_INPUT_RATE_INSTANCE
+struct InstanceData
+{
+	glm::mat4 model;
+	uint32_t material; // Picks the instance's texture from the bindless texture array
+	uint32_t padding[3]; // Culling shaders read these as std430 structs, which round up to 16 bytes
+};
+
+// Batch description used by GPU culling. The first five fields match VkDrawIndexedIndirectCommand,
+// so an array of these can be passed straight to vkCmdDrawIndexedIndirect.
+struct GpuDrawBatch
+{
+	uint32_t indexCount;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t firstInstance;
+	uint32_t padding[3];
+
+	// Local-space bounds of the batch's mesh: xyz is the center, w the radius
+	glm::vec4 boundingSphere;
+};
+
+// GPU culling runs twice a frame: first against last frame's depth, then against the depth
+// drawn by the first phase, to catch objects that just came into view
+enum CullPhase : uint32_t
+{
+	CullPhaseEarly,
+	CullPhaseLate,
+	CullPhaseCount
+};
+
+// Push constants shared by the culling shaders
+struct CullPushConstants
+{
+	uint32_t instanceCount;
+	uint32_t batchCount;
+	uint32_t phase;
+	uint32_t screenWidth;
+	uint32_t screenHeight;
+};
+
+// Kinds of light clustered lighting handles
+enum LightType : uint32_t
+{
+	LightTypePoint,
+	LightTypeSpot
+};
+
+// A light, as the clustered lighting shaders read it (std430). Positions and directions are in world space.
+struct GpuLight
+{
+	glm::vec3 position;
+	float radius; // No effect beyond this
+	glm::vec3 color; // Scaled by intensity
+	uint32_t type; // LightType
+	glm::vec3 direction; // Spot lights only
+	float cosOuterAngle; // Spot lights light nothing outside the outer cone...
+	float cosInnerAngle; // ... and are at full strength inside the inner one
+	uint32_t padding[3];
+};
+
+// Push constants for binning lights into clusters
+struct LightBinPushConstants
+{
+	glm::mat4 view;
+	glm::vec2 tanHalfFov; // Horizontal, vertical
+	float nearPlane;
+	float farPlane;
+	uint32_t lightCount;
+};
+
+// Bind-pose vertex of a skinned mesh, with the joints that move it, as the skinning shader reads it (std430)
+struct SkinVertex
+{
+	glm::vec3 position;
+	uint32_t joints; // Four 8-bit joint indices, from the instance's first joint in the palette
+	glm::vec3 normal;
+	uint32_t padding;
+	glm::vec4 weights; // Of each joint, summing to one
+};
+
+// An animated instance of a skinned mesh, as the skinning shader reads it (std430)
+struct GpuSkinnedInstance
+{
+	uint32_t sourceFirstVertex; // In the skin vertex buffer
+	uint32_t vertexCount;
+	uint32_t outputFirstVertex; // The instance's own copy of the mesh, in the vertex and position buffers
+	uint32_t firstJoint; // In the palette
+};
+
+// A particle, as the particle shaders read it (std430). Positions are in world space.
+struct GpuParticle
+{
+	glm::vec3 position;
+	float age; // Seconds
+	glm::vec3 velocity;
+	float lifetime; // Dies once age reaches this
+};
+
+// Counters the particle shaders keep from one frame to the next, and the indirect arguments they
+// write for themselves and the draw (std430)
+struct GpuParticleState
+{
+	uint32_t drawArgs[4]; // VkDrawIndirectCommand. The instance count is the particles left alive by simulation.
+	uint32_t emitGroups[3]; // VkDispatchIndirectCommand
+	uint32_t simulateGroups[3]; // VkDispatchIndirectCommand
+	uint32_t aliveCount; // In the list being simulated, not counting this frame's emission
+	uint32_t deadCount; // Free slots
+	uint32_t emitCount; // Emitted this frame, at most the free slots
+	uint32_t padding[3];
+};
+
+// Push constants shared by every particle shader
+struct ParticlePushConstants
+{
+	glm::vec3 emitterPosition;
+	float deltaTime;
+	float time; // Seconds since startup, to seed emission with
+	float lifetime; // Longest a particle lives
+	uint32_t emitCount; // Asked for; fewer are emitted if there aren't enough free slots
+	uint32_t currentList; // Alive list being simulated. Survivors go to the other one, which is drawn.
+};
+
+// A 2D sprite, read per instance by the sprite vertex shader. Positions and sizes are in pixels,
+// from the top-left of the screen.
+struct GpuSprite
+{
+	glm::vec2 position; // Center
+	glm::vec2 size;
+	glm::vec4 uvRect; // Min uv in xy, max in zw
+	float rotation; // Radians, clockwise on screen
+	uint32_t color; // RGBA8, multiplied with the texture
+};
+
+// Push constants for drawing a run of sprites
+struct SpritePushConstants
+{
+	glm::vec2 screenScale; // Two over the screen size, from pixels to clip space
+	uint32_t textureSlot; // Bindless texture every sprite in the run samples
+};
+
+// Push constants for stretching the rendered part of the scene color image over the backbuffer
+struct UpscalePushConstants
+{
+	glm::vec2 uvScale; // Rendered extent over image extent
+	glm::vec2 uvMax; // Half a texel inside the rendered extent, so filtering never reads past it
 };
\ No newline at end of file
@@ -0,0 +1,354 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+Scene::Scene()
+	:
+	staticInstanceCount(0),
+	batchesDirty(false),
+	staticVersion(0),
+	dirtyBegin(0),
+	dirtyEnd(0),
+	bvhDirty(false),
+	bvhBoundsDirty(false)
+{ }
+
+// Refit trees get worse as objects move. Rebuild once queries are expected to cost this much
+// more than on a fresh tree.
+static const float bvhRebuildCostRatio = 1.5f;
+
+MeshId Scene::addMesh(const std::vector<Vertex3D>& meshVertices, const std::vector<uint32_t>& meshIndices)
+{
+	Aabb bounds = Aabb::empty();
+	for (const Vertex3D& vertex : meshVertices)
+	{
+		bounds.grow(vertex.pos);
+	}
+
+	return addMesh(meshVertices, meshIndices, bounds);
+}
+
+MeshId Scene::addMesh(const std::vector<Vertex3D>& meshVertices, const std::vector<uint32_t>& meshIndices, const Aabb& bounds)
+{
+	MeshInfo mesh;
+	mesh.firstIndex = static_cast<uint32_t>(indices.size());
+	mesh.indexCount = static_cast<uint32_t>(meshIndices.size());
+	mesh.vertexOffset = static_cast<int32_t>(vertices.size());
+	mesh.bounds = bounds;
+	mesh.boundingSphere = glm::vec4(0.0f);
+
+	if (!meshVertices.empty())
+	{
+		// Sphere around the center of the bounding box. Not minimal, but cheap and close enough for culling.
+		glm::vec3 center = bounds.center();
+		float radius = 0.0f;
+		for (const Vertex3D& vertex : meshVertices)
+		{
+			radius = std::max(radius, glm::length(vertex.pos - center));
+		}
+
+		mesh.boundingSphere = glm::vec4(center, radius);
+	}
+	else
+	{
+		mesh.bounds.min = glm::vec3(0.0f);
+		mesh.bounds.max = glm::vec3(0.0f);
+	}
+
+	vertices.insert(vertices.end(), meshVertices.begin(), meshVertices.end());
+	indices.insert(indices.end(), meshIndices.begin(), meshIndices.end());
+	meshes.push_back(mesh);
+
+	return static_cast<MeshId>(meshes.size() - 1);
+}
+
+void Scene::setMeshBounds(MeshId mesh, const Aabb& bounds)
+{
+	// Nothing is known about where the vertices will be, so the sphere has to cover the whole box
+	meshes[mesh].bounds = bounds;
+	meshes[mesh].boundingSphere = glm::vec4(bounds.center(), glm::length(bounds.extent() * 0.5f));
+}
+
+ObjectId Scene::addObject(MeshId mesh, MaterialId material, const glm::mat4& transform)
+{
+	if (mesh >= meshes.size())
+	{
+		throw std::runtime_error("Scene::addObject -- invalid mesh id");
+	}
+
+	ObjectId id;
+	if (!freeIds.empty())
+	{
+		id = freeIds.back();
+		freeIds.pop_back();
+	}
+	else
+	{
+		id = static_cast<ObjectId>(objectIndices.size());
+		objectIndices.push_back(invalidIndex);
+	}
+
+	objectIndices[id] = static_cast<uint32_t>(objectIds.size());
+	objectIds.push_back(id);
+	objectMeshes.push_back(mesh);
+	objectMaterials.push_back(material);
+	objectTransforms.push_back(transform);
+	objectBounds.push_back(transformAabb(meshes[mesh].bounds, transform));
+	objectStatic.push_back(false);
+	objectInstances.push_back(invalidIndex);
+
+	batchesDirty = true;
+	bvhDirty = true;
+	return id;
+}
+
+void Scene::removeObject(ObjectId object)
+{
+	uint32_t index = getObjectIndex(object, "Scene::removeObject");
+	uint32_t last = static_cast<uint32_t>(objectIds.size() - 1);
+
+	if (objectStatic[index])
+	{
+		staticVersion++;
+	}
+
+	// Swap the last object into the hole
+	objectIds[index] = objectIds[last];
+	objectMeshes[index] = objectMeshes[last];
+	objectMaterials[index] = objectMaterials[last];
+	objectTransforms[index] = objectTransforms[last];
+	objectBounds[index] = objectBounds[last];
+	objectStatic[index] = objectStatic[last];
+	objectInstances[index] = objectInstances[last];
+	objectIndices[objectIds[index]] = index;
+
+	objectIds.pop_back();
+	objectMeshes.pop_back();
+	objectMaterials.pop_back();
+	objectTransforms.pop_back();
+	objectBounds.pop_back();
+	objectStatic.pop_back();
+	objectInstances.pop_back();
+
+	objectIndices[object] = invalidIndex;
+	freeIds.push_back(object);
+
+	batchesDirty = true;
+	bvhDirty = true;
+}
+
+void Scene::setTransform(ObjectId object, const glm::mat4& transform)
+{
+	uint32_t index = getObjectIndex(object, "Scene::setTransform");
+	objectTransforms[index] = transform;
+	objectBounds[index] = transformAabb(meshes[objectMeshes[index]].bounds, transform);
+	bvhBoundsDirty = true;
+
+	if (objectStatic[index])
+	{
+		staticVersion++;
+	}
+
+	// Patch the instance in place, unless batches are about to be rebuilt anyway
+	if (!batchesDirty)
+	{
+		uint32_t instance = objectInstances[index];
+		instances[instance].model = transform;
+		instanceBounds.set(instance, transformBoundingSphere(meshes[objectMeshes[index]].boundingSphere, transform));
+		markInstanceDirty(instance);
+	}
+}
+
+const glm::mat4& Scene::getTransform(ObjectId object) const
+{
+	return objectTransforms[getObjectIndex(object, "Scene::getTransform")];
+}
+
+void Scene::setStatic(ObjectId object, bool isStatic)
+{
+	uint32_t index = getObjectIndex(object, "Scene::setStatic");
+	if (objectStatic[index] == isStatic)
+	{
+		return;
+	}
+
+	// Static and dynamic objects are batched separately
+	objectStatic[index] = isStatic;
+	batchesDirty = true;
+	staticVersion++;
+}
+
+bool Scene::isStatic(ObjectId object) const
+{
+	return objectStatic[getObjectIndex(object, "Scene::isStatic")];
+}
+
+uint32_t Scene::getObjectIndex(ObjectId object, const char* caller) const
+{
+	if (object >= objectIndices.size() || objectIndices[object] == invalidIndex)
+	{
+		throw std::runtime_error(std::string(caller) + " -- invalid object id");
+	}
+
+	return objectIndices[object];
+}
+
+bool Scene::updateBatches()
+{
+	if (!batchesDirty)
+	{
+		return false;
+	}
+
+	// Order objects static first, then by material, then mesh, so each batch is a contiguous run of
+	// instances, and so are all the static ones
+	std::vector<uint32_t> order(objectIds.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+	{
+		if (objectStatic[a] != objectStatic[b])
+		{
+			return static_cast<bool>(objectStatic[a]);
+		}
+		if (objectMaterials[a] != objectMaterials[b])
+		{
+			return objectMaterials[a] < objectMaterials[b];
+		}
+		return objectMeshes[a] < objectMeshes[b];
+	});
+
+	batches.clear();
+	instances.resize(order.size());
+	instanceBatches.resize(order.size());
+	instanceBounds.resize(order.size());
+	staticInstanceCount = 0;
+
+	for (uint32_t i = 0; i < order.size(); ++i)
+	{
+		uint32_t index = order[i];
+
+		if (batches.empty() ||
+			batches.back().mesh != objectMeshes[index] ||
+			batches.back().material != objectMaterials[index] ||
+			batches.back().isStatic != objectStatic[index])
+		{
+			DrawBatch batch;
+			batch.mesh = objectMeshes[index];
+			batch.material = objectMaterials[index];
+			batch.firstInstance = i;
+			batch.instanceCount = 0;
+			batch.isStatic = objectStatic[index];
+			batches.push_back(batch);
+		}
+
+		if (objectStatic[index])
+		{
+			staticInstanceCount++;
+		}
+
+		batches.back().instanceCount++;
+		instances[i].model = objectTransforms[index];
+		instances[i].material = objectMaterials[index];
+		instanceBatches[i] = static_cast<uint32_t>(batches.size() - 1);
+		instanceBounds.set(i, transformBoundingSphere(meshes[objectMeshes[index]].boundingSphere, objectTransforms[index]));
+		objectInstances[index] = i;
+	}
+
+	batchesDirty = false;
+	dirtyBegin = 0;
+	dirtyEnd = static_cast<uint32_t>(instances.size());
+
+	return true;
+}
+
+bool Scene::getDirtyInstanceRange(uint32_t& outFirst, uint32_t& outCount) const
+{
+	if (dirtyEnd <= dirtyBegin)
+	{
+		return false;
+	}
+
+	outFirst = dirtyBegin;
+	outCount = dirtyEnd - dirtyBegin;
+	return true;
+}
+
+void Scene::clearDirtyInstances()
+{
+	dirtyBegin = 0;
+	dirtyEnd = 0;
+}
+
+void Scene::markInstanceDirty(uint32_t instance)
+{
+	if (dirtyEnd <= dirtyBegin)
+	{
+		dirtyBegin = instance;
+		dirtyEnd = instance + 1;
+	}
+	else
+	{
+		dirtyBegin = std::min(dirtyBegin, instance);
+		dirtyEnd = std::max(dirtyEnd, instance + 1);
+	}
+}
+
+void Scene::updateBvh()
+{
+	if (bvhDirty)
+	{
+		bvh.build(objectBounds);
+	}
+	else if (bvhBoundsDirty)
+	{
+		bvh.refit(objectBounds);
+		if (bvh.getCostRatio() > bvhRebuildCostRatio)
+		{
+			bvh.build(objectBounds);
+		}
+	}
+
+	bvhDirty = false;
+	bvhBoundsDirty = false;
+}
+
+void Scene::queryFrustum(const Frustum& frustum, std::vector<ObjectId>& outObjects)
+{
+	updateBvh();
+
+	queryResults.clear();
+	bvh.queryFrustum(frustum, queryResults);
+	for (uint32_t index : queryResults)
+	{
+		outObjects.push_back(objectIds[index]);
+	}
+}
+
+void Scene::queryRadius(const glm::vec3& center, float radius, std::vector<ObjectId>& outObjects)
+{
+	updateBvh();
+
+	queryResults.clear();
+	bvh.querySphere(center, radius, queryResults);
+	for (uint32_t index : queryResults)
+	{
+		outObjects.push_back(objectIds[index]);
+	}
+}
+
+bool Scene::raycast(const Ray& ray, float maxDistance, ObjectId& outObject, float& outDistance)
+{
+	updateBvh();
+
+	uint32_t index;
+	if (!bvh.raycast(ray, maxDistance, index, outDistance))
+	{
+		return false;
+	}
+
+	outObject = objectIds[index];
+	return true;
+}
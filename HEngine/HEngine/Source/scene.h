@@ -0,0 +1,171 @@
+/* Defines Scene, a set of renderable objects that reference shared meshes. Objects using the
+   same mesh and material are grouped into batches, each drawn with a single instanced call.
+   Objects can be marked static, meaning they're expected to stay put; renderers may cache what
+   they draw from static objects, and use the static version to tell when that cache is stale. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "render_types.h"
+#include "bounds.h"
+#include "bvh.h"
+
+typedef uint32_t MeshId;
+typedef uint32_t MaterialId;
+typedef uint32_t ObjectId;
+
+static const ObjectId invalidObject = 0xFFFFFFFF;
+
+// Location of a mesh inside the shared vertex / index arrays
+struct MeshInfo
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t vertexOffset;
+
+	// Local-space bounds. The sphere's xyz is the center, w the radius.
+	Aabb bounds;
+	glm::vec4 boundingSphere;
+};
+
+// A run of instances sharing a mesh and material
+struct DrawBatch
+{
+	MeshId mesh;
+	MaterialId material;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+	bool isStatic;
+};
+
+class Scene
+{
+public:
+	Scene();
+
+	// Add a mesh. All meshes are appended to one vertex array and one index array,
+	// so the whole scene can be drawn from a single pair of buffers.
+	MeshId addMesh(const std::vector<Vertex3D>& meshVertices, const std::vector<uint32_t>& meshIndices);
+
+	// As above, with bounds that are already known (e.g. from ObjUtil::loadObj)
+	MeshId addMesh(const std::vector<Vertex3D>& meshVertices, const std::vector<uint32_t>& meshIndices, const Aabb& bounds);
+
+	// Replace a mesh's bounds with ones covering every shape its vertices can take, e.g. every pose
+	// of a skinned mesh. Must be called before any object uses the mesh.
+	void setMeshBounds(MeshId mesh, const Aabb& bounds);
+
+	ObjectId addObject(MeshId mesh, MaterialId material, const glm::mat4& transform);
+
+	void removeObject(ObjectId object);
+
+	void setTransform(ObjectId object, const glm::mat4& transform);
+
+	const glm::mat4& getTransform(ObjectId object) const;
+
+	// Objects start out dynamic. Static objects can still be moved, but each move makes anything
+	// cached from them stale.
+	void setStatic(ObjectId object, bool isStatic);
+
+	bool isStatic(ObjectId object) const;
+
+	// Changes whenever a static object is added, removed or moved, or an object's static flag changes
+	uint32_t getStaticVersion() const { return staticVersion; }
+
+	// Group objects into instanced batches. Only does work if objects were added or removed
+	// since the last call. Returns true if the batch layout changed, meaning previously
+	// recorded draws are out of date.
+	bool updateBatches();
+
+	// Range of instances modified since the last clearDirtyInstances(). Returns false if none.
+	bool getDirtyInstanceRange(uint32_t& outFirst, uint32_t& outCount) const;
+
+	void clearDirtyInstances();
+
+	// Spatial queries over object bounds, using a BVH. The BVH is rebuilt after objects are added
+	// or removed, and refit after objects move; either happens lazily on the next query.
+
+	// Objects whose world bounds intersect the frustum
+	void queryFrustum(const Frustum& frustum, std::vector<ObjectId>& outObjects);
+
+	// Objects whose world bounds come within radius of center
+	void queryRadius(const glm::vec3& center, float radius, std::vector<ObjectId>& outObjects);
+
+	// Closest object whose world bounds the ray hits. Returns false if none.
+	bool raycast(const Ray& ray, float maxDistance, ObjectId& outObject, float& outDistance);
+
+	// Bring the BVH up to date now, rather than on the next query
+	void updateBvh();
+
+	const std::vector<Vertex3D>& getVertices() const { return vertices; }
+	const std::vector<uint32_t>& getIndices() const { return indices; }
+	const MeshInfo& getMesh(MeshId mesh) const { return meshes[mesh]; }
+	size_t getMeshCount() const { return meshes.size(); }
+	size_t getObjectCount() const { return objectIds.size(); }
+
+	// Valid after updateBatches()
+	const std::vector<DrawBatch>& getBatches() const { return batches; }
+
+	// Instance data in batch order. Valid after updateBatches()
+	const std::vector<InstanceData>& getInstances() const { return instances; }
+
+	// Static instances come first, so they're instances [0, count). Valid after updateBatches()
+	uint32_t getStaticInstanceCount() const { return staticInstanceCount; }
+
+	// Index of the batch each instance belongs to. Valid after updateBatches()
+	const std::vector<uint32_t>& getInstanceBatches() const { return instanceBatches; }
+
+	// World-space bounding sphere of each instance, in instance order. Valid after updateBatches()
+	const SphereBoundsArray& getInstanceBounds() const { return instanceBounds; }
+
+private:
+	void markInstanceDirty(uint32_t instance);
+
+	// Dense index of a live object. Throws if the id was never handed out or has been removed.
+	uint32_t getObjectIndex(ObjectId object, const char* caller) const;
+
+private:
+	static const uint32_t invalidIndex = 0xFFFFFFFF;
+
+	// Geometry for every mesh
+	std::vector<Vertex3D> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<MeshInfo> meshes;
+
+	// Object data, densely packed. Removing an object moves the last object into its place.
+	std::vector<MeshId> objectMeshes;
+	std::vector<MaterialId> objectMaterials;
+	std::vector<glm::mat4> objectTransforms;
+	std::vector<Aabb> objectBounds; // World space
+	std::vector<bool> objectStatic;
+
+	// Slot in the instance array for each object
+	std::vector<uint32_t> objectInstances;
+
+	// Dense index -> object id
+	std::vector<ObjectId> objectIds;
+
+	// Object id -> dense index, or invalidIndex for unused ids
+	std::vector<uint32_t> objectIndices;
+	std::vector<ObjectId> freeIds;
+
+	std::vector<DrawBatch> batches;
+	std::vector<InstanceData> instances;
+	std::vector<uint32_t> instanceBatches;
+	SphereBoundsArray instanceBounds;
+	uint32_t staticInstanceCount;
+	bool batchesDirty;
+
+	uint32_t staticVersion;
+
+	// Half-open range of modified instances
+	uint32_t dirtyBegin;
+	uint32_t dirtyEnd;
+
+	// Over dense object indices
+	Bvh bvh;
+	bool bvhDirty;
+	bool bvhBoundsDirty;
+	std::vector<uint32_t> queryResults;
+};
@@ -0,0 +1,154 @@
+#include "shader_compiler.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
+
+// Bump this to invalidate every cached shader, e.g. after changing compile options
+static const uint64_t shaderCacheVersion = 1;
+
+ShaderCompiler::ShaderCompiler(const std::string& _cacheDirectory)
+	:
+	cacheDirectory(_cacheDirectory)
+{
+	options.SetOptimizationLevel(shaderc_optimization_level_performance);
+	options.SetTargetEnvironment(shaderc_target_env_vulkan, 0);
+
+	std::error_code err;
+	fs::create_directories(cacheDirectory, err);
+}
+
+bool ShaderCompiler::compileFile(const std::string& path, std::vector<uint32_t>& outSpirv, std::string& outErrors)
+{
+	shaderc_shader_kind kind;
+	if (!getShaderKind(path, kind))
+	{
+		outErrors = "Unknown shader stage for file: " + path;
+		return false;
+	}
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		outErrors = "Could not open shader source: " + path;
+		return false;
+	}
+
+	std::stringstream sstream;
+	sstream << file.rdbuf();
+	std::string source = sstream.str();
+
+	uint64_t hash = hashSource(source, kind);
+	if (readCache(hash, outSpirv))
+	{
+		return true;
+	}
+
+	shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, kind, path.c_str(), options);
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+	{
+		outErrors = result.GetErrorMessage();
+		return false;
+	}
+
+	outSpirv.assign(result.cbegin(), result.cend());
+	writeCache(hash, outSpirv);
+
+	return true;
+}
+
+bool ShaderCompiler::getShaderKind(const std::string& path, shaderc_shader_kind& outKind)
+{
+	std::string extension = fs::path(path).extension().string();
+
+	if (extension == ".vert")
+	{
+		outKind = shaderc_glsl_vertex_shader;
+	}
+	else if (extension == ".frag")
+	{
+		outKind = shaderc_glsl_fragment_shader;
+	}
+	else if (extension == ".comp")
+	{
+		outKind = shaderc_glsl_compute_shader;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+uint64_t ShaderCompiler::hashSource(const std::string& source, shaderc_shader_kind kind)
+{
+	const uint64_t fnvPrime = 0x100000001b3ull;
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	auto hashBytes = [&](const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= fnvPrime;
+		}
+	};
+
+	hashBytes(&shaderCacheVersion, sizeof(shaderCacheVersion));
+	hashBytes(&kind, sizeof(kind));
+	hashBytes(source.data(), source.size());
+
+	return hash;
+}
+
+std::string ShaderCompiler::getCachePath(uint64_t hash) const
+{
+	std::stringstream sstream;
+	sstream << std::hex << std::setw(16) << std::setfill('0') << hash << ".spv";
+	return (fs::path(cacheDirectory) / sstream.str()).string();
+}
+
+bool ShaderCompiler::readCache(uint64_t hash, std::vector<uint32_t>& outSpirv) const
+{
+	std::ifstream file(getCachePath(hash), std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	size_t fileSize = (size_t)file.tellg();
+	if (fileSize == 0 || fileSize % sizeof(uint32_t) != 0)
+	{
+		return false;
+	}
+
+	outSpirv.resize(fileSize / sizeof(uint32_t));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(outSpirv.data()), fileSize);
+
+	return file.good();
+}
+
+void ShaderCompiler::writeCache(uint64_t hash, const std::vector<uint32_t>& spirv) const
+{
+	// Write to a temp file and rename, so a crash mid-write never leaves a truncated entry
+	std::string cachePath = getCachePath(hash);
+	std::string tempPath = cachePath + ".tmp";
+
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return;
+		}
+		file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+	}
+
+	std::error_code err;
+	fs::rename(tempPath, cachePath, err);
+}
@@ -0,0 +1,44 @@
+/* Runtime GLSL -> SPIR-V compilation, with an on-disk cache of compiled SPIR-V keyed by a hash
+   of the shader source. Uses shaderc, which ships with the Vulkan SDK (shaderc_combined.lib). */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <shaderc/shaderc.hpp>
+
+class ShaderCompiler
+{
+public:
+	// cacheDirectory is created if it does not exist
+	ShaderCompiler(const std::string& cacheDirectory);
+
+	// Copy / moves disallowed
+	ShaderCompiler(const ShaderCompiler& other)          = delete;
+	ShaderCompiler& operator=(const ShaderCompiler& rhs) = delete;
+
+	// Compile the GLSL file at path into SPIR-V. Shader stage is picked from the file extension
+	// (.vert, .frag, .comp). If SPIR-V for identical source is already in the cache, the compiler
+	// is skipped entirely. Returns false on failure, with compiler output in outErrors.
+	bool compileFile(const std::string& path, std::vector<uint32_t>& outSpirv, std::string& outErrors);
+
+private:
+	// Pick shader stage from file extension. Returns false if the extension is unknown.
+	static bool getShaderKind(const std::string& path, shaderc_shader_kind& outKind);
+
+	// 64-bit FNV-1a over the source and everything else that affects the output
+	static uint64_t hashSource(const std::string& source, shaderc_shader_kind kind);
+
+	std::string getCachePath(uint64_t hash) const;
+
+	bool readCache(uint64_t hash, std::vector<uint32_t>& outSpirv) const;
+
+	void writeCache(uint64_t hash, const std::vector<uint32_t>& spirv) const;
+
+private:
+	std::string cacheDirectory;
+	shaderc::Compiler compiler;
+	shaderc::CompileOptions options;
+};
@@ -0,0 +1,116 @@
+#include "shadow_cascades.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+// Blend between evenly spaced (0) and logarithmic (1) split depths. Logarithmic keeps shadow
+// texels the same size on screen at any depth, but leaves the far cascades too little.
+static const float splitLambda = 0.75f;
+
+// Cascades are fit this much bigger than their slice, so the camera can move a little before
+// they have to be refit
+static const float fitPadding = 1.2f;
+
+// Casters this far outside a cascade's sphere, toward the light, still shadow it
+static const float casterMargin = 10.0f;
+
+// Cosine of the angle the light can turn through before every cascade is refit
+static const float lightDirectionTolerance = 0.99999f;
+
+ShadowCascades::ShadowCascades()
+	:
+	lightDirection(0.0f),
+	staticDrawCount(0)
+{
+	for (Cascade& cascade : cascades)
+	{
+		cascade.viewProj = glm::mat4(1.0f);
+		cascade.splitDepth = 0.0f;
+		cascade.center = glm::vec3(0.0f);
+		cascade.radius = 0.0f;
+		cascade.staticValid = false;
+	}
+}
+
+void ShadowCascades::update(const glm::mat4& view, const glm::mat4& proj, float nearPlane, float farPlane, const glm::vec3& newLightDirection)
+{
+	glm::vec3 direction = glm::normalize(newLightDirection);
+	bool lightTurned = glm::dot(direction, lightDirection) < lightDirectionTolerance;
+	lightDirection = direction;
+
+	// Any up vector will do, as long as it isn't along the light
+	glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+	glm::mat4 inverseLightRotation = glm::inverse(lightRotation);
+	glm::mat4 inverseView = glm::inverse(view);
+
+	// Glm's projections put depth in [-1, 1]; Vulkan wants [0, 1]
+	glm::mat4 depthZeroToOne(1.0f);
+	depthZeroToOne[2][2] = 0.5f;
+	depthZeroToOne[3][2] = 0.5f;
+
+	// A slice of the frustum at view depth d spans (+-tanX * d, +-tanY * d, -d) in view space
+	float tanX = 1.0f / proj[0][0];
+	float tanY = 1.0f / std::abs(proj[1][1]);
+	float cornerSlope = tanX * tanX + tanY * tanY;
+
+	float sliceNear = nearPlane;
+	for (uint32_t i = 0; i < cascadeCount; ++i)
+	{
+		Cascade& cascade = cascades[i];
+
+		float t = static_cast<float>(i + 1) / cascadeCount;
+		float evenSplit = nearPlane + (farPlane - nearPlane) * t;
+		float logSplit = nearPlane * std::pow(farPlane / nearPlane, t);
+		float sliceFar = evenSplit + (logSplit - evenSplit) * splitLambda;
+		cascade.splitDepth = sliceFar;
+
+		// Smallest sphere through the slice's corners with its center on the view axis. Its size
+		// doesn't change as the camera turns, so turning only moves it.
+		float centerDepth = std::min(0.5f * (sliceNear + sliceFar) * (1.0f + cornerSlope), sliceFar);
+		float sliceRadius = std::sqrt(cornerSlope * sliceFar * sliceFar + (sliceFar - centerDepth) * (sliceFar - centerDepth));
+		glm::vec3 sliceCenter = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+		sliceNear = sliceFar;
+
+		bool contained = glm::length(sliceCenter - cascade.center) + sliceRadius <= cascade.radius;
+		if (contained && !lightTurned)
+		{
+			continue;
+		}
+
+		cascade.radius = sliceRadius * fitPadding;
+
+		// Snap the center to whole texels across the light, so shadow edges don't crawl when a
+		// cascade is refit
+		float texelSize = 2.0f * cascade.radius / cascadeResolution;
+		glm::vec3 lightSpaceCenter = glm::vec3(lightRotation * glm::vec4(sliceCenter, 1.0f));
+		lightSpaceCenter.x = std::floor(lightSpaceCenter.x / texelSize) * texelSize;
+		lightSpaceCenter.y = std::floor(lightSpaceCenter.y / texelSize) * texelSize;
+		cascade.center = glm::vec3(inverseLightRotation * glm::vec4(lightSpaceCenter, 1.0f));
+
+		// Look down the light from just outside the margin, and reach to the far side of the sphere
+		float eyeDistance = cascade.radius + casterMargin;
+		glm::mat4 lightView = glm::lookAt(cascade.center - direction * eyeDistance, cascade.center, up);
+		glm::mat4 lightProj = glm::ortho(-cascade.radius, cascade.radius, -cascade.radius, cascade.radius,
+			0.0f, eyeDistance + cascade.radius);
+
+		cascade.viewProj = depthZeroToOne * lightProj * lightView;
+		cascade.staticValid = false;
+	}
+}
+
+void ShadowCascades::invalidateStatic()
+{
+	for (Cascade& cascade : cascades)
+	{
+		cascade.staticValid = false;
+	}
+}
+
+void ShadowCascades::markStaticDrawn(uint32_t cascade)
+{
+	cascades[cascade].staticValid = true;
+	staticDrawCount++;
+}
@@ -0,0 +1,59 @@
+/* Defines ShadowCascades, which fits cascaded shadow maps for a directional light to the camera.
+   The view frustum is split into depth slices, each covered by its own orthographic shadow map
+   in one atlas. A cascade is fit a little bigger than its slice and left exactly where it is
+   until the slice leaves it or the light turns, so whatever was drawn into it stays valid. That
+   lets shadows of static objects be drawn once and cached, and only redrawn when a cascade moves. */
+
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+class ShadowCascades
+{
+public:
+	// Must match HelloTriangle.frag
+	static const uint32_t cascadeCount = 4;
+
+	// Texels along each side of a cascade. Cascades are laid out 2x2 in the atlas.
+	static const uint32_t cascadeResolution = 1024;
+	static const uint32_t atlasResolution = cascadeResolution * 2;
+
+	struct Cascade
+	{
+		glm::mat4 viewProj; // World to the cascade's clip space, with depth in [0, 1]
+		float splitDepth; // View depth the cascade covers up to
+
+		// Sphere the cascade was fit to, in world space
+		glm::vec3 center;
+		float radius;
+
+		// Static casters have been drawn into the cache with viewProj
+		bool staticValid;
+	};
+
+	ShadowCascades();
+
+	// Fit cascades to the camera. lightDirection is the way the light travels, in world space.
+	// Cascades that have to move are refit, which invalidates their cached static shadows.
+	void update(const glm::mat4& view, const glm::mat4& proj, float nearPlane, float farPlane, const glm::vec3& lightDirection);
+
+	// Static casters changed, so every cascade's cache has to be redrawn
+	void invalidateStatic();
+
+	// Record that static casters were drawn into cascade's part of the cache
+	void markStaticDrawn(uint32_t cascade);
+
+	const Cascade& getCascade(uint32_t cascade) const { return cascades[cascade]; }
+
+	// Top-left texel of cascade in the atlas
+	static glm::uvec2 getAtlasOffset(uint32_t cascade) { return glm::uvec2(cascade % 2, cascade / 2) * cascadeResolution; }
+
+	// Times any cascade's static casters were drawn, since startup
+	uint64_t getStaticDrawCount() const { return staticDrawCount; }
+
+private:
+	Cascade cascades[cascadeCount];
+	glm::vec3 lightDirection; // Zero until the first update
+	uint64_t staticDrawCount;
+};
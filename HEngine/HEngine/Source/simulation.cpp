@@ -0,0 +1,194 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+static const double timestep = 1.0 / Simulation::ticksPerSecond;
+
+// Spin speed with no input, and how quickly the speed follows input, per second
+static const float baseSpinSpeed = glm::radians(90.0f);
+static const float spinResponse = 4.0f;
+
+// Orbiters circle above the grid, and one is replaced this often, in seconds
+static const float orbitRadius = 2.5f;
+static const float orbitSpeed = 0.5f;
+static const float orbiterScale = 0.15f;
+static const double respawnInterval = 2.0;
+
+Simulation::Simulation()
+	:
+	running(false),
+	tickCount(0),
+	skippedTickCount(0),
+	renderCommands(nullptr),
+	orbiterMesh(0),
+	nextRespawn(0),
+	respawnTime(respawnInterval)
+{ }
+
+Simulation::~Simulation()
+{
+	stop();
+}
+
+void Simulation::start(RenderCommandQueue& _renderCommands, MeshId _orbiterMesh)
+{
+	if (running)
+	{
+		return;
+	}
+
+	renderCommands = &_renderCommands;
+	orbiterMesh = _orbiterMesh;
+
+	startTime = std::chrono::steady_clock::now();
+
+	// Both buffers need something to read before the thread publishes anything
+	SimulationState initial = { };
+	initial.spinSpeed = baseSpinSpeed;
+
+	Snapshot& snapshot = snapshots.getWriteBuffer();
+	snapshot.previous = initial;
+	snapshot.current = initial;
+	snapshot.dueTime = 0.0;
+	snapshots.publish();
+
+	inputs.getWriteBuffer() = SimulationInput();
+	inputs.publish();
+
+	running = true;
+	thread = std::thread(&Simulation::threadLoop, this, initial);
+}
+
+void Simulation::stop()
+{
+	running = false;
+	if (thread.joinable())
+	{
+		// Nothing drains the render command queue once the render thread stops calling this, so
+		// the simulation could be waiting for room in it. Closing the queue ends the wait, and
+		// clearing it makes room anyway.
+		if (renderCommands)
+		{
+			renderCommands->close();
+			renderCommands->clear();
+		}
+		thread.join();
+	}
+}
+
+void Simulation::setInput(const SimulationInput& input)
+{
+	inputs.getWriteBuffer() = input;
+	inputs.publish();
+}
+
+SimulationState Simulation::getInterpolatedState()
+{
+	snapshots.update();
+	const Snapshot& snapshot = snapshots.getReadBuffer();
+
+	// Showing the state one tick behind means there's always a newer one to blend towards. If the
+	// next tick is late, this holds at the latest state rather than guessing past it.
+	float alpha = static_cast<float>(glm::clamp((getElapsedSeconds() - snapshot.dueTime) / timestep, 0.0, 1.0));
+
+	SimulationState state;
+	state.time = snapshot.previous.time + alpha * timestep;
+	state.sceneAngle = glm::mix(snapshot.previous.sceneAngle, snapshot.current.sceneAngle, alpha);
+	state.spinSpeed = glm::mix(snapshot.previous.spinSpeed, snapshot.current.spinSpeed, alpha);
+	return state;
+}
+
+void Simulation::threadLoop(SimulationState state)
+{
+	double dueTime = timestep;
+
+	while (running)
+	{
+		std::this_thread::sleep_until(startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(dueTime)));
+
+		inputs.update();
+		SimulationState next = tick(state, inputs.getReadBuffer());
+
+		Snapshot& snapshot = snapshots.getWriteBuffer();
+		snapshot.previous = state;
+		snapshot.current = next;
+		snapshot.dueTime = dueTime;
+
+		// Keep the angle small without the interpolation ever crossing the wrap
+		float wrap = next.sceneAngle > glm::two_pi<float>() ? -glm::two_pi<float>() :
+			next.sceneAngle < -glm::two_pi<float>() ? glm::two_pi<float>() : 0.0f;
+		snapshot.previous.sceneAngle += wrap;
+		snapshot.current.sceneAngle += wrap;
+		snapshots.publish();
+
+		state = snapshot.current;
+		tickCount++;
+
+		updateOrbiters(state);
+
+		// Late ticks run back to back until they catch up, unless they're too far behind
+		dueTime += timestep;
+		double behind = getElapsedSeconds() - dueTime;
+		if (behind > maxCatchUpTicks * timestep)
+		{
+			uint64_t skipped = static_cast<uint64_t>(behind / timestep);
+			dueTime += skipped * timestep;
+			skippedTickCount += skipped;
+		}
+	}
+}
+
+SimulationState Simulation::tick(const SimulationState& state, const SimulationInput& input)
+{
+	float targetSpeed = baseSpinSpeed * (1.0f + 2.0f * glm::clamp(input.spin, -1.0f, 1.0f));
+
+	SimulationState next = state;
+	next.time += timestep;
+	next.spinSpeed += (targetSpeed - state.spinSpeed) * std::min(1.0f, spinResponse * static_cast<float>(timestep));
+	next.sceneAngle += next.spinSpeed * static_cast<float>(timestep);
+	return next;
+}
+
+void Simulation::updateOrbiters(const SimulationState& state)
+{
+	if (orbiters.empty())
+	{
+		for (uint32_t i = 0; i < orbiterCount; ++i)
+		{
+			Orbiter orbiter;
+			orbiter.object = renderCommands->createObject(orbiterMesh, 0, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(orbiterScale));
+			orbiter.phase = i * glm::two_pi<float>() / orbiterCount;
+			orbiters.push_back(orbiter);
+		}
+	}
+
+	// The replacement takes the old one's place on the orbit, so it shows as a blink
+	if (state.time >= respawnTime)
+	{
+		Orbiter& orbiter = orbiters[nextRespawn];
+		renderCommands->destroyObject(orbiter.object);
+		orbiter.object = renderCommands->createObject(orbiterMesh, 0, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(orbiterScale));
+
+		nextRespawn = (nextRespawn + 1) % orbiterCount;
+		respawnTime += respawnInterval;
+	}
+
+	// Moved once per tick rather than interpolated, which is smooth enough for these
+	float time = static_cast<float>(state.time);
+	for (const Orbiter& orbiter : orbiters)
+	{
+		float angle = orbiter.phase + orbitSpeed * time;
+		glm::vec3 position(orbitRadius * std::cos(angle), orbitRadius * std::sin(angle), 0.5f + 0.2f * std::sin(2.0f * time + orbiter.phase));
+		glm::quat rotation = glm::angleAxis(2.0f * time, glm::vec3(0.0f, 0.0f, 1.0f));
+		renderCommands->setTransform(orbiter.object, position, rotation, glm::vec3(orbiterScale));
+	}
+}
+
+double Simulation::getElapsedSeconds() const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
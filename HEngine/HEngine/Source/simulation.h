@@ -0,0 +1,104 @@
+/* Defines Simulation, which runs game logic on its own thread at a fixed timestep. Each tick
+   publishes a snapshot through a TripleBuffer, and the render thread interpolates between the
+   snapshot's last two states, so neither thread ever waits for the other. Rendering runs one
+   tick behind the simulation, which bounds how long input takes to show up on screen. Objects
+   the simulation owns outright are moved through the render command queue instead. */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "render_commands.h"
+#include "triple_buffer.h"
+
+// Input read by the simulation on its next tick
+struct SimulationInput
+{
+	float spin; // -1 to 1, speeds the scene's spin up or reverses it
+};
+
+struct SimulationState
+{
+	double time; // Simulated seconds
+	float sceneAngle; // Radians, in [-2 pi, 2 pi]
+	float spinSpeed; // Radians per second
+};
+
+class Simulation
+{
+public:
+	static const uint32_t ticksPerSecond = 60;
+
+	// Ticks the simulation can fall behind by (e.g. stopped in a debugger) before it skips the
+	// lost time instead of catching up
+	static const uint32_t maxCatchUpTicks = 5;
+
+	// Quads circling the scene, created, moved and replaced by the simulation through render commands
+	static const uint32_t orbiterCount = 8;
+
+	Simulation();
+	~Simulation();
+
+	Simulation(const Simulation&) = delete;
+	Simulation& operator=(const Simulation&) = delete;
+
+	// orbiterMesh is the mesh orbiters are drawn with
+	void start(RenderCommandQueue& renderCommands, MeshId orbiterMesh);
+	// Render thread only, since it clears the render command queue
+	void stop();
+
+	// Render thread only. Latest input, picked up by the next tick.
+	void setInput(const SimulationInput& input);
+
+	// Render thread only. State at the current time, interpolated between the last two ticks.
+	SimulationState getInterpolatedState();
+
+	uint64_t getTickCount() const { return tickCount; }
+	uint64_t getSkippedTickCount() const { return skippedTickCount; }
+
+private:
+	// The last two states, so the reader can interpolate without keeping its own history
+	struct Snapshot
+	{
+		SimulationState previous;
+		SimulationState current;
+		double dueTime; // Seconds since start the current tick was due at
+	};
+
+	struct Orbiter
+	{
+		RenderObjectHandle object;
+		float phase; // Radians around the orbit at time zero
+	};
+
+	void threadLoop(SimulationState state);
+
+	// Simulation thread only. Moves the orbiters to where they are at state, replacing one
+	// every so often so objects come and go while the scene runs.
+	void updateOrbiters(const SimulationState& state);
+
+	static SimulationState tick(const SimulationState& state, const SimulationInput& input);
+
+	double getElapsedSeconds() const;
+
+private:
+	std::thread thread;
+	std::atomic<bool> running;
+	std::chrono::steady_clock::time_point startTime;
+
+	TripleBuffer<Snapshot> snapshots; // Simulation thread to render thread
+	TripleBuffer<SimulationInput> inputs; // Render thread to simulation thread
+
+	std::atomic<uint64_t> tickCount;
+	std::atomic<uint64_t> skippedTickCount;
+
+	RenderCommandQueue* renderCommands;
+	MeshId orbiterMesh;
+	std::vector<Orbiter> orbiters;
+	uint32_t nextRespawn; // Orbiter replaced next
+	double respawnTime;
+};
@@ -0,0 +1,537 @@
+#include "software_occlusion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "frustum_culling.h"
+#include "parallel_util.h"
+
+// Occluder triangles with a vertex this close to the camera plane are skipped rather than
+// clipped. Losing an occluder only means less gets culled.
+static const float minOccluderW = 1e-4f;
+
+// Triangles smaller than this (in pixels squared) can't cover a pixel center worth having
+static const float minTriangleArea = 1e-4f;
+
+// Below this many tile rows or tests per thread, spreading work costs more than it saves
+static const size_t minTileRowsPerThread = 2;
+static const size_t minTestsPerThread = 1024;
+
+// Tile depths before anything is drawn. Depth 0 is the farthest possible, and an empty working
+// layer is nearer than anything.
+static const float clearDepth = std::numeric_limits<float>::max();
+static const float emptyDepth = -std::numeric_limits<float>::max();
+
+SoftwareOcclusion::SoftwareOcclusion(uint32_t _width, uint32_t _height)
+	:
+	width((std::max(_width, 1u) + tileWidth - 1) / tileWidth * tileWidth),
+	height((std::max(_height, 1u) + tileHeight - 1) / tileHeight * tileHeight),
+	tilesX(width / tileWidth),
+	tilesY(height / tileHeight),
+	supported(isSupported()),
+	viewProj(1.0f)
+{
+	tileMasks.resize(tilesX * tilesY * tileHeight);
+	tileDepth0.resize(tilesX * tilesY);
+	tileDepth1.resize(tilesX * tilesY);
+	beginFrame();
+}
+
+bool SoftwareOcclusion::isSupported()
+{
+	static const bool avx2 = []()
+	{
+		// Covers the OS saving YMM registers as well as AVX itself
+		if (FrustumCulling::getSupportedSimdLevel() != FrustumCulling::AVX)
+		{
+			return false;
+		}
+
+		int info[4];
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+	}();
+
+	return avx2;
+}
+
+OccluderMeshId SoftwareOcclusion::addOccluderMesh(const std::vector<Vertex3D>& meshVertices, const std::vector<uint32_t>& meshIndices)
+{
+	for (uint32_t index : meshIndices)
+	{
+		if (index >= meshVertices.size())
+		{
+			throw std::runtime_error("SoftwareOcclusion::addOccluderMesh -- index out of range");
+		}
+	}
+
+	OccluderMesh mesh;
+	mesh.firstPosition = static_cast<uint32_t>(positions.size());
+	mesh.positionCount = static_cast<uint32_t>(meshVertices.size());
+	mesh.firstIndex = static_cast<uint32_t>(indices.size());
+	mesh.indexCount = static_cast<uint32_t>(meshIndices.size() / 3 * 3);
+
+	for (const Vertex3D& vertex : meshVertices)
+	{
+		positions.push_back(vertex.pos);
+	}
+	indices.insert(indices.end(), meshIndices.begin(), meshIndices.begin() + mesh.indexCount);
+	meshes.push_back(mesh);
+
+	return static_cast<OccluderMeshId>(meshes.size() - 1);
+}
+
+void SoftwareOcclusion::beginFrame()
+{
+	occluders.clear();
+	triangles.clear();
+
+	std::fill(tileMasks.begin(), tileMasks.end(), 0);
+	std::fill(tileDepth0.begin(), tileDepth0.end(), clearDepth);
+	std::fill(tileDepth1.begin(), tileDepth1.end(), emptyDepth);
+}
+
+void SoftwareOcclusion::addOccluder(OccluderMeshId mesh, const glm::mat4& transform)
+{
+	if (mesh >= meshes.size())
+	{
+		throw std::runtime_error("SoftwareOcclusion::addOccluder -- invalid mesh id");
+	}
+
+	Occluder occluder;
+	occluder.mesh = mesh;
+	occluder.transform = transform;
+	occluders.push_back(occluder);
+}
+
+void SoftwareOcclusion::render(const glm::mat4& _viewProj)
+{
+	viewProj = _viewProj;
+
+	if (!supported)
+	{
+		return;
+	}
+
+	// Each occluder gets its own slice of the shared position and triangle arrays
+	occluderPositionOffsets.resize(occluders.size() + 1);
+	occluderTriangleOffsets.resize(occluders.size() + 1);
+	occluderPositionOffsets[0] = 0;
+	occluderTriangleOffsets[0] = 0;
+	for (size_t i = 0; i < occluders.size(); ++i)
+	{
+		const OccluderMesh& mesh = meshes[occluders[i].mesh];
+		occluderPositionOffsets[i + 1] = occluderPositionOffsets[i] + mesh.positionCount;
+		occluderTriangleOffsets[i + 1] = occluderTriangleOffsets[i] + mesh.indexCount / 3;
+	}
+
+	screenPositions.resize(occluderPositionOffsets.back());
+	triangles.resize(occluderTriangleOffsets.back());
+
+	ParallelUtil::parallelFor(occluders.size(), 1, 1, [this](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			setupOccluder(occluders[i], viewProj,
+				screenPositions.data() + occluderPositionOffsets[i],
+				triangles.data() + occluderTriangleOffsets[i]);
+		}
+	});
+
+	// Every thread walks all triangles, but only touches its own band of tile rows.
+	// Triangles are merged in the same order in every band.
+	ParallelUtil::parallelForRanges(tilesY, ParallelUtil::getThreadCount(), minTileRowsPerThread, [this](size_t, size_t begin, size_t end)
+	{
+		for (const Triangle& triangle : triangles)
+		{
+			int32_t firstTileY = std::max(triangle.firstTileY, static_cast<int32_t>(begin));
+			int32_t lastTileY = std::min(triangle.lastTileY, static_cast<int32_t>(end) - 1);
+			if (firstTileY <= lastTileY)
+			{
+				rasterizeTriangle(triangle, firstTileY, lastTileY);
+			}
+		}
+	});
+
+	// AVX -> SSE transitions are expensive on some CPUs
+	_mm256_zeroupper();
+}
+
+void SoftwareOcclusion::setupOccluder(const Occluder& occluder, const glm::mat4& matrix, glm::vec4* outPositions, Triangle* outTriangles) const
+{
+	const OccluderMesh& mesh = meshes[occluder.mesh];
+	glm::mat4 transform = matrix * occluder.transform;
+
+	for (uint32_t i = 0; i < mesh.positionCount; ++i)
+	{
+		glm::vec4 clip = transform * glm::vec4(positions[mesh.firstPosition + i], 1.0f);
+		if (clip.w > minOccluderW)
+		{
+			float invW = 1.0f / clip.w;
+			outPositions[i] = glm::vec4(
+				(clip.x * invW * 0.5f + 0.5f) * width,
+				(clip.y * invW * 0.5f + 0.5f) * height,
+				clip.z * invW,
+				clip.w);
+		}
+		else
+		{
+			outPositions[i] = glm::vec4(0.0f, 0.0f, 0.0f, clip.w);
+		}
+	}
+
+	for (uint32_t t = 0; t < mesh.indexCount / 3; ++t)
+	{
+		Triangle& triangle = outTriangles[t];
+
+		// Empty tile range until the triangle is known to be drawable
+		triangle.firstTileX = 0;
+		triangle.firstTileY = 0;
+		triangle.lastTileX = -1;
+		triangle.lastTileY = -1;
+
+		const glm::vec4* v[3];
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			v[i] = &outPositions[indices[mesh.firstIndex + t * 3 + i]];
+		}
+
+		if (v[0]->w <= minOccluderW || v[1]->w <= minOccluderW || v[2]->w <= minOccluderW)
+		{
+			continue;
+		}
+
+		float minX = std::min(v[0]->x, std::min(v[1]->x, v[2]->x));
+		float minY = std::min(v[0]->y, std::min(v[1]->y, v[2]->y));
+		float maxX = std::max(v[0]->x, std::max(v[1]->x, v[2]->x));
+		float maxY = std::max(v[0]->y, std::max(v[1]->y, v[2]->y));
+		if (maxX <= 0.0f || maxY <= 0.0f || minX >= width || minY >= height)
+		{
+			continue;
+		}
+
+		float area = (v[1]->x - v[0]->x) * (v[2]->y - v[0]->y) - (v[2]->x - v[0]->x) * (v[1]->y - v[0]->y);
+		if (std::abs(area) < minTriangleArea)
+		{
+			continue;
+		}
+
+		// Both windings are drawn; flip edges so the inside is always positive
+		float sign = area > 0.0f ? 1.0f : -1.0f;
+		for (uint32_t e = 0; e < 3; ++e)
+		{
+			const glm::vec4& p = *v[e];
+			const glm::vec4& q = *v[(e + 1) % 3];
+
+			// Inside where a * x + b * y + c >= 0
+			float a = (p.y - q.y) * sign;
+			float b = (q.x - p.x) * sign;
+			float c = -(a * p.x + b * p.y);
+
+			Edge& edge = triangle.edges[e];
+			if (a != 0.0f)
+			{
+				edge.type = a > 0.0f ? Edge::Left : Edge::Right;
+				edge.offset = -c / a;
+				edge.slope = -b / a;
+			}
+			else
+			{
+				edge.type = Edge::Horizontal;
+				edge.sign = b > 0.0f ? 1.0f : -1.0f;
+				edge.limit = -c / b * edge.sign;
+			}
+		}
+
+		// z / w is linear in screen space
+		float d1x = v[1]->x - v[0]->x;
+		float d1y = v[1]->y - v[0]->y;
+		float d1z = v[1]->z - v[0]->z;
+		float d2x = v[2]->x - v[0]->x;
+		float d2y = v[2]->y - v[0]->y;
+		float d2z = v[2]->z - v[0]->z;
+		triangle.depthX = (d1z * d2y - d2z * d1y) / area;
+		triangle.depthY = (d2z * d1x - d1z * d2x) / area;
+		triangle.depthOffset = v[0]->z - triangle.depthX * v[0]->x - triangle.depthY * v[0]->y;
+		triangle.maxDepth = std::max(v[0]->z, std::max(v[1]->z, v[2]->z));
+
+		triangle.minX = std::max(minX, 0.0f);
+		triangle.minY = std::max(minY, 0.0f);
+		triangle.maxX = std::min(maxX, static_cast<float>(width));
+		triangle.maxY = std::min(maxY, static_cast<float>(height));
+		triangle.firstTileX = static_cast<int32_t>(triangle.minX) / tileWidth;
+		triangle.firstTileY = static_cast<int32_t>(triangle.minY) / tileHeight;
+		triangle.lastTileX = std::min(static_cast<int32_t>(triangle.maxX), static_cast<int32_t>(width) - 1) / tileWidth;
+		triangle.lastTileY = std::min(static_cast<int32_t>(triangle.maxY), static_cast<int32_t>(height) - 1) / tileHeight;
+	}
+}
+
+void SoftwareOcclusion::rasterizeTriangle(const Triangle& triangle, int32_t firstTileY, int32_t lastTileY)
+{
+	const __m256 rowCenters = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	const __m256i allOnes = _mm256_set1_epi32(-1);
+	const __m256i zero = _mm256_setzero_si256();
+
+	for (int32_t tileY = firstTileY; tileY <= lastTileY; ++tileY)
+	{
+		__m256 y = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(tileY * tileHeight)), rowCenters);
+
+		// Where each edge crosses each row, shifted so pixel centers fall on whole numbers.
+		// Horizontal edges cover a whole row or none of it.
+		__m256 crossings[3];
+		__m256i rowMasks[3];
+		for (uint32_t e = 0; e < 3; ++e)
+		{
+			const Edge& edge = triangle.edges[e];
+			if (edge.type == Edge::Horizontal)
+			{
+				rowMasks[e] = _mm256_castps_si256(_mm256_cmp_ps(
+					_mm256_mul_ps(y, _mm256_set1_ps(edge.sign)), _mm256_set1_ps(edge.limit), _CMP_GE_OQ));
+			}
+			else
+			{
+				crossings[e] = _mm256_add_ps(_mm256_set1_ps(edge.offset - 0.5f), _mm256_mul_ps(y, _mm256_set1_ps(edge.slope)));
+			}
+		}
+
+		float rowMinY = std::max(static_cast<float>(tileY * tileHeight), triangle.minY);
+		float rowMaxY = std::min(static_cast<float>((tileY + 1) * tileHeight), triangle.maxY);
+
+		for (int32_t tileX = triangle.firstTileX; tileX <= triangle.lastTileX; ++tileX)
+		{
+			__m256 tileLeft = _mm256_set1_ps(static_cast<float>(tileX * tileWidth));
+
+			// Bit i of a row is the pixel tileWidth * tileX + i. Left edges cover from the first
+			// pixel center right of the edge, right edges up to the last one left of it.
+			__m256i coverage = allOnes;
+			for (uint32_t e = 0; e < 3; ++e)
+			{
+				const Edge& edge = triangle.edges[e];
+				if (edge.type == Edge::Horizontal)
+				{
+					coverage = _mm256_and_si256(coverage, rowMasks[e]);
+					continue;
+				}
+
+				__m256 x = _mm256_sub_ps(crossings[e], tileLeft);
+				if (edge.type == Edge::Left)
+				{
+					__m256 first = _mm256_ceil_ps(_mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(32.0f)));
+					coverage = _mm256_and_si256(coverage, _mm256_sllv_epi32(allOnes, _mm256_cvttps_epi32(first)));
+				}
+				else
+				{
+					__m256 last = _mm256_floor_ps(_mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(31.0f)));
+					__m256i count = _mm256_add_epi32(_mm256_cvttps_epi32(last), _mm256_set1_epi32(1));
+					coverage = _mm256_and_si256(coverage, _mm256_srlv_epi32(allOnes, _mm256_sub_epi32(_mm256_set1_epi32(32), count)));
+				}
+			}
+
+			if (_mm256_testz_si256(coverage, coverage))
+			{
+				continue;
+			}
+
+			// Farthest depth of the triangle's plane over the part of the tile its bounds cover,
+			// which bounds the depth of every covered pixel
+			float rowMinX = std::max(static_cast<float>(tileX * tileWidth), triangle.minX);
+			float rowMaxX = std::min(static_cast<float>((tileX + 1) * tileWidth), triangle.maxX);
+			float planeDepth = triangle.depthOffset +
+				triangle.depthX * (triangle.depthX > 0.0f ? rowMaxX : rowMinX) +
+				triangle.depthY * (triangle.depthY > 0.0f ? rowMaxY : rowMinY);
+			float depth = std::min(triangle.maxDepth, planeDepth);
+
+			uint32_t tile = tileY * tilesX + tileX;
+			uint32_t* tileMask = &tileMasks[tile * tileHeight];
+			float& depth0 = tileDepth0[tile];
+			float& depth1 = tileDepth1[tile];
+
+			// Behind everything already in the tile
+			if (depth >= depth0)
+			{
+				continue;
+			}
+
+			// Covering the whole tile makes a new reference layer. The working layer only
+			// survives if it's nearer.
+			if (_mm256_testc_si256(coverage, allOnes))
+			{
+				depth0 = depth;
+				if (depth1 >= depth)
+				{
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(tileMask), zero);
+					depth1 = emptyDepth;
+				}
+				continue;
+			}
+
+			__m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tileMask));
+
+			// Merging moves the triangle's pixels back to the working layer's depth. When the
+			// triangle is much nearer, and the working layer gains little over the reference
+			// layer anyway, start a new working layer instead.
+			if (depth1 - depth > depth0 - depth1)
+			{
+				mask = zero;
+				depth1 = emptyDepth;
+			}
+
+			mask = _mm256_or_si256(mask, coverage);
+			depth1 = std::max(depth1, depth);
+
+			// A full working layer becomes the reference layer
+			if (_mm256_testc_si256(mask, allOnes))
+			{
+				depth0 = depth1;
+				mask = zero;
+				depth1 = emptyDepth;
+			}
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(tileMask), mask);
+		}
+	}
+}
+
+bool SoftwareOcclusion::isRectOccluded(int32_t minX, int32_t minY, int32_t maxX, int32_t maxY, float depth) const
+{
+	const __m256i rowIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	bool occluded = true;
+	for (int32_t tileY = minY / tileHeight; tileY <= (maxY - 1) / static_cast<int32_t>(tileHeight) && occluded; ++tileY)
+	{
+		// Rows of the tile inside the rect
+		__m256i rows = _mm256_add_epi32(_mm256_set1_epi32(tileY * tileHeight), rowIndices);
+		__m256i rowsInside = _mm256_and_si256(
+			_mm256_cmpgt_epi32(rows, _mm256_set1_epi32(minY - 1)),
+			_mm256_cmpgt_epi32(_mm256_set1_epi32(maxY), rows));
+
+		for (int32_t tileX = minX / tileWidth; tileX <= (maxX - 1) / static_cast<int32_t>(tileWidth); ++tileX)
+		{
+			int32_t first = std::max(minX - tileX * static_cast<int32_t>(tileWidth), 0);
+			int32_t end = std::min(maxX - tileX * static_cast<int32_t>(tileWidth), static_cast<int32_t>(tileWidth));
+			uint32_t columns = (end >= 32 ? 0xFFFFFFFFu : (1u << end) - 1u) & (0xFFFFFFFFu << first);
+			__m256i rect = _mm256_and_si256(rowsInside, _mm256_set1_epi32(static_cast<int32_t>(columns)));
+
+			uint32_t tile = tileY * tilesX + tileX;
+			__m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&tileMasks[tile * tileHeight]));
+
+			// Visible if the rect reaches pixels whose depth bound is farther than the object:
+			// uncovered pixels at depth 0, covered ones at depth 1
+			if ((depth < tileDepth0[tile] && !_mm256_testc_si256(mask, rect)) ||
+				(depth < tileDepth1[tile] && !_mm256_testz_si256(mask, rect)))
+			{
+				occluded = false;
+				break;
+			}
+		}
+	}
+
+	_mm256_zeroupper();
+	return occluded;
+}
+
+bool SoftwareOcclusion::projectBox(const glm::vec3& boxMin, const glm::vec3& boxMax, int32_t& outMinX, int32_t& outMinY,
+	int32_t& outMaxX, int32_t& outMaxY, float& outNearestDepth) const
+{
+	float minX = std::numeric_limits<float>::max();
+	float minY = std::numeric_limits<float>::max();
+	float maxX = -std::numeric_limits<float>::max();
+	float maxY = -std::numeric_limits<float>::max();
+	outNearestDepth = std::numeric_limits<float>::max();
+
+	for (uint32_t i = 0; i < 8; ++i)
+	{
+		glm::vec3 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+		glm::vec4 clip = viewProj * glm::vec4(corner, 1.0f);
+		if (clip.w <= minOccluderW)
+		{
+			return false;
+		}
+
+		float invW = 1.0f / clip.w;
+		float x = (clip.x * invW * 0.5f + 0.5f) * width;
+		float y = (clip.y * invW * 0.5f + 0.5f) * height;
+		minX = std::min(minX, x);
+		minY = std::min(minY, y);
+		maxX = std::max(maxX, x);
+		maxY = std::max(maxY, y);
+		outNearestDepth = std::min(outNearestDepth, clip.z * invW);
+	}
+
+	// Every pixel the box's rect touches, clamped to the screen
+	outMinX = static_cast<int32_t>(std::floor(std::min(std::max(minX, 0.0f), static_cast<float>(width))));
+	outMinY = static_cast<int32_t>(std::floor(std::min(std::max(minY, 0.0f), static_cast<float>(height))));
+	outMaxX = static_cast<int32_t>(std::ceil(std::min(std::max(maxX, 0.0f), static_cast<float>(width))));
+	outMaxY = static_cast<int32_t>(std::ceil(std::min(std::max(maxY, 0.0f), static_cast<float>(height))));
+	return true;
+}
+
+bool SoftwareOcclusion::isOccluded(const Aabb& box) const
+{
+	if (!supported || triangles.empty())
+	{
+		return false;
+	}
+
+	int32_t minX, minY, maxX, maxY;
+	float nearestDepth;
+	if (!projectBox(box.min, box.max, minX, minY, maxX, maxY, nearestDepth))
+	{
+		return false;
+	}
+
+	// Off screen. Frustum culling deals with these.
+	if (minX >= maxX || minY >= maxY)
+	{
+		return false;
+	}
+
+	return isRectOccluded(minX, minY, maxX, maxY, nearestDepth);
+}
+
+bool SoftwareOcclusion::isOccluded(const glm::vec4& sphere) const
+{
+	glm::vec3 center(sphere);
+	Aabb box;
+	box.min = center - glm::vec3(sphere.w);
+	box.max = center + glm::vec3(sphere.w);
+	return isOccluded(box);
+}
+
+void SoftwareOcclusion::removeOccluded(const SphereBoundsArray& bounds, std::vector<uint32_t>& inOutIndices) const
+{
+	if (!supported || triangles.empty())
+	{
+		return;
+	}
+
+	// Each range packs its survivors at its own start, then ranges are packed together in order
+	std::vector<std::pair<size_t, size_t>> ranges(ParallelUtil::getThreadCount());
+	size_t rangeCount = ParallelUtil::parallelForRanges(inOutIndices.size(), ranges.size(), minTestsPerThread,
+		[&](size_t range, size_t begin, size_t end)
+	{
+		size_t keptCount = 0;
+		for (size_t i = begin; i < end; ++i)
+		{
+			uint32_t index = inOutIndices[i];
+			inOutIndices[begin + keptCount] = index;
+			keptCount += isOccluded(bounds.get(index)) ? 0 : 1;
+		}
+		ranges[range] = std::make_pair(begin, keptCount);
+	});
+
+	size_t totalKept = 0;
+	for (size_t i = 0; i < rangeCount; ++i)
+	{
+		std::copy(inOutIndices.begin() + ranges[i].first,
+			inOutIndices.begin() + ranges[i].first + ranges[i].second,
+			inOutIndices.begin() + totalKept);
+		totalKept += ranges[i].second;
+	}
+
+	inOutIndices.resize(totalKept);
+}
@@ -0,0 +1,154 @@
+/* Defines SoftwareOcclusion, a coarse depth buffer rasterized on the CPU from a few occluder meshes.
+   Each 32x8 pixel tile keeps a coverage mask and two depths instead of per-pixel depth, so a tile is
+   updated and tested with a handful of AVX2 instructions. Objects are tested against it in the same
+   frame, before draws are built, with no GPU readback. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "render_types.h"
+#include "bounds.h"
+
+typedef uint32_t OccluderMeshId;
+
+class SoftwareOcclusion
+{
+public:
+	// Tile size in pixels. A tile row is one 32-bit mask, and a tile is one AVX2 register.
+	static const uint32_t tileWidth = 32;
+	static const uint32_t tileHeight = 8;
+
+	// Resolution is rounded up to whole tiles
+	SoftwareOcclusion(uint32_t width, uint32_t height);
+
+	// Needs AVX2. When it's missing, nothing is ever reported as occluded.
+	static bool isSupported();
+
+	// Add a mesh that can be used as an occluder, e.g. straight from ObjUtil::loadObj.
+	// Only positions are kept. Occluders should be simple, closed and solid; a few hundred
+	// triangles is plenty.
+	OccluderMeshId addOccluderMesh(const std::vector<Vertex3D>& meshVertices, const std::vector<uint32_t>& meshIndices);
+
+	// Per frame: clear, queue occluders, then render. Queries are valid after render().
+	void beginFrame();
+
+	void addOccluder(OccluderMeshId mesh, const glm::mat4& transform);
+
+	// Transform the queued occluders by viewProj and rasterize them. Both steps are split across
+	// threads; rasterization by bands of tile rows, so threads never write the same tile.
+	void render(const glm::mat4& viewProj);
+
+	// True only if the box is definitely hidden behind the occluders. Boxes crossing the near
+	// plane are never occluded.
+	bool isOccluded(const Aabb& box) const;
+
+	// As above, for a bounding sphere (xyz center, w radius)
+	bool isOccluded(const glm::vec4& sphere) const;
+
+	// Remove occluded spheres from a list of sphere indices, e.g. the output of frustum culling.
+	// Order is preserved. Large lists are tested on several threads.
+	void removeOccluded(const SphereBoundsArray& bounds, std::vector<uint32_t>& inOutIndices) const;
+
+	uint32_t getWidth() const { return width; }
+	uint32_t getHeight() const { return height; }
+	size_t getTriangleCount() const { return triangles.size(); }
+
+private:
+	struct OccluderMesh
+	{
+		uint32_t firstPosition;
+		uint32_t positionCount;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+	};
+
+	struct Occluder
+	{
+		OccluderMeshId mesh;
+		glm::mat4 transform;
+	};
+
+	// Edge x = offset + slope * y, in pixels. Pixels right of a left edge and left of a right edge
+	// are inside. Horizontal edges have every pixel inside or none, depending on the row.
+	struct Edge
+	{
+		enum Type
+		{
+			Left,
+			Right,
+			Horizontal
+		};
+
+		Type type;
+		float offset;
+		float slope;
+
+		// Horizontal only: inside where y * sign >= limit
+		float sign;
+		float limit;
+	};
+
+	// A screen-space triangle ready for rasterization. Skipped triangles have an empty tile range.
+	struct Triangle
+	{
+		Edge edges[3];
+
+		// Depth plane z = depthX * x + depthY * y + depthOffset, and the farthest vertex depth
+		float depthX;
+		float depthY;
+		float depthOffset;
+		float maxDepth;
+
+		// Pixel bounds, and the inclusive tile range they touch
+		float minX;
+		float minY;
+		float maxX;
+		float maxY;
+		int32_t firstTileX;
+		int32_t firstTileY;
+		int32_t lastTileX;
+		int32_t lastTileY;
+	};
+
+	// Transform one occluder's vertices and set up its triangles
+	void setupOccluder(const Occluder& occluder, const glm::mat4& matrix, glm::vec4* outPositions, Triangle* outTriangles) const;
+
+	// Rasterize the triangle's tiles in rows [firstTileY, lastTileY] and merge it into them
+	void rasterizeTriangle(const Triangle& triangle, int32_t firstTileY, int32_t lastTileY);
+
+	// Pixel rect [minX, maxX) x [minY, maxY) is hidden at every pixel by something nearer than depth
+	bool isRectOccluded(int32_t minX, int32_t minY, int32_t maxX, int32_t maxY, float depth) const;
+
+	// Project a box's corners. Returns false if any corner is behind the near plane.
+	bool projectBox(const glm::vec3& boxMin, const glm::vec3& boxMax, int32_t& outMinX, int32_t& outMinY,
+		int32_t& outMaxX, int32_t& outMaxY, float& outNearestDepth) const;
+
+private:
+	uint32_t width;
+	uint32_t height;
+	uint32_t tilesX;
+	uint32_t tilesY;
+	bool supported;
+
+	// Positions and indices for every occluder mesh
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+	std::vector<OccluderMesh> meshes;
+
+	std::vector<Occluder> occluders;
+	std::vector<uint32_t> occluderTriangleOffsets;
+	std::vector<uint32_t> occluderPositionOffsets;
+	std::vector<glm::vec4> screenPositions; // x, y in pixels, z / w, w
+	std::vector<Triangle> triangles;
+
+	glm::mat4 viewProj;
+
+	// Per tile. Pixels whose bit is set in tileMasks are covered at tileDepth1 or nearer; the rest
+	// at tileDepth0 or nearer. tileDepth1 is always nearer than tileDepth0.
+	std::vector<uint32_t> tileMasks; // tileHeight rows per tile
+	std::vector<float> tileDepth0;
+	std::vector<float> tileDepth1;
+};
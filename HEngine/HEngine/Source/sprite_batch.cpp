@@ -0,0 +1,125 @@
+#include "sprite_batch.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Repeated edge pixels around each region
+static const uint32_t atlasPadding = 1;
+
+SpriteAtlas::SpriteAtlas(uint32_t width, uint32_t height)
+	:
+	width(width),
+	height(height),
+	pixels(width * height, 0),
+	shelfX(0),
+	shelfY(0),
+	shelfHeight(0)
+{ }
+
+SpriteRegionId SpriteAtlas::add(const void* imagePixels, uint32_t imageWidth, uint32_t imageHeight)
+{
+	uint32_t cellWidth = imageWidth + atlasPadding * 2;
+	uint32_t cellHeight = imageHeight + atlasPadding * 2;
+
+	// Start a new shelf when this one is full
+	if (shelfX + cellWidth > width)
+	{
+		shelfX = 0;
+		shelfY += shelfHeight;
+		shelfHeight = 0;
+	}
+
+	if (cellWidth > width || shelfY + cellHeight > height)
+	{
+		throw std::runtime_error("SpriteAtlas::add -- no room left in the atlas");
+	}
+
+	// Clamping source coordinates fills the padding with the nearest edge pixel
+	const uint32_t* source = static_cast<const uint32_t*>(imagePixels);
+	for (uint32_t y = 0; y < cellHeight; ++y)
+	{
+		uint32_t sourceY = static_cast<uint32_t>(std::min(std::max(static_cast<int32_t>(y) - static_cast<int32_t>(atlasPadding), 0),
+			static_cast<int32_t>(imageHeight) - 1));
+		uint32_t* row = &pixels[(shelfY + y) * width + shelfX];
+		for (uint32_t x = 0; x < cellWidth; ++x)
+		{
+			uint32_t sourceX = static_cast<uint32_t>(std::min(std::max(static_cast<int32_t>(x) - static_cast<int32_t>(atlasPadding), 0),
+				static_cast<int32_t>(imageWidth) - 1));
+			row[x] = source[sourceY * imageWidth + sourceX];
+		}
+	}
+
+	glm::vec2 atlasSize(static_cast<float>(width), static_cast<float>(height));
+	glm::vec2 min = glm::vec2(shelfX + atlasPadding, shelfY + atlasPadding) / atlasSize;
+	glm::vec2 max = glm::vec2(shelfX + atlasPadding + imageWidth, shelfY + atlasPadding + imageHeight) / atlasSize;
+	uvRects.push_back(glm::vec4(min, max));
+
+	shelfX += cellWidth;
+	shelfHeight = std::max(shelfHeight, cellHeight);
+
+	return static_cast<SpriteRegionId>(uvRects.size() - 1);
+}
+
+void SpriteBatch::clear()
+{
+	sprites.clear();
+	sortItems.clear();
+	runs.clear();
+}
+
+void SpriteBatch::add(const glm::vec2& position, const glm::vec2& size, float rotation, const glm::vec4& uvRect,
+	uint32_t color, uint32_t texture, uint32_t layer)
+{
+	GpuSprite sprite;
+	sprite.position = position;
+	sprite.size = size;
+	sprite.uvRect = uvRect;
+	sprite.rotation = rotation;
+	sprite.color = color;
+
+	// Layer first, so layers are drawn in order whatever their textures
+	DrawSort::SortItem item;
+	item.key = (static_cast<uint64_t>(layer) << 32) | texture;
+	item.index = static_cast<uint32_t>(sprites.size());
+
+	sprites.push_back(sprite);
+	sortItems.push_back(item);
+}
+
+size_t SpriteBatch::build(GpuSprite* outSprites, size_t capacity)
+{
+	// Stable, so sprites sharing a layer and texture stay in the order they were added
+	DrawSort::radixSort(sortItems, sortScratch);
+
+	size_t count = std::min(sortItems.size(), capacity);
+	runs.clear();
+	for (size_t i = 0; i < count; ++i)
+	{
+		const DrawSort::SortItem& item = sortItems[i];
+		uint32_t texture = static_cast<uint32_t>(item.key);
+
+		// Consecutive layers using the same texture share a run
+		if (runs.empty() || runs.back().texture != texture)
+		{
+			SpriteDrawRun run;
+			run.texture = texture;
+			run.firstInstance = static_cast<uint32_t>(i);
+			run.instanceCount = 0;
+			runs.push_back(run);
+		}
+
+		runs.back().instanceCount++;
+		outSprites[i] = sprites[item.index];
+	}
+
+	return count;
+}
+
+uint32_t SpriteBatch::packColor(const glm::vec4& color)
+{
+	glm::vec4 clamped = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+	return static_cast<uint32_t>(clamped.x) |
+		(static_cast<uint32_t>(clamped.y) << 8) |
+		(static_cast<uint32_t>(clamped.z) << 16) |
+		(static_cast<uint32_t>(clamped.w) << 24);
+}
@@ -0,0 +1,86 @@
+/* Defines SpriteBatch, which collects 2D screen-space sprites each frame and turns them into a few
+   instanced draws, and SpriteAtlas, which packs small images into one texture so that sprites
+   using any of them can share a draw. Sprites are sorted by layer, then texture, with a draw for
+   each run of sprites sharing a texture; the draw count depends on how many textures are in use,
+   not on how many sprites there are. Sprites keep the order they were added in within a layer and
+   texture, but sprites in the same layer with different textures may be drawn in either order, so
+   overlapping sprites that need a fixed order belong in different layers. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "render_types.h"
+#include "draw_sort.h"
+
+typedef uint32_t SpriteRegionId;
+
+class SpriteAtlas
+{
+public:
+	SpriteAtlas(uint32_t width, uint32_t height);
+
+	// Copy an RGBA8 image into the atlas, with its edge pixels repeated around it so filtering
+	// never picks up a neighbour. Throws std::runtime_error if there's no room left.
+	SpriteRegionId add(const void* pixels, uint32_t imageWidth, uint32_t imageHeight);
+
+	// Where a region is in the atlas: min uv in xy, max in zw
+	const glm::vec4& getUvRect(SpriteRegionId region) const { return uvRects[region]; }
+
+	// RGBA8, row by row
+	const std::vector<uint32_t>& getPixels() const { return pixels; }
+	uint32_t getWidth() const { return width; }
+	uint32_t getHeight() const { return height; }
+
+private:
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint32_t> pixels;
+	std::vector<glm::vec4> uvRects;
+
+	// Regions are packed left to right along shelves, each as tall as its tallest region
+	uint32_t shelfX;
+	uint32_t shelfY;
+	uint32_t shelfHeight;
+};
+
+// Sprites drawn with one instanced call
+struct SpriteDrawRun
+{
+	uint32_t texture; // Bindless texture slot
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+class SpriteBatch
+{
+public:
+	// Forget last frame's sprites
+	void clear();
+
+	// Add a sprite. position is its center and size its extent, in pixels from the top-left of the
+	// screen. rotation is clockwise on screen, in radians. uvRect is min uv in xy, max in zw, e.g.
+	// from SpriteAtlas::getUvRect. color is RGBA8, see packColor, and multiplies the texture.
+	// texture is a bindless texture slot. Higher layers are drawn over lower ones.
+	void add(const glm::vec2& position, const glm::vec2& size, float rotation, const glm::vec4& uvRect,
+		uint32_t color, uint32_t texture, uint32_t layer);
+
+	// Sort the sprites into draw order and write up to capacity of them to outSprites, e.g. a
+	// mapped instance buffer, which is only ever written front to back. Returns the number written;
+	// the rest are dropped. Draw runs are valid afterwards.
+	size_t build(GpuSprite* outSprites, size_t capacity);
+
+	const std::vector<SpriteDrawRun>& getRuns() const { return runs; }
+	size_t getSpriteCount() const { return sprites.size(); }
+
+	// Components in [0, 1]
+	static uint32_t packColor(const glm::vec4& color);
+
+private:
+	std::vector<GpuSprite> sprites; // In the order they were added
+	std::vector<DrawSort::SortItem> sortItems;
+	std::vector<DrawSort::SortItem> sortScratch;
+	std::vector<SpriteDrawRun> runs;
+};
@@ -0,0 +1,375 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <xmmintrin.h>
+
+// out = a * b, for column-major matrices. out must not alias a or b.
+static void multiplyMatrices(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+{
+	const float* aData = &a[0][0];
+	const float* bData = &b[0][0];
+	float* outData = &out[0][0];
+
+	__m128 aColumn0 = _mm_loadu_ps(aData);
+	__m128 aColumn1 = _mm_loadu_ps(aData + 4);
+	__m128 aColumn2 = _mm_loadu_ps(aData + 8);
+	__m128 aColumn3 = _mm_loadu_ps(aData + 12);
+
+	// Each output column is a's columns weighted by the matching column of b
+	for (int column = 0; column < 4; ++column)
+	{
+		const float* bColumn = bData + column * 4;
+		__m128 result = _mm_mul_ps(aColumn0, _mm_set1_ps(bColumn[0]));
+		result = _mm_add_ps(result, _mm_mul_ps(aColumn1, _mm_set1_ps(bColumn[1])));
+		result = _mm_add_ps(result, _mm_mul_ps(aColumn2, _mm_set1_ps(bColumn[2])));
+		result = _mm_add_ps(result, _mm_mul_ps(aColumn3, _mm_set1_ps(bColumn[3])));
+		_mm_storeu_ps(outData + column * 4, result);
+	}
+}
+
+// Build translation * rotation * scale directly, without the full matrix multiplies
+static glm::mat4 composeMatrix(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale)
+{
+	float xx = rotation.x * rotation.x;
+	float yy = rotation.y * rotation.y;
+	float zz = rotation.z * rotation.z;
+	float xy = rotation.x * rotation.y;
+	float xz = rotation.x * rotation.z;
+	float yz = rotation.y * rotation.z;
+	float wx = rotation.w * rotation.x;
+	float wy = rotation.w * rotation.y;
+	float wz = rotation.w * rotation.z;
+
+	return glm::mat4(
+		glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * scale.x,
+		glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * scale.y,
+		glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * scale.z,
+		glm::vec4(translation, 1.0f));
+}
+
+TransformHierarchy::TransformHierarchy()
+	:
+	orderDirty(false)
+{ }
+
+TransformId TransformHierarchy::addNode(TransformId parent,
+	const glm::vec3& translation,
+	const glm::quat& rotation,
+	const glm::vec3& scale)
+{
+	uint32_t index = static_cast<uint32_t>(nodeIds.size());
+	TransformId id;
+	if (!freeIds.empty())
+	{
+		id = freeIds.back();
+		freeIds.pop_back();
+		nodeIndices[id] = index;
+	}
+	else
+	{
+		id = static_cast<TransformId>(nodeIndices.size());
+		nodeIndices.push_back(index);
+	}
+
+	uint32_t parentIndex = noParent;
+	if (parent != invalidTransform)
+	{
+		parentIndex = nodeIndices[parent];
+
+		// Appending keeps depth-first order only if the parent's subtree ends at the end of the arrays
+		if (!orderDirty)
+		{
+			if (parentIndex + subtreeSizes[parentIndex] != index)
+			{
+				orderDirty = true;
+			}
+			else
+			{
+				for (uint32_t ancestor = parentIndex; ancestor != noParent; ancestor = parents[ancestor])
+				{
+					subtreeSizes[ancestor]++;
+				}
+			}
+		}
+	}
+
+	translations.push_back(translation);
+	rotations.push_back(rotation);
+	scales.push_back(scale);
+	parents.push_back(parentIndex);
+	subtreeSizes.push_back(1);
+	worldMatrices.push_back(glm::mat4(1.0f));
+	dirtyFlags.push_back(0);
+	nodeIds.push_back(id);
+
+	markDirty(index);
+	return id;
+}
+
+void TransformHierarchy::setParent(TransformId node, TransformId parent)
+{
+	// Subtree ranges are needed to check for cycles
+	if (orderDirty)
+	{
+		sortNodes();
+	}
+
+	uint32_t index = nodeIndices[node];
+	uint32_t parentIndex = noParent;
+	if (parent != invalidTransform)
+	{
+		parentIndex = nodeIndices[parent];
+		if (parentIndex >= index && parentIndex < index + subtreeSizes[index])
+		{
+			throw std::runtime_error("TransformHierarchy::setParent -- node can't be parented to its own subtree");
+		}
+	}
+
+	parents[index] = parentIndex;
+	orderDirty = true;
+	markDirty(index);
+}
+
+void TransformHierarchy::removeNode(TransformId node)
+{
+	// The subtree has to be one contiguous range
+	if (orderDirty)
+	{
+		sortNodes();
+	}
+
+	uint32_t first = nodeIndices[node];
+	uint32_t count = subtreeSizes[first];
+	uint32_t last = first + count;
+
+	for (uint32_t ancestor = parents[first]; ancestor != noParent; ancestor = parents[ancestor])
+	{
+		subtreeSizes[ancestor] -= count;
+	}
+
+	for (uint32_t i = first; i < last; ++i)
+	{
+		nodeIndices[nodeIds[i]] = removedIndex;
+		freeIds.push_back(nodeIds[i]);
+	}
+
+	// Closing the gap keeps depth-first order, so nothing needs re-sorting
+	auto erase = [first, last](auto& values)
+	{
+		values.erase(values.begin() + first, values.begin() + last);
+	};
+
+	erase(translations);
+	erase(rotations);
+	erase(scales);
+	erase(parents);
+	erase(subtreeSizes);
+	erase(worldMatrices);
+	erase(dirtyFlags);
+	erase(nodeIds);
+
+	for (uint32_t i = first; i < nodeIds.size(); ++i)
+	{
+		if (parents[i] != noParent && parents[i] >= last)
+		{
+			parents[i] -= count;
+		}
+		nodeIndices[nodeIds[i]] = i;
+	}
+
+	// Removed nodes may have been waiting to update
+	dirtyNodes.erase(std::remove_if(dirtyNodes.begin(), dirtyNodes.end(), [this](TransformId id)
+	{
+		return nodeIndices[id] == removedIndex;
+	}), dirtyNodes.end());
+}
+
+void TransformHierarchy::setTranslation(TransformId node, const glm::vec3& translation)
+{
+	uint32_t index = nodeIndices[node];
+	translations[index] = translation;
+	markDirty(index);
+}
+
+void TransformHierarchy::setRotation(TransformId node, const glm::quat& rotation)
+{
+	uint32_t index = nodeIndices[node];
+	rotations[index] = rotation;
+	markDirty(index);
+}
+
+void TransformHierarchy::setScale(TransformId node, const glm::vec3& scale)
+{
+	uint32_t index = nodeIndices[node];
+	scales[index] = scale;
+	markDirty(index);
+}
+
+void TransformHierarchy::update()
+{
+	updatedNodes.clear();
+
+	if (dirtyNodes.empty())
+	{
+		return;
+	}
+
+	if (orderDirty)
+	{
+		sortNodes();
+	}
+
+	// Ids to indices, in order. A dirty node inside a subtree that's already being updated
+	// needs no work of its own.
+	std::vector<uint32_t> dirtyIndices;
+	dirtyIndices.reserve(dirtyNodes.size());
+	for (TransformId id : dirtyNodes)
+	{
+		dirtyIndices.push_back(nodeIndices[id]);
+	}
+	std::sort(dirtyIndices.begin(), dirtyIndices.end());
+
+	uint32_t updatedEnd = 0;
+	for (uint32_t index : dirtyIndices)
+	{
+		if (index < updatedEnd)
+		{
+			continue;
+		}
+
+		updatedEnd = index + subtreeSizes[index];
+		updateRange(index, updatedEnd);
+	}
+
+	dirtyNodes.clear();
+}
+
+void TransformHierarchy::markDirty(uint32_t index)
+{
+	if (!dirtyFlags[index])
+	{
+		dirtyFlags[index] = 1;
+		dirtyNodes.push_back(nodeIds[index]);
+	}
+}
+
+void TransformHierarchy::updateRange(uint32_t first, uint32_t last)
+{
+	for (uint32_t i = first; i < last; ++i)
+	{
+		glm::mat4 local = composeMatrix(translations[i], rotations[i], scales[i]);
+
+		if (parents[i] == noParent)
+		{
+			worldMatrices[i] = local;
+		}
+		else
+		{
+			multiplyMatrices(worldMatrices[parents[i]], local, worldMatrices[i]);
+		}
+
+		dirtyFlags[i] = 0;
+		updatedNodes.push_back(nodeIds[i]);
+	}
+}
+
+void TransformHierarchy::sortNodes()
+{
+	uint32_t count = static_cast<uint32_t>(nodeIds.size());
+
+	// Children of each node, keeping their current relative order
+	std::vector<uint32_t> childStart(count + 1, 0);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (parents[i] != noParent)
+		{
+			childStart[parents[i] + 1]++;
+		}
+	}
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		childStart[i + 1] += childStart[i];
+	}
+
+	std::vector<uint32_t> children(childStart[count]);
+	std::vector<uint32_t> childFill(childStart.begin(), childStart.end() - 1);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (parents[i] != noParent)
+		{
+			children[childFill[parents[i]]++] = i;
+		}
+	}
+
+	// Depth-first walk from each root. order[new index] = old index.
+	std::vector<uint32_t> order;
+	order.reserve(count);
+	std::vector<uint32_t> stack;
+	for (uint32_t root = 0; root < count; ++root)
+	{
+		if (parents[root] != noParent)
+		{
+			continue;
+		}
+
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			uint32_t node = stack.back();
+			stack.pop_back();
+			order.push_back(node);
+
+			// Push in reverse, so children are visited in order
+			for (uint32_t child = childStart[node + 1]; child-- > childStart[node];)
+			{
+				stack.push_back(children[child]);
+			}
+		}
+	}
+
+	std::vector<uint32_t> newIndices(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		newIndices[order[i]] = i;
+	}
+
+	auto permute = [&order](auto& values)
+	{
+		auto sorted = values;
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			sorted[i] = values[order[i]];
+		}
+		values.swap(sorted);
+	};
+
+	permute(translations);
+	permute(rotations);
+	permute(scales);
+	permute(parents);
+	permute(worldMatrices);
+	permute(dirtyFlags);
+	permute(nodeIds);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (parents[i] != noParent)
+		{
+			parents[i] = newIndices[parents[i]];
+		}
+		nodeIndices[nodeIds[i]] = i;
+	}
+
+	// Children come after parents now, so sizes can be summed in one backwards pass
+	std::fill(subtreeSizes.begin(), subtreeSizes.end(), 1);
+	for (uint32_t i = count; i-- > 0;)
+	{
+		if (parents[i] != noParent)
+		{
+			subtreeSizes[parents[i]] += subtreeSizes[i];
+		}
+	}
+
+	orderDirty = false;
+}
@@ -0,0 +1,84 @@
+/* Defines TransformHierarchy, a tree of local TRS transforms and their world matrices. Nodes are
+   stored as flat arrays in depth-first order, so each subtree is a contiguous range; only subtrees
+   under modified nodes are recomputed on update. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+typedef uint32_t TransformId;
+
+class TransformHierarchy
+{
+public:
+	static const TransformId invalidTransform = 0xFFFFFFFF;
+
+	TransformHierarchy();
+
+	// Add a node under parent, or as a root if parent is invalidTransform
+	TransformId addNode(TransformId parent,
+		const glm::vec3& translation = glm::vec3(0.0f),
+		const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+		const glm::vec3& scale = glm::vec3(1.0f));
+
+	// Move a node, with its subtree, under a new parent
+	void setParent(TransformId node, TransformId parent);
+
+	// Remove a node and its whole subtree. Their ids are reused by later nodes.
+	void removeNode(TransformId node);
+
+	void setTranslation(TransformId node, const glm::vec3& translation);
+	void setRotation(TransformId node, const glm::quat& rotation);
+	void setScale(TransformId node, const glm::vec3& scale);
+
+	const glm::vec3& getTranslation(TransformId node) const { return translations[nodeIndices[node]]; }
+	const glm::quat& getRotation(TransformId node) const { return rotations[nodeIndices[node]]; }
+	const glm::vec3& getScale(TransformId node) const { return scales[nodeIndices[node]]; }
+
+	// Valid after update()
+	const glm::mat4& getWorldMatrix(TransformId node) const { return worldMatrices[nodeIndices[node]]; }
+
+	// Recompute world matrices below every node modified since the last update.
+	// Costs nothing when no nodes were modified.
+	void update();
+
+	// Nodes whose world matrix was recomputed by the last update()
+	const std::vector<TransformId>& getUpdatedNodes() const { return updatedNodes; }
+
+	size_t getNodeCount() const { return nodeIds.size(); }
+
+private:
+	void markDirty(uint32_t index);
+
+	// Restore depth-first order after nodes were added under existing subtrees, or reparented
+	void sortNodes();
+
+	// Recompute world matrices for nodes [first, last). Parents of nodes in the range must
+	// either be in the range, or already up to date.
+	void updateRange(uint32_t first, uint32_t last);
+
+private:
+	static const uint32_t noParent = 0xFFFFFFFF;
+	static const uint32_t removedIndex = 0xFFFFFFFF; // In nodeIndices, for ids that are free
+
+	// Per node, in depth-first order
+	std::vector<glm::vec3> translations;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<uint32_t> parents;       // Index of the parent, always lower than the node's own
+	std::vector<uint32_t> subtreeSizes;  // Including the node itself
+	std::vector<glm::mat4> worldMatrices;
+	std::vector<uint8_t> dirtyFlags;
+	std::vector<TransformId> nodeIds;
+
+	// Id -> index in the arrays above. Ids stay stable when nodes are re-sorted.
+	std::vector<uint32_t> nodeIndices;
+	std::vector<TransformId> freeIds; // Of removed nodes
+
+	std::vector<uint32_t> dirtyNodes;
+	std::vector<TransformId> updatedNodes;
+	bool orderDirty;
+};
@@ -0,0 +1,65 @@
+/* Defines TripleBuffer, which hands the latest value from one thread to another without locks.
+   The writer fills a back buffer and publishes it; the reader picks up whichever buffer was
+   published last. Neither ever waits for the other, and the reader never sees a buffer that's
+   still being written. Values the reader didn't get round to are simply skipped. */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer()
+		:
+		writeIndex(0),
+		readIndex(1),
+		shared(2)
+	{ }
+
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// Writer only. The buffer to fill before publishing; its contents are whatever was in it last.
+	T& getWriteBuffer() { return buffers[writeIndex]; }
+
+	// Writer only. Hand the write buffer to the reader, and take the spare one to write next.
+	void publish()
+	{
+		uint32_t previous = shared.exchange(writeIndex | freshBit, std::memory_order_acq_rel);
+		writeIndex = previous & indexMask;
+	}
+
+	// Reader only. Take the most recently published buffer, if there's one the reader hasn't seen.
+	// Returns true if the read buffer changed.
+	bool update()
+	{
+		if ((shared.load(std::memory_order_relaxed) & freshBit) == 0)
+		{
+			return false;
+		}
+
+		uint32_t previous = shared.exchange(readIndex, std::memory_order_acq_rel);
+		readIndex = previous & indexMask;
+		return true;
+	}
+
+	// Reader only. Stays the same until the next update().
+	const T& getReadBuffer() const { return buffers[readIndex]; }
+
+private:
+	static const uint32_t indexMask = 3;
+	static const uint32_t freshBit = 4; // Set while the shared buffer holds a value the reader hasn't taken
+
+	T buffers[3];
+
+	// Each index is only touched by its own thread. They're kept on separate cache lines from each
+	// other and from the shared index, so the threads don't slow each other down.
+	uint32_t writeIndex;
+	char writePadding[64 - sizeof(uint32_t)];
+	uint32_t readIndex;
+	char readPadding[64 - sizeof(uint32_t)];
+	std::atomic<uint32_t> shared;
+};
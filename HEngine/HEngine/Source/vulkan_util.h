@@ -22,9 +22,9 @@ namespace VulkanUtil
 	}
 	
 	template <typename Vertex3D>
-	std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+	std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions()
 	{
-		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+		std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions = {};
 		
 		attributeDescriptions[0].binding = 0;
 		attributeDescriptions[0].location = 0;
@@ -40,7 +40,112 @@ namespace VulkanUtil
 		attributeDescriptions[2].location = 2;
 		attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
 		attributeDescriptions[2].offset = offsetof(Vertex3D, texCoord);
+
+		attributeDescriptions[3].binding = 0;
+		attributeDescriptions[3].location = 3;
+		attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[3].offset = offsetof(Vertex3D, normal);
 		
 		return attributeDescriptions;
 	}
+
+	// A stream of tightly packed positions in binding 0, for passes that need nothing else
+	inline VkVertexInputBindingDescription getPositionBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(glm::vec3);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescription;
+	}
+
+	inline VkVertexInputAttributeDescription getPositionAttributeDescription()
+	{
+		VkVertexInputAttributeDescription attributeDescription = {};
+		attributeDescription.binding = 0;
+		attributeDescription.location = 0;
+		attributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescription.offset = 0;
+
+		return attributeDescription;
+	}
+
+	// Instance data goes in binding 1. Locations 0-7 are left for per-vertex attributes.
+	template <typename InstanceData>
+	VkVertexInputBindingDescription getInstanceBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 1;
+		bindingDescription.stride = sizeof(InstanceData);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		return bindingDescription;
+	}
+
+	// A mat4 attribute takes up four consecutive vec4 locations; the material follows them
+	template <typename InstanceData>
+	std::array<VkVertexInputAttributeDescription, 5> getInstanceAttributeDescriptions()
+	{
+		std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions = {};
+
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			attributeDescriptions[i].binding = 1;
+			attributeDescriptions[i].location = 8 + i;
+			attributeDescriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			attributeDescriptions[i].offset = static_cast<uint32_t>(offsetof(InstanceData, model) + sizeof(glm::vec4) * i);
+		}
+
+		attributeDescriptions[4].binding = 1;
+		attributeDescriptions[4].location = 12;
+		attributeDescriptions[4].format = VK_FORMAT_R32_UINT;
+		attributeDescriptions[4].offset = static_cast<uint32_t>(offsetof(InstanceData, material));
+
+		return attributeDescriptions;
+	}
+
+	// Sprites are drawn from instance data alone, in binding 0
+	inline VkVertexInputBindingDescription getSpriteBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(GpuSprite);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		return bindingDescription;
+	}
+
+	inline std::array<VkVertexInputAttributeDescription, 5> getSpriteAttributeDescriptions()
+	{
+		std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions = {};
+
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(GpuSprite, position);
+
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[1].offset = offsetof(GpuSprite, size);
+
+		attributeDescriptions[2].binding = 0;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(GpuSprite, uvRect);
+
+		attributeDescriptions[3].binding = 0;
+		attributeDescriptions[3].location = 3;
+		attributeDescriptions[3].format = VK_FORMAT_R32_SFLOAT;
+		attributeDescriptions[3].offset = offsetof(GpuSprite, rotation);
+
+		// Unpacked to a vec4 in [0, 1]
+		attributeDescriptions[4].binding = 0;
+		attributeDescriptions[4].location = 4;
+		attributeDescriptions[4].format = VK_FORMAT_R8G8B8A8_UNORM;
+		attributeDescriptions[4].offset = offsetof(GpuSprite, color);
+
+		return attributeDescriptions;
+	}
 };
\ No newline at end of file